@@ -1686,7 +1686,7 @@ cmd_clone(int argc, char *argv[])
 		goto done;
 
 	if (!list_refs_only) {
-		error = got_repo_init(repo_path, NULL);
+		error = got_repo_init(repo_path, NULL, 0);
 		if (error)
 			goto done;
 		error = got_repo_pack_fds_open(&pack_fds);
@@ -2747,7 +2747,7 @@ __dead static void
 usage_checkout(void)
 {
 	fprintf(stderr, "usage: %s checkout [-Eq] [-b branch] [-c commit] "
-	    "[-p path-prefix] repository-path [work-tree-path]\n",
+	    "[-p path-prefix] [-S path] repository-path [work-tree-path]\n",
 	    getprogname());
 	exit(1);
 }
@@ -2942,11 +2942,12 @@ cmd_checkout(int argc, char *argv[])
 	struct got_object_id *commit_id = NULL;
 	char *cwd = NULL;
 	int ch, same_path_prefix, allow_nonempty = 0, verbosity = 0;
-	struct got_pathlist_head paths;
+	struct got_pathlist_head paths, sparse_paths;
 	struct got_checkout_progress_arg cpa;
 	int *pack_fds = NULL;
 
 	TAILQ_INIT(&paths);
+	TAILQ_INIT(&sparse_paths);
 
 #ifndef PROFILE
 	if (pledge("stdio rpath wpath cpath fattr flock proc exec sendfd "
@@ -2954,7 +2955,7 @@ cmd_checkout(int argc, char *argv[])
 		err(1, "pledge");
 #endif
 
-	while ((ch = getopt(argc, argv, "b:c:Ep:q")) != -1) {
+	while ((ch = getopt(argc, argv, "b:c:Ep:qS:")) != -1) {
 		switch (ch) {
 		case 'b':
 			branch_name = optarg;
@@ -2973,6 +2974,12 @@ cmd_checkout(int argc, char *argv[])
 		case 'q':
 			verbosity = -1;
 			break;
+		case 'S':
+			error = got_pathlist_append(&sparse_paths, optarg,
+			    NULL);
+			if (error)
+				return error;
+			break;
 		default:
 			usage_checkout();
 			/* NOTREACHED */
@@ -3081,6 +3088,12 @@ cmd_checkout(int argc, char *argv[])
 		goto done;
 	}
 
+	if (!TAILQ_EMPTY(&sparse_paths)) {
+		error = got_worktree_set_sparse_paths(worktree, &sparse_paths);
+		if (error)
+			goto done;
+	}
+
 	if (commit_id_str) {
 		struct got_reflist_head refs;
 		TAILQ_INIT(&refs);
@@ -3142,6 +3155,12 @@ cmd_checkout(int argc, char *argv[])
 	if (error != NULL)
 		goto done;
 
+	if (!TAILQ_EMPTY(&sparse_paths)) {
+		error = got_worktree_write_sparse_paths(worktree);
+		if (error)
+			goto done;
+	}
+
 	if (got_ref_is_symbolic(head_ref)) {
 		error = got_ref_resolve_symbolic(&ref, repo, head_ref);
 		if (error)
@@ -3165,6 +3184,7 @@ done:
 	if (ref)
 		got_ref_close(ref);
 	got_pathlist_free(&paths, GOT_PATHLIST_FREE_NONE);
+	got_pathlist_free(&sparse_paths, GOT_PATHLIST_FREE_NONE);
 	free(commit_id_str);
 	free(commit_id);
 	free(repo_path);
@@ -3198,6 +3218,9 @@ print_update_progress_stats(struct got_update_progress_arg *upa)
 	if (upa->not_updated > 0)
 		printf("Files not updated because of existing merge "
 		    "conflicts: %d\n", upa->not_updated);
+	if (upa->not_deleted > 0)
+		printf("Files outside the sparse checkout set not removed "
+		    "due to local changes: %d\n", upa->not_deleted);
 }
 
 /*
@@ -3233,7 +3256,7 @@ __dead static void
 usage_update(void)
 {
 	fprintf(stderr, "usage: %s update [-q] [-b branch] [-c commit] "
-	    "[path ...]\n", getprogname());
+	    "[-S path] [path ...]\n", getprogname());
 	exit(1);
 }
 
@@ -3425,13 +3448,14 @@ cmd_update(int argc, char *argv[])
 	char *commit_id_str = NULL;
 	const char *branch_name = NULL;
 	struct got_reference *head_ref = NULL;
-	struct got_pathlist_head paths;
+	struct got_pathlist_head paths, sparse_paths;
 	struct got_pathlist_entry *pe;
-	int ch, verbosity = 0;
+	int ch, verbosity = 0, set_sparse = 0;
 	struct got_update_progress_arg upa;
 	int *pack_fds = NULL;
 
 	TAILQ_INIT(&paths);
+	TAILQ_INIT(&sparse_paths);
 
 #ifndef PROFILE
 	if (pledge("stdio rpath wpath cpath fattr flock proc exec sendfd "
@@ -3439,7 +3463,7 @@ cmd_update(int argc, char *argv[])
 		err(1, "pledge");
 #endif
 
-	while ((ch = getopt(argc, argv, "b:c:q")) != -1) {
+	while ((ch = getopt(argc, argv, "b:c:qS:")) != -1) {
 		switch (ch) {
 		case 'b':
 			branch_name = optarg;
@@ -3452,6 +3476,13 @@ cmd_update(int argc, char *argv[])
 		case 'q':
 			verbosity = -1;
 			break;
+		case 'S':
+			error = got_pathlist_append(&sparse_paths, optarg,
+			    NULL);
+			if (error)
+				return error;
+			set_sparse = 1;
+			break;
 		default:
 			usage_update();
 			/* NOTREACHED */
@@ -3461,6 +3492,13 @@ cmd_update(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
+	if (set_sparse && argc > 0) {
+		error = got_error_msg(GOT_ERR_BAD_PATH,
+		    "changing the sparse checkout set requires that "
+		    "the entire work tree gets updated");
+		goto done;
+	}
+
 	worktree_path = getcwd(NULL, 0);
 	if (worktree_path == NULL) {
 		error = got_error_from_errno("getcwd");
@@ -3576,6 +3614,12 @@ cmd_update(int argc, char *argv[])
 			goto done;
 	}
 
+	if (set_sparse) {
+		error = got_worktree_set_sparse_paths(worktree, &sparse_paths);
+		if (error)
+			goto done;
+	}
+
 	memset(&upa, 0, sizeof(upa));
 	upa.verbosity = verbosity;
 	error = got_worktree_checkout_files(worktree, &paths, repo,
@@ -3583,6 +3627,12 @@ cmd_update(int argc, char *argv[])
 	if (error != NULL)
 		goto done;
 
+	if (set_sparse) {
+		error = got_worktree_write_sparse_paths(worktree);
+		if (error)
+			goto done;
+	}
+
 	if (upa.did_something) {
 		printf("Updated to %s: %s\n",
 		    got_worktree_get_head_ref_name(worktree), commit_id_str);
@@ -3599,6 +3649,7 @@ done:
 	}
 	free(worktree_path);
 	got_pathlist_free(&paths, GOT_PATHLIST_FREE_PATH);
+	got_pathlist_free(&sparse_paths, GOT_PATHLIST_FREE_NONE);
 	free(commit_id);
 	free(commit_id_str);
 	return error;
@@ -3675,9 +3726,10 @@ diff_trees(struct got_object_id *tree_id1, struct got_object_id *tree_id2,
 	const struct got_error *err = NULL;
 	struct got_tree_object *tree1 = NULL, *tree2 = NULL;
 	struct got_diff_blob_output_unidiff_arg arg;
-	FILE *f1 = NULL, *f2 = NULL;
 	int fd1 = -1, fd2 = -1;
 
+	memset(&arg, 0, sizeof(arg));
+
 	if (tree_id1) {
 		err = got_object_open_as_tree(&tree1, repo, tree_id1);
 		if (err)
@@ -3693,17 +3745,6 @@ diff_trees(struct got_object_id *tree_id1, struct got_object_id *tree_id2,
 	if (err)
 		goto done;
 
-	f1 = got_opentemp();
-	if (f1 == NULL) {
-		err = got_error_from_errno("got_opentemp");
-		goto done;
-	}
-
-	f2 = got_opentemp();
-	if (f2 == NULL) {
-		err = got_error_from_errno("got_opentemp");
-		goto done;
-	}
 	fd2 = got_opentempfd();
 	if (fd2 == -1) {
 		err = got_error_from_errno("got_opentempfd");
@@ -3719,17 +3760,14 @@ diff_trees(struct got_object_id *tree_id1, struct got_object_id *tree_id2,
 	arg.nlines = 0;
 	while (path[0] == '/')
 		path++;
-	err = got_diff_tree(tree1, tree2, f1, f2, fd1, fd2, path, path, repo,
-	    got_diff_blob_output_unidiff, &arg, 1);
+	err = got_diff_tree_parallel(tree1, tree2, fd1, fd2, path, path, repo,
+	    &arg);
 done:
 	if (tree1)
 		got_object_tree_close(tree1);
 	if (tree2)
 		got_object_tree_close(tree2);
-	if (f1 && fclose(f1) == EOF && err == NULL)
-		err = got_error_from_errno("fclose");
-	if (f2 && fclose(f2) == EOF && err == NULL)
-		err = got_error_from_errno("fclose");
+	free(arg.lines);
 	if (fd1 != -1 && close(fd1) == -1 && err == NULL)
 		err = got_error_from_errno("close");
 	if (fd2 != -1 && close(fd2) == -1 && err == NULL)
@@ -3746,23 +3784,12 @@ get_changed_paths(struct got_pathlist_head *paths,
 	struct got_object_id *tree_id1 = NULL, *tree_id2 = NULL;
 	struct got_tree_object *tree1 = NULL, *tree2 = NULL;
 	struct got_object_qid *qid;
-	got_diff_blob_cb cb = got_diff_tree_collect_changed_paths;
-	FILE *f1 = NULL, *f2 = NULL;
+	struct got_diff_blob_output_unidiff_arg arg;
 	int fd1 = -1, fd2 = -1;
 
-	if (dsa) {
-		cb = got_diff_tree_compute_diffstat;
+	memset(&arg, 0, sizeof(arg));
 
-		f1 = got_opentemp();
-		if (f1 == NULL) {
-			err = got_error_from_errno("got_opentemp");
-			goto done;
-		}
-		f2 = got_opentemp();
-		if (f2 == NULL) {
-			err = got_error_from_errno("got_opentemp");
-			goto done;
-		}
+	if (dsa) {
 		fd1 = got_opentempfd();
 		if (fd1 == -1) {
 			err = got_error_from_errno("got_opentempfd");
@@ -3804,8 +3831,16 @@ get_changed_paths(struct got_pathlist_head *paths,
 	if (err)
 		goto done;
 
-	err = got_diff_tree(tree1, tree2, f1, f2, fd1, fd2, "", "", repo,
-	    cb, dsa ? (void *)dsa : paths, dsa ? 1 : 0);
+	if (dsa) {
+		arg.diffstat = dsa;
+		arg.diff_algo = dsa->diff_algo;
+		arg.ignore_whitespace = dsa->ignore_ws;
+		arg.force_text_diff = dsa->force_text;
+		err = got_diff_tree_parallel(tree1, tree2, fd1, fd2, "", "",
+		    repo, &arg);
+	} else
+		err = got_diff_tree(tree1, tree2, NULL, NULL, -1, -1, "", "",
+		    repo, got_diff_tree_collect_changed_paths, paths, 0);
 done:
 	if (tree1)
 		got_object_tree_close(tree1);
@@ -3815,10 +3850,7 @@ done:
 		err = got_error_from_errno("close");
 	if (fd2 != -1 && close(fd2) == -1 && err == NULL)
 		err = got_error_from_errno("close");
-	if (f1 && fclose(f1) == EOF && err == NULL)
-		err = got_error_from_errno("fclose");
-	if (f2 && fclose(f2) == EOF && err == NULL)
-		err = got_error_from_errno("fclose");
+	free(arg.lines);
 	free(tree_id1);
 	return err;
 }
@@ -4756,12 +4788,26 @@ done:
 __dead static void
 usage_diff(void)
 {
-	fprintf(stderr, "usage: %s diff [-adPsw] [-C number] [-c commit] "
-	    "[-r repository-path] [object1 object2 | path ...]\n",
+	fprintf(stderr, "usage: %s diff [-adPsw] [-A algorithm] [-C number] "
+	    "[-c commit] [-r repository-path] [object1 object2 | path ...]\n",
 	    getprogname());
 	exit(1);
 }
 
+static int
+parse_diff_algorithm(enum got_diff_algorithm *diff_algo, const char *name)
+{
+	if (strcmp(name, "myers") == 0)
+		*diff_algo = GOT_DIFF_ALGORITHM_MYERS;
+	else if (strcmp(name, "patience") == 0)
+		*diff_algo = GOT_DIFF_ALGORITHM_PATIENCE;
+	else if (strcmp(name, "histogram") == 0)
+		*diff_algo = GOT_DIFF_ALGORITHM_HISTOGRAM;
+	else
+		return -1;
+	return 0;
+}
+
 struct print_diff_arg {
 	struct got_repository *repo;
 	struct got_worktree *worktree;
@@ -5004,7 +5050,7 @@ print_diff(void *arg, unsigned char status, unsigned char staged_status,
 	}
 
 	err = got_diff_blob_file(blob1, a->f1, size1, label1, f2 ? f2 : a->f2,
-	    f2_exists, &sb, path, GOT_DIFF_ALGORITHM_PATIENCE, a->diff_context,
+	    f2_exists, &sb, path, a->diff_algo, a->diff_context,
 	    a->ignore_whitespace, a->force_text_diff, a->diffstat, a->outfile);
 done:
 	if (fd1 != -1 && close(fd1) == -1 && err == NULL)
@@ -5035,6 +5081,7 @@ cmd_diff(int argc, char *argv[])
 	int type1 = GOT_OBJ_TYPE_ANY, type2 = GOT_OBJ_TYPE_ANY;
 	int diff_context = 3, diff_staged = 0, ignore_whitespace = 0, ch, i;
 	int force_text_diff = 0, force_path = 0, rflag = 0, show_diffstat = 0;
+	enum got_diff_algorithm diff_algo = GOT_DIFF_ALGORITHM_PATIENCE;
 	const char *errstr;
 	struct got_reflist_head refs;
 	struct got_pathlist_head diffstat_paths, paths;
@@ -5055,8 +5102,12 @@ cmd_diff(int argc, char *argv[])
 		err(1, "pledge");
 #endif
 
-	while ((ch = getopt(argc, argv, "aC:c:dPr:sw")) != -1) {
+	while ((ch = getopt(argc, argv, "A:aC:c:dPr:sw")) != -1) {
 		switch (ch) {
+		case 'A':
+			if (parse_diff_algorithm(&diff_algo, optarg) == -1)
+				errx(1, "invalid diff algorithm: %s", optarg);
+			break;
 		case 'a':
 			force_text_diff = 1;
 			break;
@@ -5142,7 +5193,7 @@ cmd_diff(int argc, char *argv[])
 		dsa.paths = &diffstat_paths;
 		dsa.force_text = force_text_diff;
 		dsa.ignore_ws = ignore_whitespace;
-		dsa.diff_algo = GOT_DIFF_ALGORITHM_PATIENCE;
+		dsa.diff_algo = diff_algo;
 	}
 
 	if (rflag || worktree == NULL || ncommit_args > 0) {
@@ -5242,7 +5293,7 @@ cmd_diff(int argc, char *argv[])
 			goto done;
 		arg.repo = repo;
 		arg.worktree = worktree;
-		arg.diff_algo = GOT_DIFF_ALGORITHM_PATIENCE;
+		arg.diff_algo = diff_algo;
 		arg.diff_context = diff_context;
 		arg.id_str = id_str;
 		arg.header_shown = 0;
@@ -5410,24 +5461,26 @@ cmd_diff(int argc, char *argv[])
 	case GOT_OBJ_TYPE_BLOB:
 		error = got_diff_objects_as_blobs(NULL, NULL, f1, f2,
 		    fd1, fd2, ids[0], ids[1], NULL, NULL,
-		    GOT_DIFF_ALGORITHM_PATIENCE, diff_context,
+		    diff_algo, diff_context,
 		    ignore_whitespace, force_text_diff,
 		    show_diffstat ? &dsa : NULL, repo, outfile);
 		break;
 	case GOT_OBJ_TYPE_TREE:
 		error = got_diff_objects_as_trees(NULL, NULL, f1, f2, fd1, fd2,
 		    ids[0], ids[1], &paths, "", "",
-		    GOT_DIFF_ALGORITHM_PATIENCE, diff_context,
+		    diff_algo, diff_context,
 		    ignore_whitespace, force_text_diff,
-		    show_diffstat ? &dsa : NULL, repo, outfile);
+		    show_diffstat ? &dsa : NULL, NULL, NULL,
+		    check_cancelled, NULL, repo, outfile);
 		break;
 	case GOT_OBJ_TYPE_COMMIT:
 		fprintf(outfile, "diff %s %s\n", labels[0], labels[1]);
 		error = got_diff_objects_as_commits(NULL, NULL, f1, f2,
 		    fd1, fd2, ids[0], ids[1], &paths,
-		    GOT_DIFF_ALGORITHM_PATIENCE, diff_context,
+		    diff_algo, diff_context,
 		    ignore_whitespace, force_text_diff,
-		    show_diffstat ? &dsa : NULL, repo, outfile);
+		    show_diffstat ? &dsa : NULL, NULL, NULL,
+		    check_cancelled, NULL, repo, outfile);
 		break;
 	default:
 		error = got_error(GOT_ERR_OBJ_TYPE);
@@ -5486,11 +5539,28 @@ done:
 	return error;
 }
 
+/* Allow got_blame() to store its results in the repository. */
+static const struct got_error *
+unveil_blame_cache(struct got_repository *repo)
+{
+	const struct got_error *err;
+	char *cache_path;
+
+	err = got_blame_get_cache_path(&cache_path, repo);
+	if (err)
+		return err;
+	if (unveil(cache_path, "rwc") != 0)
+		err = got_error_from_errno2("unveil", cache_path);
+	free(cache_path);
+	return err;
+}
+
 __dead static void
 usage_blame(void)
 {
 	fprintf(stderr,
-	    "usage: %s blame [-c commit] [-r repository-path] path\n",
+	    "usage: %s blame [-A algorithm] [-c commit] [-r repository-path] "
+	    "path\n",
 	    getprogname());
 	exit(1);
 }
@@ -5623,6 +5693,7 @@ cmd_blame(int argc, char *argv[])
 	off_t filesize;
 	int *pack_fds = NULL;
 	FILE *f1 = NULL, *f2 = NULL;
+	enum got_diff_algorithm diff_algo = GOT_DIFF_ALGORITHM_PATIENCE;
 
 	fd1 = got_opentempfd();
 	if (fd1 == -1)
@@ -5636,8 +5707,12 @@ cmd_blame(int argc, char *argv[])
 		err(1, "pledge");
 #endif
 
-	while ((ch = getopt(argc, argv, "c:r:")) != -1) {
+	while ((ch = getopt(argc, argv, "A:c:r:")) != -1) {
 		switch (ch) {
+		case 'A':
+			if (parse_diff_algorithm(&diff_algo, optarg) == -1)
+				errx(1, "invalid diff algorithm: %s", optarg);
+			break;
 		case 'c':
 			commit_id_str = optarg;
 			break;
@@ -5714,8 +5789,14 @@ cmd_blame(int argc, char *argv[])
 			goto done;
 		}
 		free(p);
+		error = unveil_blame_cache(repo);
+		if (error)
+			goto done;
 		error = apply_unveil(got_repo_get_path(repo), 1, NULL);
 	} else {
+		error = unveil_blame_cache(repo);
+		if (error)
+			goto done;
 		error = apply_unveil(got_repo_get_path(repo), 1, NULL);
 		if (error)
 			goto done;
@@ -5830,7 +5911,7 @@ cmd_blame(int argc, char *argv[])
 		goto done;
 	}
 	error = got_blame(link_target ? link_target : in_repo_path, commit_id,
-	    repo, GOT_DIFF_ALGORITHM_PATIENCE, blame_cb, &bca,
+	    repo, diff_algo, blame_cb, &bca,
 	    check_cancelled, NULL, fd2, fd3, f1, f2);
 done:
 	free(in_repo_path);
@@ -13984,6 +14065,7 @@ cmd_info(int argc, char *argv[])
 	struct got_worktree *worktree = NULL;
 	char *cwd = NULL, *id_str = NULL;
 	struct got_pathlist_head paths;
+	struct got_pathlist_entry *pe;
 	char *uuidstr = NULL;
 	int ch, show_files = 0;
 
@@ -14049,13 +14131,14 @@ cmd_info(int argc, char *argv[])
 	printf("work tree base commit: %s\n", id_str);
 	printf("work tree path prefix: %s\n",
 	    got_worktree_get_path_prefix(worktree));
+	TAILQ_FOREACH(pe, got_worktree_get_sparse_paths(worktree), entry)
+		printf("work tree sparse path: %s\n", pe->path);
 	printf("work tree branch reference: %s\n",
 	    got_worktree_get_head_ref_name(worktree));
 	printf("work tree UUID: %s\n", uuidstr);
 	printf("repository: %s\n", got_worktree_get_repo_path(worktree));
 
 	if (show_files) {
-		struct got_pathlist_entry *pe;
 		TAILQ_FOREACH(pe, &paths, entry) {
 			if (pe->path_len == 0)
 				continue;
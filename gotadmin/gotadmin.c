@@ -271,7 +271,7 @@ done:
 __dead static void
 usage_init(void)
 {
-	fprintf(stderr, "usage: %s init [-b branch] repository-path\n",
+	fprintf(stderr, "usage: %s init [-R] [-b branch] repository-path\n",
 	    getprogname());
 	exit(1);
 }
@@ -282,18 +282,21 @@ cmd_init(int argc, char *argv[])
 	const struct got_error *error = NULL;
 	const char *head_name = NULL;
 	char *repo_path = NULL;
-	int ch;
+	int ch, reftable = 0;
 
 #ifndef PROFILE
-	if (pledge("stdio rpath wpath cpath unveil", NULL) == -1)
+	if (pledge("stdio rpath wpath cpath fattr flock unveil", NULL) == -1)
 		err(1, "pledge");
 #endif
 
-	while ((ch = getopt(argc, argv, "b:")) != -1) {
+	while ((ch = getopt(argc, argv, "b:R")) != -1) {
 		switch (ch) {
 		case 'b':
 			head_name = optarg;
 			break;
+		case 'R':
+			reftable = 1;
+			break;
 		default:
 			usage_init();
 			/* NOTREACHED */
@@ -321,7 +324,7 @@ cmd_init(int argc, char *argv[])
 	if (error)
 		goto done;
 
-	error = got_repo_init(repo_path, head_name);
+	error = got_repo_init(repo_path, head_name, reftable);
 done:
 	free(repo_path);
 	return error;
@@ -1218,10 +1221,10 @@ cmd_cleanup(int argc, char *argv[])
 	char *repo_path = NULL;
 	struct got_repository *repo = NULL;
 	int ch, dry_run = 0, npacked = 0, verbosity = 0;
-	int remove_lonely_packidx = 0, ignore_mtime = 0;
+	int remove_lonely_packidx = 0, ignore_mtime = 0, nblame = 0;
 	struct got_cleanup_progress_arg cpa;
 	struct got_lonely_packidx_progress_arg lpa;
-	off_t size_before, size_after;
+	off_t size_before, size_after, blame_size;
 	char scaled_before[FMT_SCALED_STRSIZE];
 	char scaled_after[FMT_SCALED_STRSIZE];
 	char scaled_diff[FMT_SCALED_STRSIZE];
@@ -1329,6 +1332,24 @@ cmd_cleanup(int argc, char *argv[])
 			printf("disk space freed: %s\n", scaled_diff);
 		printf("loose objects also found in pack files: %d\n", npacked);
 	}
+
+	error = got_repo_purge_blame_cache(repo, &nblame, &blame_size,
+	    dry_run, check_cancelled, NULL);
+	if (error)
+		goto done;
+	if (nblame > 0 && verbosity >= 0) {
+		if (fmt_scaled(blame_size, scaled_diff) == -1) {
+			error = got_error_from_errno("fmt_scaled");
+			goto done;
+		}
+		if (dry_run) {
+			printf("blame cache entries which would be removed: "
+			    "%d (%s)\n", nblame, scaled_diff);
+		} else {
+			printf("blame cache entries removed: %d (%s)\n",
+			    nblame, scaled_diff);
+		}
+	}
 done:
 	if (repo)
 		got_repo_close(repo);
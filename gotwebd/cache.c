@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Cache of rendered pages which only depend on immutable objects, such
+ * as the diff of a commit given by its full ID. Pages are looked up by
+ * their ETag. Each socket process keeps its own cache in memory; pages
+ * which no longer fit into memory are moved to a temporary file until
+ * that file reaches its size limit, at which point all pages on disk
+ * are discarded at once. The cache is shared by all worker threads of
+ * the process; pages are copied out while the cache is locked.
+ */
+
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/tree.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <event.h>
+#include <imsg.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "got_opentemp.h"
+
+#include "proc.h"
+#include "gotwebd.h"
+
+struct cache_page {
+	RB_ENTRY(cache_page)	 node;
+	TAILQ_ENTRY(cache_page)	 entry;
+	char			 etag[GOTWEBD_ETAGSZ];
+	time_t			 mtime;
+	uint8_t			*data;		/* NULL if page is on disk */
+	off_t			 offset;	/* offset in spill file */
+	size_t			 len;
+};
+TAILQ_HEAD(cache_pagelist, cache_page);
+
+static int
+cache_page_cmp(const struct cache_page *p1, const struct cache_page *p2)
+{
+	return strcmp(p1->etag, p2->etag);
+}
+
+RB_HEAD(cache_tree, cache_page);
+RB_PROTOTYPE_STATIC(cache_tree, cache_page, node, cache_page_cmp);
+RB_GENERATE_STATIC(cache_tree, cache_page, node, cache_page_cmp);
+
+static struct cache_tree cache_pages = RB_INITIALIZER(&cache_pages);
+
+/* Pages in memory, most recently used first. */
+static struct cache_pagelist cache_mem = TAILQ_HEAD_INITIALIZER(cache_mem);
+static size_t cache_mem_used;
+
+/* Pages in the spill file. */
+static struct cache_pagelist cache_disk = TAILQ_HEAD_INITIALIZER(cache_disk);
+static off_t cache_disk_used;
+static int cache_fd = -1;
+static int cache_nodisk;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+cache_lock(void)
+{
+	int errcode;
+
+	errcode = pthread_mutex_lock(&cache_mutex);
+	if (errcode)
+		fatalx("%s: pthread_mutex_lock: %s", __func__,
+		    strerror(errcode));
+}
+
+static void
+cache_unlock(void)
+{
+	int errcode;
+
+	errcode = pthread_mutex_unlock(&cache_mutex);
+	if (errcode)
+		fatalx("%s: pthread_mutex_unlock: %s", __func__,
+		    strerror(errcode));
+}
+
+static void
+cache_remove(struct cache_page *p)
+{
+	RB_REMOVE(cache_tree, &cache_pages, p);
+	if (p->data) {
+		TAILQ_REMOVE(&cache_mem, p, entry);
+		cache_mem_used -= p->len;
+		free(p->data);
+	} else
+		TAILQ_REMOVE(&cache_disk, p, entry);
+	free(p);
+}
+
+static void
+cache_disk_reset(void)
+{
+	struct cache_page *p;
+
+	while ((p = TAILQ_FIRST(&cache_disk)) != NULL)
+		cache_remove(p);
+
+	if (cache_fd != -1 && ftruncate(cache_fd, 0) == -1) {
+		log_warn("%s: ftruncate", __func__);
+		close(cache_fd);
+		cache_fd = -1;
+		cache_nodisk = 1;
+	}
+	cache_disk_used = 0;
+}
+
+/* Move the least recently used page in memory to the spill file. */
+static void
+cache_spill(struct cache_page *p)
+{
+	const uint8_t *data = p->data;
+	size_t remain = p->len;
+	off_t off;
+	ssize_t w;
+
+	if (cache_fd == -1 && !cache_nodisk) {
+		cache_fd = got_opentempfd();
+		if (cache_fd == -1) {
+			log_warn("%s: got_opentempfd", __func__);
+			cache_nodisk = 1;
+		}
+	}
+
+	if (cache_fd == -1 || p->len > GOTWEBD_PAGE_CACHE_DISKSIZE) {
+		cache_remove(p);
+		return;
+	}
+
+	if (cache_disk_used + p->len > GOTWEBD_PAGE_CACHE_DISKSIZE)
+		cache_disk_reset();
+
+	off = cache_disk_used;
+	while (remain > 0) {
+		w = pwrite(cache_fd, data, remain, off);
+		if (w == -1) {
+			if (errno == EINTR)
+				continue;
+			log_warn("%s: pwrite", __func__);
+			cache_remove(p);
+			return;
+		}
+		data += w;
+		remain -= w;
+		off += w;
+	}
+
+	TAILQ_REMOVE(&cache_mem, p, entry);
+	cache_mem_used -= p->len;
+	free(p->data);
+	p->data = NULL;
+	p->offset = cache_disk_used;
+	cache_disk_used += p->len;
+	TAILQ_INSERT_HEAD(&cache_disk, p, entry);
+}
+
+static struct cache_page *
+cache_find(const char *etag)
+{
+	struct cache_page key, *p;
+
+	if (strlcpy(key.etag, etag, sizeof(key.etag)) >= sizeof(key.etag))
+		return NULL;
+
+	p = RB_FIND(cache_tree, &cache_pages, &key);
+	if (p == NULL)
+		return NULL;
+
+	if (p->data && p != TAILQ_FIRST(&cache_mem)) {
+		TAILQ_REMOVE(&cache_mem, p, entry);
+		TAILQ_INSERT_HEAD(&cache_mem, p, entry);
+	}
+
+	return p;
+}
+
+/* Check whether a page is cached and get its modification time. */
+int
+cache_lookup(const char *etag, time_t *mtime)
+{
+	struct cache_page *p;
+
+	cache_lock();
+	p = cache_find(etag);
+	if (p && mtime)
+		*mtime = p->mtime;
+	cache_unlock();
+
+	return p != NULL;
+}
+
+/* Return a copy of a cached page, or NULL if it is not cached. */
+uint8_t *
+cache_get(const char *etag, size_t *len)
+{
+	struct cache_page *p;
+	uint8_t *buf = NULL;
+	size_t off = 0;
+	ssize_t r;
+
+	*len = 0;
+
+	cache_lock();
+
+	p = cache_find(etag);
+	if (p == NULL)
+		goto done;
+
+	buf = malloc(p->len);
+	if (buf == NULL) {
+		log_warn("%s: malloc", __func__);
+		goto done;
+	}
+
+	if (p->data) {
+		memcpy(buf, p->data, p->len);
+		*len = p->len;
+		goto done;
+	}
+
+	while (off < p->len) {
+		r = pread(cache_fd, buf + off, p->len - off, p->offset + off);
+		if (r == -1) {
+			if (errno == EINTR)
+				continue;
+			log_warn("%s: pread", __func__);
+			break;
+		}
+		if (r == 0) {
+			log_warnx("%s: short read from page cache", __func__);
+			break;
+		}
+		off += r;
+	}
+	if (off < p->len) {
+		cache_remove(p);
+		free(buf);
+		buf = NULL;
+	} else
+		*len = off;
+done:
+	cache_unlock();
+	return buf;
+}
+
+void
+cache_capture_start(struct request *c)
+{
+	cache_capture_abort(c);
+	if (c->etag[0] != '\0')
+		c->cache_capture = 1;
+}
+
+void
+cache_capture(struct request *c, const uint8_t *data, size_t len)
+{
+	uint8_t *buf;
+	size_t size;
+
+	if (!c->cache_capture)
+		return;
+
+	if (len > GOTWEBD_PAGE_CACHE_MAXPAGE - c->cache_len) {
+		cache_capture_abort(c);
+		return;
+	}
+
+	if (c->cache_len + len > c->cache_size) {
+		size = c->cache_size ? c->cache_size : BUF;
+		while (size < c->cache_len + len)
+			size *= 2;
+		if (size > GOTWEBD_PAGE_CACHE_MAXPAGE)
+			size = GOTWEBD_PAGE_CACHE_MAXPAGE;
+
+		buf = realloc(c->cache_buf, size);
+		if (buf == NULL) {
+			log_warn("%s: realloc", __func__);
+			cache_capture_abort(c);
+			return;
+		}
+		c->cache_buf = buf;
+		c->cache_size = size;
+	}
+
+	memcpy(c->cache_buf + c->cache_len, data, len);
+	c->cache_len += len;
+}
+
+void
+cache_capture_abort(struct request *c)
+{
+	free(c->cache_buf);
+	c->cache_buf = NULL;
+	c->cache_len = 0;
+	c->cache_size = 0;
+	c->cache_capture = 0;
+}
+
+/*
+ * Store the page captured since cache_capture_start() under the ETag
+ * of the request. Must only be called once the page was fully rendered.
+ */
+void
+cache_store(struct request *c)
+{
+	struct cache_page *p, *tail;
+	uint8_t *buf;
+
+	if (!c->cache_capture || c->cache_len == 0 ||
+	    c->client_status == CLIENT_DISCONNECT) {
+		cache_capture_abort(c);
+		return;
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (p == NULL) {
+		log_warn("%s: calloc", __func__);
+		cache_capture_abort(c);
+		return;
+	}
+
+	cache_lock();
+
+	if (strlcpy(p->etag, c->etag, sizeof(p->etag)) >= sizeof(p->etag) ||
+	    RB_INSERT(cache_tree, &cache_pages, p) != NULL) {
+		free(p);
+		cache_capture_abort(c);
+		goto done;
+	}
+
+	/* Don't hold on to the slack of the capture buffer. */
+	buf = realloc(c->cache_buf, c->cache_len);
+	if (buf != NULL)
+		c->cache_buf = buf;
+
+	p->mtime = c->last_modified;
+	p->data = c->cache_buf;
+	p->len = c->cache_len;
+	c->cache_buf = NULL;
+	cache_capture_abort(c);
+
+	while (cache_mem_used + p->len > GOTWEBD_PAGE_CACHE_MEMSIZE &&
+	    (tail = TAILQ_LAST(&cache_mem, cache_pagelist)) != NULL)
+		cache_spill(tail);
+
+	TAILQ_INSERT_HEAD(&cache_mem, p, entry);
+	cache_mem_used += p->len;
+done:
+	cache_unlock();
+}
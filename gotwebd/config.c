@@ -107,11 +107,7 @@ config_getserver(struct gotwebd *env, struct imsg *imsg)
 	}
 
 	memcpy(srv, p, sizeof(*srv));
-	srv->cached_repos = calloc(GOTWEBD_REPO_CACHESIZE,
-	    sizeof(*srv->cached_repos));
-	if (srv->cached_repos == NULL)
-		fatal("%s: calloc", __func__);
-	srv->ncached_repos = 0;
+	RB_INIT(&srv->repo_summaries);
 
 	/* log server info */
 	log_debug("%s: server=%s fcgi_socket=%s unix_socket=%s", __func__,
@@ -191,7 +187,7 @@ config_getsock(struct gotwebd *env, struct imsg *imsg)
 	struct socket *sock = NULL;
 	struct socket_conf sock_conf;
 	uint8_t *p = imsg->data;
-	int i;
+	int i, j;
 
 	IMSG_SIZE_CHECK(imsg, &sock_conf);
 	memcpy(&sock_conf, p, sizeof(sock_conf));
@@ -213,11 +209,19 @@ config_getsock(struct gotwebd *env, struct imsg *imsg)
 
 	TAILQ_INSERT_TAIL(&env->sockets, sock, entry);
 
-	for (i = 0; i < PRIV_FDS__MAX; i++)
-		sock->priv_fd[i] = -1;
+	for (i = 0; i < GOTWEBD_NUMWORKERS; i++) {
+		struct worker *w = &sock->workers[i];
 
-	for (i = 0; i < GOTWEB_PACK_NUM_TEMPFILES; i++)
-		sock->pack_fds[i] = -1;
+		w->sock = sock;
+		for (j = 0; j < PRIV_FDS__MAX; j++)
+			w->priv_fd[j] = -1;
+		for (j = 0; j < GOTWEB_PACK_NUM_TEMPFILES; j++)
+			w->pack_fds[j] = -1;
+	}
+
+	TAILQ_INIT(&sock->requests);
+	sock->done_pipe[0] = -1;
+	sock->done_pipe[1] = -1;
 
 	/* log new socket info */
 	log_debug("%s: name=%s id=%d server=%s af_type=%s socket_path=%s",
@@ -241,10 +245,12 @@ config_setfd(struct gotwebd *env, struct socket *sock)
 	size_t c;
 	unsigned int what;
 
-	log_debug("%s: Allocating %d file descriptors",
-	    __func__, PRIV_FDS__MAX + GOTWEB_PACK_NUM_TEMPFILES);
+	const int nfds = GOTWEBD_NUMWORKERS *
+	    (PRIV_FDS__MAX + GOTWEB_PACK_NUM_TEMPFILES);
+
+	log_debug("%s: Allocating %d file descriptors", __func__, nfds);
 
-	for (j = 0; j < PRIV_FDS__MAX + GOTWEB_PACK_NUM_TEMPFILES; j++) {
+	for (j = 0; j < nfds; j++) {
 		for (id = 0; id < PROC_MAX; id++) {
 			what = ps->ps_what[id];
 
@@ -295,34 +301,38 @@ int
 config_getfd(struct gotwebd *env, struct imsg *imsg)
 {
 	struct socket *sock;
+	struct worker *w;
 	uint8_t *p = imsg->data;
-	int sock_id, match = 0, i;
+	int sock_id, i, j;
 
 	IMSG_SIZE_CHECK(imsg, &sock_id);
 	memcpy(&sock_id, p, sizeof(sock_id));
 
 	TAILQ_FOREACH(sock, &env->sockets, entry) {
-		const int nfds = (GOTWEB_PACK_NUM_TEMPFILES + PRIV_FDS__MAX);
-		for (i = 0; i < nfds; i++) {
-			if (i < PRIV_FDS__MAX && sock->priv_fd[i] == -1) {
-				log_debug("%s: assigning socket %d priv_fd %d",
-				    __func__, sock_id, imsg->fd);
-				sock->priv_fd[i] = imsg->fd;
-				match = 1;
-				break;
+		if (sock->conf.id != sock_id)
+			continue;
+		for (i = 0; i < GOTWEBD_NUMWORKERS; i++) {
+			w = &sock->workers[i];
+			for (j = 0; j < PRIV_FDS__MAX; j++) {
+				if (w->priv_fd[j] != -1)
+					continue;
+				log_debug("%s: assigning socket %d worker %d "
+				    "priv_fd %d", __func__, sock_id, i,
+				    imsg->fd);
+				w->priv_fd[j] = imsg->fd;
+				return 0;
 			}
-			if (sock->pack_fds[i - PRIV_FDS__MAX] == -1) {
-				log_debug("%s: assigning socket %d pack_fd %d",
-				    __func__, sock_id, imsg->fd);
-				sock->pack_fds[i - PRIV_FDS__MAX] = imsg->fd;
-				match = 1;
-				break;
+			for (j = 0; j < GOTWEB_PACK_NUM_TEMPFILES; j++) {
+				if (w->pack_fds[j] != -1)
+					continue;
+				log_debug("%s: assigning socket %d worker %d "
+				    "pack_fd %d", __func__, sock_id, i,
+				    imsg->fd);
+				w->pack_fds[j] = imsg->fd;
+				return 0;
 			}
 		}
 	}
 
-	if (match)
-		 return 0;
-	else
-		return 1;
+	return 1;
 }
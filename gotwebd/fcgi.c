@@ -17,6 +17,7 @@
  */
 
 #include <arpa/inet.h>
+#include <sys/param.h>
 #include <sys/queue.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -25,6 +26,7 @@
 #include <errno.h>
 #include <event.h>
 #include <imsg.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -43,6 +45,9 @@ void	 fcgi_parse_begin_request(uint8_t *, uint16_t, struct request *,
 	    uint16_t);
 void	 fcgi_parse_params(uint8_t *, uint16_t, struct request *, uint16_t);
 int	 fcgi_send_response(struct request *, int, const void *, size_t);
+static int send_records(struct request *, int, const struct iovec *, int);
+static int fcgi_flush(struct request *);
+static void fcgi_end_request(struct request *);
 
 void	 dump_fcgi_record_header(const char *, struct fcgi_record_header *);
 void	 dump_fcgi_begin_request_body(const char *,
@@ -68,6 +73,7 @@ fcgi_request(int fd, short events, void *arg)
 		switch (errno) {
 		case EINTR:
 		case EAGAIN:
+			event_add(&c->ev, NULL);
 			return;
 		default:
 			goto fail;
@@ -103,8 +109,25 @@ fcgi_request(int fd, short events, void *arg)
 			bcopy(c->buf + c->buf_pos, c->buf, c->buf_len);
 			c->buf_pos = 0;
 		}
+
+	if (c->stdin_done && !c->processing) {
+		fcgi_end_request(c);
+		return;
+	}
+
+	/*
+	 * Wait for the remaining records, and notice if the client goes
+	 * away while the page is being built.
+	 */
+	event_add(&c->ev, NULL);
 	return;
 fail:
+	if (c->processing) {
+		/* The worker notices and gives up; clean up once it is done. */
+		c->client_status = CLIENT_DISCONNECT;
+		c->abandoned = 1;
+		return;
+	}
 	fcgi_cleanup_request(c);
 }
 
@@ -139,14 +162,7 @@ fcgi_parse_record(uint8_t *buf, size_t n, struct request *c)
 		break;
 	case FCGI_STDIN:
 	case FCGI_ABORT_REQUEST:
-		if (c->sock->client_status != CLIENT_DISCONNECT &&
-		    c->outbuf_len != 0) {
-			fcgi_send_response(c, FCGI_STDOUT, c->outbuf,
-			    c->outbuf_len);
-		}
-
-		fcgi_create_end_record(c);
-		fcgi_cleanup_request(c);
+		c->stdin_done = 1;
 		return 0;
 	default:
 		log_warn("unimplemented type %d", h->type);
@@ -193,8 +209,13 @@ fcgi_parse_params(uint8_t *buf, uint16_t n, struct request *c, uint16_t id)
 		return;
 	}
 
+	if (c->processing || c->processed) {
+		log_warnx("unexpected FCGI_PARAMS, ignoring");
+		return;
+	}
+
 	if (n == 0) {
-		gotweb_process_request(c);
+		sockets_queue_request(c);
 		return;
 	}
 
@@ -281,6 +302,22 @@ fcgi_parse_params(uint8_t *buf, uint16_t n, struct request *c, uint16_t id)
 		    strncmp(buf, "HTTPS", 5) == 0)
 			c->https = 1;
 
+		if (c->if_none_match[0] == '\0' &&
+		    val_len < sizeof(c->if_none_match) &&
+		    name_len == 18 &&
+		    strncmp(buf, "HTTP_IF_NONE_MATCH", 18) == 0) {
+			memcpy(c->if_none_match, val, val_len);
+			c->if_none_match[val_len] = '\0';
+		}
+
+		if (c->if_modified_since[0] == '\0' &&
+		    val_len < sizeof(c->if_modified_since) &&
+		    name_len == 22 &&
+		    strncmp(buf, "HTTP_IF_MODIFIED_SINCE", 22) == 0) {
+			memcpy(c->if_modified_since, val, val_len);
+			c->if_modified_since[val_len] = '\0';
+		}
+
 		buf += name_len + val_len;
 		n -= name_len - val_len;
 	}
@@ -289,7 +326,37 @@ fcgi_parse_params(uint8_t *buf, uint16_t n, struct request *c, uint16_t id)
 void
 fcgi_timeout(int fd, short events, void *arg)
 {
-	fcgi_cleanup_request((struct request*) arg);
+	struct request *c = arg;
+
+	if (c->processing) {
+		c->client_status = CLIENT_DISCONNECT;
+		c->abandoned = 1;
+		return;
+	}
+
+	fcgi_cleanup_request(c);
+}
+
+/* Called in the main thread once a worker has finished with a request. */
+void
+fcgi_request_done(struct request *c)
+{
+	c->processing = 0;
+	c->processed = 1;
+	c->worker = NULL;
+
+	if (c->abandoned)
+		fcgi_cleanup_request(c);
+	else if (c->stdin_done)
+		fcgi_end_request(c);
+}
+
+static void
+fcgi_end_request(struct request *c)
+{
+	fcgi_flush(c);
+	fcgi_create_end_record(c);
+	fcgi_cleanup_request(c);
 }
 
 int
@@ -301,10 +368,11 @@ fcgi_puts(struct template *tp, const char *str)
 }
 
 int
-fcgi_putc(struct template *tp, int ch)
+fcgi_write(struct template *tp, const char *data, size_t len)
 {
-	uint8_t c = ch;
-	return fcgi_gen_binary_response(tp->tp_arg, &c, 1);
+	if (len > INT_MAX)
+		return -1;
+	return fcgi_gen_binary_response(tp->tp_arg, data, len);
 }
 
 int
@@ -337,84 +405,69 @@ fcgi_printf(struct request *c, const char *fmt, ...)
 	return r;
 }
 
+/*
+ * Template output is collected in the request's output buffer and sent
+ * in records of up to FCGI_CONTENT_SIZE bytes, so that a page costs a
+ * handful of writev(2) calls rather than one per kilobyte.
+ */
 int
 fcgi_gen_binary_response(struct request *c, const uint8_t *data, int len)
 {
-	int r;
+	struct iovec iov[2];
+	size_t avail;
 
-	if (c->sock->client_status == CLIENT_DISCONNECT)
+	if (c->client_status == CLIENT_DISCONNECT)
 		return -1;
 
 	if (data == NULL || len == 0)
 		return 0;
 
-	/*
-	 * special case: send big replies -like blobs- directly
-	 * without copying.
-	 */
-	if (len > sizeof(c->outbuf)) {
-		if (c->outbuf_len > 0) {
-			fcgi_send_response(c, FCGI_STDOUT,
-			    c->outbuf, c->outbuf_len);
-			c->outbuf_len = 0;
-		}
-		return fcgi_send_response(c, FCGI_STDOUT, data, len);
-	}
+	if (c->cache_capture)
+		cache_capture(c, data, len);
 
-	if (len < sizeof(c->outbuf) - c->outbuf_len) {
+	avail = sizeof(c->outbuf) - c->outbuf_len;
+	if (len <= avail) {
 		memcpy(c->outbuf + c->outbuf_len, data, len);
 		c->outbuf_len += len;
 		return 0;
 	}
 
-	r = fcgi_send_response(c, FCGI_STDOUT, c->outbuf, c->outbuf_len);
-	if (r == -1)
+	/*
+	 * special case: send big replies -like blobs- directly
+	 * without copying, together with what is already buffered.
+	 */
+	if (len >= sizeof(c->outbuf)) {
+		iov[0].iov_base = c->outbuf;
+		iov[0].iov_len = c->outbuf_len;
+		iov[1].iov_base = (void *)data;
+		iov[1].iov_len = len;
+		c->outbuf_len = 0;
+		return send_records(c, FCGI_STDOUT, iov, nitems(iov));
+	}
+
+	memcpy(c->outbuf + c->outbuf_len, data, avail);
+	c->outbuf_len += avail;
+	if (fcgi_flush(c) == -1)
 		return -1;
 
-	memcpy(c->outbuf, data, len);
-	c->outbuf_len = len;
+	memcpy(c->outbuf, data + avail, len - avail);
+	c->outbuf_len = len - avail;
 	return 0;
 }
 
 static int
-send_response(struct request *c, int type, const uint8_t *data,
-    size_t len)
+send_iov(struct request *c, struct iovec *iov, int iovcnt)
 {
-	static const uint8_t padding[FCGI_PADDING_SIZE];
-	struct fcgi_record_header header;
-	struct iovec iov[3];
 	struct timespec ts;
 	ssize_t nw;
-	size_t padded_len, tot;
+	size_t tot = 0;
 	int i, err = 0, th = 2000;
 
 	ts.tv_sec = 0;
 	ts.tv_nsec = 50;
 
-	memset(&header, 0, sizeof(header));
-	header.version = 1;
-	header.type = type;
-	header.id = htons(c->id);
-	header.content_len = htons(len);
-
-	/* The FastCGI spec suggests to align the output buffer */
-	tot = sizeof(header) + len;
-	padded_len = FCGI_ALIGN(tot);
-	if (padded_len > tot) {
-		header.padding_len = padded_len - tot;
-		tot += header.padding_len;
-	}
-
-	iov[0].iov_base = &header;
-	iov[0].iov_len = sizeof(header);
-
-	iov[1].iov_base = (void *)data;
-	iov[1].iov_len = len;
-
-	iov[2].iov_base = (void *)padding;
-	iov[2].iov_len = header.padding_len;
-
-	dump_fcgi_record("resp ", &header);
+	for (i = 0; i < iovcnt; ++i)
+		tot += iov[i].iov_len;
 
 	/*
 	 * XXX: add some simple write heuristics here
@@ -423,9 +476,9 @@ send_response(struct request *c, int type, const uint8_t *data,
 	 * giving up.
 	 */
 	while (tot > 0) {
-		nw = writev(c->fd, iov, nitems(iov));
+		nw = writev(c->fd, iov, iovcnt);
 		if (nw == 0) {
-			c->sock->client_status = CLIENT_DISCONNECT;
+			c->client_status = CLIENT_DISCONNECT;
 			break;
 		}
 		if (nw == -1) {
@@ -435,7 +488,7 @@ send_response(struct request *c, int type, const uint8_t *data,
 				continue;
 			}
 			log_warn("%s: write failure", __func__);
-			c->sock->client_status = CLIENT_DISCONNECT;
+			c->client_status = CLIENT_DISCONNECT;
 			return -1;
 		}
 
@@ -444,7 +497,7 @@ send_response(struct request *c, int type, const uint8_t *data,
 			    nw, tot);
 
 		tot -= nw;
-		for (i = 0; i < nitems(iov); ++i) {
+		for (i = 0; i < iovcnt; ++i) {
 			if (nw < iov[i].iov_len) {
 				iov[i].iov_base += nw;
 				iov[i].iov_len -= nw;
@@ -458,25 +511,88 @@ send_response(struct request *c, int type, const uint8_t *data,
 	return 0;
 }
 
+/*
+ * Send data as FastCGI records of the given type, splitting it into
+ * records of at most FCGI_CONTENT_SIZE bytes.  Records are not padded;
+ * the alignment suggested by the FastCGI spec is optional and would
+ * cost an extra iovec per record.  Up to FCGI_MAXRECORDS records are
+ * written with a single writev(2).
+ */
+static int
+send_records(struct request *c, int type, const struct iovec *data,
+    int ndata)
+{
+	struct fcgi_record_header hdr[FCGI_MAXRECORDS];
+	struct iovec iov[FCGI_MAXRECORDS * 2];
+	uint8_t *p = NULL;
+	size_t len = 0, n;
+	int i = -1, niov, nrec;
+
+	for (;;) {
+		niov = 0;
+		for (nrec = 0; nrec < FCGI_MAXRECORDS; nrec++) {
+			while (len == 0 && ++i < ndata) {
+				p = data[i].iov_base;
+				len = data[i].iov_len;
+			}
+			if (len == 0)
+				break;
+
+			n = MIN(len, FCGI_CONTENT_SIZE);
+
+			memset(&hdr[nrec], 0, sizeof(hdr[nrec]));
+			hdr[nrec].version = 1;
+			hdr[nrec].type = type;
+			hdr[nrec].id = htons(c->id);
+			hdr[nrec].content_len = htons(n);
+			dump_fcgi_record("resp ", &hdr[nrec]);
+
+			iov[niov].iov_base = &hdr[nrec];
+			iov[niov].iov_len = sizeof(hdr[nrec]);
+			niov++;
+			iov[niov].iov_base = p;
+			iov[niov].iov_len = n;
+			niov++;
+
+			p += n;
+			len -= n;
+		}
+
+		if (nrec == 0)
+			return 0;
+
+		if (send_iov(c, iov, niov) == -1)
+			return -1;
+		if (c->client_status == CLIENT_DISCONNECT)
+			return -1;
+	}
+}
+
 int
 fcgi_send_response(struct request *c, int type, const void *data,
     size_t len)
 {
-	if (c->sock->client_status == CLIENT_DISCONNECT)
+	struct iovec iov;
+
+	if (c->client_status == CLIENT_DISCONNECT)
 		return -1;
 
-	while (len > FCGI_CONTENT_SIZE) {
-		if (send_response(c, type, data, len) == -1)
-			return -1;
+	iov.iov_base = (void *)data;
+	iov.iov_len = len;
+	return send_records(c, type, &iov, 1);
+}
 
-		data += FCGI_CONTENT_SIZE;
-		len -= FCGI_CONTENT_SIZE;
-	}
+static int
+fcgi_flush(struct request *c)
+{
+	int r;
 
-	if (len == 0)
+	if (c->outbuf_len == 0)
 		return 0;
 
-	return send_response(c, type, data, len);
+	r = fcgi_send_response(c, FCGI_STDOUT, c->outbuf, c->outbuf_len);
+	c->outbuf_len = 0;
+	return r;
 }
 
 void
@@ -505,6 +621,7 @@ fcgi_cleanup_request(struct request *c)
 	close(c->fd);
 	template_free(c->tp);
 	gotweb_free_transport(c->t);
+	cache_capture_abort(c);
 	free(c);
 }
 
@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Journal of the tags of each repository, newest first, from which RSS
+ * feeds are rendered. The journal is updated when the stamp of the
+ * tag references changes: references are listed again, but only tags
+ * which are new or which point to a different object are read from the
+ * repository. Serving a feed from an up-to-date journal only copies the
+ * entries shown in the feed. The journal is kept in memory for the
+ * lifetime of the socket process and is shared by its worker threads.
+ */
+
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/tree.h>
+#include <sys/types.h>
+
+#include <event.h>
+#include <imsg.h>
+#include <pthread.h>
+#include <sha1.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "got_error.h"
+#include "got_object.h"
+#include "got_reference.h"
+#include "got_repository.h"
+
+#include "proc.h"
+#include "gotwebd.h"
+
+struct feed_tag {
+	RB_ENTRY(feed_tag)	 node;
+	TAILQ_ENTRY(feed_tag)	 entry;
+	char			*name;
+	struct got_object_id	 id;		/* target of the reference */
+	int			 seen;
+	int			 journaled;
+	char			*commit_id;
+	char			*tagger;
+	char			*message;
+	time_t			 time;
+};
+TAILQ_HEAD(feed_taglist, feed_tag);
+
+static int
+feed_tag_cmp(const struct feed_tag *t1, const struct feed_tag *t2)
+{
+	return strcmp(t1->name, t2->name);
+}
+
+RB_HEAD(feed_tags, feed_tag);
+RB_PROTOTYPE_STATIC(feed_tags, feed_tag, node, feed_tag_cmp);
+RB_GENERATE_STATIC(feed_tags, feed_tag, node, feed_tag_cmp);
+
+struct repo_feed {
+	RB_ENTRY(repo_feed)	 node;
+	char			*path;
+	pthread_mutex_t		 mutex;
+	uint8_t			 stamp[SHA1_DIGEST_LENGTH];
+	int			 valid;
+	time_t			 mtime;
+	struct feed_tags	 tags;
+	struct feed_taglist	 journal;	/* newest first */
+};
+
+static int
+repo_feed_cmp(const struct repo_feed *f1, const struct repo_feed *f2)
+{
+	return strcmp(f1->path, f2->path);
+}
+
+RB_HEAD(repo_feeds, repo_feed);
+RB_PROTOTYPE_STATIC(repo_feeds, repo_feed, node, repo_feed_cmp);
+RB_GENERATE_STATIC(repo_feeds, repo_feed, node, repo_feed_cmp);
+
+static struct repo_feeds feeds = RB_INITIALIZER(&feeds);
+static pthread_mutex_t feeds_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+feed_tag_free_info(struct feed_tag *ft)
+{
+	free(ft->commit_id);
+	free(ft->tagger);
+	free(ft->message);
+	ft->commit_id = NULL;
+	ft->tagger = NULL;
+	ft->message = NULL;
+	ft->time = 0;
+}
+
+static void
+feed_tag_free(struct feed_tag *ft)
+{
+	feed_tag_free_info(ft);
+	free(ft->name);
+	free(ft);
+}
+
+/*
+ * Read what the feed shows about a tag from the repository. Tags of
+ * objects other than commits are left without information.
+ */
+static const struct got_error *
+feed_tag_load(struct feed_tag *ft, struct got_repository *repo)
+{
+	const struct got_error *error;
+	struct got_tag_object *tag = NULL;
+	struct got_commit_object *commit = NULL;
+	const char *msg;
+	char *logmsg = NULL;
+
+	error = got_object_open_as_tag(&tag, repo, &ft->id);
+	if (error) {
+		if (error->code != GOT_ERR_OBJ_TYPE)
+			return error;
+		/* "lightweight" tag */
+		error = got_object_open_as_commit(&commit, repo, &ft->id);
+		if (error) {
+			if (error->code != GOT_ERR_OBJ_TYPE)
+				return error;
+			return NULL;
+		}
+		error = got_object_id_str(&ft->commit_id, &ft->id);
+		if (error)
+			goto done;
+		ft->tagger = strdup(got_object_commit_get_committer(commit));
+		if (ft->tagger == NULL) {
+			error = got_error_from_errno("strdup");
+			goto done;
+		}
+		ft->time = got_object_commit_get_committer_time(commit);
+		error = got_object_commit_get_logmsg(&logmsg, commit);
+		if (error)
+			goto done;
+		msg = logmsg;
+	} else {
+		error = got_object_id_str(&ft->commit_id,
+		    got_object_tag_get_object_id(tag));
+		if (error)
+			goto done;
+		ft->tagger = strdup(got_object_tag_get_tagger(tag));
+		if (ft->tagger == NULL) {
+			error = got_error_from_errno("strdup");
+			goto done;
+		}
+		ft->time = got_object_tag_get_tagger_time(tag);
+		msg = got_object_tag_get_message(tag);
+	}
+
+	while (*msg == '\n')
+		msg++;
+	ft->message = strdup(msg);
+	if (ft->message == NULL)
+		error = got_error_from_errno("strdup");
+done:
+	if (tag)
+		got_object_tag_close(tag);
+	if (commit)
+		got_object_commit_close(commit);
+	free(logmsg);
+	if (error)
+		feed_tag_free_info(ft);
+	return error;
+}
+
+/* Tags are usually added with the newest time; look from the front. */
+static void
+feed_journal_insert(struct repo_feed *feed, struct feed_tag *ft)
+{
+	struct feed_tag *t;
+
+	if (ft->commit_id == NULL)
+		return;
+
+	ft->journaled = 1;
+	TAILQ_FOREACH(t, &feed->journal, entry) {
+		if (t->time <= ft->time) {
+			TAILQ_INSERT_BEFORE(t, ft, entry);
+			return;
+		}
+	}
+	TAILQ_INSERT_TAIL(&feed->journal, ft, entry);
+}
+
+static void
+feed_tag_remove(struct repo_feed *feed, struct feed_tag *ft)
+{
+	RB_REMOVE(feed_tags, &feed->tags, ft);
+	if (ft->journaled)
+		TAILQ_REMOVE(&feed->journal, ft, entry);
+	feed_tag_free(ft);
+}
+
+/*
+ * Bring the journal up to date with the tag references in the repository.
+ * Must be called with the feed locked.
+ */
+static const struct got_error *
+feed_update(struct repo_feed *feed, struct got_repository *repo,
+    const uint8_t *stamp, time_t refs_mtime)
+{
+	const struct got_error *error = NULL;
+	struct got_reflist_head refs;
+	struct got_reflist_entry *re;
+	struct got_object_id *id = NULL;
+	struct feed_tag key, *ft, *next;
+
+	TAILQ_INIT(&refs);
+
+	/* Invalidate the journal until it has been fully updated. */
+	feed->valid = 0;
+
+	error = got_ref_list(&refs, repo, "refs/tags", got_ref_cmp_by_name,
+	    NULL);
+	if (error)
+		return error;
+
+	TAILQ_FOREACH(re, &refs, entry) {
+		free(id);
+		id = NULL;
+		error = got_ref_resolve(&id, repo, re->ref);
+		if (error)
+			goto done;
+
+		key.name = (char *)got_ref_get_name(re->ref);
+		ft = RB_FIND(feed_tags, &feed->tags, &key);
+		if (ft && got_object_id_cmp(&ft->id, id) == 0) {
+			ft->seen = 1;
+			continue;
+		}
+
+		if (ft == NULL) {
+			ft = calloc(1, sizeof(*ft));
+			if (ft == NULL) {
+				error = got_error_from_errno("calloc");
+				goto done;
+			}
+			ft->name = strdup(key.name);
+			if (ft->name == NULL) {
+				error = got_error_from_errno("strdup");
+				free(ft);
+				goto done;
+			}
+			RB_INSERT(feed_tags, &feed->tags, ft);
+		} else {
+			/* The tag was moved to a different object. */
+			if (ft->journaled)
+				TAILQ_REMOVE(&feed->journal, ft, entry);
+			ft->journaled = 0;
+			feed_tag_free_info(ft);
+		}
+
+		memcpy(&ft->id, id, sizeof(ft->id));
+		ft->seen = 1;
+		error = feed_tag_load(ft, repo);
+		if (error) {
+			feed_tag_remove(feed, ft);
+			goto done;
+		}
+		feed_journal_insert(feed, ft);
+	}
+
+	/* Forget tags which have been deleted. */
+	RB_FOREACH_SAFE(ft, feed_tags, &feed->tags, next) {
+		if (!ft->seen)
+			feed_tag_remove(feed, ft);
+		else
+			ft->seen = 0;
+	}
+
+	/*
+	 * Deleting a tag does not add an entry, but must still change the
+	 * modification time of the feed.
+	 */
+	ft = TAILQ_FIRST(&feed->journal);
+	feed->mtime = refs_mtime;
+	if (ft && ft->time > feed->mtime)
+		feed->mtime = ft->time;
+
+	memcpy(feed->stamp, stamp, sizeof(feed->stamp));
+	feed->valid = 1;
+done:
+	if (error) {
+		RB_FOREACH(ft, feed_tags, &feed->tags)
+			ft->seen = 0;
+	}
+	got_ref_list_free(&refs);
+	free(id);
+	return error;
+}
+
+static const struct got_error *
+feed_get(struct repo_feed **feed, const char *path)
+{
+	const struct got_error *error = NULL;
+	struct repo_feed key;
+	int errcode;
+
+	errcode = pthread_mutex_lock(&feeds_mutex);
+	if (errcode)
+		return got_error_set_errno(errcode, "pthread_mutex_lock");
+
+	key.path = (char *)path;
+	*feed = RB_FIND(repo_feeds, &feeds, &key);
+	if (*feed == NULL) {
+		*feed = calloc(1, sizeof(**feed));
+		if (*feed == NULL) {
+			error = got_error_from_errno("calloc");
+			goto done;
+		}
+		(*feed)->path = strdup(path);
+		if ((*feed)->path == NULL) {
+			error = got_error_from_errno("strdup");
+			free(*feed);
+			*feed = NULL;
+			goto done;
+		}
+		errcode = pthread_mutex_init(&(*feed)->mutex, NULL);
+		if (errcode) {
+			error = got_error_set_errno(errcode,
+			    "pthread_mutex_init");
+			free((*feed)->path);
+			free(*feed);
+			*feed = NULL;
+			goto done;
+		}
+		RB_INIT(&(*feed)->tags);
+		TAILQ_INIT(&(*feed)->journal);
+		RB_INSERT(repo_feeds, &feeds, *feed);
+	}
+done:
+	errcode = pthread_mutex_unlock(&feeds_mutex);
+	if (errcode && error == NULL)
+		error = got_error_set_errno(errcode, "pthread_mutex_unlock");
+	return error;
+}
+
+static const struct got_error *
+feed_copy_tag(struct repo_tag **new, struct feed_tag *ft)
+{
+	struct repo_tag *rt;
+
+	*new = NULL;
+
+	rt = calloc(1, sizeof(*rt));
+	if (rt == NULL)
+		return got_error_from_errno("calloc");
+
+	rt->tag_name = strdup(ft->name);
+	rt->commit_id = strdup(ft->commit_id);
+	rt->tagger = strdup(ft->tagger);
+	rt->tag_commit = strdup(ft->message);
+	if (rt->tag_name == NULL || rt->commit_id == NULL ||
+	    rt->tagger == NULL || rt->tag_commit == NULL) {
+		gotweb_free_repo_tag(rt);
+		return got_error_from_errno("strdup");
+	}
+	rt->tagger_time = ft->time;
+
+	*new = rt;
+	return NULL;
+}
+
+/*
+ * Add the newest tags of the repository of the request to its transport,
+ * after updating the journal if the stamp of the tag references differs
+ * from the one the journal was built from. Also sets the modification
+ * time of the request to that of the feed.
+ */
+const struct got_error *
+feed_get_tags(struct request *c, const uint8_t *stamp, time_t refs_mtime,
+    int limit)
+{
+	const struct got_error *error = NULL;
+	struct transport *t = c->t;
+	struct repo_feed *feed;
+	struct feed_tag *ft;
+	struct repo_tag *rt;
+	int errcode;
+
+	error = feed_get(&feed, t->repo_dir->path);
+	if (error)
+		return error;
+
+	errcode = pthread_mutex_lock(&feed->mutex);
+	if (errcode)
+		return got_error_set_errno(errcode, "pthread_mutex_lock");
+
+	if (!feed->valid ||
+	    memcmp(feed->stamp, stamp, sizeof(feed->stamp)) != 0) {
+		error = feed_update(feed, t->repo, stamp, refs_mtime);
+		if (error)
+			goto done;
+	}
+
+	c->last_modified = feed->mtime;
+
+	TAILQ_FOREACH(ft, &feed->journal, entry) {
+		if (limit-- <= 0)
+			break;
+		error = feed_copy_tag(&rt, ft);
+		if (error)
+			goto done;
+		TAILQ_INSERT_TAIL(&t->repo_tags, rt, entry);
+		t->tag_count++;
+	}
+done:
+	errcode = pthread_mutex_unlock(&feed->mutex);
+	if (errcode && error == NULL)
+		error = got_error_set_errno(errcode, "pthread_mutex_unlock");
+	return error;
+}
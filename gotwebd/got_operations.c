@@ -19,8 +19,10 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 
+#include <errno.h>
 #include <event.h>
 #include <imsg.h>
+#include <pthread.h>
 #include <sha1.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -311,6 +313,127 @@ got_get_repo_commit(struct request *c, struct repo_commit *repo_commit,
 	return error;
 }
 
+/*
+ * Commit graph iterations which stopped at the end of a page of commits,
+ * kept so the next page can continue where the previous page ended
+ * instead of traversing history all over again.
+ */
+struct commit_cursor {
+	TAILQ_ENTRY(commit_cursor)	 entry;
+	char				*repo_path;
+	char				*path;
+	struct got_object_id		 id;	/* first commit of next page */
+	struct got_commit_graph		*graph;
+};
+TAILQ_HEAD(commit_cursors, commit_cursor);
+
+static struct commit_cursors commit_cursors =
+    TAILQ_HEAD_INITIALIZER(commit_cursors);
+static int ncommit_cursors;
+
+/* Cursors are shared by the worker threads of a socket process. */
+static pthread_mutex_t commit_cursors_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+free_commit_cursor(struct commit_cursor *cc)
+{
+	if (cc->graph)
+		got_commit_graph_close(cc->graph);
+	free(cc->repo_path);
+	free(cc->path);
+	free(cc);
+}
+
+static struct got_commit_graph *
+take_commit_cursor(const char *repo_path, const char *path,
+    struct got_object_id *id)
+{
+	struct commit_cursor *cc;
+	struct got_commit_graph *graph = NULL;
+
+	if (pthread_mutex_lock(&commit_cursors_mutex) != 0)
+		return NULL;
+
+	TAILQ_FOREACH(cc, &commit_cursors, entry) {
+		if (got_object_id_cmp(&cc->id, id) != 0 ||
+		    strcmp(cc->path, path) != 0 ||
+		    strcmp(cc->repo_path, repo_path) != 0)
+			continue;
+
+		TAILQ_REMOVE(&commit_cursors, cc, entry);
+		ncommit_cursors--;
+		graph = cc->graph;
+		cc->graph = NULL;
+		free_commit_cursor(cc);
+		break;
+	}
+
+	pthread_mutex_unlock(&commit_cursors_mutex);
+	return graph;
+}
+
+static const struct got_error *
+save_commit_cursor(const char *repo_path, const char *path,
+    struct got_object_id *id, struct got_commit_graph *graph)
+{
+	const struct got_error *error;
+	struct commit_cursor *cc;
+	int errcode;
+
+	cc = calloc(1, sizeof(*cc));
+	if (cc == NULL)
+		return got_error_from_errno("calloc");
+
+	cc->repo_path = strdup(repo_path);
+	if (cc->repo_path == NULL) {
+		error = got_error_from_errno("strdup");
+		free_commit_cursor(cc);
+		return error;
+	}
+
+	cc->path = strdup(path);
+	if (cc->path == NULL) {
+		error = got_error_from_errno("strdup");
+		free_commit_cursor(cc);
+		return error;
+	}
+
+	memcpy(&cc->id, id, sizeof(cc->id));
+
+	errcode = pthread_mutex_lock(&commit_cursors_mutex);
+	if (errcode) {
+		free_commit_cursor(cc);
+		return got_error_set_errno(errcode, "pthread_mutex_lock");
+	}
+
+	cc->graph = graph;
+	TAILQ_INSERT_HEAD(&commit_cursors, cc, entry);
+	ncommit_cursors++;
+
+	if (ncommit_cursors > GOTWEBD_MAXCURSORS) {
+		cc = TAILQ_LAST(&commit_cursors, commit_cursors);
+		TAILQ_REMOVE(&commit_cursors, cc, entry);
+		ncommit_cursors--;
+		free_commit_cursor(cc);
+	}
+
+	errcode = pthread_mutex_unlock(&commit_cursors_mutex);
+	if (errcode)
+		return got_error_set_errno(errcode, "pthread_mutex_unlock");
+	return NULL;
+}
+
+/* Give up on requests whose client went away or timed out. */
+static const struct got_error *
+check_cancelled(void *arg)
+{
+	struct request *c = arg;
+
+	if (c->client_status == CLIENT_DISCONNECT || c->sock->shutdown)
+		return got_error(GOT_ERR_CANCELLED);
+	return NULL;
+}
+
 const struct got_error *
 got_get_repo_commits(struct request *c, int limit)
 {
@@ -327,7 +450,8 @@ got_get_repo_commits(struct request *c, int limit)
 	struct querystring *qs = t->qs;
 	struct repo_dir *repo_dir = t->repo_dir;
 	char *in_repo_path = NULL, *repo_path = NULL, *file_path = NULL;
-	int chk_next = 0, chk_multi = 0;
+	const char *graph_path;
+	int chk_next = 0, chk_multi = 0, resume = 0;
 
 	TAILQ_INIT(&refs);
 
@@ -365,29 +489,40 @@ got_get_repo_commits(struct request *c, int limit)
 	if (error)
 		goto done;
 
-	if (qs->file != NULL && strlen(qs->file) > 0) {
-		error = got_commit_graph_open(&graph, file_path, 0);
+	if (file_path != NULL)
+		graph_path = file_path;
+	else
+		graph_path = in_repo_path;
+
+	graph = take_commit_cursor(repo_path, graph_path, id);
+	if (graph) {
+		/* The graph has already returned the first commit. */
+		resume = 1;
+	} else {
+		error = got_commit_graph_open(&graph, graph_path, 0);
 		if (error)
 			goto done;
-	} else {
-		error = got_commit_graph_open(&graph, in_repo_path, 0);
+
+		error = got_commit_graph_iter_start(graph, id, repo,
+		    check_cancelled, c);
 		if (error)
 			goto done;
 	}
 
-	error = got_commit_graph_iter_start(graph, id, repo, NULL, NULL);
-	if (error)
-		goto done;
-
 	for (;;) {
 		struct got_object_id next_id;
 
-		error = got_commit_graph_iter_next(&next_id, graph, repo, NULL,
-		    NULL);
-		if (error) {
-			if (error->code == GOT_ERR_ITER_COMPLETED)
-				error = NULL;
-			goto done;
+		if (resume) {
+			memcpy(&next_id, id, sizeof(next_id));
+			resume = 0;
+		} else {
+			error = got_commit_graph_iter_next(&next_id, graph,
+			    repo, check_cancelled, c);
+			if (error) {
+				if (error->code == GOT_ERR_ITER_COMPLETED)
+					error = NULL;
+				goto done;
+			}
 		}
 
 		error = got_object_open_as_commit(&commit, repo, &next_id);
@@ -428,6 +563,20 @@ got_get_repo_commits(struct request *c, int limit)
 				TAILQ_REMOVE(&t->repo_commits, repo_commit,
 				    entry);
 				gotweb_free_repo_commit(repo_commit);
+
+				/*
+				 * Let the next page continue from here, unless
+				 * this iteration could return commits which
+				 * are not ancestors of the next page's first
+				 * commit.
+				 */
+				if (got_commit_graph_iter_is_linear(graph)) {
+					error = save_commit_cursor(repo_path,
+					    graph_path, &next_id, graph);
+					if (error)
+						goto done;
+					graph = NULL;
+				}
 				goto done;
 			}
 		}
@@ -484,7 +633,7 @@ got_get_repo_tags(struct request *c, int limit)
 	    repo_dir->name) == -1)
 		return got_error_from_errno("asprintf");
 
-	if (qs->commit == NULL && (qs->action == TAGS || qs->action == RSS)) {
+	if (qs->commit == NULL && qs->action == TAGS) {
 		error = got_ref_open(&ref, repo, qs->headref, 0);
 		if (error)
 			goto err;
@@ -1106,8 +1255,8 @@ got_output_file_blame(struct request *c, got_render_blame_line_cb cb)
 		goto done;
 
 	error = got_blame(in_repo_path, commit_id, repo,
-	    GOT_DIFF_ALGORITHM_MYERS, got_gotweb_blame_cb, &bca, NULL, NULL,
-	    fd3, fd4, f1, f2);
+	    c->srv->diff_algo, got_gotweb_blame_cb, &bca,
+	    check_cancelled, c, fd3, fd4, f1, f2);
 
 done:
 	if (bca.lines) {
@@ -1155,8 +1304,80 @@ done:
 	return error;
 }
 
-const struct got_error *
-got_open_diff_for_output(FILE **fp, int *fd, struct request *c)
+struct diff_output_arg {
+	struct template		*tp;
+	int			(*cb)(struct template *, char *);
+	char			*line;
+	size_t			 linelen;
+	size_t			 linesize;
+	size_t			 outlen;
+	int			 truncated;
+	int			 failed;
+};
+
+/*
+ * Write callback of the stream passed to the diff library as its output
+ * file. Complete lines are handed to the template as soon as they become
+ * available. Once GOTWEBD_MAXDIFFSZ bytes of diff have been rendered any
+ * further output is discarded; the diff still runs to completion so that
+ * a diffstat can be shown instead.
+ */
+static int
+diff_output_write(void *arg, const char *buf, int len)
+{
+	struct diff_output_arg *a = arg;
+	const char *nl;
+	char *p;
+	size_t n, size, remain = len;
+
+	if (a->failed) {
+		errno = EIO;
+		return -1;
+	}
+
+	while (remain > 0 && !a->truncated) {
+		nl = memchr(buf, '\n', remain);
+		n = nl ? nl - buf + 1 : remain;
+
+		if (a->outlen + a->linelen + n > GOTWEBD_MAXDIFFSZ) {
+			a->truncated = 1;
+			break;
+		}
+
+		if (a->linelen + n + 1 > a->linesize) {
+			size = a->linesize ? a->linesize : 128;
+			while (size < a->linelen + n + 1)
+				size *= 2;
+			p = realloc(a->line, size);
+			if (p == NULL)
+				return -1;
+			a->line = p;
+			a->linesize = size;
+		}
+		memcpy(a->line + a->linelen, buf, n);
+		a->linelen += n;
+		a->line[a->linelen] = '\0';
+
+		if (nl) {
+			a->outlen += a->linelen;
+			a->linelen = 0;
+			if (a->cb(a->tp, a->line) == -1) {
+				a->failed = 1;
+				errno = EIO;
+				return -1;
+			}
+		}
+
+		buf += n;
+		remain -= n;
+	}
+
+	return len;
+}
+
+int
+got_output_diff(struct request *c, int (*line_cb)(struct template *, char *),
+    int (*stat_cb)(struct template *, struct got_diffstat_cb_arg *))
 {
 	const struct got_error *error = NULL;
 	struct transport *t = c->t;
@@ -1164,25 +1385,36 @@ got_open_diff_for_output(FILE **fp, int *fd, struct request *c)
 	struct repo_commit *rc = NULL;
 	struct got_object_id *id1 = NULL, *id2 = NULL;
 	struct got_reflist_head refs;
-	FILE *f1 = NULL, *f2 = NULL, *f3 = NULL;
-	int obj_type, fd1, fd2, fd3, fd4 = -1, fd5 = -1;
-
-	*fp = NULL;
-	*fd = -1;
+	struct got_pathlist_head paths;
+	struct got_diffstat_cb_arg dsa;
+	struct diff_output_arg a;
+	FILE *f1 = NULL, *f2 = NULL, *outfile = NULL;
+	int obj_type, fd1, fd2, fd4 = -1, fd5 = -1;
 
 	TAILQ_INIT(&refs);
+	TAILQ_INIT(&paths);
+
+	memset(&dsa, 0, sizeof(dsa));
+	dsa.paths = &paths;
+	dsa.diff_algo = c->srv->diff_algo;
+
+	memset(&a, 0, sizeof(a));
+	a.tp = c->tp;
+	a.cb = line_cb;
 
 	error = got_gotweb_openfile(&f1, &c->priv_fd[DIFF_FD_1], &fd1);
 	if (error)
-		return error;
+		goto done;
 
 	error = got_gotweb_openfile(&f2, &c->priv_fd[DIFF_FD_2], &fd2);
 	if (error)
-		return error;
+		goto done;
 
-	error = got_gotweb_openfile(&f3, &c->priv_fd[DIFF_FD_3], &fd3);
-	if (error)
-		return error;
+	outfile = funopen(&a, NULL, diff_output_write, NULL, NULL);
+	if (outfile == NULL) {
+		error = got_error_from_errno("funopen");
+		goto done;
+	}
 
 	rc = TAILQ_FIRST(&t->repo_commits);
 
@@ -1215,18 +1447,18 @@ got_open_diff_for_output(FILE **fp, int *fd, struct request *c)
 	switch (obj_type) {
 	case GOT_OBJ_TYPE_BLOB:
 		error = got_diff_objects_as_blobs(NULL, NULL, f1, f2, fd4, fd5,
-		     id1, id2, NULL, NULL, GOT_DIFF_ALGORITHM_MYERS, 3, 0, 0,
-		     NULL, repo, f3);
+		     id1, id2, NULL, NULL, c->srv->diff_algo, 3, 0, 0,
+		     &dsa, repo, outfile);
 		break;
 	case GOT_OBJ_TYPE_TREE:
 		error = got_diff_objects_as_trees(NULL, NULL, f1, f2, fd4, fd5,
-		    id1, id2, NULL, "", "",  GOT_DIFF_ALGORITHM_MYERS, 3, 0, 0,
-		    NULL, repo, f3);
+		    id1, id2, NULL, "", "", c->srv->diff_algo, 3, 0, 0,
+		    &dsa, NULL, NULL, NULL, NULL, repo, outfile);
 		break;
 	case GOT_OBJ_TYPE_COMMIT:
 		error = got_diff_objects_as_commits(NULL, NULL, f1, f2, fd4,
-		    fd5, id1, id2, NULL,  GOT_DIFF_ALGORITHM_MYERS, 3, 0, 0,
-		    NULL, repo, f3);
+		    fd5, id1, id2, NULL, c->srv->diff_algo, 3, 0, 0,
+		    &dsa, NULL, NULL, NULL, NULL, repo, outfile);
 		break;
 	default:
 		error = got_error(GOT_ERR_OBJ_TYPE);
@@ -1234,25 +1466,28 @@ got_open_diff_for_output(FILE **fp, int *fd, struct request *c)
 	if (error)
 		goto done;
 
-	if (fseek(f1, 0, SEEK_SET) == -1) {
-		error = got_ferror(f1, GOT_ERR_IO);
+	if (fflush(outfile) == EOF) {
+		error = got_ferror(outfile, GOT_ERR_IO);
 		goto done;
 	}
 
-	if (fseek(f2, 0, SEEK_SET) == -1) {
-		error = got_ferror(f2, GOT_ERR_IO);
-		goto done;
-	}
-
-	if (fseek(f3, 0, SEEK_SET) == -1) {
-		error = got_ferror(f3, GOT_ERR_IO);
-		goto done;
+	/* The last line of a diff may lack a trailing newline. */
+	if (!a.truncated && a.linelen > 0) {
+		a.linelen = 0;
+		if (line_cb(c->tp, a.line) == -1) {
+			error = got_error(GOT_ERR_CANCELLED);
+			goto done;
+		}
 	}
 
-	*fp = f3;
-	*fd = fd3;
-
+	if (a.truncated && stat_cb(c->tp, &dsa) == -1)
+		error = got_error(GOT_ERR_CANCELLED);
 done:
+	/* Rendering failed, e.g. because the client went away. */
+	if (a.failed)
+		error = got_error(GOT_ERR_CANCELLED);
+	if (outfile && fclose(outfile) == EOF && error == NULL)
+		error = got_error_from_errno("fclose");
 	if (fd4 != -1 && close(fd4) == -1 && error == NULL)
 		error = got_error_from_errno("close");
 	if (fd5 != -1 && close(fd5) == -1 && error == NULL)
@@ -1269,15 +1504,16 @@ done:
 		if (error == NULL)
 			error = f2_err;
 	}
-	if (error && f3) {
-		got_gotweb_flushfile(f3, fd3);
-		*fp = NULL;
-		*fd = -1;
-	}
+	got_pathlist_free(&paths, GOT_PATHLIST_FREE_ALL);
 	got_ref_list_free(&refs);
+	free(a.line);
 	free(id1);
 	free(id2);
-	return error;
+	if (error) {
+		log_warnx("%s: %s", __func__, error->msg);
+		return -1;
+	}
+	return 0;
 }
 
 static const struct got_error *
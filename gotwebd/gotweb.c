@@ -30,10 +30,12 @@
 #include <event.h>
 #include <fcntl.h>
 #include <imsg.h>
+#include <pthread.h>
 #include <sha1.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "got_error.h"
@@ -47,6 +49,7 @@
 #include "got_commit_graph.h"
 #include "got_blame.h"
 #include "got_privsep.h"
+#include "got_version.h"
 
 #include "proc.h"
 #include "gotwebd.h"
@@ -89,6 +92,12 @@ static const struct got_error *gotweb_init_repo_dir(struct repo_dir **,
     const char *);
 static const struct got_error *gotweb_load_got_path(struct request *c,
     struct repo_dir *);
+static const struct got_error *gotweb_load_repo_summary(struct request *c,
+    struct repo_dir *);
+static const struct got_error *gotweb_save_repo_summary(struct server *,
+    struct repo_dir *, uint8_t *);
+static const struct got_error *gotweb_get_feed_stamp(uint8_t *, time_t *,
+    struct repo_dir *);
 static const struct got_error *gotweb_get_repo_description(char **,
     struct server *, const char *, int);
 static const struct got_error *gotweb_get_clone_url(char **, struct server *,
@@ -104,10 +113,26 @@ gotweb_reply(struct request *c, int status, const char *ctype,
     struct gotweb_url *location)
 {
 	const char	*csp;
+	struct tm	 tm;
+	char		 datebuf[64];
 
 	if (status != 200 && fcgi_printf(c, "Status: %d\r\n", status) == -1)
 		return -1;
 
+	if (c->etag[0] != '\0' &&
+	    fcgi_printf(c, "ETag: %s\r\n", c->etag) == -1)
+		return -1;
+
+	if (c->last_modified != 0) {
+		if (gmtime_r(&c->last_modified, &tm) == NULL)
+			return -1;
+		if (strftime(datebuf, sizeof(datebuf),
+		    "%a, %d %b %Y %H:%M:%S GMT", &tm) == 0)
+			return -1;
+		if (fcgi_printf(c, "Last-Modified: %s\r\n", datebuf) == -1)
+			return -1;
+	}
+
 	if (location) {
 		if (fcgi_puts(c->tp, "Location: ") == -1 ||
 		    gotweb_render_url(c, location) == -1 ||
@@ -139,6 +164,103 @@ gotweb_reply_file(struct request *c, const char *ctype, const char *file,
 	return gotweb_reply(c, 200, ctype, NULL);
 }
 
+/*
+ * Pages showing a commit given by its full ID only depend on objects
+ * which cannot change, and may be served from the page cache.
+ */
+static int
+gotweb_page_is_cacheable(struct querystring *qs)
+{
+	const char *s;
+
+	if (qs->action != BLAME && qs->action != BLOB &&
+	    qs->action != DIFF && qs->action != TREE)
+		return 0;
+
+	if (qs->commit == NULL ||
+	    strlen(qs->commit) != SHA1_DIGEST_STRING_LENGTH - 1)
+		return 0;
+
+	for (s = qs->commit; *s != '\0'; s++) {
+		if (!isxdigit((unsigned char)*s))
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * The ETag of a cacheable page covers everything the page depends on
+ * besides the objects named in the querystring. Pages which also depend
+ * on mutable repository data pass a stamp of that data.
+ */
+static void
+gotweb_set_etag(struct request *c, const uint8_t *stamp)
+{
+	struct server	*srv = c->srv;
+	SHA1_CTX	 ctx;
+	char		 hex[SHA1_DIGEST_STRING_LENGTH];
+	char		 diff_algo[16];
+	const char	*s[] = {
+		GOT_VERSION_STR,
+		srv->name,
+		srv->site_name,
+		srv->site_owner,
+		srv->site_link,
+		srv->logo,
+		srv->logo_url,
+		srv->custom_css,
+		srv->show_site_owner ? "1" : "0",
+		srv->show_repo_description ? "1" : "0",
+		diff_algo,
+		c->https ? "https" : "http",
+		c->server_name,
+		c->document_uri,
+		c->querystring,
+	};
+	size_t		 i;
+
+	snprintf(diff_algo, sizeof(diff_algo), "%d", srv->diff_algo);
+
+	SHA1Init(&ctx);
+	for (i = 0; i < nitems(s); i++)
+		SHA1Update(&ctx, (const uint8_t *)s[i], strlen(s[i]) + 1);
+	if (stamp)
+		SHA1Update(&ctx, stamp, SHA1_DIGEST_LENGTH);
+	SHA1End(&ctx, hex);
+
+	snprintf(c->etag, sizeof(c->etag), "\"%s\"", hex);
+}
+
+/*
+ * Check whether the client's copy of a page is still valid.
+ * "If-None-Match: *" only matches once the page is known to exist.
+ */
+static int
+gotweb_not_modified(struct request *c, int exists)
+{
+	struct tm	 tm;
+	time_t		 t;
+
+	if (c->etag[0] == '\0')
+		return 0;
+
+	/* If-None-Match takes precedence over If-Modified-Since. */
+	if (c->if_none_match[0] != '\0')
+		return ((exists && strcmp(c->if_none_match, "*") == 0) ||
+		    strstr(c->if_none_match, c->etag) != NULL);
+
+	if (c->if_modified_since[0] == '\0' || c->last_modified == 0)
+		return 0;
+
+	memset(&tm, 0, sizeof(tm));
+	if (strptime(c->if_modified_since, "%a, %d %b %Y %H:%M:%S GMT",
+	    &tm) == NULL)
+		return 0;
+	t = timegm(&tm);
+	return (t != -1 && c->last_modified <= t);
+}
+
 void
 gotweb_process_request(struct request *c)
 {
@@ -148,9 +270,11 @@ gotweb_process_request(struct request *c)
 	struct querystring *qs = NULL;
 	struct repo_dir *repo_dir = NULL;
 	struct got_reflist_head refs;
-	FILE *fp = NULL;
+	uint8_t *page = NULL;
+	size_t pagelen;
+	struct repo_commit *rc;
 	uint8_t err[] = "gotwebd experienced an error: ";
-	int r, html = 0, fd = -1;
+	int r, html = 0, fd = -1, page_complete = 0, cached;
 
 	TAILQ_INIT(&refs);
 
@@ -161,7 +285,7 @@ gotweb_process_request(struct request *c)
 		return;
 	}
 	/* don't process any further if client disconnected */
-	if (c->sock->client_status == CLIENT_DISCONNECT)
+	if (c->client_status == CLIENT_DISCONNECT)
 		return;
 	/* get the gotwebd server */
 	srv = gotweb_get_server(c->server_name, c->http_host);
@@ -207,6 +331,39 @@ gotweb_process_request(struct request *c)
 			goto err;
 	}
 
+	if (gotweb_page_is_cacheable(qs)) {
+		gotweb_set_etag(c, NULL);
+		cached = cache_lookup(c->etag, &c->last_modified);
+		if (gotweb_not_modified(c, cached)) {
+			gotweb_reply(c, 304, NULL, NULL);
+			goto done;
+		}
+		if (cached && (page = cache_get(c->etag, &pagelen)) != NULL) {
+			if (gotweb_reply(c, 200, "text/html", NULL) == -1)
+				goto done;
+			fcgi_gen_binary_response(c, page, pagelen);
+			goto done;
+		}
+	}
+
+	if (qs->action == BLAME || qs->action == BLOB ||
+	    qs->action == DIFF || qs->action == TREE) {
+		error2 = got_get_repo_commits(c, 1);
+		if (error2) {
+			log_warnx("%s: %s", __func__, error2->msg);
+			goto render;
+		}
+
+		rc = TAILQ_FIRST(&c->t->repo_commits);
+		if (c->etag[0] != '\0' && rc != NULL) {
+			c->last_modified = rc->committer_time;
+			if (gotweb_not_modified(c, 1)) {
+				gotweb_reply(c, 304, NULL, NULL);
+				goto done;
+			}
+		}
+	}
+
 	if (qs->action == BLOBRAW) {
 		const uint8_t *buf;
 		size_t len;
@@ -254,14 +411,12 @@ gotweb_process_request(struct request *c)
 			.file = qs->file,
 		};
 
-		error = got_get_repo_commits(c, 1);
-		if (error)
-			goto done;
-
 		error2 = got_open_blob_for_output(&blob, &fd, &binary, c);
 		if (error2)
 			goto render;
 		if (binary) {
+			c->etag[0] = '\0';
+			c->last_modified = 0;
 			gotweb_reply(c, 302, NULL, &url);
 			goto done;
 		}
@@ -269,24 +424,48 @@ gotweb_process_request(struct request *c)
 
 	if (qs->action == RSS) {
 		const char *ctype = "application/rss+xml;charset=utf-8";
+		uint8_t stamp[SHA1_DIGEST_LENGTH];
+		time_t refs_mtime;
 
-		if (gotweb_reply_file(c, ctype, repo_dir->name, ".rss") == -1)
+		error = gotweb_get_feed_stamp(stamp, &refs_mtime, repo_dir);
+		if (error) {
+			log_warnx("%s: %s", __func__, error->msg);
+			goto err;
+		}
+
+		/* Feed readers poll; avoid even looking at the journal. */
+		gotweb_set_etag(c, stamp);
+		if (gotweb_not_modified(c, 0)) {
+			gotweb_reply(c, 304, NULL, NULL);
 			goto done;
+		}
 
-		error = got_get_repo_tags(c, D_MAXSLCOMMDISP);
+		error = feed_get_tags(c, stamp, refs_mtime, D_MAXSLCOMMDISP);
 		if (error) {
 			log_warnx("%s: %s", __func__, error->msg);
 			goto err;
 		}
+		if (gotweb_not_modified(c, 1)) {
+			gotweb_reply(c, 304, NULL, NULL);
+			goto done;
+		}
+
+		if (gotweb_reply_file(c, ctype, repo_dir->name, ".rss") == -1)
+			goto done;
 		if (gotweb_render_rss(c->tp) == -1)
 			goto err;
 		goto done;
 	}
 
 render:
+	if (error2) {
+		c->etag[0] = '\0';
+		c->last_modified = 0;
+	}
 	if (gotweb_reply(c, 200, "text/html", NULL) == -1)
 		goto done;
 	html = 1;
+	cache_capture_start(c);
 
 	if (gotweb_render_header(c->tp) == -1)
 		goto err;
@@ -298,11 +477,6 @@ render:
 
 	switch(qs->action) {
 	case BLAME:
-		error = got_get_repo_commits(c, 1);
-		if (error) {
-			log_warnx("%s: %s", __func__, error->msg);
-			goto err;
-		}
 		if (gotweb_render_blame(c->tp) == -1)
 			goto done;
 		break;
@@ -324,17 +498,7 @@ render:
 			goto err;
 		break;
 	case DIFF:
-		error = got_get_repo_commits(c, 1);
-		if (error) {
-			log_warnx("%s: %s", __func__, error->msg);
-			goto err;
-		}
-		error = got_open_diff_for_output(&fp, &fd, c);
-		if (error) {
-			log_warnx("%s: %s", __func__, error->msg);
-			goto err;
-		}
-		if (gotweb_render_diff(c->tp, fp) == -1)
+		if (gotweb_render_diff(c->tp) == -1)
 			goto err;
 		break;
 	case INDEX:
@@ -387,11 +551,6 @@ render:
 			goto done;
 		break;
 	case TREE:
-		error = got_get_repo_commits(c, 1);
-		if (error) {
-			log_warnx("%s: %s", __func__, error->msg);
-			goto err;
-		}
 		if (gotweb_render_tree(c->tp) == -1)
 			goto err;
 		break;
@@ -404,8 +563,10 @@ render:
 		break;
 	}
 
+	page_complete = 1;
 	goto done;
 err:
+	cache_capture_abort(c);
 	if (html && fcgi_printf(c, "<div id='err_content'>") == -1)
 		return;
 	if (fcgi_printf(c, "\n%s", err) == -1)
@@ -420,19 +581,15 @@ err:
 	if (html && fcgi_printf(c, "</div>\n") == -1)
 		return;
 done:
+	free(page);
 	if (blob)
 		got_object_blob_close(blob);
-	if (fp) {
-		error = got_gotweb_flushfile(fp, fd);
-		if (error)
-			log_warnx("%s: got_gotweb_flushfile failure: %s",
-			    __func__, error->msg);
-		fd = -1;
-	}
 	if (fd != -1)
 		close(fd);
-	if (html && srv != NULL)
-		gotweb_render_footer(c->tp);
+	if (html && srv != NULL &&
+	    gotweb_render_footer(c->tp) != -1 && page_complete)
+		cache_store(c);
+	cache_capture_abort(c);
 
 	got_ref_list_free(&refs);
 }
@@ -906,7 +1063,7 @@ gotweb_render_index(struct request *c)
 		if (error)
 			goto done;
 
-		error = gotweb_load_got_path(c, repo_dir);
+		error = gotweb_load_repo_summary(c, repo_dir);
 		if (error && error->code == GOT_ERR_NOT_GIT_REPO) {
 			error = NULL;
 			gotweb_free_repo_dir(repo_dir);
@@ -1165,47 +1322,47 @@ gotweb_render_absolute_url(struct request *c, struct gotweb_url *url)
 }
 
 static struct got_repository *
-find_cached_repo(struct server *srv, const char *path)
+find_cached_repo(struct worker *w, const char *path)
 {
 	int i;
 
-	for (i = 0; i < srv->ncached_repos; i++) {
-		if (strcmp(srv->cached_repos[i].path, path) == 0)
-			return srv->cached_repos[i].repo;
+	for (i = 0; i < w->ncached_repos; i++) {
+		if (strcmp(w->cached_repos[i].path, path) == 0)
+			return w->cached_repos[i].repo;
 	}
 
 	return NULL;
 }
 
 static const struct got_error *
-cache_repo(struct got_repository **new, struct server *srv,
-    struct repo_dir *repo_dir, struct socket *sock)
+cache_repo(struct got_repository **new, struct worker *w,
+    struct repo_dir *repo_dir)
 {
 	const struct got_error *error = NULL;
 	struct got_repository *repo;
 	struct cached_repo *cr;
 	int evicted = 0;
 
-	if (srv->ncached_repos >= GOTWEBD_REPO_CACHESIZE) {
-		cr = &srv->cached_repos[srv->ncached_repos - 1];
+	if (w->ncached_repos >= GOTWEBD_REPO_CACHESIZE) {
+		cr = &w->cached_repos[w->ncached_repos - 1];
 		error = got_repo_close(cr->repo);
 		memset(cr, 0, sizeof(*cr));
-		srv->ncached_repos--;
+		w->ncached_repos--;
 		if (error)
 			return error;
-		memmove(&srv->cached_repos[1], &srv->cached_repos[0],
-		    srv->ncached_repos * sizeof(srv->cached_repos[0]));
-		cr = &srv->cached_repos[0];
+		memmove(&w->cached_repos[1], &w->cached_repos[0],
+		    w->ncached_repos * sizeof(w->cached_repos[0]));
+		cr = &w->cached_repos[0];
 		evicted = 1;
 	} else {
-		cr = &srv->cached_repos[srv->ncached_repos];
+		cr = &w->cached_repos[w->ncached_repos];
 	}
 
-	error = got_repo_open(&repo, repo_dir->path, NULL, sock->pack_fds);
+	error = got_repo_open(&repo, repo_dir->path, NULL, w->pack_fds);
 	if (error) {
 		if (evicted) {
-			memmove(&srv->cached_repos[0], &srv->cached_repos[1],
-			    srv->ncached_repos * sizeof(srv->cached_repos[0]));
+			memmove(&w->cached_repos[0], &w->cached_repos[1],
+			    w->ncached_repos * sizeof(w->cached_repos[0]));
 		}
 		return error;
 	}
@@ -1213,39 +1370,35 @@ cache_repo(struct got_repository **new, struct server *srv,
 	if (strlcpy(cr->path, repo_dir->path, sizeof(cr->path))
 	    >= sizeof(cr->path)) {
 		if (evicted) {
-			memmove(&srv->cached_repos[0], &srv->cached_repos[1],
-			    srv->ncached_repos * sizeof(srv->cached_repos[0]));
+			memmove(&w->cached_repos[0], &w->cached_repos[1],
+			    w->ncached_repos * sizeof(w->cached_repos[0]));
 		}
 		return got_error(GOT_ERR_NO_SPACE);
 	}
 
 	cr->repo = repo;
-	srv->ncached_repos++;
+	w->ncached_repos++;
 	*new = repo;
 	return NULL;
 }
 
 static const struct got_error *
-gotweb_load_got_path(struct request *c, struct repo_dir *repo_dir)
+gotweb_open_repo_dir(DIR **dt, struct server *srv, struct repo_dir *repo_dir)
 {
 	const struct got_error *error = NULL;
-	struct socket *sock = c->sock;
-	struct server *srv = c->srv;
-	struct transport *t = c->t;
-	struct got_repository *repo = NULL;
-	DIR *dt;
 	char *dir_test;
 
+	*dt = NULL;
+
 	if (asprintf(&dir_test, "%s/%s/%s", srv->repos_path, repo_dir->name,
 	    GOTWEB_GIT_DIR) == -1)
 		return got_error_from_errno("asprintf");
 
-	dt = opendir(dir_test);
-	if (dt == NULL) {
+	*dt = opendir(dir_test);
+	if (*dt == NULL) {
 		free(dir_test);
 	} else {
 		repo_dir->path = dir_test;
-		dir_test = NULL;
 		goto done;
 	}
 
@@ -1253,48 +1406,346 @@ gotweb_load_got_path(struct request *c, struct repo_dir *repo_dir)
 	    repo_dir->name) == -1)
 		return got_error_from_errno("asprintf");
 
-	dt = opendir(dir_test);
-	if (dt == NULL) {
-		error = got_error_path(repo_dir->name, GOT_ERR_NOT_GIT_REPO);
-		goto err;
-	} else {
-		repo_dir->path = dir_test;
-		dir_test = NULL;
+	*dt = opendir(dir_test);
+	if (*dt == NULL) {
+		free(dir_test);
+		return got_error_path(repo_dir->name, GOT_ERR_NOT_GIT_REPO);
 	}
+	repo_dir->path = dir_test;
 
 done:
 	if (srv->respect_exportok &&
-	    faccessat(dirfd(dt), "git-daemon-export-ok", F_OK, 0) == -1) {
+	    faccessat(dirfd(*dt), "git-daemon-export-ok", F_OK, 0) == -1) {
 		error = got_error_path(repo_dir->name, GOT_ERR_NOT_GIT_REPO);
-		goto err;
+		closedir(*dt);
+		*dt = NULL;
 	}
+	return error;
+}
+
+static const struct got_error *
+gotweb_load_repo_info(struct request *c, struct repo_dir *repo_dir, DIR *dt)
+{
+	const struct got_error *error = NULL;
+	struct server *srv = c->srv;
+	struct transport *t = c->t;
+	struct got_repository *repo = NULL;
 
-	repo = find_cached_repo(srv, repo_dir->path);
+	repo = find_cached_repo(c->worker, repo_dir->path);
 	if (repo == NULL) {
-		error = cache_repo(&repo, srv, repo_dir, sock);
+		error = cache_repo(&repo, c->worker, repo_dir);
 		if (error)
-			goto err;
+			return error;
 	}
 	t->repo = repo;
 	error = gotweb_get_repo_description(&repo_dir->description, srv,
 	    repo_dir->path, dirfd(dt));
 	if (error)
-		goto err;
+		return error;
 	error = got_get_repo_owner(&repo_dir->owner, c);
 	if (error)
-		goto err;
+		return error;
 	error = got_get_repo_age(&repo_dir->age, c, NULL);
 	if (error)
-		goto err;
-	error = gotweb_get_clone_url(&repo_dir->url, srv, repo_dir->path,
+		return error;
+	return gotweb_get_clone_url(&repo_dir->url, srv, repo_dir->path,
 	    dirfd(dt));
-err:
-	free(dir_test);
-	if (dt != NULL && closedir(dt) == EOF && error == NULL)
+}
+
+static const struct got_error *
+gotweb_load_got_path(struct request *c, struct repo_dir *repo_dir)
+{
+	const struct got_error *error = NULL;
+	DIR *dt;
+
+	error = gotweb_open_repo_dir(&dt, c->srv, repo_dir);
+	if (error)
+		return error;
+
+	error = gotweb_load_repo_info(c, repo_dir, dt);
+	if (closedir(dt) == EOF && error == NULL)
 		error = got_error_from_errno("closedir");
 	return error;
 }
 
+struct repo_summary {
+	RB_ENTRY(repo_summary)	 entry;
+	char			*path;
+	uint8_t			 stamp[SHA1_DIGEST_LENGTH];
+	char			*owner;
+	char			*description;
+	char			*url;
+	time_t			 age;
+};
+
+static int
+repo_summary_cmp(const struct repo_summary *rs1,
+    const struct repo_summary *rs2)
+{
+	return strcmp(rs1->path, rs2->path);
+}
+
+RB_PROTOTYPE_STATIC(repo_summaries, repo_summary, entry, repo_summary_cmp);
+RB_GENERATE_STATIC(repo_summaries, repo_summary, entry, repo_summary_cmp);
+
+/* Summaries are shared by the worker threads of a socket process. */
+static pthread_mutex_t repo_summaries_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct got_error *
+gotweb_stamp_path(SHA1_CTX *ctx, time_t *mtime, int dir, const char *path)
+{
+	const struct got_error *error = NULL;
+	struct stat sb;
+	struct dirent *dent;
+	DIR *d = NULL;
+	char *subpath;
+	int fd;
+
+	memset(&sb, 0, sizeof(sb));
+	if (fstatat(dir, path, &sb, AT_SYMLINK_NOFOLLOW) == -1 &&
+	    errno != ENOENT)
+		return got_error_from_errno2("fstatat", path);
+
+	SHA1Update(ctx, (const uint8_t *)path, strlen(path) + 1);
+	SHA1Update(ctx, (const uint8_t *)&sb.st_ino, sizeof(sb.st_ino));
+	SHA1Update(ctx, (const uint8_t *)&sb.st_size, sizeof(sb.st_size));
+	SHA1Update(ctx, (const uint8_t *)&sb.st_mtim.tv_sec,
+	    sizeof(sb.st_mtim.tv_sec));
+	SHA1Update(ctx, (const uint8_t *)&sb.st_mtim.tv_nsec,
+	    sizeof(sb.st_mtim.tv_nsec));
+	if (sb.st_mtim.tv_sec > *mtime)
+		*mtime = sb.st_mtim.tv_sec;
+
+	/*
+	 * Updating a ref only changes the modification time of the
+	 * directory it lives in. Descend into subdirectories, if the
+	 * link count says there are any.
+	 */
+	if (!S_ISDIR(sb.st_mode) || sb.st_nlink <= 2)
+		return NULL;
+
+	fd = openat(dir, path, O_RDONLY | O_DIRECTORY);
+	if (fd == -1)
+		return got_error_from_errno2("openat", path);
+	d = fdopendir(fd);
+	if (d == NULL) {
+		error = got_error_from_errno2("fdopendir", path);
+		close(fd);
+		return error;
+	}
+
+	while ((dent = readdir(d)) != NULL) {
+		if (strcmp(dent->d_name, ".") == 0 ||
+		    strcmp(dent->d_name, "..") == 0)
+			continue;
+		if (dent->d_type != DT_DIR && dent->d_type != DT_UNKNOWN)
+			continue;
+		if (asprintf(&subpath, "%s/%s", path, dent->d_name) == -1) {
+			error = got_error_from_errno("asprintf");
+			break;
+		}
+		error = gotweb_stamp_path(ctx, mtime, dir, subpath);
+		free(subpath);
+		if (error)
+			break;
+	}
+
+	if (closedir(d) == EOF && error == NULL)
+		error = got_error_from_errno2("closedir", path);
+	return error;
+}
+
+/*
+ * Compute a stamp from the given files of a repository, and the most
+ * recent time any of them was modified.
+ */
+static const struct got_error *
+gotweb_stamp_paths(uint8_t *stamp, time_t *mtime, int dir,
+    const char **paths, size_t npaths)
+{
+	const struct got_error *error;
+	SHA1_CTX ctx;
+	size_t i;
+
+	*mtime = 0;
+
+	SHA1Init(&ctx);
+	for (i = 0; i < npaths; i++) {
+		error = gotweb_stamp_path(&ctx, mtime, dir, paths[i]);
+		if (error)
+			return error;
+	}
+	SHA1Final(stamp, &ctx);
+	return NULL;
+}
+
+/*
+ * Compute a stamp from the files which the index page data of a
+ * repository is derived from. Any change to branches, the description,
+ * the clone URL, or the owner changes the stamp. Repositories which
+ * store refs in a reftable replace tables.list on every ref update.
+ */
+static const struct got_error *
+gotweb_get_repo_stamp(uint8_t *stamp, int dir)
+{
+	const char *paths[] = {
+		"packed-refs",
+		"refs/heads",
+		"reftable/tables.list",
+		"config",
+		"description",
+		"cloneurl",
+	};
+	time_t mtime;
+
+	return gotweb_stamp_paths(stamp, &mtime, dir, paths, nitems(paths));
+}
+
+/*
+ * Compute a stamp from the files which the RSS feed of a repository is
+ * derived from: its tags and its description.
+ */
+static const struct got_error *
+gotweb_get_feed_stamp(uint8_t *stamp, time_t *mtime,
+    struct repo_dir *repo_dir)
+{
+	const struct got_error *error;
+	const char *paths[] = {
+		"packed-refs",
+		"refs/tags",
+		"reftable/tables.list",
+		"description",
+	};
+	DIR *dt;
+
+	dt = opendir(repo_dir->path);
+	if (dt == NULL)
+		return got_error_from_errno2("opendir", repo_dir->path);
+
+	error = gotweb_stamp_paths(stamp, mtime, dirfd(dt), paths,
+	    nitems(paths));
+	if (closedir(dt) == EOF && error == NULL)
+		error = got_error_from_errno("closedir");
+	return error;
+}
+
+static const struct got_error *
+dup_str(char **dst, const char *src)
+{
+	free(*dst);
+	*dst = NULL;
+	if (src == NULL)
+		return NULL;
+	*dst = strdup(src);
+	if (*dst == NULL)
+		return got_error_from_errno("strdup");
+	return NULL;
+}
+
+/*
+ * Like gotweb_load_got_path() but serve data from the summary snapshot
+ * of the repository if it is still valid, without opening the repository.
+ */
+static const struct got_error *
+gotweb_load_repo_summary(struct request *c, struct repo_dir *repo_dir)
+{
+	const struct got_error *error = NULL;
+	struct server *srv = c->srv;
+	struct repo_summary key, *rs;
+	uint8_t stamp[SHA1_DIGEST_LENGTH];
+	DIR *dt;
+	int errcode, found = 0;
+
+	error = gotweb_open_repo_dir(&dt, srv, repo_dir);
+	if (error)
+		return error;
+
+	error = gotweb_get_repo_stamp(stamp, dirfd(dt));
+	if (error)
+		goto done;
+
+	errcode = pthread_mutex_lock(&repo_summaries_mutex);
+	if (errcode) {
+		error = got_error_set_errno(errcode, "pthread_mutex_lock");
+		goto done;
+	}
+	key.path = repo_dir->path;
+	rs = RB_FIND(repo_summaries, &srv->repo_summaries, &key);
+	if (rs && memcmp(rs->stamp, stamp, sizeof(stamp)) == 0) {
+		found = 1;
+		repo_dir->age = rs->age;
+		error = dup_str(&repo_dir->owner, rs->owner);
+		if (error == NULL)
+			error = dup_str(&repo_dir->description,
+			    rs->description);
+		if (error == NULL)
+			error = dup_str(&repo_dir->url, rs->url);
+	}
+	errcode = pthread_mutex_unlock(&repo_summaries_mutex);
+	if (errcode && error == NULL)
+		error = got_error_set_errno(errcode, "pthread_mutex_unlock");
+	if (error || found)
+		goto done;
+
+	/* Workers may load the same repository concurrently; last one wins. */
+	error = gotweb_load_repo_info(c, repo_dir, dt);
+	if (error)
+		goto done;
+
+	errcode = pthread_mutex_lock(&repo_summaries_mutex);
+	if (errcode) {
+		error = got_error_set_errno(errcode, "pthread_mutex_lock");
+		goto done;
+	}
+	error = gotweb_save_repo_summary(srv, repo_dir, stamp);
+	errcode = pthread_mutex_unlock(&repo_summaries_mutex);
+	if (errcode && error == NULL)
+		error = got_error_set_errno(errcode, "pthread_mutex_unlock");
+done:
+	if (closedir(dt) == EOF && error == NULL)
+		error = got_error_from_errno("closedir");
+	return error;
+}
+
+/* Must be called with repo_summaries_mutex held. */
+static const struct got_error *
+gotweb_save_repo_summary(struct server *srv, struct repo_dir *repo_dir,
+    uint8_t *stamp)
+{
+	const struct got_error *error;
+	struct repo_summary key, *rs;
+
+	key.path = repo_dir->path;
+	rs = RB_FIND(repo_summaries, &srv->repo_summaries, &key);
+	if (rs == NULL) {
+		rs = calloc(1, sizeof(*rs));
+		if (rs == NULL)
+			return got_error_from_errno("calloc");
+		rs->path = strdup(repo_dir->path);
+		if (rs->path == NULL) {
+			error = got_error_from_errno("strdup");
+			free(rs);
+			return error;
+		}
+		RB_INSERT(repo_summaries, &srv->repo_summaries, rs);
+	}
+
+	/* Invalidate the snapshot until it has been fully updated. */
+	memset(rs->stamp, 0, sizeof(rs->stamp));
+	rs->age = repo_dir->age;
+	error = dup_str(&rs->owner, repo_dir->owner);
+	if (error)
+		return error;
+	error = dup_str(&rs->description, repo_dir->description);
+	if (error)
+		return error;
+	error = dup_str(&rs->url, repo_dir->url);
+	if (error)
+		return error;
+	memcpy(rs->stamp, stamp, sizeof(rs->stamp));
+	return NULL;
+}
+
 static const struct got_error *
 gotweb_init_repo_dir(struct repo_dir **repo_dir, const char *dir)
 {
@@ -20,8 +20,10 @@
 #include <netinet/in.h>
 #include <net/if.h>
 #include <sys/queue.h>
+#include <sys/tree.h>
 
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 
 #ifdef DEBUG
@@ -41,14 +43,22 @@
 
 #define GOTWEBD_MAXDESCRSZ	 1024
 #define GOTWEBD_MAXCLONEURLSZ	 1024
-#define GOTWEBD_CACHESIZE	 1024
 #define GOTWEBD_MAXCLIENTS	 1024
 #define GOTWEBD_MAXTEXT		 511
 #define GOTWEBD_MAXNAME		 64
 #define GOTWEBD_MAXPORT		 6
 #define GOTWEBD_NUMPROC		 3
+#define GOTWEBD_NUMWORKERS	 4
 #define GOTWEBD_MAXIFACE	 16
 #define GOTWEBD_REPO_CACHESIZE	 4
+#define GOTWEBD_MAXCURSORS	 16
+#define GOTWEBD_MAXDIFFSZ	 (4 * 1024 * 1024)
+
+/* Rendered pages of immutable objects, kept in memory and spilled to disk. */
+#define GOTWEBD_PAGE_CACHE_MEMSIZE	 (8 * 1024 * 1024)
+#define GOTWEBD_PAGE_CACHE_DISKSIZE	 (64 * 1024 * 1024)
+#define GOTWEBD_PAGE_CACHE_MAXPAGE	 (1024 * 1024)
+#define GOTWEBD_ETAGSZ			 48
 
 /* GOTWEB DEFAULTS */
 #define MAX_QUERYSTRING		 2048
@@ -88,9 +98,7 @@
 #define FCGI_RECORD_SIZE	 \
     (sizeof(struct fcgi_record_header) + FCGI_CONTENT_SIZE + FCGI_PADDING_SIZE)
 
-#define FCGI_ALIGNMENT		 8
-#define FCGI_ALIGN(n)		 \
-    (((n) + (FCGI_ALIGNMENT - 1)) & ~(FCGI_ALIGNMENT - 1))
+#define FCGI_MAXRECORDS		 16	/* records per writev(2) */
 
 #define FD_RESERVE		 5
 #define FD_NEEDED		 6
@@ -119,6 +127,7 @@
 struct got_blob_object;
 struct got_tree_entry;
 struct got_reflist_head;
+struct got_diffstat_cb_arg;
 
 enum imsg_type {
 	IMSG_CFG_SRV = IMSG_PROC_MAX,
@@ -216,14 +225,25 @@ enum socket_priv_fds {
 };
 
 struct template;
+struct worker;
 struct request {
+	TAILQ_ENTRY(request)		 entry;
 	struct socket			*sock;
+	struct worker			*worker;
 	struct server			*srv;
 	struct transport		*t;
 	struct template			*tp;
 	struct event			 ev;
 	struct event			 tmo;
 
+	/* may be set to CLIENT_DISCONNECT by the main thread at any time */
+	volatile int			 client_status;
+
+	int				 processing;	/* by a worker */
+	int				 processed;
+	int				 stdin_done;
+	int				 abandoned;
+
 	uint16_t			 id;
 	int				 fd;
 	int				 priv_fd[PRIV_FDS__MAX];
@@ -232,7 +252,7 @@ struct request {
 	size_t				 buf_pos;
 	size_t				 buf_len;
 
-	uint8_t				 outbuf[GOTWEBD_CACHESIZE];
+	uint8_t				 outbuf[FCGI_CONTENT_SIZE];
 	size_t				 outbuf_len;
 
 	char				 querystring[MAX_QUERYSTRING];
@@ -240,9 +260,22 @@ struct request {
 	char				 document_uri[MAX_DOCUMENT_URI];
 	char				 server_name[MAX_SERVER_NAME];
 	int				 https;
+	char				 if_none_match[GOTWEBD_MAXTEXT];
+	char				 if_modified_since[GOTWEBD_MAXNAME];
+
+	/* validators sent with the reply, if set */
+	char				 etag[GOTWEBD_ETAGSZ];
+	time_t				 last_modified;
+
+	/* copy of the page being rendered, for the page cache */
+	int				 cache_capture;
+	uint8_t				*cache_buf;
+	size_t				 cache_len;
+	size_t				 cache_size;
 
 	uint8_t				 request_started;
 };
+TAILQ_HEAD(requestlist, request);
 
 struct fcgi_begin_request_body {
 	uint16_t	role;
@@ -271,12 +304,15 @@ struct cached_repo {
 	struct got_repository *repo;
 };
 
+/* Data shown on the index page, kept until the repository changes. */
+struct repo_summary;
+RB_HEAD(repo_summaries, repo_summary);
+
 struct server {
 	TAILQ_ENTRY(server)	 entry;
 	struct addresslist	al;
 
-	struct cached_repo	*cached_repos;
-	int		 ncached_repos;
+	struct repo_summaries	 repo_summaries;
 
 	char		 name[GOTWEBD_MAXTEXT];
 
@@ -299,6 +335,8 @@ struct server {
 	int		 show_repo_cloneurl;
 	int		 respect_exportok;
 
+	int		 diff_algo;	/* enum got_diff_algorithm */
+
 	int		 unix_socket;
 	char		 unix_socket_name[PATH_MAX];
 
@@ -323,19 +361,41 @@ struct socket_conf {
 	in_port_t	 fcgi_socket_port;
 };
 
+/*
+ * Each socket has a pool of worker threads which process requests.
+ * Workers have their own temporary files and repository handles.
+ */
+struct worker {
+	struct socket		*sock;
+	pthread_t		 thread;
+	int			 running;
+
+	int			 pack_fds[GOTWEB_PACK_NUM_TEMPFILES];
+	int			 priv_fd[PRIV_FDS__MAX];
+
+	struct cached_repo	 cached_repos[GOTWEBD_REPO_CACHESIZE];
+	int			 ncached_repos;
+};
+
 struct socket {
 	TAILQ_ENTRY(socket)	 entry;
 	struct socket_conf	 conf;
 
 	int		 fd;
-	int		 pack_fds[GOTWEB_PACK_NUM_TEMPFILES];
-	int		 priv_fd[PRIV_FDS__MAX];
 
 	struct event	 evt;
 	struct event	 ev;
 	struct event	 pause;
 
-	int		 client_status;
+	struct worker	 workers[GOTWEBD_NUMWORKERS];
+	struct requestlist requests;	/* waiting for a worker */
+	pthread_mutex_t	 mutex;
+	pthread_cond_t	 cond;
+	volatile int	 shutdown;
+
+	/* workers pass finished requests back to the main thread */
+	int		 done_pipe[2];
+	struct event	 done_ev;
 };
 TAILQ_HEAD(socketlist, socket);
 
@@ -447,6 +507,7 @@ void sockets(struct privsep *, struct privsep_proc *);
 void sockets_shutdown(void);
 void sockets_parse_sockets(struct gotwebd *);
 void sockets_socket_accept(int, short, void *);
+void sockets_queue_request(struct request *);
 int sockets_privinit(struct gotwebd *, struct socket *);
 
 /* gotweb.c */
@@ -474,7 +535,7 @@ int	gotweb_render_blob(struct template *, struct got_blob_object *);
 int	gotweb_render_tree(struct template *);
 int	gotweb_render_tags(struct template *);
 int	gotweb_render_tag(struct template *);
-int	gotweb_render_diff(struct template *, FILE *);
+int	gotweb_render_diff(struct template *);
 int	gotweb_render_branches(struct template *, struct got_reflist_head *);
 int	gotweb_render_summary(struct template *, struct got_reflist_head *);
 int	gotweb_render_blame(struct template *);
@@ -488,16 +549,29 @@ int cmdline_symset(char *);
 void fcgi_request(int, short, void *);
 void fcgi_timeout(int, short, void *);
 void fcgi_cleanup_request(struct request *);
+void fcgi_request_done(struct request *);
 void fcgi_create_end_record(struct request *);
 void dump_fcgi_record(const char *, struct fcgi_record_header *);
 int fcgi_puts(struct template *, const char *);
-int fcgi_putc(struct template *, int);
+int fcgi_write(struct template *, const char *, size_t);
 int fcgi_vprintf(struct request *, const char *, va_list);
 int fcgi_printf(struct request *, const char *, ...)
 	__attribute__((__format__(printf, 2, 3)))
 	__attribute__((__nonnull__(2)));
 int fcgi_gen_binary_response(struct request *, const uint8_t *, int);
 
+/* cache.c */
+int cache_lookup(const char *, time_t *);
+uint8_t *cache_get(const char *, size_t *);
+void cache_capture_start(struct request *);
+void cache_capture(struct request *, const uint8_t *, size_t);
+void cache_capture_abort(struct request *);
+void cache_store(struct request *);
+
+/* feed.c */
+const struct got_error *feed_get_tags(struct request *, const uint8_t *,
+    time_t, int);
+
 /* got_operations.c */
 const struct got_error *got_gotweb_flushfile(FILE *, int);
 const struct got_error *got_get_repo_owner(char **, struct request *);
@@ -506,8 +580,8 @@ const struct got_error *got_get_repo_age(time_t *, struct request *,
 const struct got_error *got_get_repo_commits(struct request *, int);
 const struct got_error *got_get_repo_tags(struct request *, int);
 const struct got_error *got_get_repo_heads(struct request *);
-const struct got_error *got_open_diff_for_output(FILE **, int *,
-    struct request *);
+int got_output_diff(struct request *, int (*)(struct template *, char *),
+    int (*)(struct template *, struct got_diffstat_cb_arg *));
 int got_output_repo_tree(struct request *,
     int (*)(struct template *, struct got_tree_entry *));
 const struct got_error *got_open_blob_for_output(struct got_blob_object **,
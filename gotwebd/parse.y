@@ -40,6 +40,7 @@
 #include <imsg.h>
 #include <limits.h>
 #include <netdb.h>
+#include <sha1.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -47,6 +48,12 @@
 #include <syslog.h>
 #include <unistd.h>
 
+#include "got_error.h"
+#include "got_object.h"
+#include "got_repository.h"
+#include "got_cancel.h"
+#include "got_diff.h"
+
 #include "proc.h"
 #include "gotwebd.h"
 #include "got_sockaddr.h"
@@ -123,6 +130,7 @@ typedef struct {
 %token	MAX_REPOS_DISPLAY REPOS_PATH MAX_COMMITS_DISPLAY ON ERROR
 %token	SHOW_SITE_OWNER SHOW_REPO_CLONEURL PORT PREFORK RESPECT_EXPORTOK
 %token	UNIX_SOCKET UNIX_SOCKET_NAME SERVER CHROOT CUSTOM_CSS SOCKET
+%token	DIFF_ALGORITHM
 
 %token	<v.string>	STRING
 %type	<v.port>	fcgiport
@@ -384,6 +392,22 @@ serveropts1	: REPOS_PATH STRING {
 		| RESPECT_EXPORTOK boolean {
 			new_srv->respect_exportok = $2;
 		}
+		| DIFF_ALGORITHM STRING {
+			if (strcmp($2, "myers") == 0)
+				new_srv->diff_algo = GOT_DIFF_ALGORITHM_MYERS;
+			else if (strcmp($2, "patience") == 0)
+				new_srv->diff_algo =
+				    GOT_DIFF_ALGORITHM_PATIENCE;
+			else if (strcmp($2, "histogram") == 0)
+				new_srv->diff_algo =
+				    GOT_DIFF_ALGORITHM_HISTOGRAM;
+			else {
+				yyerror("unknown diff algorithm: %s", $2);
+				free($2);
+				YYERROR;
+			}
+			free($2);
+		}
 		| MAX_REPOS_DISPLAY NUMBER {
 				new_srv->max_repos_display = $2;
 		}
@@ -440,6 +464,7 @@ lookup(char *s)
 	static const struct keywords keywords[] = {
 		{ "chroot",			CHROOT },
 		{ "custom_css",			CUSTOM_CSS },
+		{ "diff_algorithm",		DIFF_ALGORITHM },
 		{ "listen",			LISTEN },
 		{ "logo",			LOGO },
 		{ "logo_url",			LOGO_URL },
@@ -889,6 +914,7 @@ conf_new_server(const char *name)
 	srv->show_repo_description = D_SHOWDESC;
 	srv->show_repo_cloneurl = D_SHOWURL;
 	srv->respect_exportok = D_RESPECTEXPORTOK;
+	srv->diff_algo = GOT_DIFF_ALGORITHM_MYERS;
 
 	srv->max_repos_display = D_MAXREPODISP;
 	srv->max_commits_display = D_MAXCOMMITDISP;
@@ -42,6 +42,7 @@
 #include <netdb.h>
 #include <poll.h>
 #include <pwd.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -71,6 +72,10 @@ static void	 sockets_launch(void);
 static void	 sockets_purge(struct gotwebd *);
 static void	 sockets_accept_paused(int, short, void *);
 static void	 sockets_rlimit(int);
+static void	 sockets_start_workers(struct socket *);
+static void	 sockets_stop_workers(struct socket *);
+static void	*sockets_worker(void *);
+static void	 sockets_request_done(int, short, void *);
 
 static int	 sockets_dispatch_gotwebd(int, struct privsep_proc *,
 		    struct imsg *);
@@ -259,11 +264,197 @@ sockets_launch(void)
 
 		evtimer_set(&sock->pause, sockets_accept_paused, sock);
 
+		sockets_start_workers(sock);
+
 		log_debug("%s: running socket listener %d", __func__,
 		    sock->conf.id);
 	}
 }
 
+static void
+sockets_start_workers(struct socket *sock)
+{
+	struct worker *w;
+	sigset_t set, oset;
+	int i, errcode;
+
+	if (pipe2(sock->done_pipe, O_CLOEXEC) == -1)
+		fatal("%s: pipe2", __func__);
+	if (fcntl(sock->done_pipe[0], F_SETFL, O_NONBLOCK) == -1)
+		fatal("%s: fcntl", __func__);
+
+	event_set(&sock->done_ev, sock->done_pipe[0], EV_READ | EV_PERSIST,
+	    sockets_request_done, sock);
+	if (event_add(&sock->done_ev, NULL))
+		fatalx("event add done pipe");
+
+	errcode = pthread_mutex_init(&sock->mutex, NULL);
+	if (errcode)
+		fatalx("%s: pthread_mutex_init: %s", __func__,
+		    strerror(errcode));
+	errcode = pthread_cond_init(&sock->cond, NULL);
+	if (errcode)
+		fatalx("%s: pthread_cond_init: %s", __func__,
+		    strerror(errcode));
+
+	/* Signals are handled by the main thread's event loop. */
+	sigfillset(&set);
+	errcode = pthread_sigmask(SIG_BLOCK, &set, &oset);
+	if (errcode)
+		fatalx("%s: pthread_sigmask: %s", __func__, strerror(errcode));
+
+	for (i = 0; i < GOTWEBD_NUMWORKERS; i++) {
+		w = &sock->workers[i];
+		errcode = pthread_create(&w->thread, NULL, sockets_worker, w);
+		if (errcode)
+			fatalx("%s: pthread_create: %s", __func__,
+			    strerror(errcode));
+		w->running = 1;
+	}
+
+	errcode = pthread_sigmask(SIG_SETMASK, &oset, NULL);
+	if (errcode)
+		fatalx("%s: pthread_sigmask: %s", __func__, strerror(errcode));
+}
+
+static void
+sockets_stop_workers(struct socket *sock)
+{
+	struct worker *w;
+	int i, j, errcode;
+
+	if (sock->done_pipe[0] == -1)
+		return;
+
+	errcode = pthread_mutex_lock(&sock->mutex);
+	if (errcode)
+		fatalx("%s: pthread_mutex_lock: %s", __func__,
+		    strerror(errcode));
+	sock->shutdown = 1;
+	errcode = pthread_cond_broadcast(&sock->cond);
+	if (errcode)
+		fatalx("%s: pthread_cond_broadcast: %s", __func__,
+		    strerror(errcode));
+	errcode = pthread_mutex_unlock(&sock->mutex);
+	if (errcode)
+		fatalx("%s: pthread_mutex_unlock: %s", __func__,
+		    strerror(errcode));
+
+	for (i = 0; i < GOTWEBD_NUMWORKERS; i++) {
+		w = &sock->workers[i];
+		if (!w->running)
+			continue;
+		errcode = pthread_join(w->thread, NULL);
+		if (errcode)
+			fatalx("%s: pthread_join: %s", __func__,
+			    strerror(errcode));
+		w->running = 0;
+
+		for (j = 0; j < w->ncached_repos; j++)
+			got_repo_close(w->cached_repos[j].repo);
+		w->ncached_repos = 0;
+	}
+
+	event_del(&sock->done_ev);
+	close(sock->done_pipe[0]);
+	close(sock->done_pipe[1]);
+	sock->done_pipe[0] = -1;
+	sock->done_pipe[1] = -1;
+}
+
+/*
+ * Requests are handed to the socket's worker threads once all parameters
+ * have been received, so that a slow page only occupies one worker while
+ * the main thread keeps accepting and dispatching other requests.
+ */
+void
+sockets_queue_request(struct request *c)
+{
+	struct socket *sock = c->sock;
+	int errcode;
+
+	c->processing = 1;
+
+	errcode = pthread_mutex_lock(&sock->mutex);
+	if (errcode)
+		fatalx("%s: pthread_mutex_lock: %s", __func__,
+		    strerror(errcode));
+	TAILQ_INSERT_TAIL(&sock->requests, c, entry);
+	errcode = pthread_cond_signal(&sock->cond);
+	if (errcode)
+		fatalx("%s: pthread_cond_signal: %s", __func__,
+		    strerror(errcode));
+	errcode = pthread_mutex_unlock(&sock->mutex);
+	if (errcode)
+		fatalx("%s: pthread_mutex_unlock: %s", __func__,
+		    strerror(errcode));
+}
+
+static void *
+sockets_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct socket *sock = w->sock;
+	struct request *c;
+	ssize_t n;
+	int errcode;
+
+	for (;;) {
+		errcode = pthread_mutex_lock(&sock->mutex);
+		if (errcode)
+			fatalx("%s: pthread_mutex_lock: %s", __func__,
+			    strerror(errcode));
+		while (TAILQ_EMPTY(&sock->requests) && !sock->shutdown) {
+			errcode = pthread_cond_wait(&sock->cond, &sock->mutex);
+			if (errcode)
+				fatalx("%s: pthread_cond_wait: %s", __func__,
+				    strerror(errcode));
+		}
+		if (sock->shutdown) {
+			pthread_mutex_unlock(&sock->mutex);
+			break;
+		}
+		c = TAILQ_FIRST(&sock->requests);
+		TAILQ_REMOVE(&sock->requests, c, entry);
+		errcode = pthread_mutex_unlock(&sock->mutex);
+		if (errcode)
+			fatalx("%s: pthread_mutex_unlock: %s", __func__,
+			    strerror(errcode));
+
+		c->worker = w;
+		memcpy(c->priv_fd, w->priv_fd, sizeof(c->priv_fd));
+		gotweb_process_request(c);
+
+		do {
+			n = write(sock->done_pipe[1], &c, sizeof(c));
+		} while (n == -1 && errno == EINTR);
+		if (n == -1)
+			fatal("%s: write", __func__);
+		if (n != sizeof(c))
+			fatalx("%s: short write", __func__);
+	}
+
+	return NULL;
+}
+
+static void
+sockets_request_done(int fd, short events, void *arg)
+{
+	struct request *c;
+	ssize_t n;
+
+	n = read(fd, &c, sizeof(c));
+	if (n == -1) {
+		if (errno == EINTR || errno == EAGAIN)
+			return;
+		fatal("%s: read", __func__);
+	}
+	if (n != sizeof(c))
+		fatalx("%s: short read", __func__);
+
+	fcgi_request_done(c);
+}
+
 static void
 sockets_purge(struct gotwebd *env)
 {
@@ -271,6 +462,7 @@ sockets_purge(struct gotwebd *env)
 
 	/* shutdown and remove sockets */
 	TAILQ_FOREACH_SAFE(sock, &env->sockets, entry, tsock) {
+		sockets_stop_workers(sock);
 		if (event_initialized(&sock->ev))
 			event_del(&sock->ev);
 		if (evtimer_initialized(&sock->evt))
@@ -353,7 +545,6 @@ sockets_shutdown(void)
 {
 	struct server *srv, *tsrv;
 	struct socket *sock, *tsock;
-	int i;
 
 	sockets_purge(gotwebd_env);
 
@@ -365,11 +556,8 @@ sockets_shutdown(void)
 	}
 
 	/* clean servers */
-	TAILQ_FOREACH_SAFE(srv, &gotwebd_env->servers, entry, tsrv) {
-		for (i = 0; i < srv->ncached_repos; i++)
-			got_repo_close(srv->cached_repos[i].repo);
+	TAILQ_FOREACH_SAFE(srv, &gotwebd_env->servers, entry, tsrv)
 		free(srv);
-	}
 
 	free(gotwebd_env);
 }
@@ -620,7 +808,7 @@ sockets_socket_accept(int fd, short event, void *arg)
 		return;
 	}
 
-	c->tp = template(c, fcgi_puts, fcgi_putc);
+	c->tp = template(c, fcgi_write);
 	if (c->tp == NULL) {
 		log_warn("%s", __func__);
 		close(s);
@@ -631,11 +819,10 @@ sockets_socket_accept(int fd, short event, void *arg)
 
 	c->fd = s;
 	c->sock = sock;
-	memcpy(c->priv_fd, sock->priv_fd, sizeof(c->priv_fd));
 	c->buf_pos = 0;
 	c->buf_len = 0;
 	c->request_started = 0;
-	c->sock->client_status = CLIENT_CONNECT;
+	c->client_status = CLIENT_CONNECT;
 
 	event_set(&c->ev, s, EV_READ, fcgi_request, c);
 	event_add(&c->ev, NULL);
@@ -33,7 +33,19 @@ typedef const struct got_error *(*got_blame_cb)(void *, int, int,
  * will be aborted and this function returns NULL.
  * If the callback returns any other error, the blame operation will be
  * aborted and the callback's error is returned from this function.
+ *
+ * Results of completed blame operations are cached within the repository
+ * if its cache directory exists and is writable. Blaming the same file version again is answered from
+ * the cache, and blaming a newer version stops traversing history once a
+ * cached version of the file is reached.
  */
 const struct got_error *got_blame(const char *,
     struct got_object_id *, struct got_repository *, enum got_diff_algorithm,
     got_blame_cb, void *, got_cancel_cb, void *, int, int, FILE *, FILE *);
+
+/*
+ * Get the path of the directory in which got_blame() caches its results
+ * for the given repository. The caller must dispose of the path with free(3).
+ */
+const struct got_error *got_blame_get_cache_path(char **,
+    struct got_repository *);
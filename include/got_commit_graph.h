@@ -25,6 +25,14 @@ const struct got_error *got_commit_graph_iter_start(
     got_cancel_cb, void *);
 const struct got_error *got_commit_graph_iter_next(struct got_object_id *,
     struct got_commit_graph *, struct got_repository *, got_cancel_cb, void *);
+
+/*
+ * Return non-zero if the commits which remain to be iterated are the same
+ * which a new iteration started at the commit most recently returned by
+ * got_commit_graph_iter_next() would return after that commit. This may not
+ * be the case while several branches of a merge are being traversed.
+ */
+int got_commit_graph_iter_is_linear(struct got_commit_graph *);
 const struct got_error *got_commit_graph_intersect(struct got_object_id **,
     struct got_commit_graph *, struct got_commit_graph *,
     struct got_repository *);
@@ -33,3 +41,11 @@ const struct got_error *got_commit_graph_intersect(struct got_object_id **,
 const struct got_error *got_commit_graph_find_youngest_common_ancestor(
     struct got_object_id **, struct got_object_id *, struct got_object_id *,
     int, struct got_repository *, got_cancel_cb, void *);
+
+/*
+ * Count commits reachable from the first commit but not from the second
+ * ("ahead"), and vice versa ("behind").
+ */
+const struct got_error *got_commit_graph_count_ahead_behind(int *, int *,
+    struct got_object_id *, struct got_object_id *, int,
+    struct got_repository *, got_cancel_cb, void *);
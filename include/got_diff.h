@@ -17,6 +17,7 @@
 enum got_diff_algorithm {
 	GOT_DIFF_ALGORITHM_MYERS,
 	GOT_DIFF_ALGORITHM_PATIENCE,
+	GOT_DIFF_ALGORITHM_HISTOGRAM,
 };
 
 /*
@@ -98,6 +99,15 @@ typedef const struct got_error *(*got_diff_blob_cb)(void *,
     struct got_object_id *, struct got_object_id *,
     const char *, const char *, mode_t, mode_t, struct got_repository *);
 
+/*
+ * A callback function which is invoked while diffing several files, each
+ * time the diff of a file has been appended to the output. The output
+ * file has been flushed, such that the output described by the array of
+ * line offsets and types can be read from the file by other means.
+ */
+typedef const struct got_error *(*got_diff_progress_cb)(void *,
+    struct got_diff_line *, size_t);
+
 /*
  * A pre-defined implementation of got_diff_blob_cb() which appends unidiff
  * output to a file. The caller must allocate and fill in the argument
@@ -125,6 +135,16 @@ struct got_diff_blob_output_unidiff_arg {
 	 */
 	size_t nlines;
 	struct got_diff_line *lines; /* Dispose of with free(3) when done. */
+
+	/*
+	 * If not NULL, cancel_cb is invoked before each file is diffed, and
+	 * progress_cb is invoked whenever the diff of a file has been
+	 * appended to the output. May be initialized to NULL.
+	 */
+	got_cancel_cb cancel_cb;
+	void *cancel_arg;
+	got_diff_progress_cb progress_cb;
+	void *progress_arg;
 };
 const struct got_error *got_diff_blob_output_unidiff(void *,
     struct got_blob_object *, struct got_blob_object *, FILE *, FILE *,
@@ -149,6 +169,19 @@ const struct got_error *got_diff_tree(struct got_tree_object *,
     const char *, const char *,
     struct got_repository *, got_diff_blob_cb cb, void *cb_arg, int);
 
+/*
+ * Compute the differences between two trees like got_diff_tree() with
+ * got_diff_blob_output_unidiff() as callback, but diff the contents of
+ * several files at once in separate threads. Output, line metadata, and
+ * diffstat are produced in the same order as with got_diff_tree().
+ * Two open temporary file descriptors must be provided for internal use;
+ * these can be obtained from got_opentempfd() and must be closed by the
+ * caller. The file descriptor for a tree which is NULL may be -1.
+ */
+const struct got_error *got_diff_tree_parallel(struct got_tree_object *,
+    struct got_tree_object *, int, int, const char *, const char *,
+    struct got_repository *, struct got_diff_blob_output_unidiff_arg *);
+
 /*
  * Pre-defined implementations of got_diff_blob_cb(): the first of which
  * collects a list of file paths that differ between two trees; the second
@@ -227,12 +260,15 @@ struct got_pathlist_head;
  * Write unified diff text to the provided output FILE.
  * If not NULL, the two initial output arguments will be populated with an
  * array of line offsets for, and the number of lines in, the unidiff text.
+ * The optional progress and cancellation callbacks are used as with
+ * struct got_diff_blob_output_unidiff_arg.
  */
 const struct got_error *got_diff_objects_as_trees(struct got_diff_line **,
     size_t *, FILE *, FILE *, int, int, struct got_object_id *,
     struct got_object_id *, struct got_pathlist_head *, const char *,
     const char *, enum got_diff_algorithm, int, int, int,
-    struct got_diffstat_cb_arg *, struct got_repository *, FILE *);
+    struct got_diffstat_cb_arg *, got_diff_progress_cb, void *,
+    got_cancel_cb, void *, struct got_repository *, FILE *);
 
 /*
  * Diff two objects, assuming both objects are commits.
@@ -245,11 +281,13 @@ const struct got_error *got_diff_objects_as_trees(struct got_diff_line **,
  * Write unified diff text to the provided output FILE.
  * If not NULL, the two initial output arguments will be populated with an
  * array of line offsets for, and the number of lines in, the unidiff text.
+ * The optional progress and cancellation callbacks are used as with
+ * struct got_diff_blob_output_unidiff_arg.
  */
 const struct got_error *got_diff_objects_as_commits(struct got_diff_line **,
     size_t *, FILE *, FILE *, int, int, struct got_object_id *,
     struct got_object_id *, struct got_pathlist_head *, enum got_diff_algorithm,
-    int, int, int, struct got_diffstat_cb_arg *, struct got_repository *,
-    FILE *);
+    int, int, int, struct got_diffstat_cb_arg *, got_diff_progress_cb, void *,
+    got_cancel_cb, void *, struct got_repository *, FILE *);
 
 #define GOT_DIFF_MAX_CONTEXT	64
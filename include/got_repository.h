@@ -132,8 +132,10 @@ const struct got_error *got_repo_map_path(char **, struct got_repository *,
 /*
  * Create a new repository with optional specified
  * HEAD ref in an empty directory at a specified path.
+ * If the last argument is non-zero, references will be stored
+ * in the reftable format instead of in loose files.
  */
-const struct got_error *got_repo_init(const char *, const char *);
+const struct got_error *got_repo_init(const char *, const char *, int);
 
 /* Attempt to find a unique object ID for a given ID string prefix. */
 const struct got_error *got_repo_match_object_id_prefix(struct got_object_id **,
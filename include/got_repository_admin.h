@@ -97,3 +97,13 @@ const struct got_error *
 got_repo_remove_lonely_packidx(struct got_repository *repo, int dry_run,
     got_lonely_packidx_progress_cb progress_cb, void *progress_arg,
     got_cancel_cb cancel_cb, void *cancel_arg);
+
+/*
+ * Remove all entries of the blame cache, which got_blame() maintains in
+ * the repository if the got-blame-cache directory exists. The directory
+ * itself is kept such that blame results will be cached again.
+ * Return the number of cache entries and their total size on disk.
+ */
+const struct got_error *
+got_repo_purge_blame_cache(struct got_repository *repo, int *nentries,
+    off_t *size, int dry_run, got_cancel_cb cancel_cb, void *cancel_arg);
@@ -123,6 +123,31 @@ struct got_object_id *got_worktree_get_base_commit_id(struct got_worktree *);
 const struct got_error *got_worktree_set_base_commit_id(struct got_worktree *,
     struct got_repository *, struct got_object_id *);
 
+/*
+ * Get the list of paths which make up the work tree's sparse checkout set.
+ * The list is empty if the entire work tree is checked out.
+ */
+struct got_pathlist_head *got_worktree_get_sparse_paths(struct got_worktree *);
+
+/*
+ * Set the list of paths which make up the work tree's sparse checkout set.
+ * Only these directories, their parent directories, and files residing
+ * directly in any of these parent directories will be checked out by
+ * subsequent checkout operations. Paths are relative to the work tree's
+ * root. An empty list, or a list containing the root directory, selects
+ * a full checkout of the work tree.
+ * The new set is not stored on disk until got_worktree_write_sparse_paths()
+ * is called, which should be done once the work tree has been updated.
+ */
+const struct got_error *got_worktree_set_sparse_paths(struct got_worktree *,
+    struct got_pathlist_head *);
+
+/*
+ * Store the work tree's current sparse checkout set on disk, such that
+ * it will be used by subsequent invocations of got(1).
+ */
+const struct got_error *got_worktree_write_sparse_paths(struct got_worktree *);
+
 /*
  * Obtain a parsed representation of this worktree's got.conf file.
  * Return NULL if this configuration file could not be read.
@@ -153,6 +178,9 @@ typedef const struct got_error *(*got_worktree_delete_cb)(void *,
  * an error or if the checkout operation is cancelled by the cancel callback.
  * Allspecified paths are relative to the work tree's root. Pass a pathlist
  * with a single empty path "" to check out files across the entire work tree.
+ * Files outside of the work tree's sparse checkout set are not checked out,
+ * and are removed from the work tree unless they contain local changes.
+ * Specifying a path outside of the sparse checkout set is an error.
  *
  * Some operations may refuse to run while the work tree contains files from
  * multiple base commits.
@@ -16,16 +16,22 @@
  */
 
 #include <sys/queue.h>
+#include <sys/tree.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
+#include <dirent.h>
+#include <endian.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sha1.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <limits.h>
+#include <unistd.h>
 #include <util.h>
 #include <zlib.h>
 
@@ -35,17 +41,36 @@
 #include "got_commit_graph.h"
 #include "got_opentemp.h"
 #include "got_diff.h"
+#include "got_path.h"
+#include "got_repository.h"
 #include "got_blame.h"
 
 #include "got_lib_inflate.h"
 #include "got_lib_delta.h"
 #include "got_lib_object.h"
+#include "got_lib_object_cache.h"
+#include "got_lib_pack.h"
+#include "got_lib_repository.h"
 #include "got_lib_diff.h"
+#include "got_lib_sha1.h"
 
 #ifndef MAX
 #define	MAX(_a,_b) ((_a) > (_b) ? (_a) : (_b))
 #endif
 
+/*
+ * Completed blame results are cached in files within the GOT_BLAME_CACHE_DIR
+ * directory of the repository, if this directory exists. Each file holds the
+ * commit which last changed each line of one version of a file, as found
+ * with one diff algorithm. The oldest entries are evicted once the cache
+ * grows beyond GOT_BLAME_CACHE_MAX_SIZE bytes.
+ */
+#define GOT_BLAME_CACHE_MAX_SIZE	(32 * 1024 * 1024)
+#define GOT_BLAME_CACHE_SIGNATURE	0x67626c63 /* 'g' 'b' 'l' 'c' */
+#define GOT_BLAME_CACHE_VERSION		1
+#define GOT_BLAME_CACHE_HDR_SIZE	(6 * sizeof(uint32_t) + \
+					 2 * SHA1_DIGEST_LENGTH)
+
 struct got_blame_line {
 	int annotated;
 	struct got_object_id id;
@@ -88,6 +113,23 @@ struct got_blame {
 
 	struct diff_data *data1;
 	struct diff_data *data2;
+
+	/* Blob IDs of the file versions in data1 and data2. */
+	struct got_object_id blob_id1;
+	struct got_object_id blob_id2;
+
+	enum got_diff_algorithm diff_algo;
+
+	/* Set if the blame cache directory exists. */
+	int use_cache;
+};
+
+struct got_blame_cache_entry {
+	int nlines;
+	int nids;
+	struct got_object_id *ids;	/* commits which changed lines */
+	uint32_t *lines;		/* index into ids for each line */
+	struct got_commit_object **commits; /* opened on demand */
 };
 
 static const struct got_error *
@@ -196,7 +238,7 @@ blame_prepare_file(FILE *f, unsigned char **p, off_t *size,
 }
 
 static const struct got_error *
-blame_commit(struct got_blame *blame, struct got_object_id *id,
+blame_commit(int *changed, struct got_blame *blame, struct got_object_id *id,
     const char *path, struct got_repository *repo,
     got_blame_cb cb, void *arg)
 {
@@ -207,6 +249,8 @@ blame_commit(struct got_blame *blame, struct got_object_id *id,
 	struct got_blob_object *pblob = NULL;
 	struct diff_result *diff_result = NULL;
 
+	*changed = 1;
+
 	err = got_object_open_as_commit(&commit, repo, id);
 	if (err)
 		return err;
@@ -228,9 +272,18 @@ blame_commit(struct got_blame *blame, struct got_object_id *id,
 		goto done;
 	}
 
+	if (got_object_id_cmp(pblob_id, &blame->blob_id2) == 0) {
+		/* The file is unchanged; keep the current version's data. */
+		*changed = 0;
+		if (cb)
+			err = cb(arg, blame->nlines, -1, commit, id);
+		goto done;
+	}
+
 	err = got_object_open_as_blob(&pblob, repo, pblob_id, 8192, blame->fd);
 	if (err)
 		goto done;
+	memcpy(&blame->blob_id1, pblob_id, sizeof(blame->blob_id1));
 
 	err = blame_prepare_file(blame->f1, &blame->map1, &blame->size1,
 	    &blame->nlines1, &blame->line_offsets1, blame->data1,
@@ -482,6 +535,9 @@ flip_files(struct got_blame *blame)
 	blame->nlines2 = blame->nlines1;
 	blame->nlines1 = 0;
 
+	memcpy(&blame->blob_id2, &blame->blob_id1, sizeof(blame->blob_id2));
+	memset(&blame->blob_id1, 0, sizeof(blame->blob_id1));
+
 	diff_data_free(blame->data2); /* does not free pointer itself */
 	memset(blame->data2, 0, sizeof(*blame->data2));
 	d = blame->data2;
@@ -491,6 +547,495 @@ flip_files(struct got_blame *blame)
 	return NULL;
 }
 
+const struct got_error *
+got_blame_get_cache_path(char **path, struct got_repository *repo)
+{
+	if (asprintf(path, "%s/%s", got_repo_get_path_git_dir(repo),
+	    GOT_BLAME_CACHE_DIR) == -1) {
+		*path = NULL;
+		return got_error_from_errno("asprintf");
+	}
+	return NULL;
+}
+
+/* The cache is only used if the user has created its directory. */
+static int
+blame_cache_enabled(struct got_repository *repo)
+{
+	struct stat sb;
+	char *cache_path;
+	int ret;
+
+	if (got_blame_get_cache_path(&cache_path, repo) != NULL)
+		return 0;
+	ret = (stat(cache_path, &sb) == 0 && S_ISDIR(sb.st_mode));
+	free(cache_path);
+	return ret;
+}
+
+static const struct got_error *
+blame_cache_entry_path(char **path, struct got_repository *repo,
+    const char *in_repo_path, struct got_object_id *commit_id,
+    enum got_diff_algorithm diff_algo)
+{
+	const struct got_error *err;
+	SHA1_CTX ctx;
+	uint8_t digest[SHA1_DIGEST_LENGTH];
+	char hex[SHA1_DIGEST_STRING_LENGTH];
+	char *cache_path;
+	uint32_t algo = htobe32(diff_algo);
+
+	SHA1Init(&ctx);
+	SHA1Update(&ctx, (uint8_t *)&algo, sizeof(algo));
+	SHA1Update(&ctx, (const uint8_t *)in_repo_path,
+	    strlen(in_repo_path) + 1);
+	SHA1Update(&ctx, commit_id->sha1, sizeof(commit_id->sha1));
+	SHA1Final(digest, &ctx);
+	if (got_sha1_digest_to_str(digest, hex, sizeof(hex)) == NULL)
+		return got_error(GOT_ERR_BAD_OBJ_ID_STR);
+
+	err = got_blame_get_cache_path(&cache_path, repo);
+	if (err)
+		return err;
+	if (asprintf(path, "%s/%s", cache_path, hex) == -1) {
+		err = got_error_from_errno("asprintf");
+		*path = NULL;
+	}
+	free(cache_path);
+	return err;
+}
+
+static void
+blame_cache_entry_free(struct got_blame_cache_entry *entry)
+{
+	int i;
+
+	if (entry == NULL)
+		return;
+	for (i = 0; i < entry->nids; i++) {
+		if (entry->commits[i])
+			got_object_commit_close(entry->commits[i]);
+	}
+	free(entry->commits);
+	free(entry->ids);
+	free(entry->lines);
+	free(entry);
+}
+
+static uint32_t
+blame_cache_get32(const uint8_t *p)
+{
+	uint32_t val;
+
+	memcpy(&val, p, sizeof(val));
+	return be32toh(val);
+}
+
+static void
+blame_cache_put32(uint8_t **p, uint32_t val)
+{
+	val = htobe32(val);
+	memcpy(*p, &val, sizeof(val));
+	*p += sizeof(val);
+}
+
+/*
+ * Look up the cached blame of a file version. Set *entry to NULL if no
+ * valid cache entry exists. Cache entries which cannot be read are ignored.
+ */
+static const struct got_error *
+blame_cache_get(struct got_blame_cache_entry **entry,
+    struct got_repository *repo, const char *in_repo_path,
+    struct got_object_id *commit_id, struct got_object_id *blob_id,
+    enum got_diff_algorithm diff_algo)
+{
+	const struct got_error *err = NULL;
+	struct got_blame_cache_entry *e = NULL;
+	char *path = NULL;
+	uint8_t *buf = NULL, *p;
+	uint8_t digest[SHA1_DIGEST_LENGTH];
+	SHA1_CTX ctx;
+	struct stat sb;
+	size_t len, pathlen, i;
+	ssize_t r;
+	uint32_t nlines, nids;
+	int fd = -1;
+
+	*entry = NULL;
+
+	err = blame_cache_entry_path(&path, repo, in_repo_path, commit_id,
+	    diff_algo);
+	if (err)
+		return err;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1)
+		goto done;
+	if (fstat(fd, &sb) == -1) {
+		err = got_error_from_errno2("fstat", path);
+		goto done;
+	}
+	if (!S_ISREG(sb.st_mode) || sb.st_size > INT_MAX ||
+	    sb.st_size < GOT_BLAME_CACHE_HDR_SIZE + SHA1_DIGEST_LENGTH)
+		goto done;
+	len = sb.st_size;
+
+	buf = malloc(len);
+	if (buf == NULL) {
+		err = got_error_from_errno("malloc");
+		goto done;
+	}
+	r = read(fd, buf, len);
+	if (r == -1) {
+		err = got_error_from_errno2("read", path);
+		goto done;
+	}
+	if (r != len)
+		goto done;
+
+	SHA1Init(&ctx);
+	SHA1Update(&ctx, buf, len - SHA1_DIGEST_LENGTH);
+	SHA1Final(digest, &ctx);
+	if (memcmp(digest, buf + len - SHA1_DIGEST_LENGTH,
+	    SHA1_DIGEST_LENGTH) != 0)
+		goto done;
+
+	p = buf;
+	if (blame_cache_get32(p) != GOT_BLAME_CACHE_SIGNATURE ||
+	    blame_cache_get32(p + 4) != GOT_BLAME_CACHE_VERSION ||
+	    blame_cache_get32(p + 8) != diff_algo)
+		goto done;
+	nlines = blame_cache_get32(p + 12);
+	nids = blame_cache_get32(p + 16);
+	pathlen = blame_cache_get32(p + 20);
+	p += 6 * sizeof(uint32_t);
+	if (nlines > INT_MAX / sizeof(uint32_t) ||
+	    nids > INT_MAX / SHA1_DIGEST_LENGTH || pathlen > len ||
+	    GOT_BLAME_CACHE_HDR_SIZE + pathlen +
+	    (size_t)nids * SHA1_DIGEST_LENGTH +
+	    (size_t)nlines * sizeof(uint32_t) + SHA1_DIGEST_LENGTH != len)
+		goto done;
+
+	/* Guard against hash collisions in the file name. */
+	if (memcmp(p, commit_id->sha1, SHA1_DIGEST_LENGTH) != 0 ||
+	    memcmp(p + SHA1_DIGEST_LENGTH, blob_id->sha1,
+	    SHA1_DIGEST_LENGTH) != 0)
+		goto done;
+	p += 2 * SHA1_DIGEST_LENGTH;
+	if (pathlen != strlen(in_repo_path) ||
+	    memcmp(p, in_repo_path, pathlen) != 0)
+		goto done;
+	p += pathlen;
+
+	e = calloc(1, sizeof(*e));
+	if (e == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	e->nlines = nlines;
+	e->nids = nids;
+	e->ids = calloc(MAX(nids, 1), sizeof(*e->ids));
+	e->commits = calloc(MAX(nids, 1), sizeof(*e->commits));
+	e->lines = calloc(MAX(nlines, 1), sizeof(*e->lines));
+	if (e->ids == NULL || e->commits == NULL || e->lines == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	for (i = 0; i < nids; i++) {
+		memcpy(e->ids[i].sha1, p, SHA1_DIGEST_LENGTH);
+		p += SHA1_DIGEST_LENGTH;
+	}
+	for (i = 0; i < nlines; i++) {
+		e->lines[i] = blame_cache_get32(p);
+		p += sizeof(uint32_t);
+		if (e->lines[i] >= nids)
+			goto done;
+	}
+
+	*entry = e;
+	e = NULL;
+done:
+	if (fd != -1 && close(fd) == -1 && err == NULL)
+		err = got_error_from_errno2("close", path);
+	blame_cache_entry_free(e);
+	free(buf);
+	free(path);
+	return err;
+}
+
+struct blame_cache_file {
+	char name[SHA1_DIGEST_STRING_LENGTH];
+	struct timespec mtime;
+	off_t size;
+};
+
+static int
+blame_cache_file_cmp(const void *pa, const void *pb)
+{
+	const struct blame_cache_file *a = pa, *b = pb;
+
+	if (timespeccmp(&a->mtime, &b->mtime, <))
+		return -1;
+	if (timespeccmp(&a->mtime, &b->mtime, >))
+		return 1;
+	return strcmp(a->name, b->name);
+}
+
+/*
+ * Remove the oldest cache entries until the total size of the cache
+ * does not exceed max_size bytes.
+ */
+static const struct got_error *
+blame_cache_evict(const char *cache_path, off_t max_size)
+{
+	const struct got_error *err = NULL;
+	struct blame_cache_file *files = NULL, *f;
+	struct dirent *dent;
+	struct stat sb;
+	DIR *dir = NULL;
+	off_t total = 0;
+	size_t nfiles = 0, nalloc = 0, i;
+	int fd;
+
+	fd = open(cache_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		return got_error_from_errno2("open", cache_path);
+	dir = fdopendir(fd);
+	if (dir == NULL) {
+		err = got_error_from_errno2("fdopendir", cache_path);
+		close(fd);
+		return err;
+	}
+
+	while ((dent = readdir(dir)) != NULL) {
+		/* Skip temporary files which are still being written. */
+		if (dent->d_namlen != SHA1_DIGEST_STRING_LENGTH - 1)
+			continue;
+		if (fstatat(fd, dent->d_name, &sb, AT_SYMLINK_NOFOLLOW) == -1) {
+			if (errno == ENOENT)
+				continue;
+			err = got_error_from_errno2("fstatat", dent->d_name);
+			goto done;
+		}
+		if (!S_ISREG(sb.st_mode))
+			continue;
+		if (nfiles == nalloc) {
+			size_t n = nalloc ? nalloc * 2 : 64;
+
+			f = recallocarray(files, nalloc, n, sizeof(*files));
+			if (f == NULL) {
+				err = got_error_from_errno("recallocarray");
+				goto done;
+			}
+			files = f;
+			nalloc = n;
+		}
+		f = &files[nfiles++];
+		strlcpy(f->name, dent->d_name, sizeof(f->name));
+		f->mtime = sb.st_mtim;
+		f->size = sb.st_size;
+		total += sb.st_size;
+	}
+
+	if (total <= max_size)
+		goto done;
+
+	qsort(files, nfiles, sizeof(files[0]), blame_cache_file_cmp);
+	for (i = 0; i < nfiles && total > max_size; i++) {
+		if (unlinkat(fd, files[i].name, 0) == -1 && errno != ENOENT) {
+			err = got_error_from_errno2("unlinkat", files[i].name);
+			goto done;
+		}
+		total -= files[i].size;
+	}
+done:
+	if (closedir(dir) == -1 && err == NULL)
+		err = got_error_from_errno2("closedir", cache_path);
+	free(files);
+	return err;
+}
+
+/*
+ * Store the completed blame of the file version being blamed. The cache
+ * entry is written to a temporary file first and then renamed into place,
+ * such that concurrent readers never see a partially written entry.
+ */
+static const struct got_error *
+blame_cache_put(struct got_blame *blame, struct got_repository *repo,
+    const char *in_repo_path, struct got_object_id *commit_id,
+    struct got_object_id *blob_id)
+{
+	const struct got_error *err = NULL;
+	char *path = NULL, *cache_path = NULL, *tmppath = NULL;
+	struct got_object_id *ids = NULL;
+	uint32_t *lines = NULL;
+	uint8_t *buf = NULL, *p;
+	SHA1_CTX ctx;
+	size_t len, pathlen = strlen(in_repo_path);
+	ssize_t w;
+	int i, j, nids = 0, fd = -1;
+
+	ids = calloc(blame->nlines, sizeof(*ids));
+	lines = calloc(blame->nlines, sizeof(*lines));
+	if (ids == NULL || lines == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+
+	/* Most lines were changed by a few commits; store each one once. */
+	for (i = 0; i < blame->nlines; i++) {
+		struct got_blame_line *line = &blame->lines[i];
+
+		if (!line->annotated)
+			goto done;
+		for (j = nids - 1; j >= 0; j--) {
+			if (got_object_id_cmp(&ids[j], &line->id) == 0)
+				break;
+		}
+		if (j < 0) {
+			j = nids++;
+			memcpy(&ids[j], &line->id, sizeof(ids[j]));
+		}
+		lines[i] = j;
+	}
+
+	len = GOT_BLAME_CACHE_HDR_SIZE + pathlen +
+	    (size_t)nids * SHA1_DIGEST_LENGTH +
+	    (size_t)blame->nlines * sizeof(uint32_t) + SHA1_DIGEST_LENGTH;
+	buf = malloc(len);
+	if (buf == NULL) {
+		err = got_error_from_errno("malloc");
+		goto done;
+	}
+
+	p = buf;
+	blame_cache_put32(&p, GOT_BLAME_CACHE_SIGNATURE);
+	blame_cache_put32(&p, GOT_BLAME_CACHE_VERSION);
+	blame_cache_put32(&p, blame->diff_algo);
+	blame_cache_put32(&p, blame->nlines);
+	blame_cache_put32(&p, nids);
+	blame_cache_put32(&p, pathlen);
+	memcpy(p, commit_id->sha1, SHA1_DIGEST_LENGTH);
+	p += SHA1_DIGEST_LENGTH;
+	memcpy(p, blob_id->sha1, SHA1_DIGEST_LENGTH);
+	p += SHA1_DIGEST_LENGTH;
+	memcpy(p, in_repo_path, pathlen);
+	p += pathlen;
+	for (i = 0; i < nids; i++) {
+		memcpy(p, ids[i].sha1, SHA1_DIGEST_LENGTH);
+		p += SHA1_DIGEST_LENGTH;
+	}
+	for (i = 0; i < blame->nlines; i++)
+		blame_cache_put32(&p, lines[i]);
+	SHA1Init(&ctx);
+	SHA1Update(&ctx, buf, p - buf);
+	SHA1Final(p, &ctx);
+
+	err = got_blame_get_cache_path(&cache_path, repo);
+	if (err)
+		goto done;
+
+	err = blame_cache_entry_path(&path, repo, in_repo_path, commit_id,
+	    blame->diff_algo);
+	if (err)
+		goto done;
+	err = got_opentemp_named_fd(&tmppath, &fd, path, "");
+	if (err)
+		goto done;
+	w = write(fd, buf, len);
+	if (w == -1) {
+		err = got_error_from_errno2("write", tmppath);
+		goto done;
+	}
+	if (w != len) {
+		err = got_error(GOT_ERR_IO);
+		goto done;
+	}
+	if (close(fd) == -1) {
+		err = got_error_from_errno2("close", tmppath);
+		fd = -1;
+		goto done;
+	}
+	fd = -1;
+	if (rename(tmppath, path) == -1) {
+		err = got_error_from_errno3("rename", tmppath, path);
+		goto done;
+	}
+	free(tmppath);
+	tmppath = NULL;
+
+	err = blame_cache_evict(cache_path, GOT_BLAME_CACHE_MAX_SIZE);
+done:
+	if (fd != -1 && close(fd) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	if (tmppath && unlink(tmppath) == -1 && err == NULL)
+		err = got_error_from_errno2("unlink", tmppath);
+	free(tmppath);
+	free(path);
+	free(cache_path);
+	free(buf);
+	free(ids);
+	free(lines);
+	return err;
+}
+
+/*
+ * If the blame of the file version in data2, as of the given commit, was
+ * cached, annotate all remaining lines which originate from this version.
+ */
+static const struct got_error *
+blame_apply_cache(int *hit, struct got_blame *blame,
+    struct got_object_id *commit_id, const char *path,
+    struct got_repository *repo, got_blame_cb cb, void *arg)
+{
+	const struct got_error *err;
+	struct got_blame_cache_entry *entry;
+	int i, nlines;
+
+	*hit = 0;
+
+	if (!blame->use_cache)
+		return NULL;
+
+	err = blame_cache_get(&entry, repo, path, commit_id,
+	    &blame->blob_id2, blame->diff_algo);
+	if (err || entry == NULL)
+		return err;
+
+	/*
+	 * Cache entries count lines the way blame_open() does: a newline
+	 * at the end of the file does not begin another line.
+	 */
+	nlines = blame->nlines2;
+	if (nlines > 0 && blame->line_offsets2[nlines - 1] == blame->size2)
+		nlines--;
+	if (entry->nlines != nlines)
+		goto done;
+
+	for (i = 0; i < entry->nlines && blame->nannotated < blame->nlines;
+	    i++) {
+		int ln = blame->linemap2[i];
+		uint32_t idx = entry->lines[i];
+
+		if (ln < 0 || ln >= blame->nlines || blame->lines[ln].annotated)
+			continue;
+		if (entry->commits[idx] == NULL) {
+			err = got_object_open_as_commit(&entry->commits[idx],
+			    repo, &entry->ids[idx]);
+			if (err)
+				goto done;
+		}
+		err = annotate_line(blame, ln, entry->commits[idx],
+		    &entry->ids[idx], cb, arg);
+		if (err)
+			goto done;
+	}
+	*hit = 1;
+done:
+	blame_cache_entry_free(entry);
+	return err;
+}
+
 static const struct got_error *
 blame_open(struct got_blame **blamep, const char *path,
     struct got_object_id *start_commit_id, struct got_repository *repo,
@@ -504,7 +1049,7 @@ blame_open(struct got_blame **blamep, const char *path,
 	struct got_blob_object *blob = NULL;
 	struct got_blame *blame = NULL;
 	struct got_object_id id;
-	int lineno, have_id = 0;
+	int lineno, have_id = 0, changed, hit;
 	struct got_commit_graph *graph = NULL;
 
 	*blamep = NULL;
@@ -541,6 +1086,9 @@ blame_open(struct got_blame **blamep, const char *path,
 	blame->f1 = f1;
 	blame->f2 = f2;
 	blame->fd = fd2;
+	blame->diff_algo = diff_algo;
+	blame->use_cache = blame_cache_enabled(repo);
+	memcpy(&blame->blob_id2, obj_id, sizeof(blame->blob_id2));
 
 	err = got_diff_get_config(&blame->cfg, diff_algo, blame_atomize_file,
 	    blame);
@@ -575,6 +1123,12 @@ blame_open(struct got_blame **blamep, const char *path,
 	for (lineno = 0; lineno < blame->nlines2; lineno++)
 		blame->linemap2[lineno] = lineno;
 
+	/* Answer repeated requests from the cache. */
+	err = blame_apply_cache(&hit, blame, start_commit_id, path, repo,
+	    cb, arg);
+	if (err || hit)
+		goto done;
+
 	err = got_commit_graph_open(&graph, path, 1);
 	if (err)
 		goto done;
@@ -595,7 +1149,20 @@ blame_open(struct got_blame **blamep, const char *path,
 		}
 		have_id = 1;
 
-		err = blame_commit(blame, &id, path, repo, cb, arg);
+		/*
+		 * If this version of the file was blamed before, the
+		 * remaining lines can be annotated from the cache.
+		 */
+		if (got_object_id_cmp(&id, start_commit_id) != 0) {
+			err = blame_apply_cache(&hit, blame, &id, path, repo,
+			    cb, arg);
+			if (err)
+				goto done;
+			if (hit)
+				break;
+		}
+
+		err = blame_commit(&changed, blame, &id, path, repo, cb, arg);
 		if (err) {
 			if (err->code == GOT_ERR_ITER_COMPLETED)
 				err = NULL;
@@ -604,9 +1171,11 @@ blame_open(struct got_blame **blamep, const char *path,
 		if (blame->nannotated == blame->nlines)
 			break;
 
-		err = flip_files(blame);
-		if (err)
-			goto done;
+		if (changed) {
+			err = flip_files(blame);
+			if (err)
+				goto done;
+		}
 	}
 
 	if (have_id && blame->nannotated < blame->nlines) {
@@ -622,6 +1191,12 @@ blame_open(struct got_blame **blamep, const char *path,
 		}
 	}
 
+	/*
+	 * The cache is an optimization only. Failure to write it, e.g.
+	 * because the repository is read-only, is not an error.
+	 */
+	if (blame->use_cache && blame->nannotated == blame->nlines)
+		blame_cache_put(blame, repo, path, start_commit_id, obj_id);
 done:
 	if (graph)
 		got_commit_graph_close(graph);
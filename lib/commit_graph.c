@@ -17,6 +17,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/queue.h>
+#include <sys/tree.h>
 #include <sys/stdint.h>
 
 #include <limits.h>
@@ -43,6 +44,8 @@ struct got_commit_graph_node {
 
 	/* Used only during iteration. */
 	time_t timestamp;
+	int round;
+	int dominates;
 	TAILQ_ENTRY(got_commit_graph_node) entry;
 };
 
@@ -52,6 +55,7 @@ struct got_commit_graph_branch_tip {
 	struct got_object_id *commit_id;
 	struct got_commit_object *commit;
 	struct got_commit_graph_node *new_node;
+	int listed;
 };
 
 struct got_commit_graph {
@@ -82,6 +86,23 @@ struct got_commit_graph {
 	struct got_commit_graph_branch_tip *tips;
 	int ntips;
 
+	/*
+	 * Commits are fetched in rounds, one commit from each open branch
+	 * per round. A commit "dominates" if all branches which remain open
+	 * after its round lead to its parents. All commits fetched in later
+	 * rounds are then ancestors of this commit.
+	 *
+	 * This does not hold if a branch ended before joining the others,
+	 * because its commits might be ancestors of commits fetched later.
+	 * Remember the first round where this happened.
+	 */
+	int nrounds;
+	int unjoined_round;
+
+	/* Round of the node most recently returned by the iterator. */
+	int iter_round;
+	int iter_dominates;
+
 	/* Path of tree entry of interest to the API user. */
 	char *path;
 
@@ -452,6 +473,7 @@ add_branch_tip(struct got_object_id *commit_id, void *data, void *arg)
 	a->tips[a->ntips].commit_id = &new_node->id;
 	a->tips[a->ntips].commit = commit;
 	a->tips[a->ntips].new_node = new_node;
+	a->tips[a->ntips].listed = 0;
 	a->ntips++;
 
 	return NULL;
@@ -463,12 +485,14 @@ fetch_commits_from_open_branches(struct got_commit_graph *graph,
 {
 	const struct got_error *err;
 	struct add_branch_tip_arg arg;
-	int i, ntips;
+	int i, ntips, branch_ended = 0;
 
 	ntips = got_object_idset_num_elements(graph->open_branches);
 	if (ntips == 0)
 		return NULL;
 
+	graph->nrounds++;
+
 	/* (Re-)allocate branch tips array if necessary. */
 	if (graph->ntips < ntips) {
 		struct got_commit_graph_branch_tip *tips;
@@ -516,21 +540,45 @@ fetch_commits_from_open_branches(struct got_commit_graph *graph,
 			err = close_branch(graph, commit_id);
 			if (err)
 				break;
+			branch_ended = 1;
 			continue;
 		}
 		if (changed) {
+			new_node->round = graph->nrounds;
 			add_node_to_iter_list(graph, new_node,
 			    got_object_commit_get_committer_time(commit));
-			arg.tips[i].new_node = NULL;
+			arg.tips[i].listed = 1;
 		}
 		err = advance_branch(graph, commit_id, commit, repo);
 		if (err)
 			break;
+		if (commit->nparents == 0)
+			branch_ended = 1;
+	}
+	if (err)
+		goto done;
+
+	ntips = got_object_idset_num_elements(graph->open_branches);
+	if (branch_ended && ntips > 0 && graph->unjoined_round == 0)
+		graph->unjoined_round = graph->nrounds;
+	for (i = 0; i < arg.ntips; i++) {
+		struct got_object_qid *pid;
+		int nopen = 0;
+
+		if (!arg.tips[i].listed)
+			continue;
+		STAILQ_FOREACH(pid, &arg.tips[i].commit->parent_ids, entry) {
+			if (got_object_idset_contains(graph->open_branches,
+			    &pid->id))
+				nopen++;
+		}
+		arg.tips[i].new_node->dominates = (nopen == ntips);
 	}
 done:
 	for (i = 0; i < arg.ntips; i++) {
 		got_object_commit_close(arg.tips[i].commit);
-		free(arg.tips[i].new_node);
+		if (!arg.tips[i].listed)
+			free(arg.tips[i].new_node);
 	}
 	return err;
 }
@@ -613,33 +661,224 @@ got_commit_graph_iter_next(struct got_object_id *id,
 	}
 
 	memcpy(id, &node->id, sizeof(*id));
+	graph->iter_round = node->round;
+	graph->iter_dominates = node->dominates;
 
 	TAILQ_REMOVE(&graph->iter_list, node, entry);
 	free(node);
 	return NULL;
 }
 
+int
+got_commit_graph_iter_is_linear(struct got_commit_graph *graph)
+{
+	struct got_commit_graph_node *node;
+
+	if (graph->flags & GOT_COMMIT_GRAPH_FIRST_PARENT_TRAVERSAL)
+		return 1;
+
+	if (!graph->iter_dominates)
+		return 0;
+	if (graph->unjoined_round != 0 &&
+	    graph->iter_round >= graph->unjoined_round)
+		return 0;
+
+	/*
+	 * Commits fetched in the same round or earlier, on other branches,
+	 * are not necessarily ancestors of the commit just returned.
+	 */
+	TAILQ_FOREACH(node, &graph->iter_list, entry) {
+		if (node->round <= graph->iter_round)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Finding common ancestors works by "painting" commits reachable from two
+ * starting points. Commits are visited in order of descending committer
+ * timestamp, which approximates a topological order well enough in
+ * practice. A commit painted from both sides is a common ancestor, and
+ * so are all its parents. Once every queued commit is painted from both
+ * sides, no commit reachable from only one side remains to be found.
+ * Queued commits are kept in a red-black tree which serves as a priority
+ * queue, ordered by timestamp and then by ID.
+ */
+#define GOT_COMMIT_GRAPH_PAINT_LEFT	0x01
+#define GOT_COMMIT_GRAPH_PAINT_RIGHT	0x02
+#define GOT_COMMIT_GRAPH_PAINT_BOTH	\
+	(GOT_COMMIT_GRAPH_PAINT_LEFT | GOT_COMMIT_GRAPH_PAINT_RIGHT)
+
+struct got_commit_graph_paint_node {
+	struct got_object_id id;
+	time_t timestamp;
+	int flags;
+
+	/* Set while the node is queued. */
+	struct got_commit_object *commit;
+	RB_ENTRY(got_commit_graph_paint_node) entry;
+};
+
+static int
+paint_node_cmp(const struct got_commit_graph_paint_node *n1,
+    const struct got_commit_graph_paint_node *n2)
+{
+	/* The newest commit comes first. */
+	if (n1->timestamp > n2->timestamp)
+		return -1;
+	if (n1->timestamp < n2->timestamp)
+		return 1;
+	return got_object_id_cmp(&n1->id, &n2->id);
+}
+
+RB_HEAD(got_commit_graph_paint_queue, got_commit_graph_paint_node);
+RB_PROTOTYPE_STATIC(got_commit_graph_paint_queue, got_commit_graph_paint_node,
+    entry, paint_node_cmp);
+RB_GENERATE_STATIC(got_commit_graph_paint_queue, got_commit_graph_paint_node,
+    entry, paint_node_cmp);
+
+struct got_commit_graph_painter {
+	struct got_object_idset *nodes;
+	struct got_commit_graph_paint_queue queue;
+
+	/* Number of queued nodes which are not painted from both sides. */
+	int nactive;
+
+	int first_parent_traversal;
+};
+
+static void
+paint_enqueue(struct got_commit_graph_painter *p,
+    struct got_commit_graph_paint_node *node)
+{
+	RB_INSERT(got_commit_graph_paint_queue, &p->queue, node);
+	if (node->flags != GOT_COMMIT_GRAPH_PAINT_BOTH)
+		p->nactive++;
+}
+
 static const struct got_error *
-find_yca_add_id(struct got_object_id **yca_id, struct got_commit_graph *graph,
-    struct got_object_idset *commit_ids, struct got_repository *repo,
+paint_commit(struct got_commit_graph_painter *p, struct got_object_id *id,
+    int flags, struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_commit_graph_paint_node *node;
+
+	node = got_object_idset_get(p->nodes, id);
+	if (node) {
+		if ((node->flags & flags) == flags)
+			return NULL;
+		if (node->commit) {
+			/* Still queued; its parents will see the new flags. */
+			node->flags |= flags;
+			if (node->flags == GOT_COMMIT_GRAPH_PAINT_BOTH)
+				p->nactive--;
+			return NULL;
+		}
+		/* Already visited; visit again to pass new flags on. */
+		node->flags |= flags;
+	} else {
+		node = calloc(1, sizeof(*node));
+		if (node == NULL)
+			return got_error_from_errno("calloc");
+		memcpy(&node->id, id, sizeof(node->id));
+		node->flags = flags;
+		err = got_object_idset_add(p->nodes, &node->id, node);
+		if (err) {
+			free(node);
+			return err;
+		}
+	}
+
+	err = got_object_open_as_commit(&node->commit, repo, &node->id);
+	if (err)
+		return err;
+	node->timestamp = got_object_commit_get_committer_time(node->commit);
+	paint_enqueue(p, node);
+	return NULL;
+}
+
+static const struct got_error *
+free_paint_node(struct got_object_id *id, void *data, void *arg)
+{
+	struct got_commit_graph_paint_node *node = data;
+
+	if (node->commit)
+		got_object_commit_close(node->commit);
+	free(node);
+	return NULL;
+}
+
+static void
+painter_free(struct got_commit_graph_painter *p)
+{
+	if (p->nodes == NULL)
+		return;
+	got_object_idset_for_each(p->nodes, free_paint_node, NULL);
+	got_object_idset_free(p->nodes);
+	p->nodes = NULL;
+}
+
+/*
+ * Paint ancestors of commit_id and commit_id2 until no commit reachable
+ * from only one side remains queued. If yca_id is not NULL, stop early
+ * and return the first commit found to be reachable from both sides.
+ */
+static const struct got_error *
+paint_down_to_common(struct got_object_id **yca_id,
+    struct got_commit_graph_painter *p, struct got_object_id *commit_id,
+    struct got_object_id *commit_id2, struct got_repository *repo,
     got_cancel_cb cancel_cb, void *cancel_arg)
 {
 	const struct got_error *err = NULL;
-	struct got_object_id id;
 
-	err = got_commit_graph_iter_next(&id, graph, repo, cancel_cb,
-	    cancel_arg);
+	err = paint_commit(p, commit_id, GOT_COMMIT_GRAPH_PAINT_LEFT, repo);
 	if (err)
 		return err;
-
-	if (got_object_idset_contains(commit_ids, &id)) {
-		*yca_id = got_object_id_dup(&id);
-		if (*yca_id == NULL)
-			err = got_error_from_errno("got_object_id_dup");
+	err = paint_commit(p, commit_id2, GOT_COMMIT_GRAPH_PAINT_RIGHT, repo);
+	if (err)
 		return err;
+
+	while (!RB_EMPTY(&p->queue) && (yca_id || p->nactive > 0)) {
+		struct got_commit_graph_paint_node *node;
+		struct got_commit_object *commit;
+		struct got_object_qid *pid;
+
+		if (cancel_cb) {
+			err = (*cancel_cb)(cancel_arg);
+			if (err)
+				return err;
+		}
+
+		node = RB_MIN(got_commit_graph_paint_queue, &p->queue);
+		RB_REMOVE(got_commit_graph_paint_queue, &p->queue, node);
+		commit = node->commit;
+		node->commit = NULL;
+
+		if (node->flags == GOT_COMMIT_GRAPH_PAINT_BOTH) {
+			if (yca_id) {
+				got_object_commit_close(commit);
+				*yca_id = got_object_id_dup(&node->id);
+				if (*yca_id == NULL)
+					return got_error_from_errno(
+					    "got_object_id_dup");
+				return NULL;
+			}
+		} else
+			p->nactive--;
+
+		STAILQ_FOREACH(pid, &commit->parent_ids, entry) {
+			err = paint_commit(p, &pid->id, node->flags, repo);
+			if (err)
+				break;
+			if (p->first_parent_traversal)
+				break;
+		}
+		got_object_commit_close(commit);
+		if (err)
+			return err;
 	}
 
-	return got_object_idset_add(commit_ids, &id, NULL);
+	return NULL;
 }
 
 const struct got_error *
@@ -649,77 +888,76 @@ got_commit_graph_find_youngest_common_ancestor(struct got_object_id **yca_id,
     struct got_repository *repo, got_cancel_cb cancel_cb, void *cancel_arg)
 {
 	const struct got_error *err = NULL;
-	struct got_commit_graph *graph = NULL, *graph2 = NULL;
-	int completed = 0, completed2 = 0;
-	struct got_object_idset *commit_ids;
+	struct got_commit_graph_painter p;
 
 	*yca_id = NULL;
 
-	commit_ids = got_object_idset_alloc();
-	if (commit_ids == NULL)
+	memset(&p, 0, sizeof(p));
+	RB_INIT(&p.queue);
+	p.first_parent_traversal = first_parent_traversal;
+	p.nodes = got_object_idset_alloc();
+	if (p.nodes == NULL)
 		return got_error_from_errno("got_object_idset_alloc");
 
-	err = got_commit_graph_open(&graph, "/", first_parent_traversal);
-	if (err)
-		goto done;
+	err = paint_down_to_common(yca_id, &p, commit_id, commit_id2, repo,
+	    cancel_cb, cancel_arg);
+	if (err == NULL && *yca_id == NULL)
+		err = got_error(GOT_ERR_ANCESTRY);
 
-	err = got_commit_graph_open(&graph2, "/", first_parent_traversal);
-	if (err)
-		goto done;
+	painter_free(&p);
+	return err;
+}
+
+struct count_ahead_behind_arg {
+	int ahead;
+	int behind;
+};
+
+static const struct got_error *
+count_ahead_behind(struct got_object_id *id, void *data, void *arg)
+{
+	struct got_commit_graph_paint_node *node = data;
+	struct count_ahead_behind_arg *a = arg;
+
+	if (node->flags == GOT_COMMIT_GRAPH_PAINT_LEFT)
+		a->ahead++;
+	else if (node->flags == GOT_COMMIT_GRAPH_PAINT_RIGHT)
+		a->behind++;
+	return NULL;
+}
 
-	err = got_commit_graph_iter_start(graph, commit_id, repo,
+const struct got_error *
+got_commit_graph_count_ahead_behind(int *ahead, int *behind,
+    struct got_object_id *commit_id, struct got_object_id *commit_id2,
+    int first_parent_traversal, struct got_repository *repo,
+    got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	struct got_commit_graph_painter p;
+	struct count_ahead_behind_arg arg;
+
+	*ahead = 0;
+	*behind = 0;
+
+	memset(&p, 0, sizeof(p));
+	RB_INIT(&p.queue);
+	p.first_parent_traversal = first_parent_traversal;
+	p.nodes = got_object_idset_alloc();
+	if (p.nodes == NULL)
+		return got_error_from_errno("got_object_idset_alloc");
+
+	err = paint_down_to_common(NULL, &p, commit_id, commit_id2, repo,
 	    cancel_cb, cancel_arg);
 	if (err)
 		goto done;
 
-	err = got_commit_graph_iter_start(graph2, commit_id2, repo,
-	    cancel_cb, cancel_arg);
+	memset(&arg, 0, sizeof(arg));
+	err = got_object_idset_for_each(p.nodes, count_ahead_behind, &arg);
 	if (err)
 		goto done;
-
-	for (;;) {
-		if (cancel_cb) {
-			err = (*cancel_cb)(cancel_arg);
-			if (err)
-				break;
-		}
-
-		if (!completed) {
-			err = find_yca_add_id(yca_id, graph, commit_ids, repo,
-			    cancel_cb, cancel_arg);
-			if (err) {
-				if (err->code != GOT_ERR_ITER_COMPLETED)
-					break;
-				err = NULL;
-				completed = 1;
-			}
-			if (*yca_id)
-				break;
-		}
-
-		if (!completed2) {
-			err = find_yca_add_id(yca_id, graph2, commit_ids, repo,
-			    cancel_cb, cancel_arg);
-			if (err) {
-				if (err->code != GOT_ERR_ITER_COMPLETED)
-					break;
-				err = NULL;
-				completed2 = 1;
-			}
-			if (*yca_id)
-				break;
-		}
-
-		if (completed && completed2) {
-			err = got_error(GOT_ERR_ANCESTRY);
-			break;
-		}
-	}
+	*ahead = arg.ahead;
+	*behind = arg.behind;
 done:
-	got_object_idset_free(commit_ids);
-	if (graph)
-		got_commit_graph_close(graph);
-	if (graph2)
-		got_commit_graph_close(graph2);
+	painter_free(&p);
 	return err;
 }
@@ -17,19 +17,21 @@
 #include <sys/queue.h>
 #include <sys/stat.h>
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <sha1.h>
+#include <unistd.h>
 #include <zlib.h>
 
 #include "got_object.h"
 #include "got_repository.h"
 #include "got_error.h"
+#include "got_cancel.h"
 #include "got_diff.h"
 #include "got_path.h"
-#include "got_cancel.h"
 #include "got_worktree.h"
 #include "got_opentemp.h"
 
@@ -37,6 +39,11 @@
 #include "got_lib_delta.h"
 #include "got_lib_inflate.h"
 #include "got_lib_object.h"
+#include "got_lib_object_parse.h"
+
+#ifndef MIN
+#define	MIN(_a,_b) ((_a) < (_b) ? (_a) : (_b))
+#endif
 
 #ifndef MAX
 #define	MAX(_a,_b) ((_a) > (_b) ? (_a) : (_b))
@@ -77,12 +84,33 @@ diffstat_field_width(size_t *maxlen, int *add_cols, int *rm_cols, size_t len,
 	*rm_cols = MAX(*rm_cols, d2);
 }
 
+static const struct got_error *
+diffstat_add_change(struct got_diffstat_cb_arg *ds, const char *path,
+    struct got_diff_changed_path *change)
+{
+	const struct got_error *err;
+	struct got_pathlist_entry *pe;
+
+	ds->ins += change->add;
+	ds->del += change->rm;
+	++ds->nfiles;
+
+	err = got_pathlist_append(ds->paths, path, change);
+	if (err)
+		return err;
+
+	pe = TAILQ_LAST(ds->paths, got_pathlist_head);
+	diffstat_field_width(&ds->max_path_len, &ds->add_cols, &ds->rm_cols,
+	    pe->path_len, change->add, change->rm);
+
+	return NULL;
+}
+
 static const struct got_error *
 get_diffstat(struct got_diffstat_cb_arg *ds, const char *path,
     struct diff_result *r, int force_text, int status)
 {
 	const struct got_error *err;
-	struct got_pathlist_entry *pe;
 	struct got_diff_changed_path *change = NULL;
 	int flags = (r->left->atomizer_flags | r->right->atomizer_flags);
 	int isbin = (flags & DIFF_ATOMIZER_FOUND_BINARY_DATA);
@@ -109,27 +137,22 @@ get_diffstat(struct got_diffstat_cb_arg *ds, const char *path,
 	}
 
 	change->status = status;
-	ds->ins += change->add;
-	ds->del += change->rm;
-	++ds->nfiles;
-
-	err = got_pathlist_append(ds->paths, path, change);
-	if (err) {
+	err = diffstat_add_change(ds, path, change);
+	if (err)
 		free(change);
-		return err;
-	}
-
-	pe = TAILQ_LAST(ds->paths, got_pathlist_head);
-	diffstat_field_width(&ds->max_path_len, &ds->add_cols, &ds->rm_cols,
-	    pe->path_len, change->add, change->rm);
-
-	return NULL;
+	return err;
 }
 
+/*
+ * Diff blob contents which have already been written to f1 and f2.
+ * The blob IDs may be NULL to indicate that no content is present on
+ * their respective side of the diff. This function does not access the
+ * repository and may run in threads other than the main thread.
+ */
 static const struct got_error *
-diff_blobs(struct got_diff_line **lines, size_t *nlines,
-    struct got_diffreg_result **resultp, struct got_blob_object *blob1,
-    struct got_blob_object *blob2, FILE *f1, FILE *f2,
+diff_blob_files(struct got_diff_line **lines, size_t *nlines,
+    struct got_diffreg_result **resultp, FILE *f1, FILE *f2,
+    struct got_object_id *id1, struct got_object_id *id2,
     const char *label1, const char *label2, mode_t mode1, mode_t mode2,
     int diff_context, int ignore_whitespace, int force_text_diff,
     struct got_diffstat_cb_arg *diffstat, FILE *outfile,
@@ -140,7 +163,6 @@ diff_blobs(struct got_diff_line **lines, size_t *nlines,
 	char hex2[GOT_OBJECT_ID_HEX_MAXLEN];
 	const char *idstr1 = NULL, *idstr2 = NULL;
 	char *modestr1 = NULL, *modestr2 = NULL;
-	off_t size1, size2;
 	struct got_diffreg_result *result = NULL;
 	off_t outoff = 0;
 	int n;
@@ -156,35 +178,14 @@ diff_blobs(struct got_diff_line **lines, size_t *nlines,
 	if (resultp)
 		*resultp = NULL;
 
-	if (f1) {
-		err = got_opentemp_truncate(f1);
-		if (err)
-			goto done;
-	}
-	if (f2) {
-		err = got_opentemp_truncate(f2);
-		if (err)
-			goto done;
-	}
-
-	size1 = 0;
-	if (blob1) {
-		idstr1 = got_object_blob_id_str(blob1, hex1, sizeof(hex1));
-		err = got_object_blob_dump_to_file(&size1, NULL, NULL, f1,
-		    blob1);
-		if (err)
-			goto done;
-	} else
+	if (id1)
+		idstr1 = got_object_id_hex(id1, hex1, sizeof(hex1));
+	else
 		idstr1 = "/dev/null";
 
-	size2 = 0;
-	if (blob2) {
-		idstr2 = got_object_blob_id_str(blob2, hex2, sizeof(hex2));
-		err = got_object_blob_dump_to_file(&size2, NULL, NULL, f2,
-		    blob2);
-		if (err)
-			goto done;
-	} else
+	if (id2)
+		idstr2 = got_object_id_hex(id2, hex2, sizeof(hex2));
+	else
 		idstr2 = "/dev/null";
 
 	if (outfile) {
@@ -246,9 +247,9 @@ diff_blobs(struct got_diff_line **lines, size_t *nlines,
 		char	*path = NULL;
 		int	 status = GOT_STATUS_NO_CHANGE;
 
-		if (blob1 == NULL)
+		if (id1 == NULL)
 			status = GOT_STATUS_ADD;
-		else if (blob2 == NULL)
+		else if (id2 == NULL)
 			status = GOT_STATUS_DELETE;
 		else {
 			if (strcmp(idstr1, idstr2) != 0)
@@ -286,7 +287,7 @@ diff_blobs(struct got_diff_line **lines, size_t *nlines,
 
 	if (outfile) {
 		err = got_diffreg_output(lines, nlines, result,
-		    blob1 != NULL, blob2 != NULL,
+		    id1 != NULL, id2 != NULL,
 		    label1 ? label1 : idstr1,
 		    label2 ? label2 : idstr2,
 		    GOT_DIFF_OUTPUT_UNIDIFF, diff_context, outfile);
@@ -308,6 +309,61 @@ done:
 	return err;
 }
 
+static const struct got_error *
+diff_blobs(struct got_diff_line **lines, size_t *nlines,
+    struct got_diffreg_result **resultp, struct got_blob_object *blob1,
+    struct got_blob_object *blob2, FILE *f1, FILE *f2,
+    const char *label1, const char *label2, mode_t mode1, mode_t mode2,
+    int diff_context, int ignore_whitespace, int force_text_diff,
+    struct got_diffstat_cb_arg *diffstat, FILE *outfile,
+    enum got_diff_algorithm diff_algo)
+{
+	const struct got_error *err;
+
+	if (resultp)
+		*resultp = NULL;
+
+	if (f1) {
+		err = got_opentemp_truncate(f1);
+		if (err)
+			return err;
+	}
+	if (f2) {
+		err = got_opentemp_truncate(f2);
+		if (err)
+			return err;
+	}
+
+	if (blob1) {
+		err = got_object_blob_dump_to_file(NULL, NULL, NULL, f1,
+		    blob1);
+		if (err)
+			return err;
+	}
+
+	if (blob2) {
+		err = got_object_blob_dump_to_file(NULL, NULL, NULL, f2,
+		    blob2);
+		if (err)
+			return err;
+	}
+
+	return diff_blob_files(lines, nlines, resultp, f1, f2,
+	    blob1 ? &blob1->id : NULL, blob2 ? &blob2->id : NULL,
+	    label1, label2, mode1, mode2, diff_context, ignore_whitespace,
+	    force_text_diff, diffstat, outfile, diff_algo);
+}
+
+static const struct got_error *
+diff_report_progress(struct got_diff_blob_output_unidiff_arg *a)
+{
+	if (a->progress_cb == NULL)
+		return NULL;
+	if (a->outfile && fflush(a->outfile) == EOF)
+		return got_ferror(a->outfile, GOT_ERR_IO);
+	return a->progress_cb(a->progress_arg, a->lines, a->nlines);
+}
+
 const struct got_error *
 got_diff_blob_output_unidiff(void *arg, struct got_blob_object *blob1,
     struct got_blob_object *blob2, FILE *f1, FILE *f2,
@@ -315,12 +371,23 @@ got_diff_blob_output_unidiff(void *arg, struct got_blob_object *blob1,
     const char *label1, const char *label2, mode_t mode1, mode_t mode2,
     struct got_repository *repo)
 {
+	const struct got_error *err;
 	struct got_diff_blob_output_unidiff_arg *a = arg;
 
-	return diff_blobs(&a->lines, &a->nlines, NULL,
+	if (a->cancel_cb) {
+		err = a->cancel_cb(a->cancel_arg);
+		if (err)
+			return err;
+	}
+
+	err = diff_blobs(&a->lines, &a->nlines, NULL,
 	    blob1, blob2, f1, f2, label1, label2, mode1, mode2, a->diff_context,
 	    a->ignore_whitespace, a->force_text_diff, a->diffstat, a->outfile,
 	    a->diff_algo);
+	if (err)
+		return err;
+
+	return diff_report_progress(a);
 }
 
 const struct got_error *
@@ -987,6 +1054,500 @@ done:
 	return err;
 }
 
+/*
+ * Diffing trees with many changed files, such as large imports of vendor
+ * code, is sped up by diffing several files at once. Objects can only be
+ * read from the repository by the main thread, which loads the blobs of
+ * changed files into a ring of slots while worker threads diff the files
+ * in these slots. Results are written to the output in tree order.
+ */
+#define GOT_DIFF_TREE_MAX_THREADS	8
+
+/* Below this number of changed files threads are not worth starting. */
+#define GOT_DIFF_TREE_MIN_PARALLEL	4
+
+struct got_diff_tree_change {
+	struct got_object_id id1;
+	struct got_object_id id2;
+	int have_id1;
+	int have_id2;
+	char *label1;
+	char *label2;
+	mode_t mode1;
+	mode_t mode2;
+};
+
+struct got_diff_tree_changes {
+	struct got_diff_tree_change *changes;
+	size_t nchanges;
+	size_t nalloc;
+};
+
+struct got_diff_tree_slot {
+	struct got_diff_tree_change *change;
+	FILE *f1;
+	FILE *f2;
+	FILE *outfile;
+	struct got_diff_line *lines;
+	size_t nlines;
+	struct got_pathlist_head paths;
+	const struct got_error *err;
+	int done;
+};
+
+struct got_diff_tree_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct got_diff_tree_slot *slots;
+	size_t nslots;
+	size_t nloaded;		/* number of changes loaded into slots */
+	size_t next;		/* next change which needs to be diffed */
+	int quit;
+	struct got_diff_blob_output_unidiff_arg *arg;
+};
+
+static const struct got_error *
+diff_tree_queue_change(void *arg, struct got_blob_object *blob1,
+    struct got_blob_object *blob2, FILE *f1, FILE *f2,
+    struct got_object_id *id1, struct got_object_id *id2,
+    const char *label1, const char *label2,
+    mode_t mode1, mode_t mode2, struct got_repository *repo)
+{
+	struct got_diff_tree_changes *q = arg;
+	struct got_diff_tree_change *c;
+
+	if (q->nchanges == q->nalloc) {
+		size_t nalloc = q->nalloc ? q->nalloc * 2 : 64;
+
+		c = recallocarray(q->changes, q->nalloc, nalloc, sizeof(*c));
+		if (c == NULL)
+			return got_error_from_errno("recallocarray");
+		q->changes = c;
+		q->nalloc = nalloc;
+	}
+
+	c = &q->changes[q->nchanges];
+	if (id1) {
+		memcpy(&c->id1, id1, sizeof(c->id1));
+		c->have_id1 = 1;
+	}
+	if (id2) {
+		memcpy(&c->id2, id2, sizeof(c->id2));
+		c->have_id2 = 1;
+	}
+	if (label1) {
+		c->label1 = strdup(label1);
+		if (c->label1 == NULL)
+			return got_error_from_errno("strdup");
+	}
+	if (label2) {
+		c->label2 = strdup(label2);
+		if (c->label2 == NULL) {
+			free(c->label1);
+			c->label1 = NULL;
+			return got_error_from_errno("strdup");
+		}
+	}
+	c->mode1 = mode1;
+	c->mode2 = mode2;
+	q->nchanges++;
+	return NULL;
+}
+
+static const struct got_error *
+diff_tree_load_blob(FILE **f, struct got_object_id *id, int fd,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_blob_object *blob = NULL;
+
+	if (*f == NULL) {
+		*f = got_opentemp();
+		if (*f == NULL)
+			return got_error_from_errno("got_opentemp");
+	} else {
+		err = got_opentemp_truncate(*f);
+		if (err)
+			return err;
+	}
+
+	if (id == NULL)
+		return NULL;
+
+	err = got_object_open_as_blob(&blob, repo, id, 8192, fd);
+	if (err)
+		return err;
+	err = got_object_blob_dump_to_file(NULL, NULL, NULL, *f, blob);
+	got_object_blob_close(blob);
+	return err;
+}
+
+static const struct got_error *
+diff_tree_load_slot(struct got_diff_tree_slot *slot,
+    struct got_diff_tree_change *c, int fd1, int fd2, int want_output,
+    struct got_repository *repo)
+{
+	const struct got_error *err;
+
+	slot->change = c;
+	slot->err = NULL;
+	slot->done = 0;
+
+	err = diff_tree_load_blob(&slot->f1, c->have_id1 ? &c->id1 : NULL,
+	    fd1, repo);
+	if (err)
+		return err;
+	err = diff_tree_load_blob(&slot->f2, c->have_id2 ? &c->id2 : NULL,
+	    fd2, repo);
+	if (err)
+		return err;
+
+	if (!want_output)
+		return NULL;
+	if (slot->outfile == NULL) {
+		slot->outfile = got_opentemp();
+		if (slot->outfile == NULL)
+			return got_error_from_errno("got_opentemp");
+		return NULL;
+	}
+	return got_opentemp_truncate(slot->outfile);
+}
+
+static void
+diff_tree_run_slot(struct got_diff_tree_slot *slot,
+    struct got_diff_blob_output_unidiff_arg *arg)
+{
+	struct got_diff_tree_change *c = slot->change;
+	struct got_diffstat_cb_arg ds;
+
+	memset(&ds, 0, sizeof(ds));
+	ds.paths = &slot->paths;
+
+	slot->err = diff_blob_files(&slot->lines, &slot->nlines, NULL,
+	    slot->f1, slot->f2, c->have_id1 ? &c->id1 : NULL,
+	    c->have_id2 ? &c->id2 : NULL, c->label1, c->label2,
+	    c->mode1, c->mode2, arg->diff_context, arg->ignore_whitespace,
+	    arg->force_text_diff, arg->diffstat ? &ds : NULL, slot->outfile,
+	    arg->diff_algo);
+}
+
+/*
+ * Append the output, line metadata, and diffstat of a diffed slot to
+ * the results of the slots which were emitted before.
+ */
+static const struct got_error *
+diff_tree_emit_slot(struct got_diff_tree_slot *slot,
+    struct got_diff_blob_output_unidiff_arg *arg)
+{
+	const struct got_error *err = NULL;
+	struct got_pathlist_entry *pe;
+	struct got_diff_line *p;
+	off_t outoff = 0;
+	size_t i, n;
+	char buf[8192];
+
+	if (arg->nlines > 0)
+		outoff = arg->lines[arg->nlines - 1].offset;
+	else {
+		err = add_line_metadata(&arg->lines, &arg->nlines, 0,
+		    GOT_DIFF_LINE_NONE);
+		if (err)
+			goto done;
+	}
+
+	/* The first line of each slot is a placeholder at offset zero. */
+	if (slot->nlines > 1) {
+		p = reallocarray(arg->lines, arg->nlines + slot->nlines - 1,
+		    sizeof(*arg->lines));
+		if (p == NULL) {
+			err = got_error_from_errno("reallocarray");
+			goto done;
+		}
+		arg->lines = p;
+		for (i = 1; i < slot->nlines; i++) {
+			p = &arg->lines[arg->nlines++];
+			p->offset = outoff + slot->lines[i].offset;
+			p->type = slot->lines[i].type;
+		}
+	}
+
+	if (arg->outfile) {
+		if (fseeko(slot->outfile, 0L, SEEK_SET) == -1) {
+			err = got_error_from_errno("fseeko");
+			goto done;
+		}
+		while ((n = fread(buf, 1, sizeof(buf), slot->outfile)) > 0) {
+			if (fwrite(buf, 1, n, arg->outfile) != n) {
+				err = got_ferror(arg->outfile, GOT_ERR_IO);
+				goto done;
+			}
+		}
+		if (ferror(slot->outfile)) {
+			err = got_ferror(slot->outfile, GOT_ERR_IO);
+			goto done;
+		}
+	}
+
+	pe = TAILQ_FIRST(&slot->paths);
+	if (arg->diffstat && pe) {
+		err = diffstat_add_change(arg->diffstat, pe->path, pe->data);
+		if (err)
+			goto done;
+		got_pathlist_free(&slot->paths, GOT_PATHLIST_FREE_NONE);
+	}
+done:
+	got_pathlist_free(&slot->paths, GOT_PATHLIST_FREE_ALL);
+	free(slot->lines);
+	slot->lines = NULL;
+	slot->nlines = 0;
+	return err;
+}
+
+static void *
+diff_tree_thread(void *arg)
+{
+	struct got_diff_tree_pool *pool = arg;
+	struct got_diff_tree_slot *slot;
+
+	if (pthread_mutex_lock(&pool->mutex) != 0)
+		return NULL;
+
+	for (;;) {
+		while (!pool->quit && pool->next >= pool->nloaded) {
+			if (pthread_cond_wait(&pool->cond, &pool->mutex) != 0)
+				goto done;
+		}
+		if (pool->quit)
+			break;
+
+		slot = &pool->slots[pool->next++ % pool->nslots];
+		if (pthread_mutex_unlock(&pool->mutex) != 0)
+			return NULL;
+
+		diff_tree_run_slot(slot, pool->arg);
+
+		if (pthread_mutex_lock(&pool->mutex) != 0)
+			return NULL;
+		slot->done = 1;
+		pthread_cond_broadcast(&pool->cond);
+	}
+done:
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+static const struct got_error *
+diff_tree_wait_slot(struct got_diff_tree_pool *pool, size_t idx)
+{
+	struct got_diff_tree_slot *slot = &pool->slots[idx % pool->nslots];
+	int errcode;
+
+	errcode = pthread_mutex_lock(&pool->mutex);
+	if (errcode)
+		return got_error_set_errno(errcode, "pthread_mutex_lock");
+
+	/*
+	 * Changes are picked up in order. If no thread has started on
+	 * this change yet then diff it here instead of waiting idly.
+	 */
+	if (pool->next == idx) {
+		pool->next++;
+		errcode = pthread_mutex_unlock(&pool->mutex);
+		if (errcode)
+			return got_error_set_errno(errcode,
+			    "pthread_mutex_unlock");
+		diff_tree_run_slot(slot, pool->arg);
+		return NULL;
+	}
+
+	while (!slot->done) {
+		errcode = pthread_cond_wait(&pool->cond, &pool->mutex);
+		if (errcode) {
+			pthread_mutex_unlock(&pool->mutex);
+			return got_error_set_errno(errcode,
+			    "pthread_cond_wait");
+		}
+	}
+
+	errcode = pthread_mutex_unlock(&pool->mutex);
+	if (errcode)
+		return got_error_set_errno(errcode, "pthread_mutex_unlock");
+	return NULL;
+}
+
+const struct got_error *
+got_diff_tree_parallel(struct got_tree_object *tree1,
+    struct got_tree_object *tree2, int fd1, int fd2,
+    const char *label1, const char *label2, struct got_repository *repo,
+    struct got_diff_blob_output_unidiff_arg *arg)
+{
+	const struct got_error *err = NULL;
+	struct got_diff_tree_changes q;
+	struct got_diff_tree_pool pool;
+	pthread_t threads[GOT_DIFF_TREE_MAX_THREADS];
+	size_t i, nthreads = 0, maxthreads = 0, nloaded = 0;
+	long ncpu;
+	int errcode, have_mutex = 0, have_cond = 0;
+
+	memset(&q, 0, sizeof(q));
+	memset(&pool, 0, sizeof(pool));
+	pool.arg = arg;
+
+	err = got_diff_tree(tree1, tree2, NULL, NULL, -1, -1, label1, label2,
+	    repo, diff_tree_queue_change, &q, 0);
+	if (err || q.nchanges == 0)
+		goto done;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (q.nchanges >= GOT_DIFF_TREE_MIN_PARALLEL && ncpu > 1)
+		maxthreads = MIN(ncpu - 1, GOT_DIFF_TREE_MAX_THREADS);
+
+	/*
+	 * Each slot holds up to three open temporary files. Provide enough
+	 * slots to keep all threads busy while the main thread is loading
+	 * blobs or writing output.
+	 */
+	pool.nslots = MIN(2 * (maxthreads + 1), q.nchanges);
+	pool.slots = calloc(pool.nslots, sizeof(*pool.slots));
+	if (pool.slots == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	for (i = 0; i < pool.nslots; i++)
+		TAILQ_INIT(&pool.slots[i].paths);
+
+	errcode = pthread_mutex_init(&pool.mutex, NULL);
+	if (errcode) {
+		err = got_error_set_errno(errcode, "pthread_mutex_init");
+		goto done;
+	}
+	have_mutex = 1;
+	errcode = pthread_cond_init(&pool.cond, NULL);
+	if (errcode) {
+		err = got_error_set_errno(errcode, "pthread_cond_init");
+		goto done;
+	}
+	have_cond = 1;
+
+	for (i = 0; i < maxthreads; i++) {
+		errcode = pthread_create(&threads[i], NULL, diff_tree_thread,
+		    &pool);
+		if (errcode) {
+			/*
+			 * Threads are an optimization only. The main thread
+			 * diffs any changes which are not picked up by the
+			 * threads we already have, if any.
+			 */
+			break;
+		}
+		nthreads++;
+	}
+
+	for (i = 0; i < q.nchanges; i++) {
+		struct got_diff_tree_slot *slot;
+
+		while (nloaded < q.nchanges && nloaded < i + pool.nslots) {
+			err = diff_tree_load_slot(
+			    &pool.slots[nloaded % pool.nslots],
+			    &q.changes[nloaded], fd1, fd2,
+			    arg->outfile != NULL, repo);
+			if (err)
+				goto done;
+			nloaded++;
+
+			errcode = pthread_mutex_lock(&pool.mutex);
+			if (errcode) {
+				err = got_error_set_errno(errcode,
+				    "pthread_mutex_lock");
+				goto done;
+			}
+			pool.nloaded = nloaded;
+			pthread_cond_broadcast(&pool.cond);
+			errcode = pthread_mutex_unlock(&pool.mutex);
+			if (errcode) {
+				err = got_error_set_errno(errcode,
+				    "pthread_mutex_unlock");
+				goto done;
+			}
+		}
+
+		if (arg->cancel_cb) {
+			err = arg->cancel_cb(arg->cancel_arg);
+			if (err)
+				goto done;
+		}
+
+		err = diff_tree_wait_slot(&pool, i);
+		if (err)
+			goto done;
+
+		slot = &pool.slots[i % pool.nslots];
+		if (slot->err) {
+			err = slot->err;
+			goto done;
+		}
+		err = diff_tree_emit_slot(slot, arg);
+		if (err)
+			goto done;
+		err = diff_report_progress(arg);
+		if (err)
+			goto done;
+	}
+done:
+	if (nthreads > 0) {
+		errcode = pthread_mutex_lock(&pool.mutex);
+		if (errcode && err == NULL)
+			err = got_error_set_errno(errcode,
+			    "pthread_mutex_lock");
+		pool.quit = 1;
+		pthread_cond_broadcast(&pool.cond);
+		if (errcode == 0) {
+			errcode = pthread_mutex_unlock(&pool.mutex);
+			if (errcode && err == NULL)
+				err = got_error_set_errno(errcode,
+				    "pthread_mutex_unlock");
+		}
+		for (i = 0; i < nthreads; i++) {
+			errcode = pthread_join(threads[i], NULL);
+			if (errcode && err == NULL)
+				err = got_error_set_errno(errcode,
+				    "pthread_join");
+		}
+	}
+	if (have_cond) {
+		errcode = pthread_cond_destroy(&pool.cond);
+		if (errcode && err == NULL)
+			err = got_error_set_errno(errcode,
+			    "pthread_cond_destroy");
+	}
+	if (have_mutex) {
+		errcode = pthread_mutex_destroy(&pool.mutex);
+		if (errcode && err == NULL)
+			err = got_error_set_errno(errcode,
+			    "pthread_mutex_destroy");
+	}
+	for (i = 0; i < pool.nslots; i++) {
+		struct got_diff_tree_slot *slot = &pool.slots[i];
+
+		if (slot->f1 && fclose(slot->f1) == EOF && err == NULL)
+			err = got_error_from_errno("fclose");
+		if (slot->f2 && fclose(slot->f2) == EOF && err == NULL)
+			err = got_error_from_errno("fclose");
+		if (slot->outfile && fclose(slot->outfile) == EOF &&
+		    err == NULL)
+			err = got_error_from_errno("fclose");
+		free(slot->lines);
+		got_pathlist_free(&slot->paths, GOT_PATHLIST_FREE_ALL);
+	}
+	free(pool.slots);
+	for (i = 0; i < q.nchanges; i++) {
+		free(q.changes[i].label1);
+		free(q.changes[i].label2);
+	}
+	free(q.changes);
+	return err;
+}
+
 const struct got_error *
 got_diff_objects_as_blobs(struct got_diff_line **lines, size_t *nlines,
     FILE *f1, FILE *f2, int fd1, int fd2,
@@ -1188,8 +1749,10 @@ diff_objects_as_trees(struct got_diff_line **lines, size_t *nlines,
     struct got_object_id *id1, struct got_object_id *id2,
     struct got_pathlist_head *paths, const char *label1, const char *label2,
     int diff_context, int ignore_whitespace, int force_text_diff,
-    struct got_diffstat_cb_arg *dsa, struct got_repository *repo,
-    FILE *outfile, enum got_diff_algorithm diff_algo)
+    struct got_diffstat_cb_arg *dsa, got_diff_progress_cb progress_cb,
+    void *progress_arg, got_cancel_cb cancel_cb, void *cancel_arg,
+    struct got_repository *repo, FILE *outfile,
+    enum got_diff_algorithm diff_algo)
 {
 	const struct got_error *err;
 	struct got_tree_object *tree1 = NULL, *tree2 = NULL;
@@ -1216,6 +1779,10 @@ diff_objects_as_trees(struct got_diff_line **lines, size_t *nlines,
 	arg.force_text_diff = force_text_diff;
 	arg.diffstat = dsa;
 	arg.outfile = outfile;
+	arg.cancel_cb = cancel_cb;
+	arg.cancel_arg = cancel_arg;
+	arg.progress_cb = want_linemeta ? progress_cb : NULL;
+	arg.progress_arg = progress_arg;
 	if (want_linemeta) {
 		arg.lines = *lines;
 		arg.nlines = *nlines;
@@ -1224,8 +1791,8 @@ diff_objects_as_trees(struct got_diff_line **lines, size_t *nlines,
 		arg.nlines = 0;
 	}
 	if (paths == NULL || TAILQ_EMPTY(paths))
-		err = got_diff_tree(tree1, tree2, f1, f2, fd1, fd2, label1,
-		    label2, repo, got_diff_blob_output_unidiff, &arg, 1);
+		err = got_diff_tree_parallel(tree1, tree2, fd1, fd2, label1,
+		    label2, repo, &arg);
 	else
 		err = diff_paths(tree1, tree2, f1, f2, fd1, fd2, paths, repo,
 		    got_diff_blob_output_unidiff, &arg);
@@ -1248,6 +1815,8 @@ got_diff_objects_as_trees(struct got_diff_line **lines, size_t *nlines,
     struct got_pathlist_head *paths, const char *label1, const char *label2,
     enum got_diff_algorithm diff_algo, int diff_context, int ignore_whitespace,
     int force_text_diff, struct got_diffstat_cb_arg *dsa,
+    got_diff_progress_cb progress_cb, void *progress_arg,
+    got_cancel_cb cancel_cb, void *cancel_arg,
     struct got_repository *repo, FILE *outfile)
 {
 	const struct got_error *err;
@@ -1290,7 +1859,8 @@ got_diff_objects_as_trees(struct got_diff_line **lines, size_t *nlines,
 
 	err = diff_objects_as_trees(lines, nlines, f1, f2, fd1, fd2, id1, id2,
 	    paths, label1, label2, diff_context, ignore_whitespace,
-	    force_text_diff, dsa, repo, outfile, diff_algo);
+	    force_text_diff, dsa, progress_cb, progress_arg, cancel_cb,
+	    cancel_arg, repo, outfile, diff_algo);
 done:
 	free(idstr);
 	return err;
@@ -1302,7 +1872,9 @@ got_diff_objects_as_commits(struct got_diff_line **lines, size_t *nlines,
     struct got_object_id *id1, struct got_object_id *id2,
     struct got_pathlist_head *paths, enum got_diff_algorithm diff_algo,
     int diff_context, int ignore_whitespace, int force_text_diff,
-    struct got_diffstat_cb_arg *dsa, struct got_repository *repo, FILE *outfile)
+    struct got_diffstat_cb_arg *dsa, got_diff_progress_cb progress_cb,
+    void *progress_arg, got_cancel_cb cancel_cb, void *cancel_arg,
+    struct got_repository *repo, FILE *outfile)
 {
 	const struct got_error *err;
 	struct got_commit_object *commit1 = NULL, *commit2 = NULL;
@@ -1345,7 +1917,8 @@ got_diff_objects_as_commits(struct got_diff_line **lines, size_t *nlines,
 	err = diff_objects_as_trees(lines, nlines, f1, f2, fd1, fd2,
 	    commit1 ? got_object_commit_get_tree_id(commit1) : NULL,
 	    got_object_commit_get_tree_id(commit2), paths, "", "",
-	    diff_context, ignore_whitespace, force_text_diff, dsa, repo,
+	    diff_context, ignore_whitespace, force_text_diff, dsa,
+	    progress_cb, progress_arg, cancel_cb, cancel_arg, repo,
 	    outfile, diff_algo);
 done:
 	if (commit1)
@@ -80,6 +80,7 @@
 #include "got_error.h"
 #include "got_opentemp.h"
 #include "got_object.h"
+#include "got_cancel.h"
 #include "got_diff.h"
 
 #include "buf.h"
@@ -16,34 +16,158 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <ctype.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include <arraylist.h>
 #include <diff_main.h>
 
 #include "diff_internal.h"
 #include "diff_debug.h"
 
+/* Size of the read buffer used when atomizing data which is not mmapped. */
+#define DIFF_ATOMIZE_BUFSIZE (64 * 1024)
+
 unsigned int
 diff_atom_hash_update(unsigned int hash, unsigned char atom_byte)
 {
 	return hash * 23 + atom_byte;
 }
 
+/* Return the same hash as calling diff_atom_hash_update() for each byte in
+ * buf. Several bytes are folded in per step, which lets the CPU overlap the
+ * multiplications instead of waiting for each one in turn. */
+static unsigned int
+diff_atom_hash_update_buf(unsigned int hash, const uint8_t *buf, size_t len,
+			  bool ignore_whitespace)
+{
+	size_t i = 0;
+
+	if (ignore_whitespace) {
+		for (; i < len; i++) {
+			if (!isspace(buf[i]))
+				hash = diff_atom_hash_update(hash, buf[i]);
+		}
+		return hash;
+	}
+
+	for (; i + 4 <= len; i += 4) {
+		hash = hash * (23U * 23 * 23 * 23)
+		    + buf[i] * (23U * 23 * 23)
+		    + buf[i + 1] * (23U * 23)
+		    + buf[i + 2] * 23U
+		    + buf[i + 3];
+	}
+	for (; i < len; i++)
+		hash = diff_atom_hash_update(hash, buf[i]);
+	return hash;
+}
+
+/* Return the index of the first '\r' or '\n' in buf, or len if there is
+ * none. */
+static size_t
+diff_scan_eol(const uint8_t *buf, size_t len)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(
+		    _mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+		if (mask)
+			return i + ffs(mask) - 1;
+	}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+	const uint8x16_t cr = vdupq_n_u8('\r');
+	const uint8x16_t lf = vdupq_n_u8('\n');
+
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8(buf + i);
+		if (vmaxvq_u8(vorrq_u8(vceqq_u8(v, cr), vceqq_u8(v, lf))))
+			break; /* locate it below */
+	}
+#endif
+
+	for (; i < len; i++) {
+		if (buf[i] == '\r' || buf[i] == '\n')
+			return i;
+	}
+	return len;
+}
+
+static int
+diff_data_add_line_atom(struct diff_data *d, off_t pos, const uint8_t *at,
+			off_t len, unsigned int hash)
+{
+	struct diff_atom *atom;
+
+	ARRAYLIST_ADD(atom, d->atoms);
+	if (!atom)
+		return ENOMEM;
+
+	*atom = (struct diff_atom){
+		.root = d,
+		.pos = pos,
+		.at = at,
+		.len = len,
+		.hash = hash,
+	};
+	return DIFF_RC_OK;
+}
+
+/* Read the next chunk of the file into buf. At the end of data, *buflen is
+ * zero and *off is the amount of data consumed. */
+static int
+diff_data_fill_buf(struct diff_data *d, uint8_t *buf, off_t *off,
+		   size_t *buflen, size_t *i)
+{
+	size_t n, r;
+
+	*off += *buflen;
+	*i = 0;
+	*buflen = 0;
+
+	n = MIN(DIFF_ATOMIZE_BUFSIZE, d->len - *off);
+	if (n == 0)
+		return DIFF_RC_OK;
+
+	r = fread(buf, 1, n, d->root->f);
+	if (r == 0 && ferror(d->root->f))
+		return EIO;
+	*buflen = r;
+	return DIFF_RC_OK;
+}
+
 static int
 diff_data_atomize_text_lines_fd(struct diff_data *d)
 {
-	off_t pos = 0;
-	const off_t end = pos + d->len;
+	off_t pos = 0;		/* start of the current line */
+	off_t off = 0;		/* file offset of buf[0] */
+	uint8_t *buf;
+	size_t buflen = 0, i = 0;
+	unsigned int hash = 0;
 	unsigned int array_size_estimate = d->len / 50;
 	unsigned int pow2 = 1;
 	bool ignore_whitespace = (d->diff_flags & DIFF_FLAG_IGNORE_WHITESPACE);
 	bool embedded_nul = false;
+	int rc = DIFF_RC_OK;
 
 	while (array_size_estimate >>= 1)
 		pow2++;
@@ -53,73 +177,71 @@ diff_data_atomize_text_lines_fd(struct diff_data *d)
 	if (fseek(d->root->f, 0L, SEEK_SET) == -1)
 		return errno;
 
-	while (pos < end) {
-		off_t line_end = pos;
-		unsigned int hash = 0;
-		unsigned char buf[512];
-		size_t r, i;
-		struct diff_atom *atom;
-		int eol = 0;
-
-		while (eol == 0 && line_end < end) {
-			r = fread(buf, sizeof(char), sizeof(buf), d->root->f);
-			if (r == 0 && ferror(d->root->f))
-				return EIO;
-			i = 0;
-			while (eol == 0 && i < r) {
-				if (buf[i] != '\r' && buf[i] != '\n') {
-					if (!ignore_whitespace
-					    || !isspace((unsigned char)buf[i]))
-						hash = diff_atom_hash_update(
-						    hash, buf[i]);
-					if (buf[i] == '\0')
-						embedded_nul = true;
-					line_end++;
-				} else
-					eol = buf[i];
-				i++;
-			}
+	buf = malloc(DIFF_ATOMIZE_BUFSIZE);
+	if (buf == NULL)
+		return ENOMEM;
+
+	/* Read the file sequentially in large chunks. Lines may span chunks;
+	 * the hash is carried over from one chunk to the next. */
+	for (;;) {
+		size_t n;
+		uint8_t eol;
+
+		if (i == buflen) {
+			rc = diff_data_fill_buf(d, buf, &off, &buflen, &i);
+			if (rc)
+				goto done;
+			if (buflen == 0)
+				break;
 		}
 
-		/* When not at the end of data, the line ending char ('\r' or
-		 * '\n') must follow */
-		if (line_end < end)
-			line_end++;
-		/* If that was an '\r', also pull in any following '\n' */
-		if (line_end < end && eol == '\r') {
-			if (fseeko(d->root->f, line_end, SEEK_SET) == -1)
-				return errno;
-			r = fread(buf, sizeof(char), sizeof(buf), d->root->f);
-			if (r == 0 && ferror(d->root->f))
-				return EIO;
-			if (r > 0 && buf[0] == '\n')
-				line_end++;
+		n = diff_scan_eol(buf + i, buflen - i);
+		hash = diff_atom_hash_update_buf(hash, buf + i, n,
+		    ignore_whitespace);
+		if (!embedded_nul && memchr(buf + i, '\0', n) != NULL)
+			embedded_nul = true;
+		i += n;
+		if (i == buflen)
+			continue; /* the line continues in the next chunk */
+
+		/* The line ending char ('\r' or '\n') follows. If that was an
+		 * '\r', also pull in any following '\n'. */
+		eol = buf[i++];
+		if (eol == '\r') {
+			if (i == buflen) {
+				rc = diff_data_fill_buf(d, buf, &off, &buflen,
+				    &i);
+				if (rc)
+					goto done;
+			}
+			if (i < buflen && buf[i] == '\n')
+				i++;
 		}
 
-		/* Record the found line as diff atom */
-		ARRAYLIST_ADD(atom, d->atoms);
-		if (!atom)
-			return ENOMEM;
-
-		*atom = (struct diff_atom){
-			.root = d,
-			.pos = pos,
-			.at = NULL,	/* atom data is not memory-mapped */
-			.len = line_end - pos,
-			.hash = hash,
-		};
+		/* Record the found line as diff atom; atom data is not
+		 * memory-mapped. */
+		rc = diff_data_add_line_atom(d, pos, NULL, off + i - pos, hash);
+		if (rc)
+			goto done;
 
 		/* Starting point for next line: */
-		pos = line_end;
-		if (fseeko(d->root->f, pos, SEEK_SET) == -1)
-			return errno;
+		pos = off + i;
+		hash = 0;
+	}
+
+	/* The last line may lack a line ending. */
+	if (pos < off) {
+		rc = diff_data_add_line_atom(d, pos, NULL, off - pos, hash);
+		if (rc)
+			goto done;
 	}
 
 	/* File are considered binary if they contain embedded '\0' bytes. */
 	if (embedded_nul)
 		d->atomizer_flags |= DIFF_ATOMIZER_FOUND_BINARY_DATA;
-
-	return DIFF_RC_OK;
+done:
+	free(buf);
+	return rc;
 }
 
 static int
@@ -131,23 +253,23 @@ diff_data_atomize_text_lines_mmap(struct diff_data *d)
 	bool embedded_nul = false;
 	unsigned int array_size_estimate = d->len / 50;
 	unsigned int pow2 = 1;
+	int rc;
+
 	while (array_size_estimate >>= 1)
 		pow2++;
 
 	ARRAYLIST_INIT(d->atoms, 1 << pow2);
 
 	while (pos < end) {
-		const uint8_t *line_end = pos;
-		unsigned int hash = 0;
-
-		while (line_end < end && *line_end != '\r' && *line_end != '\n') {
-			if (!ignore_whitespace
-			    || !isspace((unsigned char)*line_end))
-				hash = diff_atom_hash_update(hash, *line_end);
-			if (*line_end == '\0')
-				embedded_nul = true;
-			line_end++;
-		}
+		const uint8_t *line_end;
+		unsigned int hash;
+		size_t n;
+
+		n = diff_scan_eol(pos, end - pos);
+		hash = diff_atom_hash_update_buf(0, pos, n, ignore_whitespace);
+		if (!embedded_nul && memchr(pos, '\0', n) != NULL)
+			embedded_nul = true;
+		line_end = pos + n;
 
 		/* When not at the end of data, the line ending char ('\r' or
 		 * '\n') must follow */
@@ -157,18 +279,10 @@ diff_data_atomize_text_lines_mmap(struct diff_data *d)
 			line_end++;
 
 		/* Record the found line as diff atom */
-		struct diff_atom *atom;
-		ARRAYLIST_ADD(atom, d->atoms);
-		if (!atom)
-			return ENOMEM;
-
-		*atom = (struct diff_atom){
-			.root = d,
-			.pos = (off_t)(pos - d->data),
-			.at = pos,
-			.len = line_end - pos,
-			.hash = hash,
-		};
+		rc = diff_data_add_line_atom(d, (off_t)(pos - d->data), pos,
+		    line_end - pos, hash);
+		if (rc)
+			return rc;
 
 		/* Starting point for next line: */
 		pos = line_end;
@@ -195,3 +309,113 @@ diff_atomize_text_by_line(void *func_data, struct diff_data *d)
 {
 	return diff_data_atomize_text_lines(d);
 }
+
+/* Spread the bits of a simplistic atom hash across a hash table index. */
+static unsigned int
+diff_atom_hash_mix(unsigned int hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+static int
+diff_data_intern_atoms(struct diff_data *d, unsigned int *slots,
+    unsigned int mask, struct diff_atom **classes, unsigned int *nclasses)
+{
+	struct diff_atom *atom;
+
+	diff_data_foreach_atom(atom, d) {
+		unsigned int i = diff_atom_hash_mix(atom->hash) & mask;
+		unsigned int id;
+
+		for (;;) {
+			struct diff_atom *rep;
+			int cmp, r;
+
+			id = slots[i];
+			if (id == 0) {
+				id = ++(*nclasses);
+				classes[id] = atom;
+				slots[i] = id;
+				break;
+			}
+			rep = classes[id];
+			if (rep->hash == atom->hash) {
+				r = diff_atom_cmp(&cmp, rep, atom);
+				if (r)
+					return r;
+				if (cmp == 0)
+					break;
+			}
+			i = (i + 1) & mask;
+		}
+		atom->class_id = id;
+	}
+
+	return DIFF_RC_OK;
+}
+
+int
+diff_atoms_intern(struct diff_data *left, struct diff_data *right)
+{
+	struct diff_atom *atom;
+	struct diff_atom **classes = NULL;
+	unsigned int *slots = NULL;
+	unsigned int natoms, size, nclasses = 0;
+	int flags = (left->diff_flags | right->diff_flags);
+	int rc;
+
+	/* Invalidate class IDs assigned by a previous diff. */
+	diff_data_foreach_atom(atom, left)
+		atom->class_id = 0;
+	diff_data_foreach_atom(atom, right)
+		atom->class_id = 0;
+	left->nclasses = 0;
+	right->nclasses = 0;
+
+	if (flags & DIFF_FLAG_NO_INTERNING)
+		return DIFF_RC_OK;
+
+	natoms = left->atoms.len;
+	if (right != left)
+		natoms += right->atoms.len;
+	if (natoms < left->atoms.len || natoms > UINT_MAX / 4)
+		return DIFF_RC_OK; /* too large; compare atom data instead */
+
+	/* Keep the open-addressed hash table at most half full. */
+	size = 16;
+	while (size < natoms * 2)
+		size <<= 1;
+
+	slots = calloc(size, sizeof(*slots));
+	if (slots == NULL)
+		return ENOMEM;
+	classes = calloc(natoms + 1, sizeof(*classes));
+	if (classes == NULL) {
+		free(slots);
+		return ENOMEM;
+	}
+
+	rc = diff_data_intern_atoms(left, slots, size - 1, classes, &nclasses);
+	if (rc == DIFF_RC_OK && right != left)
+		rc = diff_data_intern_atoms(right, slots, size - 1, classes,
+		    &nclasses);
+	if (rc != DIFF_RC_OK) {
+		diff_data_foreach_atom(atom, left)
+			atom->class_id = 0;
+		diff_data_foreach_atom(atom, right)
+			atom->class_id = 0;
+		nclasses = 0;
+	}
+
+	left->nclasses = nclasses;
+	right->nclasses = nclasses;
+
+	free(slots);
+	free(classes);
+	return rc;
+}
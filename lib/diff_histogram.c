@@ -0,0 +1,399 @@
+/* Implementation of the Histogram Diff algorithm, as found in JGit and Git:
+ * Divide a diff problem into smaller chunks by the longest run of identical
+ * lines which contains the least frequently occurring line. */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arraylist.h>
+#include <diff_main.h>
+
+#include "diff_internal.h"
+#include "diff_debug.h"
+
+/* Lines occurring more often than this on the left side are not used to
+ * divide the diff problem. If all common lines are this frequent, the section
+ * is left to inner_algo. Same limit as Git's xhistogram. */
+#define HISTOGRAM_MAX_CHAIN_LENGTH 64
+
+#define HISTOGRAM_NO_PTR UINT_MAX
+
+/* All occurrences of one class of identical atoms on the left side. */
+struct histogram_record {
+	unsigned int class_id;
+	unsigned int ptr;	/* index of the first occurrence */
+	unsigned int cnt;	/* number of occurrences */
+};
+
+struct histogram_index {
+	struct diff_atom *left;
+	struct diff_atom *right;
+
+	/* Open addressing hash table of record indexes + 1, 0 means empty. */
+	unsigned int *table;
+	unsigned int table_size;
+	unsigned int table_mask;
+
+	struct histogram_record *records;
+	unsigned int nrecords;
+
+	/* Per left atom: index of the next identical atom, and the index of
+	 * the atom's record. */
+	unsigned int *next_ptrs;
+	unsigned int *line_map;
+
+	/* Lowest occurrence count of the best match found so far. */
+	unsigned int cnt;
+	bool has_common;
+};
+
+/* A section of atoms, indexes into left and right; end is exclusive. */
+struct histogram_region {
+	unsigned int begin1;
+	unsigned int end1;
+	unsigned int begin2;
+	unsigned int end2;
+	bool equal;
+};
+
+typedef ARRAYLIST(struct histogram_region) histogram_region_arraylist_t;
+
+static unsigned int
+histogram_hash(unsigned int class_id)
+{
+	return class_id * 2654435761U;
+}
+
+static struct histogram_record *
+histogram_lookup(struct histogram_index *idx, unsigned int class_id)
+{
+	unsigned int i = histogram_hash(class_id) & idx->table_mask;
+
+	while (idx->table[i]) {
+		struct histogram_record *r = &idx->records[idx->table[i] - 1];
+		if (r->class_id == class_id)
+			return r;
+		i = (i + 1) & idx->table_mask;
+	}
+	return NULL;
+}
+
+/* Count occurrences of each line in the left side of the region. Chains of
+ * identical lines are linked via next_ptrs in ascending order. */
+static void
+histogram_scan_left(struct histogram_index *idx, struct histogram_region *r)
+{
+	unsigned int count = r->end1 - r->begin1;
+	unsigned int size = 16;
+	unsigned int p;
+
+	while (size < count * 2 && size < idx->table_size)
+		size <<= 1;
+	idx->table_mask = size - 1;
+	memset(idx->table, 0, size * sizeof(*idx->table));
+	idx->nrecords = 0;
+
+	for (p = r->end1; p-- > r->begin1;) {
+		unsigned int class_id = idx->left[p].class_id;
+		unsigned int i = histogram_hash(class_id) & idx->table_mask;
+		struct histogram_record *rec;
+
+		while (idx->table[i]) {
+			rec = &idx->records[idx->table[i] - 1];
+			if (rec->class_id == class_id)
+				break;
+			i = (i + 1) & idx->table_mask;
+		}
+
+		if (idx->table[i]) {
+			rec = &idx->records[idx->table[i] - 1];
+			idx->next_ptrs[p] = rec->ptr;
+			rec->ptr = p;
+			if (rec->cnt < UINT_MAX)
+				rec->cnt++;
+			idx->line_map[p] = idx->table[i] - 1;
+			continue;
+		}
+
+		rec = &idx->records[idx->nrecords];
+		rec->class_id = class_id;
+		rec->ptr = p;
+		rec->cnt = 1;
+		idx->next_ptrs[p] = HISTOGRAM_NO_PTR;
+		idx->line_map[p] = idx->nrecords;
+		idx->table[i] = ++idx->nrecords;
+	}
+}
+
+#define HISTOGRAM_CNT(IDX, PTR) ((IDX)->records[(IDX)->line_map[PTR]].cnt)
+#define HISTOGRAM_SAME(IDX, A, B) \
+	((IDX)->left[A].class_id == (IDX)->right[B].class_id)
+
+/* Try all matches of right line b_ptr on the left, extend each match to a run
+ * of identical lines, and keep the run with the least frequent line in lcs.
+ * Return the next right line worth looking at. */
+static unsigned int
+histogram_try_lcs(struct histogram_index *idx, struct histogram_region *lcs,
+		  bool *lcs_found, unsigned int b_ptr, struct histogram_region *r)
+{
+	unsigned int b_next = b_ptr + 1;
+	struct histogram_record *rec;
+	unsigned int as, ae, bs, be, np, rc;
+
+	rec = histogram_lookup(idx, idx->right[b_ptr].class_id);
+	if (rec == NULL)
+		return b_next;
+
+	idx->has_common = true;
+	if (rec->cnt > idx->cnt)
+		return b_next;
+
+	as = rec->ptr;
+	for (;;) {
+		np = idx->next_ptrs[as];
+		bs = b_ptr;
+		ae = as;
+		be = bs;
+		rc = rec->cnt;
+
+		while (r->begin1 < as && r->begin2 < bs &&
+		       HISTOGRAM_SAME(idx, as - 1, bs - 1)) {
+			as--;
+			bs--;
+			if (rc > 1)
+				rc = MIN(rc, HISTOGRAM_CNT(idx, as));
+		}
+		while (ae + 1 < r->end1 && be + 1 < r->end2 &&
+		       HISTOGRAM_SAME(idx, ae + 1, be + 1)) {
+			ae++;
+			be++;
+			if (rc > 1)
+				rc = MIN(rc, HISTOGRAM_CNT(idx, ae));
+		}
+
+		if (b_next <= be)
+			b_next = be + 1;
+		if (!*lcs_found || lcs->end1 - lcs->begin1 < ae + 1 - as ||
+		    rc < idx->cnt) {
+			lcs->begin1 = as;
+			lcs->end1 = ae + 1;
+			lcs->begin2 = bs;
+			lcs->end2 = be + 1;
+			lcs->equal = true;
+			idx->cnt = rc;
+			*lcs_found = true;
+		}
+
+		/* Skip occurrences already covered by this run. */
+		while (np != HISTOGRAM_NO_PTR && np <= ae)
+			np = idx->next_ptrs[np];
+		if (np == HISTOGRAM_NO_PTR)
+			break;
+		as = np;
+	}
+
+	return b_next;
+}
+
+/* Return true and set lcs if a run of identical lines was found whose lines
+ * occur at most HISTOGRAM_MAX_CHAIN_LENGTH times. Set *too_common if the
+ * region only has lines in common which occur more often than that. */
+static bool
+histogram_find_lcs(struct histogram_index *idx, struct histogram_region *lcs,
+		   bool *too_common, struct histogram_region *r)
+{
+	bool lcs_found = false;
+	unsigned int b_ptr;
+
+	histogram_scan_left(idx, r);
+	idx->cnt = HISTOGRAM_MAX_CHAIN_LENGTH + 1;
+	idx->has_common = false;
+
+	for (b_ptr = r->begin2; b_ptr < r->end2; )
+		b_ptr = histogram_try_lcs(idx, lcs, &lcs_found, b_ptr, r);
+
+	*too_common = (idx->has_common &&
+	    idx->cnt > HISTOGRAM_MAX_CHAIN_LENGTH);
+	return (lcs_found && !*too_common);
+}
+
+static int
+histogram_add_chunk(struct diff_state *state, bool solved,
+		    struct histogram_region *r)
+{
+	struct diff_data *left = &state->left;
+	struct diff_data *right = &state->right;
+
+	if (!diff_state_add_chunk(state, solved,
+				  &left->atoms.head[r->begin1], r->end1 - r->begin1,
+				  &right->atoms.head[r->begin2],
+				  r->end2 - r->begin2))
+		return ENOMEM;
+	return DIFF_RC_OK;
+}
+
+static int
+histogram_push(histogram_region_arraylist_t *stack,
+	       unsigned int begin1, unsigned int end1,
+	       unsigned int begin2, unsigned int end2, bool equal)
+{
+	struct histogram_region *r;
+
+	if (begin1 == end1 && begin2 == end2)
+		return DIFF_RC_OK;
+	ARRAYLIST_ADD(r, *stack);
+	if (r == NULL)
+		return ENOMEM;
+	r->begin1 = begin1;
+	r->end1 = end1;
+	r->begin2 = begin2;
+	r->end2 = end2;
+	r->equal = equal;
+	return DIFF_RC_OK;
+}
+
+int
+diff_algo_histogram(const struct diff_algo_config *algo_config,
+		    struct diff_state *state)
+{
+	struct diff_data *left = &state->left;
+	struct diff_data *right = &state->right;
+	struct histogram_index idx;
+	histogram_region_arraylist_t stack;
+	unsigned int prefix = 0, suffix = 0;
+	unsigned int len;
+	int rc;
+
+	debug("\n** %s\n", __func__);
+
+	/* Matching lines are found by class ID only. */
+	if (left->root->nclasses == 0 || right->root->nclasses == 0 ||
+	    left->atoms.len >= UINT_MAX / 2 || right->atoms.len >= UINT_MAX / 2)
+		return DIFF_RC_USE_DIFF_ALGO_FALLBACK;
+
+	memset(&idx, 0, sizeof(idx));
+	ARRAYLIST_INIT(stack, 64);
+
+	idx.left = left->atoms.head;
+	idx.right = right->atoms.head;
+	idx.table_size = 16;
+	while (idx.table_size < left->atoms.len * 2)
+		idx.table_size <<= 1;
+
+	rc = ENOMEM;
+	idx.table = calloc(idx.table_size, sizeof(*idx.table));
+	idx.records = calloc(MAX(left->atoms.len, 1), sizeof(*idx.records));
+	idx.next_ptrs = calloc(MAX(left->atoms.len, 1),
+			       sizeof(*idx.next_ptrs));
+	idx.line_map = calloc(MAX(left->atoms.len, 1), sizeof(*idx.line_map));
+	if (idx.table == NULL || idx.records == NULL ||
+	    idx.next_ptrs == NULL || idx.line_map == NULL)
+		goto free_and_exit;
+
+	/* Like Git, strip identical lines at the start and the end first. */
+	len = MIN(left->atoms.len, right->atoms.len);
+	while (prefix < len && HISTOGRAM_SAME(&idx, prefix, prefix))
+		prefix++;
+	while (suffix < len - prefix &&
+	       HISTOGRAM_SAME(&idx, left->atoms.len - 1 - suffix,
+			      right->atoms.len - 1 - suffix))
+		suffix++;
+
+	/* Regions are popped from the end of the stack, so push them in
+	 * reverse order to add chunks in the order of the files. */
+	rc = histogram_push(&stack, left->atoms.len - suffix, left->atoms.len,
+			    right->atoms.len - suffix, right->atoms.len, true);
+	if (rc)
+		goto free_and_exit;
+	rc = histogram_push(&stack, prefix, left->atoms.len - suffix,
+			    prefix, right->atoms.len - suffix, false);
+	if (rc)
+		goto free_and_exit;
+	rc = histogram_push(&stack, 0, prefix, 0, prefix, true);
+	if (rc)
+		goto free_and_exit;
+
+	while (stack.len > 0) {
+		struct histogram_region r = stack.head[--stack.len];
+		struct histogram_region lcs;
+		bool too_common;
+
+		debug("region L %u..%u R %u..%u%s\n", r.begin1, r.end1,
+		      r.begin2, r.end2, r.equal ? " equal" : "");
+
+		if (r.equal || r.begin1 == r.end1 || r.begin2 == r.end2) {
+			/* Identical lines, or a plain minus or plus chunk. */
+			rc = histogram_add_chunk(state, true, &r);
+			if (rc)
+				goto free_and_exit;
+			continue;
+		}
+
+		memset(&lcs, 0, sizeof(lcs));
+		if (!histogram_find_lcs(&idx, &lcs, &too_common, &r)) {
+			if (too_common) {
+				/* Leave this section to inner_algo. */
+				rc = histogram_add_chunk(state, false, &r);
+				if (rc)
+					goto free_and_exit;
+				continue;
+			}
+
+			/* Nothing in common: everything on the left was
+			 * removed and everything on the right was added. */
+			rc = histogram_push(&stack, r.end1, r.end1,
+					    r.begin2, r.end2, false);
+			if (rc)
+				goto free_and_exit;
+			rc = histogram_push(&stack, r.begin1, r.end1,
+					    r.begin2, r.begin2, false);
+			if (rc)
+				goto free_and_exit;
+			continue;
+		}
+
+		rc = histogram_push(&stack, lcs.end1, r.end1,
+				    lcs.end2, r.end2, false);
+		if (rc)
+			goto free_and_exit;
+		rc = histogram_push(&stack, lcs.begin1, lcs.end1,
+				    lcs.begin2, lcs.end2, true);
+		if (rc)
+			goto free_and_exit;
+		rc = histogram_push(&stack, r.begin1, lcs.begin1,
+				    r.begin2, lcs.begin2, false);
+		if (rc)
+			goto free_and_exit;
+	}
+
+	rc = DIFF_RC_OK;
+	debug("** END %s\n", __func__);
+
+free_and_exit:
+	ARRAYLIST_FREE(stack);
+	free(idx.table);
+	free(idx.records);
+	free(idx.next_ptrs);
+	free(idx.line_map);
+	return rc;
+}
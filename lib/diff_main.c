@@ -199,6 +199,10 @@ diff_atom_same(bool *same,
 {
 	int cmp;
 	int r;
+	if (left->class_id && right->class_id) {
+		*same = (left->class_id == right->class_id);
+		return 0;
+	}
 	if (left->hash != right->hash) {
 		*same = false;
 		return 0;
@@ -600,6 +604,10 @@ diff_main(const struct diff_config *config, struct diff_data *left,
 	result->left = left;
 	result->right = right;
 
+	result->rc = diff_atoms_intern(left->root, right->root);
+	if (result->rc != DIFF_RC_OK)
+		return result;
+
 	struct diff_state state = {
 		.result = result,
 		.recursion_depth_left = config->max_recursion_depth ?
@@ -37,6 +37,12 @@ struct diff_atom {
 	 * find out whether they are indeed identical or not.
 	 * Calculated over all atom bytes with diff_atom_hash_update(). */
 	unsigned int hash;
+
+	/* Atoms on either side of a diff which are identical share the same
+	 * class ID, such that diff algorithms can compare atoms without
+	 * looking at their data. Class IDs are assigned by diff_main() with
+	 * diff_atoms_intern(). Zero if atoms have not been interned. */
+	unsigned int class_id;
 };
 
 /* Mix another atom_byte into the provided hash value and return the result.
@@ -113,6 +119,9 @@ struct diff_data {
 
 	int diff_flags;
 
+	/* Highest atom class ID in use, if atoms have been interned. */
+	unsigned int nclasses;
+
 	int err;
 };
 
@@ -123,6 +132,8 @@ struct diff_data {
 #define DIFF_FLAG_IGNORE_WHITESPACE	0x00000001
 #define DIFF_FLAG_SHOW_PROTOTYPES	0x00000002
 #define DIFF_FLAG_FORCE_TEXT_DATA	0x00000004
+/* Compare atom data instead of atom class IDs; for benchmarking. */
+#define DIFF_FLAG_NO_INTERNING		0x00000008
 
 void diff_data_free(struct diff_data *diff_data);
 
@@ -155,6 +166,11 @@ typedef int (*diff_atomize_func_t)(void *func_data, struct diff_data *d);
 
 extern int diff_atomize_text_by_line(void *func_data, struct diff_data *d);
 
+/* Assign class IDs to the atoms of two root diff_data, such that atoms with
+ * identical content share the same class ID across both sides. Return 0 on
+ * success, or errno on failure. */
+int diff_atoms_intern(struct diff_data *left, struct diff_data *right);
+
 struct diff_algo_config;
 typedef int (*diff_algo_impl_t)(
 	const struct diff_algo_config *algo_config, struct diff_state *state);
@@ -182,6 +198,13 @@ extern int diff_algo_myers_divide(
 extern int diff_algo_patience(
 	const struct diff_algo_config *algo_config, struct diff_state *state);
 
+/* Histogram Diff algorithm, as in JGit and Git. Divides a diff into smaller
+ * chunks by the longest run of identical atoms which contains the least
+ * frequent atom. Requires interned atoms, and needs an inner algo to solve
+ * chunks whose common atoms all occur very frequently. */
+extern int diff_algo_histogram(
+	const struct diff_algo_config *algo_config, struct diff_state *state);
+
 /* Diff algorithms to use, possibly nested. For example:
  *
  * struct diff_algo_config myers, patience, myers_divide;
@@ -19,6 +19,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -30,10 +31,11 @@
 #include "diff_internal.h"
 #include "diff_debug.h"
 
-/* Algorithm to find unique lines:
+/* Algorithm to find unique lines if atoms have not been interned:
  * 0: stupidly iterate atoms
  * 1: qsort
  * 2: mergesort
+ * Interned atoms are counted in a hash table instead.
  */
 #define UNIQUE_STRATEGY 1
 
@@ -209,6 +211,16 @@ static int diff_atoms_compar(const void *_a, const void *_b)
 		return 0;
 	}
 
+	/* Identical atoms only need to end up next to each other, so the
+	 * order of interned atoms is arbitrary. */
+	if (a->class_id && b->class_id) {
+		if (a->class_id < b->class_id)
+			return -1;
+		if (a->class_id > b->class_id)
+			return 1;
+		return 0;
+	}
+
 	/* Sort by the simplistic hash */
 	if (a->hash < b->hash)
 		return -1;
@@ -244,6 +256,81 @@ static int diff_atoms_sort(struct diff_atom *atoms[],
 	return atoms[0]->root->err;
 }
 
+/* Occurrences of an atom class within the current left and right sections. */
+struct atom_class_count {
+	unsigned int class_id;
+	unsigned int count_left;
+	unsigned int count_right;
+	struct diff_atom *left;
+	struct diff_atom *right;
+};
+
+static struct atom_class_count *
+atom_class_count_get(struct atom_class_count *counts, unsigned int mask,
+		     unsigned int class_id)
+{
+	unsigned int i = (class_id * 2654435761U) & mask;
+
+	while (counts[i].class_id != 0 && counts[i].class_id != class_id)
+		i = (i + 1) & mask;
+	counts[i].class_id = class_id;
+	return &counts[i];
+}
+
+/* Count atom class IDs in a hash table, which takes linear time. Requires
+ * that atoms have been interned with diff_atoms_intern(). */
+static int
+diff_atoms_mark_unique_in_both_interned(struct diff_data *left,
+					struct diff_data *right,
+					unsigned int *unique_in_both_count_p)
+{
+	struct atom_class_count *counts, *c;
+	struct diff_atom *a;
+	unsigned int natoms = left->atoms.len + right->atoms.len;
+	unsigned int size = 16, i;
+	unsigned int unique_in_both_count = 0;
+
+	/* Keep the open-addressed hash table at most half full. */
+	while (size < natoms * 2)
+		size <<= 1;
+
+	counts = calloc(size, sizeof(*counts));
+	if (counts == NULL)
+		return ENOMEM;
+
+	diff_data_foreach_atom(a, left) {
+		c = atom_class_count_get(counts, size - 1, a->class_id);
+		c->count_left++;
+		c->left = a;
+	}
+	diff_data_foreach_atom(a, right) {
+		c = atom_class_count_get(counts, size - 1, a->class_id);
+		c->count_right++;
+		c->right = a;
+	}
+
+	for (i = 0; i < size; i++) {
+		c = &counts[i];
+		if (c->count_left != 1 || c->count_right != 1)
+			continue;
+		PATIENCE(c->left).unique_in_both = true;
+		PATIENCE(c->left).pos_in_other = c->right;
+		PATIENCE(c->right).unique_in_both = true;
+		PATIENCE(c->right).pos_in_other = c->left;
+		unique_in_both_count++;
+	}
+
+	free(counts);
+	*unique_in_both_count_p = unique_in_both_count;
+	return 0;
+}
+
+static bool
+diff_data_is_interned(struct diff_data *d)
+{
+	return (d->root->nclasses > 0 && d->atoms.len < UINT_MAX / 4);
+}
+
 static int
 diff_atoms_mark_unique_in_both(struct diff_data *left, struct diff_data *right,
 			       unsigned int *unique_in_both_count_p)
@@ -256,6 +343,10 @@ diff_atoms_mark_unique_in_both(struct diff_data *left, struct diff_data *right,
 	unsigned int unique_in_both_count = 0;
 	int rc;
 
+	if (diff_data_is_interned(left) && diff_data_is_interned(right))
+		return diff_atoms_mark_unique_in_both_interned(left, right,
+		    unique_in_both_count_p);
+
 	all_atoms = calloc(left->atoms.len + right->atoms.len,
 	    sizeof(struct diff_atom *));
 	if (all_atoms == NULL)
@@ -28,6 +28,7 @@
 #include "got_object.h"
 #include "got_opentemp.h"
 #include "got_error.h"
+#include "got_cancel.h"
 #include "got_diff.h"
 
 #include "got_lib_diff.h"
@@ -36,6 +37,7 @@ const struct diff_algo_config myers_then_patience;
 const struct diff_algo_config myers_then_myers_divide;
 const struct diff_algo_config patience;
 const struct diff_algo_config myers_divide;
+const struct diff_algo_config histogram;
 
 const struct diff_algo_config myers_then_patience = {
 	.impl = diff_algo_myers,
@@ -64,6 +66,14 @@ const struct diff_algo_config myers_divide = {
 	/* (fallback_algo = NULL implies diff_algo_none). */
 };
 
+const struct diff_algo_config histogram = {
+	.impl = diff_algo_histogram,
+	/* Sections with only very frequent common lines are left to Myers: */
+	.inner_algo = &myers_then_myers_divide,
+	/* If atoms have not been interned, do Myers: */
+	.fallback_algo = &myers_then_myers_divide,
+};
+
 /* If the state for a forward-Myers is small enough, use Myers, otherwise first
  * do a Myers-divide. */
 const struct diff_config diff_config_myers_then_myers_divide = {
@@ -117,6 +127,9 @@ got_diff_get_config(struct diff_config **cfg,
 	case GOT_DIFF_ALGORITHM_MYERS:
 		(*cfg)->algo = &myers_then_myers_divide;
 		break;
+	case GOT_DIFF_ALGORITHM_HISTOGRAM:
+		(*cfg)->algo = &histogram;
+		break;
 	default:
 		return got_error_msg(GOT_ERR_NOT_IMPL, "bad diff algorithm");
 	}
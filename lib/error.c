@@ -232,6 +232,8 @@ static const struct got_error got_errors[] = {
 	    "make Git unhappy" },
 	{ GOT_ERR_UID, "bad user ID" },
 	{ GOT_ERR_GID, "bad group ID" },
+	{ GOT_ERR_SPARSE_PATH, "path is outside of the work tree's sparse "
+	    "checkout set" },
 };
 
 static struct got_custom_error {
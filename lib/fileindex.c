@@ -14,8 +14,10 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/param.h>
 #include <sys/queue.h>
 #include <sys/tree.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <errno.h>
@@ -47,11 +49,49 @@
 #define GOT_FILEIDX_F_NO_FILE_ON_DISK	0x00080000
 #define GOT_FILEIDX_F_REMOVE_ON_FLUSH	0x00100000
 #define GOT_FILEIDX_F_SKIPPED		0x00200000
+#define GOT_FILEIDX_F_CONTENT		0x00c00000
+#define GOT_FILEIDX_F_CONTENT_SHIFT	22
+#define GOT_FILEIDX_F_STAT_REFRESHED	0x01000000
+
+/* Flags which are only meaningful in memory and never written to disk. */
+#define GOT_FILEIDX_F_INMEM_MASK	(GOT_FILEIDX_F_NOT_FLUSHED | \
+					GOT_FILEIDX_F_REMOVE_ON_FLUSH | \
+					GOT_FILEIDX_F_SKIPPED | \
+					GOT_FILEIDX_F_STAT_REFRESHED)
 
 struct got_fileindex {
 	struct got_fileindex_tree entries;
 	int nentries; /* Does not include entries marked for removal. */
 #define GOT_FILEIDX_MAX_ENTRIES INT_MAX
+
+	/*
+	 * A version 3 file index is memory-mapped. Entries are loaded
+	 * from the mapped entry table into the RB tree on demand.
+	 * Entries in the RB tree take precedence over the entry table.
+	 */
+	uint8_t *map;
+	size_t maplen;
+	int map_is_malloced;
+	struct got_fileindex_rec *table;
+	uint32_t nrecs;
+	const char *pool;
+	size_t pool_size;
+	size_t base_len;	/* length of header, table, pool, checksum */
+	uint8_t *loaded;	/* bitmap of records loaded into the RB tree */
+	uint32_t nloaded;
+	int base_verified;
+
+	/* Delta file state. */
+	size_t delta_end;	/* offset after the last valid record */
+	int ndelta;		/* number of records in the delta file */
+#define GOT_FILEIDX_DELTA_MIN_RECORDS	256
+
+	/*
+	 * Errors which occur while loading entries on demand during
+	 * lookups. Such errors are reported when the file index gets
+	 * iterated or written.
+	 */
+	const struct got_error *load_err;
 };
 
 mode_t
@@ -109,6 +149,16 @@ got_fileindex_entry_update(struct got_fileindex_entry *ie,
 			ie->ctime_nsec = sb.st_ctim.tv_nsec;
 			ie->mtime_sec = sb.st_mtim.tv_sec;
 			ie->mtime_nsec = sb.st_mtim.tv_nsec;
+		} else if (ie->flags & GOT_FILEIDX_F_CONTENT) {
+			/*
+			 * The cached content status no longer applies.
+			 * Ensure that the file's content will be compared
+			 * against its blob again.
+			 */
+			ie->ctime_sec = 0;
+			ie->ctime_nsec = 0;
+			ie->mtime_sec = 0;
+			ie->mtime_nsec = 0;
 		}
 		ie->uid = sb.st_uid;
 		ie->gid = sb.st_gid;
@@ -125,6 +175,8 @@ got_fileindex_entry_update(struct got_fileindex_entry *ie,
 		}
 	}
 
+	ie->flags &= ~GOT_FILEIDX_F_CONTENT;
+
 	if (blob_sha1) {
 		memcpy(ie->blob_sha1, blob_sha1, SHA1_DIGEST_LENGTH);
 		ie->flags &= ~GOT_FILEIDX_F_NO_BLOB;
@@ -152,6 +204,28 @@ got_fileindex_entry_mark_skipped(struct got_fileindex_entry *ie)
 	ie->flags |= GOT_FILEIDX_F_SKIPPED;
 }
 
+uint32_t
+got_fileindex_entry_content_get(struct got_fileindex_entry *ie)
+{
+	return ((ie->flags & GOT_FILEIDX_F_CONTENT) >>
+	    GOT_FILEIDX_F_CONTENT_SHIFT);
+}
+
+void
+got_fileindex_entry_content_set(struct got_fileindex_entry *ie,
+    struct stat *sb, uint32_t content)
+{
+	ie->ctime_sec = sb->st_ctim.tv_sec;
+	ie->ctime_nsec = sb->st_ctim.tv_nsec;
+	ie->mtime_sec = sb->st_mtim.tv_sec;
+	ie->mtime_nsec = sb->st_mtim.tv_nsec;
+	ie->size = (sb->st_size & 0xffffffff);
+	ie->flags &= ~GOT_FILEIDX_F_CONTENT;
+	ie->flags |= ((content << GOT_FILEIDX_F_CONTENT_SHIFT) &
+	    GOT_FILEIDX_F_CONTENT);
+	ie->flags |= GOT_FILEIDX_F_STAT_REFRESHED;
+}
+
 const struct got_error *
 got_fileindex_entry_alloc(struct got_fileindex_entry **ie,
     const char *relpath)
@@ -182,6 +256,7 @@ void
 got_fileindex_entry_free(struct got_fileindex_entry *ie)
 {
 	free(ie->path);
+	free(ie->journaled);
 	free(ie);
 }
 
@@ -200,7 +275,7 @@ got_fileindex_entry_stage_get(const struct got_fileindex_entry *ie)
 void
 got_fileindex_entry_stage_set(struct got_fileindex_entry *ie, uint32_t stage)
 {
-	ie->flags &= ~GOT_FILEIDX_F_STAGE;
+	ie->flags &= ~(GOT_FILEIDX_F_STAGE | GOT_FILEIDX_F_CONTENT);
 	ie->flags |= ((stage << GOT_FILEIDX_F_STAGE_SHIFT) &
 	    GOT_FILEIDX_F_STAGE);
 }
@@ -258,12 +333,316 @@ got_fileindex_entry_was_skipped(struct got_fileindex_entry *ie)
 	return (ie->flags & GOT_FILEIDX_F_SKIPPED) != 0;
 }
 
+static int
+rec_get_path(const char **path, size_t *path_len,
+    struct got_fileindex *fileindex, struct got_fileindex_rec *rec)
+{
+	uint32_t off = be32toh(rec->path_offset);
+	uint32_t len = be32toh(rec->path_len);
+
+	if (len == 0 || off >= fileindex->pool_size ||
+	    len >= fileindex->pool_size - off ||
+	    fileindex->pool[off + len] != '\0')
+		return -1;
+
+	*path = fileindex->pool + off;
+	*path_len = len;
+	return 0;
+}
+
+static void
+entry_from_rec(struct got_fileindex_entry *ie, struct got_fileindex_rec *rec)
+{
+	uint32_t stage;
+
+	ie->ctime_sec = be64toh(rec->ctime_sec);
+	ie->ctime_nsec = be64toh(rec->ctime_nsec);
+	ie->mtime_sec = be64toh(rec->mtime_sec);
+	ie->mtime_nsec = be64toh(rec->mtime_nsec);
+	ie->uid = be32toh(rec->uid);
+	ie->gid = be32toh(rec->gid);
+	ie->size = be32toh(rec->size);
+	ie->flags = (be32toh(rec->flags) & ~GOT_FILEIDX_F_INMEM_MASK);
+	ie->mode = be16toh(rec->mode);
+	memcpy(ie->blob_sha1, rec->blob_sha1, SHA1_DIGEST_LENGTH);
+	memcpy(ie->commit_sha1, rec->commit_sha1, SHA1_DIGEST_LENGTH);
+
+	stage = got_fileindex_entry_stage_get(ie);
+	if (stage == GOT_FILEIDX_STAGE_MODIFY || stage == GOT_FILEIDX_STAGE_ADD)
+		memcpy(ie->staged_blob_sha1, rec->staged_blob_sha1,
+		    SHA1_DIGEST_LENGTH);
+	else
+		memset(ie->staged_blob_sha1, 0, SHA1_DIGEST_LENGTH);
+}
+
+static void
+rec_from_entry(struct got_fileindex_rec *rec, struct got_fileindex_entry *ie,
+    uint32_t path_offset)
+{
+	uint32_t stage;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->ctime_sec = htobe64(ie->ctime_sec);
+	rec->ctime_nsec = htobe64(ie->ctime_nsec);
+	rec->mtime_sec = htobe64(ie->mtime_sec);
+	rec->mtime_nsec = htobe64(ie->mtime_nsec);
+	rec->uid = htobe32(ie->uid);
+	rec->gid = htobe32(ie->gid);
+	rec->size = htobe32(ie->size);
+	rec->flags = htobe32(ie->flags & ~GOT_FILEIDX_F_INMEM_MASK);
+	rec->path_offset = htobe32(path_offset);
+	rec->path_len = htobe32(strlen(ie->path));
+	rec->mode = htobe16(ie->mode);
+	memcpy(rec->blob_sha1, ie->blob_sha1, SHA1_DIGEST_LENGTH);
+	memcpy(rec->commit_sha1, ie->commit_sha1, SHA1_DIGEST_LENGTH);
+
+	stage = got_fileindex_entry_stage_get(ie);
+	if (stage == GOT_FILEIDX_STAGE_MODIFY || stage == GOT_FILEIDX_STAGE_ADD)
+		memcpy(rec->staged_blob_sha1, ie->staged_blob_sha1,
+		    SHA1_DIGEST_LENGTH);
+}
+
+/*
+ * Binary-search the memory-mapped entry table for a path.
+ * Return the index of the matching record, or -1 if not found.
+ */
+static int64_t
+find_rec(struct got_fileindex *fileindex, const char *path, size_t path_len)
+{
+	int64_t left = 0, right = (int64_t)fileindex->nrecs - 1;
+
+	while (left <= right) {
+		int64_t i = left + (right - left) / 2;
+		const char *rec_path;
+		size_t rec_path_len;
+		int cmp;
+
+		if (rec_get_path(&rec_path, &rec_path_len, fileindex,
+		    &fileindex->table[i]) == -1) {
+			if (fileindex->load_err == NULL)
+				fileindex->load_err =
+				    got_error(GOT_ERR_FILEIDX_BAD);
+			return -1;
+		}
+		cmp = got_path_cmp(path, rec_path, path_len, rec_path_len);
+		if (cmp == 0)
+			return i;
+		if (cmp < 0)
+			right = i - 1;
+		else
+			left = i + 1;
+	}
+
+	return -1;
+}
+
+static int
+rec_is_loaded(struct got_fileindex *fileindex, uint32_t i)
+{
+	return (fileindex->loaded[i / 8] & (1 << (i % 8))) != 0;
+}
+
+/*
+ * Load an entry from the memory-mapped entry table into the RB tree.
+ * Entries which are already present in the tree are not loaded again.
+ * This does not affect fileindex->nentries; the entry was already counted.
+ */
+static const struct got_error *
+load_rec(struct got_fileindex_entry **iep, struct got_fileindex *fileindex,
+    uint32_t i)
+{
+	const struct got_error *err = NULL;
+	struct got_fileindex_entry *ie = NULL;
+	const char *path;
+	size_t path_len;
+
+	*iep = NULL;
+
+	if (rec_is_loaded(fileindex, i))
+		return NULL;
+
+	if (rec_get_path(&path, &path_len, fileindex,
+	    &fileindex->table[i]) == -1)
+		return got_error(GOT_ERR_FILEIDX_BAD);
+
+	ie = calloc(1, sizeof(*ie));
+	if (ie == NULL)
+		return got_error_from_errno("calloc");
+
+	ie->path = strndup(path, path_len);
+	if (ie->path == NULL) {
+		err = got_error_from_errno("strndup");
+		free(ie);
+		return err;
+	}
+
+	entry_from_rec(ie, &fileindex->table[i]);
+	ie->flags &= ~GOT_FILEIDX_F_PATH_LEN;
+	ie->flags |= MIN(path_len, GOT_FILEIDX_F_PATH_LEN);
+	ie->map_slot = i + 1;
+
+	if (RB_INSERT(got_fileindex_tree, &fileindex->entries, ie) != NULL) {
+		err = got_error_path(ie->path, GOT_ERR_FILEIDX_DUP_ENTRY);
+		got_fileindex_entry_free(ie);
+		return err;
+	}
+
+	fileindex->loaded[i / 8] |= (1 << (i % 8));
+	fileindex->nloaded++;
+	*iep = ie;
+	return NULL;
+}
+
+/*
+ * Load the memory-mapped entry which matches the given path, if any.
+ * Errors are recorded in fileindex->load_err.
+ */
+static struct got_fileindex_entry *
+load_rec_by_path(struct got_fileindex *fileindex, const char *path,
+    size_t path_len)
+{
+	const struct got_error *err;
+	struct got_fileindex_entry *ie;
+	int64_t i;
+
+	if (fileindex->map == NULL || fileindex->load_err ||
+	    fileindex->nloaded >= fileindex->nrecs)
+		return NULL;
+
+	i = find_rec(fileindex, path, path_len);
+	if (i == -1)
+		return NULL;
+
+	err = load_rec(&ie, fileindex, i);
+	if (err) {
+		fileindex->load_err = err;
+		return NULL;
+	}
+
+	return ie;
+}
+
+static const struct got_error *
+verify_base_checksum(struct got_fileindex *fileindex)
+{
+	SHA1_CTX ctx;
+	uint8_t sha1[SHA1_DIGEST_LENGTH];
+	size_t len = fileindex->base_len - SHA1_DIGEST_LENGTH;
+
+	if (fileindex->base_verified)
+		return NULL;
+
+	SHA1Init(&ctx);
+	SHA1Update(&ctx, fileindex->map, len);
+	SHA1Final(sha1, &ctx);
+	if (memcmp(sha1, fileindex->map + len, SHA1_DIGEST_LENGTH) != 0)
+		return got_error(GOT_ERR_FILEIDX_CSUM);
+
+	fileindex->base_verified = 1;
+	return NULL;
+}
+
+/*
+ * Load all remaining entries from the memory-mapped entry table.
+ * Required before iterating over the RB tree.
+ * Lookups of individual paths only touch the records visited during
+ * binary search; the checksum of the entire table is verified here.
+ */
+static const struct got_error *
+load_all_recs(struct got_fileindex *fileindex)
+{
+	const struct got_error *err;
+	struct got_fileindex_entry *ie;
+	uint32_t i;
+
+	if (fileindex->load_err)
+		return fileindex->load_err;
+
+	if (fileindex->map == NULL || fileindex->nloaded >= fileindex->nrecs)
+		return NULL;
+
+	err = verify_base_checksum(fileindex);
+	if (err)
+		return err;
+
+	for (i = 0; i < fileindex->nrecs; i++) {
+		err = load_rec(&ie, fileindex, i);
+		if (err)
+			return err;
+	}
+
+	return NULL;
+}
+
+/*
+ * Load all entries at or beneath the given path from the memory-mapped
+ * entry table. Such entries are stored next to each other in the table.
+ * This allows for traversing a subtree of the file index without loading
+ * entries outside of this subtree.
+ */
+static const struct got_error *
+load_subtree_recs(struct got_fileindex *fileindex, const char *path)
+{
+	const struct got_error *err;
+	struct got_fileindex_entry *ie;
+	const char *rec_path;
+	size_t rec_path_len, path_len = strlen(path);
+	uint32_t left, right, i;
+
+	if (path_len == 0 || got_path_is_root_dir(path))
+		return load_all_recs(fileindex);
+
+	if (fileindex->load_err)
+		return fileindex->load_err;
+
+	if (fileindex->map == NULL || fileindex->nloaded >= fileindex->nrecs)
+		return NULL;
+
+	/* Find the first record which does not sort before the path. */
+	left = 0;
+	right = fileindex->nrecs;
+	while (left < right) {
+		uint32_t mid = left + (right - left) / 2;
+
+		if (rec_get_path(&rec_path, &rec_path_len, fileindex,
+		    &fileindex->table[mid]) == -1)
+			return got_error(GOT_ERR_FILEIDX_BAD);
+		if (got_path_cmp(rec_path, path, rec_path_len, path_len) < 0)
+			left = mid + 1;
+		else
+			right = mid;
+	}
+
+	for (i = left; i < fileindex->nrecs; i++) {
+		if (rec_get_path(&rec_path, &rec_path_len, fileindex,
+		    &fileindex->table[i]) == -1)
+			return got_error(GOT_ERR_FILEIDX_BAD);
+		if (got_path_cmp(rec_path, path, rec_path_len,
+		    path_len) != 0 &&
+		    !got_path_is_child(rec_path, path, path_len))
+			break;
+		err = load_rec(&ie, fileindex, i);
+		if (err)
+			return err;
+	}
+
+	return NULL;
+}
+
 static const struct got_error *
 add_entry(struct got_fileindex *fileindex, struct got_fileindex_entry *ie)
 {
 	if (fileindex->nentries >= GOT_FILEIDX_MAX_ENTRIES)
 		return got_error(GOT_ERR_NO_SPACE);
 
+	/* Ensure that duplicates of not-yet-loaded entries are detected. */
+	if (RB_FIND(got_fileindex_tree, &fileindex->entries, ie) == NULL) {
+		load_rec_by_path(fileindex, ie->path,
+		    got_fileindex_entry_path_len(ie));
+		if (fileindex->load_err)
+			return fileindex->load_err;
+	}
+
 	if (RB_INSERT(got_fileindex_tree, &fileindex->entries, ie) != NULL)
 		return got_error_path(ie->path, GOT_ERR_FILEIDX_DUP_ENTRY);
 
@@ -306,6 +685,8 @@ got_fileindex_entry_get(struct got_fileindex *fileindex, const char *path,
 	key.path = (char *)path;
 	key.flags = (path_len & GOT_FILEIDX_F_PATH_LEN);
 	ie = RB_FIND(got_fileindex_tree, &fileindex->entries, &key);
+	if (ie == NULL)
+		ie = load_rec_by_path(fileindex, path, path_len);
 	if (ie && (ie->flags & GOT_FILEIDX_F_REMOVE_ON_FLUSH))
 		return NULL;
 	return ie;
@@ -318,6 +699,10 @@ got_fileindex_for_each_entry_safe(struct got_fileindex *fileindex,
 	const struct got_error *err;
 	struct got_fileindex_entry *ie, *tmp;
 
+	err = load_all_recs(fileindex);
+	if (err)
+		return err;
+
 	RB_FOREACH_SAFE(ie, got_fileindex_tree, &fileindex->entries, tmp) {
 		if (ie->flags & GOT_FILEIDX_F_REMOVE_ON_FLUSH)
 			continue;
@@ -341,196 +726,384 @@ got_fileindex_alloc(void)
 	return fileindex;
 }
 
-void
-got_fileindex_free(struct got_fileindex *fileindex)
+static void
+fileindex_unmap(struct got_fileindex *fileindex)
 {
 	struct got_fileindex_entry *ie;
 
-	while ((ie = RB_MIN(got_fileindex_tree, &fileindex->entries))) {
-		RB_REMOVE(got_fileindex_tree, &fileindex->entries, ie);
-		got_fileindex_entry_free(ie);
+	RB_FOREACH(ie, got_fileindex_tree, &fileindex->entries) {
+		ie->map_slot = 0;
+		free(ie->journaled);
+		ie->journaled = NULL;
 	}
-	free(fileindex);
+
+	if (fileindex->map) {
+		if (fileindex->map_is_malloced)
+			free(fileindex->map);
+		else
+			munmap(fileindex->map, fileindex->maplen);
+	}
+	free(fileindex->loaded);
+
+	fileindex->map = NULL;
+	fileindex->maplen = 0;
+	fileindex->map_is_malloced = 0;
+	fileindex->table = NULL;
+	fileindex->nrecs = 0;
+	fileindex->pool = NULL;
+	fileindex->pool_size = 0;
+	fileindex->base_len = 0;
+	fileindex->loaded = NULL;
+	fileindex->nloaded = 0;
+	fileindex->base_verified = 0;
+	fileindex->delta_end = 0;
+	fileindex->ndelta = 0;
 }
 
-static const struct got_error *
-write_fileindex_val64(SHA1_CTX *ctx, uint64_t val, FILE *outfile)
+const struct got_error *
+got_fileindex_for_each_subtree_entry(struct got_fileindex *fileindex,
+    const char *path, got_fileindex_cb cb, void *cb_arg)
 {
-	size_t n;
+	const struct got_error *err;
+	struct got_fileindex_entry *ie, *tmp, key;
+	size_t path_len = strlen(path);
+
+	if (path_len == 0 || got_path_is_root_dir(path))
+		return got_fileindex_for_each_entry_safe(fileindex, cb, cb_arg);
+
+	err = load_subtree_recs(fileindex, path);
+	if (err)
+		return err;
+
+	memset(&key, 0, sizeof(key));
+	key.path = (char *)path;
+	key.flags = (path_len & GOT_FILEIDX_F_PATH_LEN);
+	ie = RB_NFIND(got_fileindex_tree, &fileindex->entries, &key);
+	while (ie) {
+		size_t len = got_fileindex_entry_path_len(ie);
+
+		if (got_path_cmp(ie->path, path, len, path_len) != 0 &&
+		    !got_path_is_child(ie->path, path, path_len))
+			break;
+		tmp = RB_NEXT(got_fileindex_tree, &fileindex->entries, ie);
+		if ((ie->flags & GOT_FILEIDX_F_REMOVE_ON_FLUSH) == 0) {
+			err = (*cb)(cb_arg, ie);
+			if (err)
+				return err;
+		}
+		ie = tmp;
+	}
 
-	val = htobe64(val);
-	SHA1Update(ctx, (uint8_t *)&val, sizeof(val));
-	n = fwrite(&val, 1, sizeof(val), outfile);
-	if (n != sizeof(val))
-		return got_ferror(outfile, GOT_ERR_IO);
 	return NULL;
 }
 
-static const struct got_error *
-write_fileindex_val32(SHA1_CTX *ctx, uint32_t val, FILE *outfile)
+int
+got_fileindex_has_refreshed_entries(struct got_fileindex *fileindex)
 {
-	size_t n;
+	struct got_fileindex_entry *ie;
 
-	val = htobe32(val);
-	SHA1Update(ctx, (uint8_t *)&val, sizeof(val));
-	n = fwrite(&val, 1, sizeof(val), outfile);
-	if (n != sizeof(val))
-		return got_ferror(outfile, GOT_ERR_IO);
-	return NULL;
+	RB_FOREACH(ie, got_fileindex_tree, &fileindex->entries) {
+		if (ie->flags & GOT_FILEIDX_F_STAT_REFRESHED)
+			return 1;
+	}
+
+	return 0;
 }
 
-static const struct got_error *
-write_fileindex_val16(SHA1_CTX *ctx, uint16_t val, FILE *outfile)
+void
+got_fileindex_free(struct got_fileindex *fileindex)
 {
-	size_t n;
+	struct got_fileindex_entry *ie;
 
-	val = htobe16(val);
-	SHA1Update(ctx, (uint8_t *)&val, sizeof(val));
-	n = fwrite(&val, 1, sizeof(val), outfile);
-	if (n != sizeof(val))
-		return got_ferror(outfile, GOT_ERR_IO);
-	return NULL;
+	while ((ie = RB_MIN(got_fileindex_tree, &fileindex->entries))) {
+		RB_REMOVE(got_fileindex_tree, &fileindex->entries, ie);
+		got_fileindex_entry_free(ie);
+	}
+	fileindex_unmap(fileindex);
+	free(fileindex);
 }
 
-static const struct got_error *
-write_fileindex_path(SHA1_CTX *ctx, const char *path, FILE *outfile)
+static size_t
+journal_path_padded_len(size_t len)
 {
-	size_t n, len, pad = 0;
-	static const uint8_t zero[8] = { 0 };
+	size_t pad = 0;
 
-	len = strlen(path);
 	while ((len + pad) % 8 != 0)
 		pad++;
 	if (pad == 0)
 		pad = 8; /* NUL-terminate */
 
-	SHA1Update(ctx, path, len);
-	n = fwrite(path, 1, len, outfile);
-	if (n != len)
-		return got_ferror(outfile, GOT_ERR_IO);
-	SHA1Update(ctx, zero, pad);
-	n = fwrite(zero, 1, pad, outfile);
-	if (n != pad)
-		return got_ferror(outfile, GOT_ERR_IO);
-	return NULL;
+	return len + pad;
 }
 
 static const struct got_error *
-write_fileindex_entry(SHA1_CTX *ctx, struct got_fileindex_entry *ie,
+write_fileindex_data(SHA1_CTX *ctx, const void *data, size_t len,
     FILE *outfile)
 {
-	const struct got_error *err;
 	size_t n;
-	uint32_t stage;
 
-	err = write_fileindex_val64(ctx, ie->ctime_sec, outfile);
-	if (err)
-		return err;
-	err = write_fileindex_val64(ctx, ie->ctime_nsec, outfile);
-	if (err)
-		return err;
-	err = write_fileindex_val64(ctx, ie->mtime_sec, outfile);
+	SHA1Update(ctx, data, len);
+	n = fwrite(data, 1, len, outfile);
+	if (n != len)
+		return got_ferror(outfile, GOT_ERR_IO);
+	return NULL;
+}
+
+const struct got_error *
+got_fileindex_write(struct got_fileindex *fileindex, FILE *outfile)
+{
+	const struct got_error *err = NULL;
+	struct got_fileindex_hdr hdr;
+	struct got_fileindex_rec rec;
+	SHA1_CTX ctx;
+	uint8_t sha1[SHA1_DIGEST_LENGTH];
+	static const uint8_t zero[8] = { 0 };
+	size_t n, pool_size = 0, pad = 0;
+	struct got_fileindex_entry *ie, *tmp;
+
+	err = load_all_recs(fileindex);
 	if (err)
 		return err;
-	err = write_fileindex_val64(ctx, ie->mtime_nsec, outfile);
+
+	RB_FOREACH_SAFE(ie, got_fileindex_tree, &fileindex->entries, tmp) {
+		ie->flags &= ~GOT_FILEIDX_F_NOT_FLUSHED;
+		ie->flags &= ~(GOT_FILEIDX_F_SKIPPED |
+		    GOT_FILEIDX_F_STAT_REFRESHED);
+		if (ie->flags & GOT_FILEIDX_F_REMOVE_ON_FLUSH) {
+			RB_REMOVE(got_fileindex_tree, &fileindex->entries, ie);
+			got_fileindex_entry_free(ie);
+			continue;
+		}
+		pool_size += strlen(ie->path) + 1;
+		if (pool_size > UINT32_MAX - 8)
+			return got_error(GOT_ERR_NO_SPACE);
+	}
+	while ((pool_size + pad) % 8 != 0)
+		pad++;
+
+	SHA1Init(&ctx);
+
+	hdr.signature = htobe32(GOT_FILE_INDEX_SIGNATURE);
+	hdr.version = htobe32(GOT_FILE_INDEX_VERSION);
+	hdr.nentries = htobe32(fileindex->nentries);
+	hdr.pool_size = htobe32(pool_size + pad);
+
+	err = write_fileindex_data(&ctx, &hdr.signature,
+	    sizeof(hdr.signature), outfile);
 	if (err)
 		return err;
-
-	err = write_fileindex_val32(ctx, ie->uid, outfile);
+	err = write_fileindex_data(&ctx, &hdr.version,
+	    sizeof(hdr.version), outfile);
 	if (err)
 		return err;
-	err = write_fileindex_val32(ctx, ie->gid, outfile);
+	err = write_fileindex_data(&ctx, &hdr.nentries,
+	    sizeof(hdr.nentries), outfile);
 	if (err)
 		return err;
-	err = write_fileindex_val32(ctx, ie->size, outfile);
+	err = write_fileindex_data(&ctx, &hdr.pool_size,
+	    sizeof(hdr.pool_size), outfile);
 	if (err)
 		return err;
 
-	err = write_fileindex_val16(ctx, ie->mode, outfile);
+	pool_size = 0;
+	RB_FOREACH(ie, got_fileindex_tree, &fileindex->entries) {
+		rec_from_entry(&rec, ie, pool_size);
+		err = write_fileindex_data(&ctx, &rec, sizeof(rec), outfile);
+		if (err)
+			return err;
+		pool_size += strlen(ie->path) + 1;
+	}
+
+	RB_FOREACH(ie, got_fileindex_tree, &fileindex->entries) {
+		err = write_fileindex_data(&ctx, ie->path,
+		    strlen(ie->path) + 1, outfile);
+		if (err)
+			return err;
+	}
+	err = write_fileindex_data(&ctx, zero, pad, outfile);
 	if (err)
 		return err;
 
-	SHA1Update(ctx, ie->blob_sha1, SHA1_DIGEST_LENGTH);
-	n = fwrite(ie->blob_sha1, 1, SHA1_DIGEST_LENGTH, outfile);
-	if (n != SHA1_DIGEST_LENGTH)
+	SHA1Final(sha1, &ctx);
+	n = fwrite(sha1, 1, sizeof(sha1), outfile);
+	if (n != sizeof(sha1))
 		return got_ferror(outfile, GOT_ERR_IO);
 
-	SHA1Update(ctx, ie->commit_sha1, SHA1_DIGEST_LENGTH);
-	n = fwrite(ie->commit_sha1, 1, SHA1_DIGEST_LENGTH, outfile);
-	if (n != SHA1_DIGEST_LENGTH)
-		return got_ferror(outfile, GOT_ERR_IO);
+	if (fflush(outfile) != 0)
+		return got_error_from_errno("fflush");
+
+	/*
+	 * The mapped file is about to be replaced. Changes made after this
+	 * point cannot be journaled and will cause another rewrite.
+	 */
+	fileindex_unmap(fileindex);
+	return NULL;
+}
+
+/*
+ * Return non-zero if an entry differs from its most recent on-disk record.
+ */
+static int
+entry_is_dirty(struct got_fileindex *fileindex, struct got_fileindex_entry *ie)
+{
+	struct got_fileindex_rec rec, base;
+
+	if (ie->journaled)
+		memcpy(&base, ie->journaled, sizeof(base));
+	else if (ie->map_slot)
+		memcpy(&base, &fileindex->table[ie->map_slot - 1], sizeof(base));
+	else
+		return 1;
+
+	base.path_offset = 0;
+	rec_from_entry(&rec, ie, 0);
+	return memcmp(&rec, &base, sizeof(rec)) != 0;
+}
+
+static const struct got_error *
+write_journal_record(struct got_fileindex_entry *ie, uint32_t type,
+    FILE *outfile)
+{
+	const struct got_error *err;
+	struct got_fileindex_journal_hdr jhdr;
+	struct got_fileindex_rec rec;
+	SHA1_CTX ctx;
+	uint8_t sha1[SHA1_DIGEST_LENGTH];
+	static const uint8_t zero[8] = { 0 };
+	size_t n, len = strlen(ie->path);
+
+	SHA1Init(&ctx);
 
-	err = write_fileindex_val32(ctx, ie->flags, outfile);
+	jhdr.type = htobe32(type);
+	jhdr.path_len = htobe32(len);
+	err = write_fileindex_data(&ctx, &jhdr, sizeof(jhdr), outfile);
 	if (err)
 		return err;
 
-	err = write_fileindex_path(ctx, ie->path, outfile);
+	if (type == GOT_FILEIDX_JOURNAL_UPSERT) {
+		rec_from_entry(&rec, ie, 0);
+		err = write_fileindex_data(&ctx, &rec, sizeof(rec), outfile);
+		if (err)
+			return err;
+	}
+
+	err = write_fileindex_data(&ctx, ie->path, len, outfile);
+	if (err)
+		return err;
+	err = write_fileindex_data(&ctx, zero,
+	    journal_path_padded_len(len) - len, outfile);
 	if (err)
 		return err;
 
-	stage = got_fileindex_entry_stage_get(ie);
-	if (stage == GOT_FILEIDX_STAGE_MODIFY ||
-	    stage == GOT_FILEIDX_STAGE_ADD) {
-		SHA1Update(ctx, ie->staged_blob_sha1, SHA1_DIGEST_LENGTH);
-		n = fwrite(ie->staged_blob_sha1, 1, SHA1_DIGEST_LENGTH,
-		    outfile);
-		if (n != SHA1_DIGEST_LENGTH)
-			return got_ferror(outfile, GOT_ERR_IO);
+	SHA1Final(sha1, &ctx);
+	n = fwrite(sha1, 1, sizeof(sha1), outfile);
+	if (n != sizeof(sha1))
+		return got_ferror(outfile, GOT_ERR_IO);
+
+	if (type == GOT_FILEIDX_JOURNAL_UPSERT) {
+		if (ie->journaled == NULL) {
+			ie->journaled = malloc(sizeof(*ie->journaled));
+			if (ie->journaled == NULL)
+				return got_error_from_errno("malloc");
+		}
+		memcpy(ie->journaled, &rec, sizeof(rec));
 	}
 
 	return NULL;
 }
 
+/*
+ * Append entries which were added, modified, or removed since the file
+ * index was read to the delta file of a memory-mapped file index.
+ * The outfile must refer to the delta file which was read with
+ * got_fileindex_read_delta(), or to a new delta file.
+ * Set *written to zero, without writing anything, if the file index was
+ * not read from a memory-mapped file or if the delta file would grow too
+ * large; the caller must rewrite the base file with got_fileindex_write()
+ * and remove the delta file in this case.
+ */
 const struct got_error *
-got_fileindex_write(struct got_fileindex *fileindex, FILE *outfile)
+got_fileindex_write_delta(int *written, struct got_fileindex *fileindex,
+    FILE *outfile)
 {
 	const struct got_error *err = NULL;
-	struct got_fileindex_hdr hdr;
-	SHA1_CTX ctx;
-	uint8_t sha1[SHA1_DIGEST_LENGTH];
-	size_t n;
 	struct got_fileindex_entry *ie, *tmp;
+	int ndirty = 0, max;
+	off_t off;
 
-	SHA1Init(&ctx);
+	*written = 0;
 
-	hdr.signature = htobe32(GOT_FILE_INDEX_SIGNATURE);
-	hdr.version = htobe32(GOT_FILE_INDEX_VERSION);
-	hdr.nentries = htobe32(fileindex->nentries);
+	if (fileindex->map == NULL)
+		return NULL;
+	if (fileindex->load_err)
+		return fileindex->load_err;
 
-	SHA1Update(&ctx, (uint8_t *)&hdr.signature, sizeof(hdr.signature));
-	SHA1Update(&ctx, (uint8_t *)&hdr.version, sizeof(hdr.version));
-	SHA1Update(&ctx, (uint8_t *)&hdr.nentries, sizeof(hdr.nentries));
-	n = fwrite(&hdr.signature, 1, sizeof(hdr.signature), outfile);
-	if (n != sizeof(hdr.signature))
-		return got_ferror(outfile, GOT_ERR_IO);
-	n = fwrite(&hdr.version, 1, sizeof(hdr.version), outfile);
-	if (n != sizeof(hdr.version))
-		return got_ferror(outfile, GOT_ERR_IO);
-	n = fwrite(&hdr.nentries, 1, sizeof(hdr.nentries), outfile);
-	if (n != sizeof(hdr.nentries))
-		return got_ferror(outfile, GOT_ERR_IO);
+	RB_FOREACH(ie, got_fileindex_tree, &fileindex->entries) {
+		if (ie->flags & GOT_FILEIDX_F_REMOVE_ON_FLUSH) {
+			if (ie->map_slot || ie->journaled)
+				ndirty++;
+		} else if (entry_is_dirty(fileindex, ie))
+			ndirty++;
+	}
+
+	max = MAX(GOT_FILEIDX_DELTA_MIN_RECORDS, fileindex->nrecs / 8);
+	if (fileindex->ndelta > max - ndirty)
+		return NULL;
+
+	/*
+	 * Discard a partially written record left behind by a crash,
+	 * or a stale delta file which belongs to a different base file.
+	 */
+	if (ftruncate(fileno(outfile), fileindex->delta_end) == -1)
+		return got_error_from_errno("ftruncate");
+	if (fseeko(outfile, fileindex->delta_end, SEEK_SET) == -1)
+		return got_error_from_errno("fseeko");
+
+	if (fileindex->delta_end == 0) {
+		struct got_fileindex_delta_hdr dhdr;
+		size_t n;
+
+		dhdr.signature = htobe32(GOT_FILE_INDEX_DELTA_SIGNATURE);
+		dhdr.version = htobe32(GOT_FILE_INDEX_DELTA_VERSION);
+		memcpy(dhdr.base_sha1, fileindex->map + fileindex->base_len -
+		    SHA1_DIGEST_LENGTH, sizeof(dhdr.base_sha1));
+		n = fwrite(&dhdr, 1, sizeof(dhdr), outfile);
+		if (n != sizeof(dhdr))
+			return got_ferror(outfile, GOT_ERR_IO);
+	}
 
 	RB_FOREACH_SAFE(ie, got_fileindex_tree, &fileindex->entries, tmp) {
 		ie->flags &= ~GOT_FILEIDX_F_NOT_FLUSHED;
-		ie->flags &= ~GOT_FILEIDX_F_SKIPPED;
+		ie->flags &= ~(GOT_FILEIDX_F_SKIPPED |
+		    GOT_FILEIDX_F_STAT_REFRESHED);
 		if (ie->flags & GOT_FILEIDX_F_REMOVE_ON_FLUSH) {
+			if (ie->map_slot || ie->journaled) {
+				err = write_journal_record(ie,
+				    GOT_FILEIDX_JOURNAL_REMOVE, outfile);
+				if (err)
+					return err;
+			}
 			RB_REMOVE(got_fileindex_tree, &fileindex->entries, ie);
 			got_fileindex_entry_free(ie);
 			continue;
 		}
-		err = write_fileindex_entry(&ctx, ie, outfile);
+		if (!entry_is_dirty(fileindex, ie))
+			continue;
+		err = write_journal_record(ie, GOT_FILEIDX_JOURNAL_UPSERT,
+		    outfile);
 		if (err)
 			return err;
 	}
 
-	SHA1Final(sha1, &ctx);
-	n = fwrite(sha1, 1, sizeof(sha1), outfile);
-	if (n != sizeof(sha1))
-		return got_ferror(outfile, GOT_ERR_IO);
-
 	if (fflush(outfile) != 0)
 		return got_error_from_errno("fflush");
+	off = ftello(outfile);
+	if (off == -1)
+		return got_error_from_errno("ftello");
 
+	fileindex->delta_end = off;
+	fileindex->ndelta += ndirty;
+	*written = 1;
 	return NULL;
 }
 
@@ -698,6 +1271,209 @@ done:
 	return err;
 }
 
+static const struct got_error *
+replay_journal_record(struct got_fileindex *fileindex, uint32_t type,
+    struct got_fileindex_rec *rec, const char *path, size_t path_len)
+{
+	const struct got_error *err;
+	struct got_fileindex_entry *ie;
+
+	ie = got_fileindex_entry_get(fileindex, path, path_len);
+	if (fileindex->load_err)
+		return fileindex->load_err;
+
+	if (type == GOT_FILEIDX_JOURNAL_REMOVE) {
+		if (ie == NULL)
+			return got_error_path(path, GOT_ERR_FILEIDX_BAD);
+		RB_REMOVE(got_fileindex_tree, &fileindex->entries, ie);
+		got_fileindex_entry_free(ie);
+		fileindex->nentries--;
+		return NULL;
+	}
+
+	if (ie == NULL) {
+		err = got_fileindex_entry_alloc(&ie, path);
+		if (err)
+			return err;
+		entry_from_rec(ie, rec);
+		ie->flags &= ~GOT_FILEIDX_F_PATH_LEN;
+		ie->flags |= MIN(path_len, GOT_FILEIDX_F_PATH_LEN);
+		err = add_entry(fileindex, ie);
+		if (err) {
+			got_fileindex_entry_free(ie);
+			return err;
+		}
+	} else {
+		entry_from_rec(ie, rec);
+		ie->flags &= ~GOT_FILEIDX_F_PATH_LEN;
+		ie->flags |= MIN(path_len, GOT_FILEIDX_F_PATH_LEN);
+	}
+
+	if (ie->journaled == NULL) {
+		ie->journaled = malloc(sizeof(*ie->journaled));
+		if (ie->journaled == NULL)
+			return got_error_from_errno("malloc");
+	}
+	memcpy(ie->journaled, rec, sizeof(*rec));
+	ie->journaled->path_offset = 0;
+	return NULL;
+}
+
+/*
+ * Replay journal records from a delta file on top of the entry table.
+ * A truncated or corrupt record ends the journal; such records may be
+ * left behind if we crashed while appending to the delta file. They will
+ * be overwritten when the delta file is appended to next time.
+ */
+static const struct got_error *
+replay_delta(struct got_fileindex *fileindex, const uint8_t *buf,
+    size_t buflen, size_t off)
+{
+	const struct got_error *err;
+	struct got_fileindex_journal_hdr jhdr;
+	struct got_fileindex_rec rec;
+	SHA1_CTX ctx;
+	uint8_t sha1[SHA1_DIGEST_LENGTH];
+
+	while (buflen - off >= sizeof(jhdr)) {
+		const uint8_t *p = buf + off;
+		const char *path;
+		size_t len, path_len, padded_len;
+
+		memcpy(&jhdr, p, sizeof(jhdr));
+		jhdr.type = be32toh(jhdr.type);
+		jhdr.path_len = be32toh(jhdr.path_len);
+		if (jhdr.type != GOT_FILEIDX_JOURNAL_UPSERT &&
+		    jhdr.type != GOT_FILEIDX_JOURNAL_REMOVE)
+			break;
+		path_len = jhdr.path_len;
+		if (path_len == 0 || path_len > PATH_MAX)
+			break;
+		padded_len = journal_path_padded_len(path_len);
+
+		len = sizeof(jhdr) + padded_len;
+		if (jhdr.type == GOT_FILEIDX_JOURNAL_UPSERT)
+			len += sizeof(rec);
+		if (buflen - off < len + SHA1_DIGEST_LENGTH)
+			break;
+
+		SHA1Init(&ctx);
+		SHA1Update(&ctx, p, len);
+		SHA1Final(sha1, &ctx);
+		if (memcmp(sha1, p + len, SHA1_DIGEST_LENGTH) != 0)
+			break;
+
+		p += sizeof(jhdr);
+		if (jhdr.type == GOT_FILEIDX_JOURNAL_UPSERT) {
+			memcpy(&rec, p, sizeof(rec));
+			p += sizeof(rec);
+		}
+		path = (const char *)p;
+		if (memchr(path, '\0', path_len) != NULL ||
+		    path[path_len] != '\0')
+			return got_error(GOT_ERR_FILEIDX_BAD);
+
+		err = replay_journal_record(fileindex, jhdr.type, &rec,
+		    path, path_len);
+		if (err)
+			return err;
+
+		off += len + SHA1_DIGEST_LENGTH;
+		fileindex->ndelta++;
+	}
+
+	fileindex->delta_end = off;
+	return NULL;
+}
+
+static const struct got_error *
+read_fileindex_mapped(struct got_fileindex *fileindex, FILE *infile)
+{
+	const struct got_error *err = NULL;
+	struct got_fileindex_hdr hdr;
+	struct stat sb;
+	size_t table_size, hdrlen;
+
+	if (fstat(fileno(infile), &sb) == -1)
+		return got_error_from_errno("fstat");
+	if (sb.st_size < 0 || (uintmax_t)sb.st_size > SIZE_MAX)
+		return got_error(GOT_ERR_FILEIDX_BAD);
+
+	fileindex->maplen = sb.st_size;
+#ifndef GOT_FILEIDX_NO_MMAP
+	fileindex->map = mmap(NULL, fileindex->maplen, PROT_READ, MAP_PRIVATE,
+	    fileno(infile), 0);
+	if (fileindex->map == MAP_FAILED)
+#endif
+	{
+		/* Fall back on reading the file into memory. */
+		size_t n;
+
+		fileindex->map = malloc(fileindex->maplen);
+		if (fileindex->map == NULL) {
+			err = got_error_from_errno("malloc");
+			goto done;
+		}
+		fileindex->map_is_malloced = 1;
+		if (fseeko(infile, 0L, SEEK_SET) == -1) {
+			err = got_error_from_errno("fseeko");
+			goto done;
+		}
+		n = fread(fileindex->map, 1, fileindex->maplen, infile);
+		if (n != fileindex->maplen) {
+			err = got_ferror(infile, GOT_ERR_FILEIDX_BAD);
+			goto done;
+		}
+	}
+
+	hdrlen = sizeof(hdr.signature) + sizeof(hdr.version) +
+	    sizeof(hdr.nentries) + sizeof(hdr.pool_size);
+	if (fileindex->maplen < hdrlen + SHA1_DIGEST_LENGTH) {
+		err = got_error(GOT_ERR_FILEIDX_BAD);
+		goto done;
+	}
+	memcpy(&hdr.nentries, fileindex->map + 8, sizeof(hdr.nentries));
+	memcpy(&hdr.pool_size, fileindex->map + 12, sizeof(hdr.pool_size));
+	hdr.nentries = be32toh(hdr.nentries);
+	hdr.pool_size = be32toh(hdr.pool_size);
+	if (hdr.nentries > GOT_FILEIDX_MAX_ENTRIES) {
+		err = got_error(GOT_ERR_FILEIDX_BAD);
+		goto done;
+	}
+
+	table_size = (size_t)hdr.nentries * sizeof(struct got_fileindex_rec);
+	if (fileindex->maplen - hdrlen - SHA1_DIGEST_LENGTH < table_size ||
+	    fileindex->maplen - hdrlen - SHA1_DIGEST_LENGTH - table_size <
+	    hdr.pool_size) {
+		err = got_error(GOT_ERR_FILEIDX_BAD);
+		goto done;
+	}
+
+	fileindex->table = (struct got_fileindex_rec *)
+	    (fileindex->map + hdrlen);
+	fileindex->nrecs = hdr.nentries;
+	fileindex->pool = (const char *)(fileindex->map + hdrlen + table_size);
+	fileindex->pool_size = hdr.pool_size;
+	fileindex->base_len = hdrlen + table_size + hdr.pool_size +
+	    SHA1_DIGEST_LENGTH;
+	if (fileindex->base_len != fileindex->maplen) {
+		err = got_error(GOT_ERR_FILEIDX_BAD);
+		goto done;
+	}
+	fileindex->nentries = hdr.nentries;
+
+	fileindex->loaded = calloc(1, hdr.nentries / 8 + 1);
+	if (fileindex->loaded == NULL)
+		err = got_error_from_errno("calloc");
+done:
+	if (err) {
+		if (fileindex->map == MAP_FAILED)
+			fileindex->map = NULL;
+		fileindex_unmap(fileindex);
+	}
+	return err;
+}
+
 const struct got_error *
 got_fileindex_read(struct got_fileindex *fileindex, FILE *infile)
 {
@@ -743,6 +1519,8 @@ got_fileindex_read(struct got_fileindex *fileindex, FILE *infile)
 		return got_error(GOT_ERR_FILEIDX_SIG);
 	if (hdr.version > GOT_FILE_INDEX_VERSION)
 		return got_error(GOT_ERR_FILEIDX_VER);
+	if (hdr.version >= 3)
+		return read_fileindex_mapped(fileindex, infile);
 
 	for (i = 0; i < hdr.nentries; i++) {
 		err = read_fileindex_entry(&ie, &ctx, infile, hdr.version);
@@ -763,6 +1541,55 @@ got_fileindex_read(struct got_fileindex *fileindex, FILE *infile)
 	return NULL;
 }
 
+/*
+ * Apply changes recorded in a delta file to a memory-mapped file index
+ * which was read with got_fileindex_read(). Delta files which do not
+ * belong to the base file are ignored.
+ */
+const struct got_error *
+got_fileindex_read_delta(struct got_fileindex *fileindex, FILE *infile)
+{
+	const struct got_error *err = NULL;
+	struct got_fileindex_delta_hdr dhdr;
+	struct stat sb;
+	uint8_t *buf = NULL;
+	size_t n;
+
+	fileindex->delta_end = 0;
+	fileindex->ndelta = 0;
+
+	if (fileindex->map == NULL)
+		return NULL;
+
+	if (fstat(fileno(infile), &sb) == -1)
+		return got_error_from_errno("fstat");
+	if (sb.st_size < 0 || (uintmax_t)sb.st_size > SIZE_MAX)
+		return got_error(GOT_ERR_FILEIDX_BAD);
+	if (sb.st_size < sizeof(dhdr))
+		return NULL;
+
+	buf = malloc(sb.st_size);
+	if (buf == NULL)
+		return got_error_from_errno("malloc");
+	n = fread(buf, 1, sb.st_size, infile);
+	if (n != sb.st_size) {
+		err = got_ferror(infile, GOT_ERR_FILEIDX_BAD);
+		goto done;
+	}
+
+	memcpy(&dhdr, buf, sizeof(dhdr));
+	if (be32toh(dhdr.signature) != GOT_FILE_INDEX_DELTA_SIGNATURE ||
+	    be32toh(dhdr.version) != GOT_FILE_INDEX_DELTA_VERSION ||
+	    memcmp(dhdr.base_sha1, fileindex->map + fileindex->base_len -
+	    SHA1_DIGEST_LENGTH, sizeof(dhdr.base_sha1)) != 0)
+		goto done;
+
+	err = replay_delta(fileindex, buf, sb.st_size, sizeof(dhdr));
+done:
+	free(buf);
+	return err;
+}
+
 static struct got_fileindex_entry *
 walk_fileindex(struct got_fileindex *fileindex, struct got_fileindex_entry *ie)
 {
@@ -836,6 +1663,11 @@ diff_fileindex_tree(struct got_fileindex *fileindex,
 
 	te = got_object_tree_get_entry(tree, tidx);
 	while ((*ie && got_path_is_child((*ie)->path, path, path_len)) || te) {
+		if (te && cb->diff_filter &&
+		    !cb->diff_filter(cb_arg, te, path)) {
+			te = got_object_tree_get_entry(tree, ++tidx);
+			continue;
+		}
 		if (te && *ie) {
 			char *te_path;
 			const char *te_name = got_tree_entry_get_name(te);
@@ -918,7 +1750,13 @@ got_fileindex_diff_tree(struct got_fileindex *fileindex,
     struct got_repository *repo,
     struct got_fileindex_diff_tree_cb *cb, void *cb_arg)
 {
+	const struct got_error *err;
 	struct got_fileindex_entry *ie;
+
+	err = load_subtree_recs(fileindex, path);
+	if (err)
+		return err;
+
 	ie = RB_MIN(got_fileindex_tree, &fileindex->entries);
 	while (ie && !got_path_is_child(ie->path, path, strlen(path)))
 		ie = walk_fileindex(fileindex, ie);
@@ -1194,6 +2032,10 @@ got_fileindex_diff_dir(struct got_fileindex *fileindex, int fd,
 
 	TAILQ_INIT(&dirlist);
 
+	err = load_subtree_recs(fileindex, path);
+	if (err)
+		return err;
+
 	/*
 	 * Duplicate the file descriptor so we can call closedir() below
 	 * without closing the file descriptor passed in by our caller.
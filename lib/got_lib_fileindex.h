@@ -67,6 +67,19 @@ struct got_fileindex_entry {
 	 * Otherwise, this field is not written to disk.
 	 */
 	uint8_t staged_blob_sha1[SHA1_DIGEST_LENGTH];
+
+	/*
+	 * The following fields are never written to disk.
+	 * If this entry was loaded from a memory-mapped file index,
+	 * map_slot is the index of its on-disk record plus one; else zero.
+	 * If this entry was loaded from or written to the change journal,
+	 * journaled points to a copy of its most recent journal record.
+	 * If got_worktree_preload() looked at the file, preload points to
+	 * the result until the file's status is looked up.
+	 */
+	uint32_t map_slot;
+	struct got_fileindex_rec *journaled;
+	struct got_preloaded_file *preload;
 };
 
 /* Modifications explicitly staged for commit. */
@@ -97,12 +110,69 @@ struct got_fileindex_hdr {
 	uint32_t signature;	/* big-endian */
 #define GOT_FILE_INDEX_SIGNATURE	0x676f7449 /* 'g', 'o', 't', 'I' */
 	uint32_t version;	/* big-endian */
-#define GOT_FILE_INDEX_VERSION	2
+#define GOT_FILE_INDEX_VERSION	3
 	uint32_t nentries;	/* big-endian */
-	/* list of concatenated fileindex entries */
+	uint32_t pool_size;	/* big-endian; since GOT_FILE_INDEX_VERSION 3 */
+	/*
+	 * Up to GOT_FILE_INDEX_VERSION 2: list of concatenated entries.
+	 * Since GOT_FILE_INDEX_VERSION 3: table of nentries fixed-size
+	 * records sorted by path, followed by pool_size bytes of paths.
+	 */
 	uint8_t sha1[SHA1_DIGEST_LENGTH]; /* checksum of above on-disk data */
 };
 
+/*
+ * On-disk file index entry record (since GOT_FILE_INDEX_VERSION 3).
+ * All records have the same size such that the entry table can be
+ * memory-mapped and binary-searched in place. Multi-byte fields are
+ * big-endian, and paths are stored NUL-terminated in the path pool.
+ */
+struct got_fileindex_rec {
+	uint64_t ctime_sec;
+	uint64_t ctime_nsec;
+	uint64_t mtime_sec;
+	uint64_t mtime_nsec;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t size;
+	uint32_t flags;
+	uint32_t path_offset;	/* relative to start of path pool */
+	uint32_t path_len;	/* not including NUL */
+	uint16_t mode;
+	uint16_t pad;
+	uint8_t blob_sha1[SHA1_DIGEST_LENGTH];
+	uint8_t commit_sha1[SHA1_DIGEST_LENGTH];
+	uint8_t staged_blob_sha1[SHA1_DIGEST_LENGTH]; /* zero if not staged */
+};
+
+/*
+ * A memory-mapped file index is split into a base file, which is rarely
+ * rewritten, and a small delta file. Changes to the file index are appended
+ * to the delta file as journal records instead of rewriting the base file.
+ * The journal is replayed on top of the base file's entry table when the
+ * file index is read, and is folded into a new base file once it grows
+ * too large. The delta file refers to its base file by checksum; a delta
+ * file which does not match the current base file is ignored.
+ */
+struct got_fileindex_delta_hdr {
+	uint32_t signature;	/* big-endian */
+#define GOT_FILE_INDEX_DELTA_SIGNATURE	0x676f7444 /* 'g', 'o', 't', 'D' */
+	uint32_t version;	/* big-endian */
+#define GOT_FILE_INDEX_DELTA_VERSION	1
+	uint8_t base_sha1[SHA1_DIGEST_LENGTH]; /* checksum of base file */
+	/* Journal records. */
+};
+
+struct got_fileindex_journal_hdr {
+	uint32_t type;		/* big-endian */
+#define GOT_FILEIDX_JOURNAL_UPSERT	1
+#define GOT_FILEIDX_JOURNAL_REMOVE	2
+	uint32_t path_len;	/* big-endian */
+	/* UPSERT only: struct got_fileindex_rec with a zero path_offset */
+	/* Path, NUL-padded to a multiple of 8. */
+	/* SHA1 checksum of this journal record. */
+};
+
 mode_t got_fileindex_entry_perms_get(struct got_fileindex_entry *);
 uint16_t got_fileindex_perms_from_st(struct stat *);
 mode_t got_fileindex_perms_to_st(struct got_fileindex_entry *);
@@ -117,6 +187,8 @@ void got_fileindex_entry_free(struct got_fileindex_entry *);
 struct got_fileindex *got_fileindex_alloc(void);
 void got_fileindex_free(struct got_fileindex *);
 const struct got_error *got_fileindex_write(struct got_fileindex *, FILE *);
+const struct got_error *got_fileindex_write_delta(int *,
+    struct got_fileindex *, FILE *);
 const struct got_error *got_fileindex_entry_add(struct got_fileindex *,
     struct got_fileindex_entry *);
 void got_fileindex_entry_remove(struct got_fileindex *,
@@ -124,10 +196,15 @@ void got_fileindex_entry_remove(struct got_fileindex *,
 struct got_fileindex_entry *got_fileindex_entry_get(struct got_fileindex *,
     const char *, size_t);
 const struct got_error *got_fileindex_read(struct got_fileindex *, FILE *);
+const struct got_error *got_fileindex_read_delta(struct got_fileindex *,
+    FILE *);
 typedef const struct got_error *(*got_fileindex_cb)(void *,
     struct got_fileindex_entry *);
 const struct got_error *got_fileindex_for_each_entry_safe(
     struct got_fileindex *, got_fileindex_cb cb, void *);
+/* Like got_fileindex_for_each_entry_safe() but limited to a path's subtree. */
+const struct got_error *got_fileindex_for_each_subtree_entry(
+    struct got_fileindex *, const char *, got_fileindex_cb cb, void *);
 
 typedef const struct got_error *(*got_fileindex_diff_tree_old_new_cb)(void *,
     struct got_fileindex_entry *, struct got_tree_entry *, const char *);
@@ -135,10 +212,18 @@ typedef const struct got_error *(*got_fileindex_diff_tree_old_cb)(void *,
     struct got_fileindex_entry *, const char *);
 typedef const struct got_error *(*got_fileindex_diff_tree_new_cb)(void *,
     struct got_tree_entry *, const char *);
+/*
+ * Optional filter for tree entries. Tree entries for which the filter
+ * returns zero are skipped, as if they did not exist in the tree, and
+ * subtrees of skipped tree entries are not traversed.
+ */
+typedef int (*got_fileindex_diff_tree_filter_cb)(void *,
+    struct got_tree_entry *, const char *);
 struct got_fileindex_diff_tree_cb {
 	got_fileindex_diff_tree_old_new_cb diff_old_new;
 	got_fileindex_diff_tree_old_cb diff_old;
 	got_fileindex_diff_tree_new_cb diff_new;
+	got_fileindex_diff_tree_filter_cb diff_filter;
 };
 const struct got_error *got_fileindex_diff_tree(struct got_fileindex *,
     struct got_tree_object *, const char *, const char *,
@@ -175,6 +260,25 @@ int got_fileindex_entry_staged_filetype_get(struct got_fileindex_entry *);
 
 void got_fileindex_entry_mark_deleted_from_disk(struct got_fileindex_entry *);
 
+/*
+ * The result of the most recent comparison of a file's content against
+ * its blob. It remains valid for as long as the file's stat info matches
+ * the stat info recorded in the file index entry.
+ */
+#define GOT_FILEIDX_CONTENT_UNCHANGED	0
+#define GOT_FILEIDX_CONTENT_MODIFIED	1
+#define GOT_FILEIDX_CONTENT_CONFLICT	2
+uint32_t got_fileindex_entry_content_get(struct got_fileindex_entry *);
+void got_fileindex_entry_content_set(struct got_fileindex_entry *,
+    struct stat *, uint32_t);
+
+/*
+ * Return non-zero if the content status of any file index entry was
+ * recorded with got_fileindex_entry_content_set() since the file index
+ * was last written.
+ */
+int got_fileindex_has_refreshed_entries(struct got_fileindex *);
+
 /*
  * Retrieve staged, blob or commit id from a fileindex entry, and return
  * the given object id.
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Git-compatible reftable reference storage, used by repositories which
+ * set extensions.refStorage to "reftable".
+ *
+ * References are stored in a stack of immutable tables which is listed,
+ * oldest table first, in the file reftable/tables.list. Each table holds
+ * references sorted by name in blocks which can be binary searched.
+ * Every update appends a new table to the stack, and records in newer
+ * tables shadow records of the same name in older tables. Tables at the
+ * top of the stack are merged whenever the stack grows too deep.
+ */
+
+#define GOT_REFTABLE_DIR	"reftable"
+#define GOT_REFTABLE_LIST	"tables.list"
+
+struct got_reftable;
+
+struct got_reftable_record {
+	const char *name;
+	int type;
+#define GOT_REFTABLE_DELETION	0x0
+#define GOT_REFTABLE_VAL1	0x1	/* object ID */
+#define GOT_REFTABLE_VAL2	0x2	/* object ID and peeled object ID */
+#define GOT_REFTABLE_SYMREF	0x3
+	struct got_object_id id;	/* VAL1 and VAL2 only */
+	struct got_object_id peeled;	/* VAL2 only */
+	const char *target;		/* SYMREF only */
+	uint64_t update_index;
+	time_t mtime;			/* modification time of the table */
+};
+
+typedef const struct got_error *(*got_reftable_cb)(void *,
+    struct got_reftable_record *);
+
+/* Prepare access to the reftable stack of a Git repository. */
+const struct got_error *got_reftable_open(struct got_reftable **,
+    const char *);
+void got_reftable_close(struct got_reftable *);
+
+/*
+ * Lock the reftable stack against modification by other processes.
+ * Locks may be nested; the stack is unlocked once each call to
+ * got_reftable_lock() has been balanced by got_reftable_unlock().
+ */
+const struct got_error *got_reftable_lock(struct got_reftable *);
+const struct got_error *got_reftable_unlock(struct got_reftable *);
+
+/*
+ * Look up a reference by its full name and pass it to the callback.
+ * The callback is not invoked if the reference does not exist.
+ * Record data is only valid during the callback.
+ */
+const struct got_error *got_reftable_lookup(struct got_reftable *,
+    const char *, got_reftable_cb, void *);
+
+/*
+ * Pass all references whose names begin with the given prefix to the
+ * callback, in sorted order. Record data is only valid during the
+ * callback.
+ */
+const struct got_error *got_reftable_foreach(struct got_reftable *,
+    const char *, got_reftable_cb, void *);
+
+/*
+ * Atomically apply a set of reference updates by adding a new table to
+ * the stack. Records of type GOT_REFTABLE_DELETION delete references.
+ * The array of records will be sorted by reference name.
+ */
+const struct got_error *got_reftable_update(struct got_reftable *,
+    struct got_reftable_record *, int);
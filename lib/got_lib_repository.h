@@ -27,6 +27,7 @@
 #define GOT_ORIG_HEAD_FILE	"ORIG_HEAD"
 #define GOT_OBJECTS_PACK_DIR	"objects/pack"
 #define GOT_PACKED_REFS_FILE	"packed-refs"
+#define GOT_BLAME_CACHE_DIR	"got-blame-cache"
 
 #define GOT_PACK_CACHE_SIZE	32
 
@@ -130,6 +131,9 @@ struct got_repository {
 
 	/* Settings read from got.conf. */
 	struct got_gotconfig *gotconfig;
+
+	/* Reftable stack; NULL if references are stored in files. */
+	struct got_reftable *reftable;
 };
 
 const struct got_error*got_repo_cache_object(struct got_repository *,
@@ -152,6 +156,7 @@ const struct got_error*got_repo_cache_raw_object(struct got_repository *,
     struct got_object_id *, struct got_raw_object *);
 struct got_raw_object *got_repo_get_cached_raw_object(struct got_repository *,
     struct got_object_id *);
+struct got_reftable *got_repo_get_reftable(struct got_repository *);
 int got_repo_is_packidx_filename(const char *, size_t);
 int got_repo_check_packidx_bloom_filter(struct got_repository *,
     const char *, struct got_object_id *);
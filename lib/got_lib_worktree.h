@@ -40,6 +40,12 @@ struct got_worktree {
 
 	/* Settings read from got.conf. */
 	struct got_gotconfig *gotconfig;
+
+	/*
+	 * Paths which make up the sparse checkout set, relative to the
+	 * work tree root. Empty if the entire work tree is checked out.
+	 */
+	struct got_pathlist_head sparse_paths;
 };
 
 struct got_commitable {
@@ -59,6 +65,7 @@ struct got_commitable {
 
 #define GOT_WORKTREE_GOT_DIR		".got"
 #define GOT_WORKTREE_FILE_INDEX		"file-index"
+#define GOT_WORKTREE_FILE_INDEX_DELTA	"file-index-delta"
 #define GOT_WORKTREE_REPOSITORY		"repository"
 #define GOT_WORKTREE_PATH_PREFIX	"path-prefix"
 #define GOT_WORKTREE_HEAD_REF		"head-ref"
@@ -67,6 +74,7 @@ struct got_commitable {
 #define GOT_WORKTREE_FORMAT		"format"
 #define GOT_WORKTREE_UUID		"uuid"
 #define GOT_WORKTREE_HISTEDIT_SCRIPT	"histedit-script"
+#define GOT_WORKTREE_SPARSE_PATHS	"sparse-paths"
 
 #define GOT_WORKTREE_FORMAT_VERSION	1
 #define GOT_WORKTREE_INVALID_COMMIT_ID	GOT_SHA1_STRING_ZERO
@@ -76,6 +84,31 @@ struct got_commitable {
 const struct got_error *got_worktree_get_base_ref_name(char **,
     struct got_worktree *worktree);
 
+struct got_fileindex;
+
+/* Result of preloading a file's status, consumed by the status walk. */
+struct got_preloaded_file {
+	struct stat sb;
+	struct timespec now;	/* clock reading taken before sb */
+	unsigned char status;	/* GOT_STATUS_NO_CHANGE or _MODIFY, or 0 */
+};
+
+struct got_worktree_preload;
+
+/*
+ * Run stat(2) calls for files in the subtree of the given path on a pool
+ * of threads, and compare the content of files which appear to be modified
+ * against their blob IDs. Results are attached to file index entries and
+ * are used instead of stat(2) and blob reads when each file's status is
+ * looked up for the first time. Release the results with
+ * got_worktree_preload_free() once the subtree has been walked.
+ * This is meant for status walks only; operations which modify files in
+ * the work tree should look at the files as they find them instead.
+ */
+const struct got_error *got_worktree_preload(struct got_worktree_preload **,
+    struct got_worktree *, struct got_fileindex *, const char *);
+void got_worktree_preload_free(struct got_worktree_preload *);
+
 /* Temporary branch which accumulates commits during a rebase operation. */
 #define GOT_WORKTREE_REBASE_TMP_REF_PREFIX "refs/got/worktree/rebase/tmp"
 
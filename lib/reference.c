@@ -16,10 +16,13 @@
 
 #include <sys/types.h>
 #include <sys/queue.h>
+#include <sys/tree.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <sha1.h>
 #include <stdio.h>
@@ -44,6 +47,10 @@
 #include "got_lib_object.h"
 #include "got_lib_object_idset.h"
 #include "got_lib_lockfile.h"
+#include "got_lib_object_cache.h"
+#include "got_lib_pack.h"
+#include "got_lib_repository.h"
+#include "got_lib_reftable.h"
 
 #ifndef nitems
 #define nitems(_a) (sizeof(_a) / sizeof((_a)[0]))
@@ -53,11 +60,7 @@
 #define GOT_REF_TAGS	"tags"
 #define GOT_REF_REMOTES	"remotes"
 
-/*
- * We do not resolve tags yet, and don't yet care about sorting refs either,
- * so packed-refs files we write contain a minimal header which disables all
- * packed-refs "traits" supported by Git.
- */
+/* First line of a packed-refs file, followed by a list of traits. */
 #define GOT_PACKED_REFS_HEADER	"# pack-refs with:"
 
 /* A symbolic reference. */
@@ -86,6 +89,7 @@ struct got_reference {
 	} ref;
 
 	struct got_lockfile *lf;
+	struct got_reftable *rt;	/* locked reftable stack */
 	time_t mtime;
 
 	/* Cached timestamp for got_ref_cmp_by_commit_timestamp_descending() */
@@ -287,74 +291,317 @@ got_ref_alloc_symref(struct got_reference **ref, const char *name,
 	return alloc_symref(ref, name, got_ref_get_name(target_ref), 0);
 }
 
+/*
+ * A packed-refs file, mapped into memory. If Git's "sorted" trait is
+ * present in the header, references are sorted by name in byte order
+ * and may be searched for with a binary search. Otherwise the file is
+ * scanned from start to end.
+ */
+struct got_packed_refs {
+	char	*buf;
+	size_t	 len;
+	size_t	 start;		/* offset of the first record */
+	int	 mapped;
+	int	 sorted;
+	time_t	 mtime;
+};
+
+static void
+packed_refs_close(struct got_packed_refs *pr)
+{
+	if (pr->mapped)
+		munmap(pr->buf, pr->len);
+	else
+		free(pr->buf);
+	memset(pr, 0, sizeof(*pr));
+}
+
+static void
+packed_refs_parse_header(struct got_packed_refs *pr)
+{
+	const char *p, *end, *trait;
+	size_t len;
+
+	end = memchr(pr->buf, '\n', pr->len);
+	if (end == NULL)
+		end = pr->buf + pr->len;
+
+	len = strlen(GOT_PACKED_REFS_HEADER);
+	if (end - pr->buf < len ||
+	    memcmp(pr->buf, GOT_PACKED_REFS_HEADER, len) != 0)
+		return;
+
+	p = pr->buf + len;
+	while (p < end) {
+		while (p < end && *p == ' ')
+			p++;
+		trait = p;
+		while (p < end && *p != ' ')
+			p++;
+		if (p - trait == 6 && memcmp(trait, "sorted", 6) == 0)
+			pr->sorted = 1;
+	}
+}
+
+/*
+ * Open the packed-refs file at the given path. A missing file is treated
+ * like an empty one.
+ */
 static const struct got_error *
-parse_packed_ref_line(struct got_reference **ref, const char *abs_refname,
-    const char *line, time_t mtime)
+packed_refs_open(struct got_packed_refs *pr, const char *path)
 {
+	const struct got_error *err = NULL;
+	struct stat sb;
+	ssize_t r;
+	size_t off = 0;
+	int fd;
+
+	memset(pr, 0, sizeof(*pr));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return NULL;
+		return got_error_from_errno2("open", path);
+	}
+
+	if (fstat(fd, &sb) == -1) {
+		err = got_error_from_errno2("fstat", path);
+		goto done;
+	}
+	pr->mtime = sb.st_mtime;
+	if (sb.st_size == 0)
+		goto done;
+	if (sb.st_size > SIZE_MAX) {
+		err = got_error(GOT_ERR_NO_SPACE);
+		goto done;
+	}
+	pr->len = sb.st_size;
+
+#ifndef GOT_PACK_NO_MMAP
+	pr->buf = mmap(NULL, pr->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (pr->buf != MAP_FAILED) {
+		pr->mapped = 1;
+		goto parse;
+	}
+	if (errno != ENOMEM) {
+		err = got_error_from_errno2("mmap", path);
+		pr->buf = NULL;
+		goto done;
+	}
+#endif
+	/* fall back to read(2) */
+	pr->buf = malloc(pr->len);
+	if (pr->buf == NULL) {
+		err = got_error_from_errno("malloc");
+		goto done;
+	}
+	while (off < pr->len) {
+		r = read(fd, pr->buf + off, pr->len - off);
+		if (r == -1) {
+			err = got_error_from_errno2("read", path);
+			goto done;
+		}
+		if (r == 0)
+			break;
+		off += r;
+	}
+	pr->len = off;
+#ifndef GOT_PACK_NO_MMAP
+parse:
+#endif
+	packed_refs_parse_header(pr);
+
+	/* Skip the header and any other leading comments. */
+	while (pr->start < pr->len && pr->buf[pr->start] == '#') {
+		const char *nl = memchr(pr->buf + pr->start, '\n',
+		    pr->len - pr->start);
+		pr->start = nl ? nl - pr->buf + 1 : pr->len;
+	}
+done:
+	if (close(fd) == -1 && err == NULL)
+		err = got_error_from_errno2("close", path);
+	if (err)
+		packed_refs_close(pr);
+	return err;
+}
+
+/* Return the offset just past the line at the given offset. */
+static size_t
+packed_refs_next_line(struct got_packed_refs *pr, size_t off)
+{
+	const char *nl;
+
+	nl = memchr(pr->buf + off, '\n', pr->len - off);
+	return nl ? nl - pr->buf + 1 : pr->len;
+}
+
+/*
+ * Return the offset just past the record at the given offset, which
+ * includes the peeled object ID line following a reference, if any.
+ */
+static size_t
+packed_refs_next_record(struct got_packed_refs *pr, size_t off)
+{
+	off = packed_refs_next_line(pr, off);
+	while (off < pr->len && (pr->buf[off] == '^' || pr->buf[off] == '#'))
+		off = packed_refs_next_line(pr, off);
+	return off;
+}
+
+/* Find the start of the record which contains the given offset. */
+static size_t
+packed_refs_record_start(struct got_packed_refs *pr, size_t lo, size_t off)
+{
+	for (;;) {
+		while (off > lo && pr->buf[off - 1] != '\n')
+			off--;
+		if (off == lo ||
+		    (pr->buf[off] != '^' && pr->buf[off] != '#'))
+			return off;
+		off--;
+	}
+}
+
+/*
+ * Get the reference name of the record at the given offset.
+ * Returns NULL if the record does not contain a reference.
+ */
+static const char *
+packed_refs_name(size_t *namelen, struct got_packed_refs *pr, size_t off)
+{
+	size_t end;
+
+	if (pr->buf[off] == '#' || pr->buf[off] == '^')
+		return NULL;
+
+	end = packed_refs_next_line(pr, off);
+	if (end > off && pr->buf[end - 1] == '\n')
+		end--;
+	if (end - off < SHA1_DIGEST_STRING_LENGTH)
+		return NULL;
+
+	*namelen = end - off - SHA1_DIGEST_STRING_LENGTH;
+	return pr->buf + off + SHA1_DIGEST_STRING_LENGTH;
+}
+
+static int
+packed_refs_cmp(const char *name, size_t namelen, const char *key,
+    size_t keylen)
+{
+	int cmp;
+
+	cmp = memcmp(name, key, namelen < keylen ? namelen : keylen);
+	if (cmp != 0)
+		return cmp;
+	if (namelen < keylen)
+		return -1;
+	return namelen > keylen;
+}
+
+/*
+ * Find the offset of the first record of a sorted packed-refs file
+ * whose reference name is not less than the given key.
+ */
+static size_t
+packed_refs_lower_bound(struct got_packed_refs *pr, const char *key)
+{
+	size_t lo = pr->start, hi = pr->len, rec, namelen;
+	size_t keylen = strlen(key);
+	const char *name;
+
+	while (lo < hi) {
+		rec = packed_refs_record_start(pr, lo, lo + (hi - lo) / 2);
+		name = packed_refs_name(&namelen, pr, rec);
+		if (name == NULL ||
+		    packed_refs_cmp(name, namelen, key, keylen) < 0)
+			lo = packed_refs_next_record(pr, rec);
+		else
+			hi = rec;
+	}
+
+	return lo;
+}
+
+static const struct got_error *
+packed_refs_parse(struct got_reference **ref, struct got_packed_refs *pr,
+    size_t off)
+{
+	const struct got_error *err;
 	struct got_object_id id;
 	const char *name;
+	char *refname;
+	size_t namelen;
 
 	*ref = NULL;
 
-	if (line[0] == '#' || line[0] == '^')
-		return NULL;
-
-	if (!got_parse_sha1_digest(id.sha1, line))
+	name = packed_refs_name(&namelen, pr, off);
+	if (name == NULL) {
+		if (pr->buf[off] == '#' || pr->buf[off] == '^')
+			return NULL;
 		return got_error(GOT_ERR_BAD_REF_DATA);
+	}
 
-	if (abs_refname) {
-		if (strcmp(line + SHA1_DIGEST_STRING_LENGTH, abs_refname) != 0)
-			return NULL;
-		name = abs_refname;
-	} else
-		name = line + SHA1_DIGEST_STRING_LENGTH;
+	if (!got_parse_sha1_digest(id.sha1, pr->buf + off))
+		return got_error(GOT_ERR_BAD_REF_DATA);
 
-	return alloc_ref(ref, name, &id, GOT_REF_IS_PACKED, mtime);
+	refname = strndup(name, namelen);
+	if (refname == NULL)
+		return got_error_from_errno("strndup");
+	err = alloc_ref(ref, refname, &id, GOT_REF_IS_PACKED, pr->mtime);
+	free(refname);
+	return err;
 }
 
+/*
+ * Look up a reference in the packed-refs file which matches one of the
+ * given absolute reference names. If several match, the earliest name
+ * in the list wins.
+ */
 static const struct got_error *
-open_packed_ref(struct got_reference **ref, FILE *f, const char **subdirs,
-    int nsubdirs, const char *refname, time_t mtime)
+open_packed_ref(struct got_reference **ref, struct got_packed_refs *pr,
+    char **refnames, int nrefnames)
 {
-	const struct got_error *err = NULL;
-	char *abs_refname;
-	char *line = NULL;
-	size_t linesize = 0;
-	ssize_t linelen;
-	int i, ref_is_absolute = (strncmp(refname, "refs/", 5) == 0);
+	const char *name;
+	size_t off, namelen, match = 0;
+	int i, best = nrefnames;
 
 	*ref = NULL;
 
-	if (ref_is_absolute)
-		abs_refname = (char *)refname;
-	do {
-		linelen = getline(&line, &linesize, f);
-		if (linelen == -1) {
-			if (feof(f))
-				break;
-			err = got_ferror(f, GOT_ERR_BAD_REF_DATA);
-			break;
+	if (pr->sorted) {
+		for (i = 0; i < nrefnames; i++) {
+			off = packed_refs_lower_bound(pr, refnames[i]);
+			if (off >= pr->len)
+				continue;
+			name = packed_refs_name(&namelen, pr, off);
+			if (name && packed_refs_cmp(name, namelen,
+			    refnames[i], strlen(refnames[i])) == 0)
+				return packed_refs_parse(ref, pr, off);
 		}
-		if (linelen > 0 && line[linelen - 1] == '\n')
-			line[linelen - 1] = '\0';
-		for (i = 0; i < nsubdirs; i++) {
-			if (!ref_is_absolute &&
-			    asprintf(&abs_refname, "refs/%s/%s", subdirs[i],
-			    refname) == -1)
-				return got_error_from_errno("asprintf");
-			err = parse_packed_ref_line(ref, abs_refname, line,
-			    mtime);
-			if (!ref_is_absolute)
-				free(abs_refname);
-			if (err || *ref != NULL)
+		return NULL;
+	}
+
+	for (off = pr->start; off < pr->len;
+	    off = packed_refs_next_line(pr, off)) {
+		name = packed_refs_name(&namelen, pr, off);
+		if (name == NULL)
+			continue;
+		/* Earlier names take precedence, wherever they are stored. */
+		for (i = 0; i < best; i++) {
+			if (packed_refs_cmp(name, namelen, refnames[i],
+			    strlen(refnames[i])) == 0) {
+				best = i;
+				match = off;
 				break;
+			}
 		}
-		if (err)
+		if (best == 0)
 			break;
-	} while (*ref == NULL);
-	free(line);
+	}
 
-	return err;
+	if (best < nrefnames)
+		return packed_refs_parse(ref, pr, match);
+	return NULL;
 }
 
 static const struct got_error *
@@ -396,6 +643,73 @@ done:
 	return err;
 }
 
+static const struct got_error *
+reftable_ref(struct got_reference **ref, struct got_reftable_record *rec)
+{
+	if (rec->type == GOT_REFTABLE_SYMREF)
+		return alloc_symref(ref, rec->name, rec->target, 0);
+
+	return alloc_ref(ref, rec->name, &rec->id, 0, rec->mtime);
+}
+
+static const struct got_error *
+reftable_open_cb(void *arg, struct got_reftable_record *rec)
+{
+	struct got_reference **ref = arg;
+
+	return reftable_ref(ref, rec);
+}
+
+static const struct got_error *
+open_reftable_ref(struct got_reference **ref, struct got_reftable *rt,
+    const char *refname, int lock)
+{
+	const struct got_error *err = NULL;
+	const char *subdirs[] = {
+	    GOT_REF_HEADS, GOT_REF_TAGS, GOT_REF_REMOTES
+	};
+	char *name;
+	size_t i;
+
+	*ref = NULL;
+
+	if (!got_ref_name_is_valid(refname))
+		return got_error_path(refname, GOT_ERR_BAD_REF_NAME);
+
+	if (lock) {
+		err = got_reftable_lock(rt);
+		if (err)
+			return err;
+	}
+
+	if (is_well_known_ref(refname) || strncmp(refname, "refs/", 5) == 0)
+		err = got_reftable_lookup(rt, refname, reftable_open_cb, ref);
+	else {
+		for (i = 0; i < nitems(subdirs); i++) {
+			if (asprintf(&name, "refs/%s/%s", subdirs[i],
+			    refname) == -1) {
+				err = got_error_from_errno("asprintf");
+				break;
+			}
+			err = got_reftable_lookup(rt, name, reftable_open_cb,
+			    ref);
+			free(name);
+			if (err || *ref)
+				break;
+		}
+	}
+
+	if (err == NULL && *ref == NULL)
+		err = got_error_not_ref(refname);
+	if (lock) {
+		if (err)
+			got_reftable_unlock(rt);
+		else
+			(*ref)->rt = rt;
+	}
+	return err;
+}
+
 const struct got_error *
 got_ref_open(struct got_reference **ref, struct got_repository *repo,
     const char *refname, int lock)
@@ -405,12 +719,18 @@ got_ref_open(struct got_reference **ref, struct got_repository *repo,
 	const char *subdirs[] = {
 	    GOT_REF_HEADS, GOT_REF_TAGS, GOT_REF_REMOTES
 	};
-	size_t i;
+	char *refnames[nitems(subdirs)];
+	size_t i, nrefnames = 0;
 	int well_known = is_well_known_ref(refname);
 	struct got_lockfile *lf = NULL;
+	struct got_reftable *rt = got_repo_get_reftable(repo);
 
 	*ref = NULL;
 
+	/* FETCH_HEAD is always stored in a file. */
+	if (rt && strcmp(refname, GOT_REF_FETCH_HEAD) != 0)
+		return open_reftable_ref(ref, rt, refname, lock);
+
 	path_refs = get_refs_dir_path(repo, refname);
 	if (path_refs == NULL) {
 		err = got_error_from_errno2("get_refs_dir_path", refname);
@@ -420,7 +740,7 @@ got_ref_open(struct got_reference **ref, struct got_repository *repo,
 	if (well_known) {
 		err = open_ref(ref, path_refs, "", refname, lock);
 	} else {
-		FILE *f;
+		struct got_packed_refs pr;
 
 		/* Search on-disk refs before packed refs! */
 		for (i = 0; i < nitems(subdirs); i++) {
@@ -430,6 +750,24 @@ got_ref_open(struct got_reference **ref, struct got_repository *repo,
 				goto done;
 		}
 
+		if (strncmp(refname, "refs/", 5) == 0) {
+			refnames[0] = strdup(refname);
+			if (refnames[0] == NULL) {
+				err = got_error_from_errno("strdup");
+				goto done;
+			}
+			nrefnames = 1;
+		} else {
+			for (i = 0; i < nitems(subdirs); i++) {
+				if (asprintf(&refnames[i], "refs/%s/%s",
+				    subdirs[i], refname) == -1) {
+					err = got_error_from_errno("asprintf");
+					goto done;
+				}
+				nrefnames++;
+			}
+		}
+
 		packed_refs_path = got_repo_get_path_packed_refs(repo);
 		if (packed_refs_path == NULL) {
 			err = got_error_from_errno(
@@ -442,31 +780,21 @@ got_ref_open(struct got_reference **ref, struct got_repository *repo,
 			if (err)
 				goto done;
 		}
-		f = fopen(packed_refs_path, "rbe");
-		if (f != NULL) {
-			struct stat sb;
-			if (fstat(fileno(f), &sb) == -1) {
-				err = got_error_from_errno2("fstat",
-				    packed_refs_path);
-				goto done;
-			}
-			err = open_packed_ref(ref, f, subdirs, nitems(subdirs),
-			    refname, sb.st_mtime);
-			if (!err) {
-				if (fclose(f) == EOF) {
-					err = got_error_from_errno("fclose");
-					got_ref_close(*ref);
-					*ref = NULL;
-				} else if (*ref)
-					(*ref)->lf = lf;
-			}
-		}
+		err = packed_refs_open(&pr, packed_refs_path);
+		if (err)
+			goto done;
+		err = open_packed_ref(ref, &pr, refnames, nrefnames);
+		packed_refs_close(&pr);
+		if (!err && *ref)
+			(*ref)->lf = lf;
 	}
 done:
 	if (!err && *ref == NULL)
 		err = got_error_not_ref(refname);
 	if (err && lf)
 		got_lockfile_unlock(lf, -1);
+	for (i = 0; i < nrefnames; i++)
+		free(refnames[i]);
 	free(packed_refs_path);
 	free(path_refs);
 	return err;
@@ -948,6 +1276,60 @@ done:
 	return err;
 }
 
+struct reftable_list_arg {
+	struct got_reflist_head *refs;
+	const char *prefix;
+	got_ref_cmp_cb cmp_cb;
+	void *cmp_arg;
+};
+
+static const struct got_error *
+reftable_list_cb(void *arg, struct got_reftable_record *rec)
+{
+	const struct got_error *err;
+	struct reftable_list_arg *a = arg;
+	struct got_reference *ref;
+	struct got_reflist_entry *new;
+
+	if (a->prefix[0] != '\0' &&
+	    !got_path_is_child(rec->name, a->prefix, strlen(a->prefix)))
+		return NULL;
+
+	err = reftable_ref(&ref, rec);
+	if (err)
+		return err;
+	err = got_reflist_insert(&new, a->refs, ref, a->cmp_cb, a->cmp_arg);
+	if (err || new == NULL /* duplicate */)
+		got_ref_close(ref);
+	return err;
+}
+
+/* Look up a reference by name, with names outside refs/ taken as relative. */
+static const struct got_error *
+open_reftable_absref(struct got_reference **ref, struct got_reftable *rt,
+    const char *refname)
+{
+	const struct got_error *err;
+	char *absname;
+
+	*ref = NULL;
+
+	if (!got_ref_name_is_valid(refname))
+		return got_error_path(refname, GOT_ERR_BAD_REF_NAME);
+
+	if (is_well_known_ref(refname) || strncmp(refname, "refs/", 5) == 0)
+		err = got_reftable_lookup(rt, refname, reftable_open_cb, ref);
+	else {
+		if (asprintf(&absname, "refs/%s", refname) == -1)
+			return got_error_from_errno("asprintf");
+		err = got_reftable_lookup(rt, absname, reftable_open_cb, ref);
+		free(absname);
+	}
+	if (err == NULL && *ref == NULL)
+		err = got_error_not_ref(refname);
+	return err;
+}
+
 const struct got_error *
 got_ref_list(struct got_reflist_head *refs, struct got_repository *repo,
     const char *ref_namespace, got_ref_cmp_cb cmp_cb, void *cmp_arg)
@@ -956,18 +1338,26 @@ got_ref_list(struct got_reflist_head *refs, struct got_repository *repo,
 	char *packed_refs_path = NULL, *path_refs = NULL;
 	char *abs_namespace = NULL, *buf = NULL;
 	const char *ondisk_ref_namespace = NULL;
-	char *line = NULL;
-	FILE *f = NULL;
+	struct got_packed_refs pr;
 	struct got_reference *ref;
 	struct got_reflist_entry *new;
+	struct got_reftable *rt = got_repo_get_reftable(repo);
+	size_t off, nslen = 0;
+
+	memset(&pr, 0, sizeof(pr));
 
 	if (ref_namespace == NULL || ref_namespace[0] == '\0') {
-		path_refs = get_refs_dir_path(repo, GOT_REF_HEAD);
-		if (path_refs == NULL) {
-			err = got_error_from_errno("get_refs_dir_path");
-			goto done;
+		if (rt)
+			err = open_reftable_absref(&ref, rt, GOT_REF_HEAD);
+		else {
+			path_refs = get_refs_dir_path(repo, GOT_REF_HEAD);
+			if (path_refs == NULL) {
+				err = got_error_from_errno(
+				    "get_refs_dir_path");
+				goto done;
+			}
+			err = open_ref(&ref, path_refs, "", GOT_REF_HEAD, 0);
 		}
-		err = open_ref(&ref, path_refs, "", GOT_REF_HEAD, 0);
 		if (err)
 			goto done;
 		err = got_reflist_insert(&new, refs, ref, cmp_cb, cmp_arg);
@@ -978,12 +1368,17 @@ got_ref_list(struct got_reflist_head *refs, struct got_repository *repo,
 	} else {
 		/* Try listing a single reference. */
 		const char *refname = ref_namespace;
-		path_refs = get_refs_dir_path(repo, refname);
-		if (path_refs == NULL) {
-			err = got_error_from_errno("get_refs_dir_path");
-			goto done;
+		if (rt)
+			err = open_reftable_absref(&ref, rt, refname);
+		else {
+			path_refs = get_refs_dir_path(repo, refname);
+			if (path_refs == NULL) {
+				err = got_error_from_errno(
+				    "get_refs_dir_path");
+				goto done;
+			}
+			err = open_ref(&ref, path_refs, "", refname, 0);
 		}
-		err = open_ref(&ref, path_refs, "", refname, 0);
 		if (err) {
 			if (err->code != GOT_ERR_NOT_REF)
 				goto done;
@@ -1022,6 +1417,25 @@ got_ref_list(struct got_reflist_head *refs, struct got_repository *repo,
 			ondisk_ref_namespace = "";
 	}
 
+	if (rt) {
+		struct reftable_list_arg arg;
+		char *prefix;
+
+		if (asprintf(&prefix, "refs/%s", ondisk_ref_namespace ?
+		    ondisk_ref_namespace : "") == -1) {
+			err = got_error_from_errno("asprintf");
+			goto done;
+		}
+		arg.refs = refs;
+		arg.prefix = ondisk_ref_namespace &&
+		    ondisk_ref_namespace[0] != '\0' ? prefix : "";
+		arg.cmp_cb = cmp_cb;
+		arg.cmp_arg = cmp_arg;
+		err = got_reftable_foreach(rt, prefix, reftable_list_cb, &arg);
+		free(prefix);
+		goto done;
+	}
+
 	/* Gather on-disk refs before parsing packed-refs. */
 	free(path_refs);
 	path_refs = get_refs_dir_path(repo, "");
@@ -1045,58 +1459,54 @@ got_ref_list(struct got_reflist_head *refs, struct got_repository *repo,
 		goto done;
 	}
 
-	f = fopen(packed_refs_path, "re");
-	if (f) {
-		size_t linesize = 0;
-		ssize_t linelen;
-		struct stat sb;
+	err = packed_refs_open(&pr, packed_refs_path);
+	if (err)
+		goto done;
 
-		if (fstat(fileno(f), &sb) == -1) {
-			err = got_error_from_errno2("fstat", packed_refs_path);
-			goto done;
+	/*
+	 * In a sorted file all references in the namespace are found in
+	 * a contiguous range of records which begins with the first name
+	 * not less than the namespace itself.
+	 */
+	off = pr.start;
+	if (pr.sorted && ref_namespace && ref_namespace[0] != '\0' &&
+	    !got_path_is_root_dir(ref_namespace)) {
+		nslen = strlen(ref_namespace);
+		off = packed_refs_lower_bound(&pr, ref_namespace);
+	}
+
+	for (; off < pr.len; off = packed_refs_next_line(&pr, off)) {
+		if (nslen > 0) {
+			const char *name;
+			size_t namelen;
+
+			name = packed_refs_name(&namelen, &pr, off);
+			if (name && (namelen < nslen ||
+			    memcmp(name, ref_namespace, nslen) != 0))
+				break;
 		}
-		for (;;) {
-			linelen = getline(&line, &linesize, f);
-			if (linelen == -1) {
-				if (feof(f))
-					break;
-				err = got_ferror(f, GOT_ERR_BAD_REF_DATA);
-				goto done;
-			}
-			if (linelen > 0 && line[linelen - 1] == '\n')
-				line[linelen - 1] = '\0';
-			err = parse_packed_ref_line(&ref, NULL, line,
-			    sb.st_mtime);
-			if (err)
-				goto done;
-			if (ref) {
-				if (ref_namespace) {
-					const char *name;
-					name = got_ref_get_name(ref);
-					if (!got_path_is_child(name,
-					    ref_namespace,
-					    strlen(ref_namespace))) {
-						got_ref_close(ref);
-						continue;
-					}
-				}
-				err = got_reflist_insert(&new, refs, ref,
-				    cmp_cb, cmp_arg);
-				if (err || new == NULL /* duplicate */)
-					got_ref_close(ref);
-				if (err)
-					goto done;
-			}
+		err = packed_refs_parse(&ref, &pr, off);
+		if (err)
+			goto done;
+		if (ref == NULL)
+			continue;
+		if (ref_namespace && !got_path_is_child(got_ref_get_name(ref),
+		    ref_namespace, strlen(ref_namespace))) {
+			got_ref_close(ref);
+			continue;
 		}
+		err = got_reflist_insert(&new, refs, ref, cmp_cb, cmp_arg);
+		if (err || new == NULL /* duplicate */)
+			got_ref_close(ref);
+		if (err)
+			goto done;
 	}
 done:
 	free(packed_refs_path);
 	free(abs_namespace);
 	free(buf);
-	free(line);
 	free(path_refs);
-	if (f && fclose(f) == EOF && err == NULL)
-		err = got_error_from_errno("fclose");
+	packed_refs_close(&pr);
 	return err;
 }
 
@@ -1158,6 +1568,27 @@ got_ref_change_symref_to_ref(struct got_reference *symref,
 	return NULL;
 }
 
+static const struct got_error *
+write_reftable_ref(struct got_reference *ref, struct got_reftable *rt,
+    int delete)
+{
+	struct got_reftable_record rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.name = got_ref_get_name(ref);
+	if (delete)
+		rec.type = GOT_REFTABLE_DELETION;
+	else if (ref->flags & GOT_REF_IS_SYMBOLIC) {
+		rec.type = GOT_REFTABLE_SYMREF;
+		rec.target = ref->ref.symref.ref;
+	} else {
+		rec.type = GOT_REFTABLE_VAL1;
+		memcpy(&rec.id, &ref->ref.ref.id, sizeof(rec.id));
+	}
+
+	return got_reftable_update(rt, &rec, 1);
+}
+
 const struct got_error *
 got_ref_write(struct got_reference *ref, struct got_repository *repo)
 {
@@ -1168,6 +1599,14 @@ got_ref_write(struct got_reference *ref, struct got_repository *repo)
 	FILE *f = NULL;
 	size_t n;
 	struct stat sb;
+	struct got_reftable *rt = got_repo_get_reftable(repo);
+
+	if (rt && strcmp(name, GOT_REF_FETCH_HEAD) != 0) {
+		err = write_reftable_ref(ref, rt, 0);
+		if (err == NULL)
+			ref->mtime = time(NULL);
+		return err;
+	}
 
 	path_refs = get_refs_dir_path(repo, name);
 	if (path_refs == NULL) {
@@ -1274,17 +1713,18 @@ delete_packed_ref(struct got_reference *delref, struct got_repository *repo)
 {
 	const struct got_error *err = NULL, *unlock_err = NULL;
 	struct got_lockfile *lf = NULL;
-	FILE *f = NULL, *tmpf = NULL;
-	char *line = NULL, *packed_refs_path, *tmppath = NULL;
-	size_t linesize = 0;
-	struct got_reflist_head refs;
+	struct got_packed_refs pr;
+	FILE *tmpf = NULL;
+	char *packed_refs_path, *tmppath = NULL;
+	const char *delname = delref->ref.ref.name;
+	size_t off, next, copied = 0, dellen = strlen(delname);
 	int found_delref = 0;
 
 	/* The packed-refs file does not cotain symbolic references. */
 	if (delref->flags & GOT_REF_IS_SYMBOLIC)
 		return got_error(GOT_ERR_BAD_REF_DATA);
 
-	TAILQ_INIT(&refs);
+	memset(&pr, 0, sizeof(pr));
 
 	packed_refs_path = got_repo_get_path_packed_refs(repo);
 	if (packed_refs_path == NULL)
@@ -1300,88 +1740,60 @@ delete_packed_ref(struct got_reference *delref, struct got_repository *repo)
 			goto done;
 	}
 
-	f = fopen(packed_refs_path, "re");
-	if (f == NULL) {
-		err = got_error_from_errno2("fopen", packed_refs_path);
+	err = packed_refs_open(&pr, packed_refs_path);
+	if (err)
 		goto done;
-	}
-	for (;;) {
-		ssize_t linelen;
-		struct got_reference *ref;
-		struct got_reflist_entry *new;
 
-		linelen = getline(&line, &linesize, f);
-		if (linelen == -1) {
-			if (feof(f))
-				break;
-			err = got_ferror(f, GOT_ERR_BAD_REF_DATA);
+	/*
+	 * Copy the file while leaving out the deleted reference and its
+	 * peeled object ID, if any. This preserves the header, and with
+	 * it the sort order promised by the "sorted" trait.
+	 */
+	for (off = pr.start; off < pr.len; off = next) {
+		struct got_object_id id;
+		const char *name;
+		size_t namelen;
+
+		next = packed_refs_next_record(&pr, off);
+		name = packed_refs_name(&namelen, &pr, off);
+		if (name == NULL ||
+		    packed_refs_cmp(name, namelen, delname, dellen) != 0)
+			continue;
+		if (!got_parse_sha1_digest(id.sha1, pr.buf + off)) {
+			err = got_error(GOT_ERR_BAD_REF_DATA);
 			goto done;
 		}
-		if (linelen > 0 && line[linelen - 1] == '\n')
-			line[linelen - 1] = '\0';
-		err = parse_packed_ref_line(&ref, NULL, line, 0);
-		if (err)
-			goto done;
-		if (ref == NULL)
-			continue;
-
-		if (strcmp(ref->ref.ref.name, delref->ref.ref.name) == 0 &&
-		    got_object_id_cmp(&ref->ref.ref.id,
-		    &delref->ref.ref.id) == 0) {
-			found_delref = 1;
-			got_ref_close(ref);
+		if (got_object_id_cmp(&id, &delref->ref.ref.id) != 0)
 			continue;
-		}
 
-		err = got_reflist_insert(&new, &refs, ref,
-		    got_ref_cmp_by_name, NULL);
-		if (err || new == NULL /* duplicate */)
-			got_ref_close(ref);
-		if (err)
+		found_delref = 1;
+		if (off > copied &&
+		    fwrite(pr.buf + copied, 1, off - copied, tmpf) !=
+		    off - copied) {
+			err = got_ferror(tmpf, GOT_ERR_IO);
 			goto done;
+		}
+		copied = next;
 	}
 
 	if (found_delref) {
-		struct got_reflist_entry *re;
-		size_t n;
 		struct stat sb;
 
-		n = fprintf(tmpf, "%s\n", GOT_PACKED_REFS_HEADER);
-		if (n != sizeof(GOT_PACKED_REFS_HEADER)) {
-			err = got_ferror(f, GOT_ERR_IO);
+		if (pr.len > copied &&
+		    fwrite(pr.buf + copied, 1, pr.len - copied, tmpf) !=
+		    pr.len - copied) {
+			err = got_ferror(tmpf, GOT_ERR_IO);
 			goto done;
 		}
 
-		TAILQ_FOREACH(re, &refs, entry) {
-			char *hex;
-			size_t len;
-
-			err = got_object_id_str(&hex, &re->ref->ref.ref.id);
-			if (err)
-				goto done;
-			len = strlen(hex);
-			n = fprintf(tmpf, "%s ", hex);
-			free(hex);
-			if (n != len + 1) {
-				err = got_ferror(f, GOT_ERR_IO);
-				goto done;
-			}
-
-			n = fprintf(tmpf, "%s\n", re->ref->ref.ref.name);
-			if (n != strlen(re->ref->ref.ref.name) + 1) {
-				err = got_ferror(f, GOT_ERR_IO);
-				goto done;
-			}
-		}
-
 		if (fflush(tmpf) != 0) {
 			err = got_error_from_errno("fflush");
 			goto done;
 		}
 
-		if (fstat(fileno(f), &sb) != 0) {
+		if (stat(packed_refs_path, &sb) != 0) {
 			if (errno != ENOENT) {
-				err = got_error_from_errno2("fstat",
+				err = got_error_from_errno2("stat",
 				    packed_refs_path);
 				goto done;
 			}
@@ -1404,18 +1816,13 @@ delete_packed_ref(struct got_reference *delref, struct got_repository *repo)
 done:
 	if (delref->lf == NULL && lf)
 		unlock_err = got_lockfile_unlock(lf, -1);
-	if (f) {
-		if (fclose(f) == EOF && err == NULL)
-			err = got_error_from_errno("fclose");
-	}
+	packed_refs_close(&pr);
 	if (tmppath && unlink(tmppath) == -1 && err == NULL)
 		err = got_error_from_errno2("unlink", tmppath);
 	if (tmpf && fclose(tmpf) == EOF && err == NULL)
 		err = got_error_from_errno("fclose");
 	free(tmppath);
 	free(packed_refs_path);
-	free(line);
-	got_ref_list_free(&refs);
 	return err ? err : unlock_err;
 }
 
@@ -1462,6 +1869,10 @@ got_ref_delete(struct got_reference *ref, struct got_repository *repo)
 {
 	const struct got_error *err = NULL;
 	struct got_reference *ref2;
+	struct got_reftable *rt = got_repo_get_reftable(repo);
+
+	if (rt && strcmp(got_ref_get_name(ref), GOT_REF_FETCH_HEAD) != 0)
+		return write_reftable_ref(ref, rt, 1);
 
 	if (ref->flags & GOT_REF_IS_PACKED) {
 		err = delete_packed_ref(ref, repo);
@@ -1500,6 +1911,13 @@ const struct got_error *
 got_ref_unlock(struct got_reference *ref)
 {
 	const struct got_error *err;
+
+	if (ref->rt) {
+		err = got_reftable_unlock(ref->rt);
+		ref->rt = NULL;
+		return err;
+	}
+
 	err = got_lockfile_unlock(ref->lf, -1);
 	ref->lf = NULL;
 	return err;
@@ -0,0 +1,1710 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sha1.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "got_error.h"
+#include "got_object.h"
+#include "got_opentemp.h"
+#include "got_path.h"
+
+#include "got_lib_lockfile.h"
+#include "got_lib_reftable.h"
+
+/*
+ * Only version 1 of the format, which uses SHA1 object IDs, is supported.
+ * Tables written by got contain reference blocks and a reference index
+ * but no object or log blocks; such sections written by Git are ignored.
+ */
+#define REFTABLE_MAGIC		"REFT"
+#define REFTABLE_VERSION	1
+#define REFTABLE_HEADER_SIZE	24
+#define REFTABLE_FOOTER_SIZE	68
+#define REFTABLE_BLOCK_SIZE	4096
+#define REFTABLE_RESTART_INTERVAL 16
+#define REFTABLE_INDEX_MIN_BLOCKS 4
+#define REFTABLE_INDEX_MAX_DEPTH 16
+#define REFTABLE_RELOAD_ATTEMPTS 5
+
+#define REFTABLE_BLOCK_REF	'r'
+#define REFTABLE_BLOCK_INDEX	'i'
+
+struct reftable_table {
+	char *name;
+	uint8_t *buf;
+	size_t size;		/* size of the file */
+	size_t len;		/* offset of the footer */
+	int mapped;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+	size_t ref_index_pos;
+	size_t refs_end;	/* end of the section of reference blocks */
+	size_t log_pos;		/* offset of the log blocks, if any */
+	time_t mtime;
+};
+
+struct got_reftable {
+	char *path;		/* path to the reftable directory */
+	char *list_path;	/* path to tables.list */
+	struct reftable_table **tables;	/* oldest table first */
+	int ntables;
+	int loaded;
+	struct stat list_sb;
+	struct got_lockfile *lf;
+	int nlocks;
+};
+
+/* A cursor on the records of one table. */
+struct reftable_iter {
+	struct reftable_table *t;
+	int eof;
+
+	int block_type;
+	size_t blk;		/* offset of the current block */
+	size_t blen;		/* length of the current block */
+	size_t records;		/* offset of the first record in the block */
+	size_t restarts;	/* offset of the restart point table */
+	uint16_t nrestarts;
+	size_t off;		/* offset of the next record */
+
+	/* The current record. */
+	char *key;
+	size_t keylen;
+	size_t keysize;
+	int type;
+	uint64_t update_index;	/* relative to the table's minimum */
+	const uint8_t *id;
+	char *target;
+	size_t targetsize;
+	uint64_t child;		/* block position, in index records */
+};
+
+/* A cursor on the merged records of a range of tables. */
+struct reftable_merged {
+	struct reftable_iter *its;	/* oldest table first */
+	int nits;
+	int cur;		/* cursor on the current record, or -1 */
+};
+
+struct reftable_index_entry {
+	char *key;
+	uint64_t pos;
+};
+
+struct reftable_writer {
+	FILE *f;
+	uint8_t header[REFTABLE_HEADER_SIZE];
+	uint64_t min_update_index;
+	size_t off;		/* bytes written to the file */
+
+	uint8_t block[REFTABLE_BLOCK_SIZE];
+	int block_type;		/* 0 if no block has been started */
+	size_t hdr;		/* size of the file header in this block */
+	size_t used;		/* bytes used in the current block */
+	uint32_t *restarts;
+	size_t nrestarts;
+	size_t restartsize;
+	size_t nrecords;	/* records in the current block */
+	char *lastkey;
+	size_t lastkeysize;
+	uint8_t *val;
+	size_t valsize;
+
+	/* Last key and position of each block written so far. */
+	struct reftable_index_entry *index;
+	size_t nindex;
+	size_t indexsize;
+};
+
+static uint16_t
+get_be16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static uint32_t
+get_be24(const uint8_t *p)
+{
+	return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static uint32_t
+get_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t
+get_be64(const uint8_t *p)
+{
+	return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+static void
+put_be16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void
+put_be24(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 16;
+	p[1] = v >> 8;
+	p[2] = v;
+}
+
+static void
+put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void
+put_be64(uint8_t *p, uint64_t v)
+{
+	put_be32(p, v >> 32);
+	put_be32(p + 4, v);
+}
+
+/*
+ * Variable-length integers use the same encoding as offsets of
+ * OFS_DELTA objects in pack files. Return the number of bytes
+ * consumed, or zero if the integer is malformed.
+ */
+static size_t
+get_varint(uint64_t *val, const uint8_t *p, size_t len)
+{
+	uint64_t v;
+	size_t i = 0;
+
+	if (len == 0)
+		return 0;
+
+	v = p[i] & 0x7f;
+	while (p[i++] & 0x80) {
+		if (i >= len || v >= (UINT64_MAX >> 7))
+			return 0;
+		v = ((v + 1) << 7) | (p[i] & 0x7f);
+	}
+
+	*val = v;
+	return i;
+}
+
+/* Encode an integer into at most 10 bytes and return its length. */
+static size_t
+put_varint(uint8_t *p, uint64_t val)
+{
+	uint8_t buf[10];
+	size_t i = sizeof(buf) - 1, n;
+
+	buf[i] = val & 0x7f;
+	while (val >>= 7)
+		buf[--i] = 0x80 | (--val & 0x7f);
+
+	n = sizeof(buf) - i;
+	memcpy(p, buf + i, n);
+	return n;
+}
+
+static void
+table_close(struct reftable_table *t)
+{
+	if (t == NULL)
+		return;
+	if (t->mapped)
+		munmap(t->buf, t->size);
+	else
+		free(t->buf);
+	free(t->name);
+	free(t);
+}
+
+static const struct got_error *
+table_open(struct reftable_table **tp, const char *dir, const char *name)
+{
+	const struct got_error *err = NULL;
+	struct reftable_table *t;
+	struct stat sb;
+	const uint8_t *footer;
+	char *path = NULL;
+	size_t pos, off = 0;
+	ssize_t r;
+	int fd = -1;
+
+	*tp = NULL;
+
+	t = calloc(1, sizeof(*t));
+	if (t == NULL)
+		return got_error_from_errno("calloc");
+
+	t->name = strdup(name);
+	if (t->name == NULL) {
+		err = got_error_from_errno("strdup");
+		goto done;
+	}
+
+	if (asprintf(&path, "%s/%s", dir, name) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		err = got_error_from_errno2("open", path);
+		goto done;
+	}
+	if (fstat(fd, &sb) == -1) {
+		err = got_error_from_errno2("fstat", path);
+		goto done;
+	}
+	if (sb.st_size < REFTABLE_HEADER_SIZE + REFTABLE_FOOTER_SIZE ||
+	    sb.st_size > SIZE_MAX) {
+		err = got_error_path(path, GOT_ERR_BAD_REF_DATA);
+		goto done;
+	}
+	t->size = sb.st_size;
+	t->mtime = sb.st_mtime;
+
+#ifndef GOT_PACK_NO_MMAP
+	t->buf = mmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (t->buf != MAP_FAILED) {
+		t->mapped = 1;
+		goto parse;
+	}
+	t->buf = NULL;
+	if (errno != ENOMEM) {
+		err = got_error_from_errno2("mmap", path);
+		goto done;
+	}
+#endif
+	/* fall back to read(2) */
+	t->buf = malloc(t->size);
+	if (t->buf == NULL) {
+		err = got_error_from_errno("malloc");
+		goto done;
+	}
+	while (off < t->size) {
+		r = read(fd, t->buf + off, t->size - off);
+		if (r == -1) {
+			err = got_error_from_errno2("read", path);
+			goto done;
+		}
+		if (r == 0) {
+			err = got_error_path(path, GOT_ERR_BAD_REF_DATA);
+			goto done;
+		}
+		off += r;
+	}
+#ifndef GOT_PACK_NO_MMAP
+parse:
+#endif
+	t->len = t->size - REFTABLE_FOOTER_SIZE;
+	footer = t->buf + t->len;
+
+	if (memcmp(t->buf, REFTABLE_MAGIC, 4) != 0 ||
+	    t->buf[4] != REFTABLE_VERSION ||
+	    memcmp(t->buf, footer, REFTABLE_HEADER_SIZE) != 0 ||
+	    get_be32(footer + REFTABLE_FOOTER_SIZE - 4) !=
+	    crc32(0, footer, REFTABLE_FOOTER_SIZE - 4)) {
+		err = got_error_path(path, GOT_ERR_BAD_REF_DATA);
+		goto done;
+	}
+
+	t->min_update_index = get_be64(t->buf + 8);
+	t->max_update_index = get_be64(t->buf + 16);
+
+	/*
+	 * Reference blocks come first and are followed by the reference
+	 * index, object blocks, and log blocks, each of which is optional.
+	 */
+	t->refs_end = t->len;
+	t->ref_index_pos = get_be64(footer + 24);
+	if (t->ref_index_pos >= t->len) {
+		err = got_error_path(path, GOT_ERR_BAD_REF_DATA);
+		goto done;
+	}
+	if (t->ref_index_pos)
+		t->refs_end = t->ref_index_pos;
+	pos = get_be64(footer + 32) >> 5;	/* object blocks */
+	if (pos && pos < t->refs_end)
+		t->refs_end = pos;
+	pos = get_be64(footer + 48);		/* log blocks */
+	t->log_pos = pos;
+	if (pos && pos < t->refs_end)
+		t->refs_end = pos;
+	if (t->refs_end < REFTABLE_HEADER_SIZE) {
+		err = got_error_path(path, GOT_ERR_BAD_REF_DATA);
+		goto done;
+	}
+done:
+	if (fd != -1 && close(fd) == -1 && err == NULL)
+		err = got_error_from_errno2("close", path);
+	free(path);
+	if (err)
+		table_close(t);
+	else
+		*tp = t;
+	return err;
+}
+
+/*
+ * Position the cursor on the block at the given offset. If the block
+ * is not a reference block while one was expected, the end of the
+ * reference block section has been reached.
+ */
+static const struct got_error *
+block_open(struct reftable_iter *it, size_t blk, int type)
+{
+	struct reftable_table *t = it->t;
+	size_t hdr = (blk == 0 ? REFTABLE_HEADER_SIZE : 0);
+	const uint8_t *p;
+	uint32_t blen;
+	uint16_t nrestarts;
+
+	if (type == REFTABLE_BLOCK_REF && blk + hdr >= t->refs_end) {
+		it->eof = 1;
+		return NULL;
+	}
+	if (blk + hdr + 4 > t->len)
+		return got_error(GOT_ERR_BAD_REF_DATA);
+
+	p = t->buf + blk + hdr;
+	if (p[0] != type) {
+		if (type == REFTABLE_BLOCK_REF) {
+			it->eof = 1;
+			return NULL;
+		}
+		return got_error(GOT_ERR_BAD_REF_DATA);
+	}
+
+	blen = get_be24(p + 1);
+	if (blen < hdr + 4 + 3 + 2 || blen > t->len - blk)
+		return got_error(GOT_ERR_BAD_REF_DATA);
+	nrestarts = get_be16(t->buf + blk + blen - 2);
+	if (nrestarts == 0 || nrestarts * 3 > blen - hdr - 4 - 2)
+		return got_error(GOT_ERR_BAD_REF_DATA);
+
+	it->eof = 0;
+	it->block_type = type;
+	it->blk = blk;
+	it->blen = blen;
+	it->records = blk + hdr + 4;
+	it->restarts = blk + blen - 2 - nrestarts * 3;
+	it->nrestarts = nrestarts;
+	it->off = it->records;
+	it->keylen = 0;
+	return NULL;
+}
+
+/* Move the cursor to the next reference block. */
+static const struct got_error *
+block_next(struct reftable_iter *it)
+{
+	struct reftable_table *t = it->t;
+	size_t next = it->blk + it->blen;
+
+	if (it->block_type != REFTABLE_BLOCK_REF) {
+		it->eof = 1;
+		return NULL;
+	}
+
+	/* Skip padding, if blocks are aligned. */
+	while (next < t->refs_end && t->buf[next] == 0)
+		next++;
+
+	return block_open(it, next, REFTABLE_BLOCK_REF);
+}
+
+/* Decode the record at the cursor and advance the cursor. */
+static const struct got_error *
+record_decode(struct reftable_iter *it)
+{
+	const uint8_t *buf = it->t->buf;
+	size_t off = it->off, end = it->restarts, n, keylen;
+	uint64_t prefix, x, len;
+	char *key;
+
+	n = get_varint(&prefix, buf + off, end - off);
+	if (n == 0)
+		return got_error(GOT_ERR_BAD_REF_DATA);
+	off += n;
+	n = get_varint(&x, buf + off, end - off);
+	if (n == 0)
+		return got_error(GOT_ERR_BAD_REF_DATA);
+	off += n;
+	len = x >> 3;
+	it->type = x & 0x7;
+
+	if (prefix > it->keylen || len > end - off)
+		return got_error(GOT_ERR_BAD_REF_DATA);
+	keylen = prefix + len;
+	if (keylen + 1 > it->keysize) {
+		key = realloc(it->key, keylen + 1);
+		if (key == NULL)
+			return got_error_from_errno("realloc");
+		it->key = key;
+		it->keysize = keylen + 1;
+	}
+	memcpy(it->key + prefix, buf + off, len);
+	it->key[keylen] = '\0';
+	it->keylen = keylen;
+	off += len;
+
+	if (it->block_type == REFTABLE_BLOCK_INDEX) {
+		if (it->type != 0)
+			return got_error(GOT_ERR_BAD_REF_DATA);
+		n = get_varint(&it->child, buf + off, end - off);
+		if (n == 0)
+			return got_error(GOT_ERR_BAD_REF_DATA);
+		it->off = off + n;
+		return NULL;
+	}
+
+	n = get_varint(&it->update_index, buf + off, end - off);
+	if (n == 0)
+		return got_error(GOT_ERR_BAD_REF_DATA);
+	off += n;
+
+	switch (it->type) {
+	case GOT_REFTABLE_DELETION:
+		break;
+	case GOT_REFTABLE_VAL1:
+	case GOT_REFTABLE_VAL2:
+		len = SHA1_DIGEST_LENGTH;
+		if (it->type == GOT_REFTABLE_VAL2)
+			len *= 2;
+		if (len > end - off)
+			return got_error(GOT_ERR_BAD_REF_DATA);
+		it->id = buf + off;
+		off += len;
+		break;
+	case GOT_REFTABLE_SYMREF:
+		n = get_varint(&len, buf + off, end - off);
+		if (n == 0 || len > end - off - n)
+			return got_error(GOT_ERR_BAD_REF_DATA);
+		off += n;
+		if (len + 1 > it->targetsize) {
+			char *target = realloc(it->target, len + 1);
+			if (target == NULL)
+				return got_error_from_errno("realloc");
+			it->target = target;
+			it->targetsize = len + 1;
+		}
+		memcpy(it->target, buf + off, len);
+		it->target[len] = '\0';
+		off += len;
+		break;
+	default:
+		return got_error(GOT_ERR_BAD_REF_DATA);
+	}
+
+	it->off = off;
+	return NULL;
+}
+
+/*
+ * Compare the key of the record at a restart point, which is stored
+ * without prefix compression, with the given key.
+ */
+static const struct got_error *
+restart_cmp(int *cmp, struct reftable_iter *it, int i, const char *key)
+{
+	const uint8_t *buf = it->t->buf;
+	size_t off, end = it->restarts, n, keylen = strlen(key);
+	uint64_t prefix, x, len;
+
+	off = it->blk + get_be24(buf + it->restarts + i * 3);
+	if (off < it->records || off >= end)
+		return got_error(GOT_ERR_BAD_REF_DATA);
+
+	n = get_varint(&prefix, buf + off, end - off);
+	if (n == 0 || prefix != 0)
+		return got_error(GOT_ERR_BAD_REF_DATA);
+	off += n;
+	n = get_varint(&x, buf + off, end - off);
+	if (n == 0)
+		return got_error(GOT_ERR_BAD_REF_DATA);
+	off += n;
+	len = x >> 3;
+	if (len > end - off)
+		return got_error(GOT_ERR_BAD_REF_DATA);
+
+	*cmp = memcmp(buf + off, key, len < keylen ? len : keylen);
+	if (*cmp == 0)
+		*cmp = (len > keylen) - (len < keylen);
+	return NULL;
+}
+
+/*
+ * Move the cursor to the first record in the current block whose key
+ * is not less than the given key. Set *found to zero if the block has
+ * no such record.
+ */
+static const struct got_error *
+block_seek(int *found, struct reftable_iter *it, const char *key)
+{
+	const struct got_error *err;
+	int lo = 0, hi = it->nrestarts, mid, cmp;
+
+	*found = 0;
+
+	/* Find the first restart point with a key greater than ours. */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		err = restart_cmp(&cmp, it, mid, key);
+		if (err)
+			return err;
+		if (cmp > 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	/* Scan forward from the restart point preceding it. */
+	if (lo == 0)
+		it->off = it->records;
+	else
+		it->off = it->blk + get_be24(it->t->buf + it->restarts +
+		    (lo - 1) * 3);
+	it->keylen = 0;
+
+	while (it->off < it->restarts) {
+		err = record_decode(it);
+		if (err)
+			return err;
+		if (strcmp(it->key, key) >= 0) {
+			*found = 1;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+iter_free(struct reftable_iter *it)
+{
+	free(it->key);
+	free(it->target);
+	memset(it, 0, sizeof(*it));
+}
+
+/* Move the cursor to the next record. */
+static const struct got_error *
+iter_next(struct reftable_iter *it)
+{
+	const struct got_error *err;
+
+	if (it->eof)
+		return NULL;
+
+	if (it->off >= it->restarts) {
+		err = block_next(it);
+		if (err || it->eof)
+			return err;
+	}
+
+	return record_decode(it);
+}
+
+/*
+ * Position a cursor on the first reference in a table whose name is not
+ * less than the given key. The reference index, if present, is used to
+ * locate the reference block to search.
+ */
+static const struct got_error *
+iter_seek(struct reftable_iter *it, struct reftable_table *t,
+    const char *key)
+{
+	const struct got_error *err;
+	size_t blk = 0, hdr;
+	int depth, found;
+
+	it->t = t;
+	it->eof = 0;
+
+	for (depth = 0; t->ref_index_pos != 0; depth++) {
+		if (depth >= REFTABLE_INDEX_MAX_DEPTH)
+			return got_error(GOT_ERR_BAD_REF_DATA);
+		err = block_open(it, depth == 0 ? t->ref_index_pos : blk,
+		    REFTABLE_BLOCK_INDEX);
+		if (err)
+			return err;
+		err = block_seek(&found, it, key);
+		if (err)
+			return err;
+		if (!found) {
+			it->eof = 1;
+			return NULL;
+		}
+		blk = it->child;
+		hdr = (blk == 0 ? REFTABLE_HEADER_SIZE : 0);
+		if (blk + hdr >= t->len)
+			return got_error(GOT_ERR_BAD_REF_DATA);
+		if (t->buf[blk + hdr] == REFTABLE_BLOCK_REF)
+			break;
+	}
+
+	err = block_open(it, blk, REFTABLE_BLOCK_REF);
+	while (err == NULL && !it->eof) {
+		err = block_seek(&found, it, key);
+		if (err || found)
+			break;
+		err = block_next(it);
+	}
+
+	return err;
+}
+
+static void
+iter_record(struct got_reftable_record *rec, struct reftable_iter *it)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->name = it->key;
+	rec->type = it->type;
+	if (it->type == GOT_REFTABLE_VAL1 || it->type == GOT_REFTABLE_VAL2)
+		memcpy(rec->id.sha1, it->id, SHA1_DIGEST_LENGTH);
+	if (it->type == GOT_REFTABLE_VAL2)
+		memcpy(rec->peeled.sha1, it->id + SHA1_DIGEST_LENGTH,
+		    SHA1_DIGEST_LENGTH);
+	if (it->type == GOT_REFTABLE_SYMREF)
+		rec->target = it->target;
+	rec->update_index = it->t->min_update_index + it->update_index;
+	rec->mtime = it->t->mtime;
+}
+
+static void
+merged_select(struct reftable_merged *m)
+{
+	int i;
+
+	/* Among records with equal keys, the newest table wins. */
+	m->cur = -1;
+	for (i = 0; i < m->nits; i++) {
+		if (m->its[i].eof)
+			continue;
+		if (m->cur == -1 ||
+		    strcmp(m->its[i].key, m->its[m->cur].key) <= 0)
+			m->cur = i;
+	}
+}
+
+static void
+merged_free(struct reftable_merged *m)
+{
+	int i;
+
+	for (i = 0; i < m->nits; i++)
+		iter_free(&m->its[i]);
+	free(m->its);
+	m->its = NULL;
+	m->nits = 0;
+	m->cur = -1;
+}
+
+static const struct got_error *
+merged_seek(struct reftable_merged *m, struct reftable_table **tables,
+    int ntables, const char *key)
+{
+	const struct got_error *err;
+	int i;
+
+	m->cur = -1;
+	m->nits = 0;
+	m->its = calloc(ntables, sizeof(*m->its));
+	if (ntables > 0 && m->its == NULL)
+		return got_error_from_errno("calloc");
+	m->nits = ntables;
+
+	for (i = 0; i < ntables; i++) {
+		err = iter_seek(&m->its[i], tables[i], key);
+		if (err)
+			return err;
+	}
+
+	merged_select(m);
+	return NULL;
+}
+
+/* Advance past the current record and any records it shadows. */
+static const struct got_error *
+merged_next(struct reftable_merged *m)
+{
+	const struct got_error *err;
+	struct reftable_iter *cur = &m->its[m->cur];
+	int i;
+
+	for (i = 0; i < m->nits; i++) {
+		if (i == m->cur || m->its[i].eof ||
+		    strcmp(m->its[i].key, cur->key) != 0)
+			continue;
+		err = iter_next(&m->its[i]);
+		if (err)
+			return err;
+	}
+
+	err = iter_next(cur);
+	if (err)
+		return err;
+
+	merged_select(m);
+	return NULL;
+}
+
+static void
+close_tables(struct reftable_table **tables, int ntables)
+{
+	int i;
+
+	for (i = 0; i < ntables; i++)
+		table_close(tables[i]);
+	free(tables);
+}
+
+static const struct got_error *
+read_list(char ***names, int *nnames, struct stat *sb, const char *path)
+{
+	const struct got_error *err = NULL;
+	FILE *f;
+	char *line = NULL, **n;
+	size_t linesize = 0;
+	ssize_t linelen;
+	int nalloc = 0;
+
+	*names = NULL;
+	*nnames = 0;
+
+	f = fopen(path, "re");
+	if (f == NULL) {
+		if (errno != ENOENT)
+			return got_error_from_errno2("fopen", path);
+		memset(sb, 0, sizeof(*sb));
+		return NULL;
+	}
+	if (fstat(fileno(f), sb) == -1) {
+		err = got_error_from_errno2("fstat", path);
+		goto done;
+	}
+
+	while ((linelen = getline(&line, &linesize, f)) != -1) {
+		if (linelen > 0 && line[linelen - 1] == '\n')
+			line[--linelen] = '\0';
+		if (linelen == 0)
+			continue;
+		if (line[0] == '.' || strchr(line, '/') != NULL) {
+			err = got_error_path(path, GOT_ERR_BAD_REF_DATA);
+			goto done;
+		}
+		if (*nnames >= nalloc) {
+			n = reallocarray(*names, nalloc + 8, sizeof(**names));
+			if (n == NULL) {
+				err = got_error_from_errno("reallocarray");
+				goto done;
+			}
+			*names = n;
+			nalloc += 8;
+		}
+		(*names)[*nnames] = strdup(line);
+		if ((*names)[*nnames] == NULL) {
+			err = got_error_from_errno("strdup");
+			goto done;
+		}
+		(*nnames)++;
+	}
+	if (ferror(f))
+		err = got_ferror(f, GOT_ERR_IO);
+done:
+	free(line);
+	if (fclose(f) == EOF && err == NULL)
+		err = got_error_from_errno2("fclose", path);
+	return err;
+}
+
+static void
+free_names(char **names, int nnames)
+{
+	int i;
+
+	for (i = 0; i < nnames; i++)
+		free(names[i]);
+	free(names);
+}
+
+/*
+ * Make sure the open tables match the current contents of tables.list.
+ * Tables which remain on the stack are kept open. A concurrent writer
+ * may remove tables after compacting them, in which case the list is
+ * read again.
+ */
+static const struct got_error *
+reftable_reload(struct got_reftable *rt)
+{
+	const struct got_error *err = NULL;
+	struct reftable_table **tables = NULL;
+	struct stat sb;
+	char **names = NULL;
+	int nnames = 0, attempts, i, j;
+
+	for (attempts = 0; attempts < REFTABLE_RELOAD_ATTEMPTS; attempts++) {
+		if (rt->loaded && stat(rt->list_path, &sb) == 0 &&
+		    sb.st_dev == rt->list_sb.st_dev &&
+		    sb.st_ino == rt->list_sb.st_ino &&
+		    sb.st_size == rt->list_sb.st_size &&
+		    timespeccmp(&sb.st_mtim, &rt->list_sb.st_mtim, ==))
+			return NULL;
+
+		err = read_list(&names, &nnames, &sb, rt->list_path);
+		if (err)
+			break;
+
+		tables = calloc(nnames, sizeof(*tables));
+		if (nnames > 0 && tables == NULL) {
+			err = got_error_from_errno("calloc");
+			break;
+		}
+
+		for (i = 0; i < nnames; i++) {
+			for (j = 0; j < rt->ntables; j++) {
+				if (rt->tables[j] &&
+				    strcmp(rt->tables[j]->name, names[i]) == 0)
+					break;
+			}
+			if (j < rt->ntables) {
+				tables[i] = rt->tables[j];
+				rt->tables[j] = NULL;
+				continue;
+			}
+			err = table_open(&tables[i], rt->path, names[i]);
+			if (err)
+				break;
+		}
+
+		if (err == NULL) {
+			close_tables(rt->tables, rt->ntables);
+			rt->tables = tables;
+			rt->ntables = nnames;
+			rt->list_sb = sb;
+			rt->loaded = 1;
+			free_names(names, nnames);
+			return NULL;
+		}
+
+		/* Start over with a clean slate. */
+		close_tables(tables, nnames);
+		tables = NULL;
+		close_tables(rt->tables, rt->ntables);
+		rt->tables = NULL;
+		rt->ntables = 0;
+		rt->loaded = 0;
+		free_names(names, nnames);
+		names = NULL;
+		nnames = 0;
+		if (!(err->code == GOT_ERR_ERRNO && errno == ENOENT))
+			break;
+	}
+
+	free_names(names, nnames);
+	return err;
+}
+
+const struct got_error *
+got_reftable_open(struct got_reftable **rtp, const char *path_git_dir)
+{
+	const struct got_error *err = NULL;
+	struct got_reftable *rt;
+
+	*rtp = NULL;
+
+	rt = calloc(1, sizeof(*rt));
+	if (rt == NULL)
+		return got_error_from_errno("calloc");
+
+	if (asprintf(&rt->path, "%s/%s", path_git_dir,
+	    GOT_REFTABLE_DIR) == -1) {
+		err = got_error_from_errno("asprintf");
+		rt->path = NULL;
+		goto done;
+	}
+	if (asprintf(&rt->list_path, "%s/%s", rt->path,
+	    GOT_REFTABLE_LIST) == -1) {
+		err = got_error_from_errno("asprintf");
+		rt->list_path = NULL;
+		goto done;
+	}
+done:
+	if (err)
+		got_reftable_close(rt);
+	else
+		*rtp = rt;
+	return err;
+}
+
+void
+got_reftable_close(struct got_reftable *rt)
+{
+	if (rt->lf)
+		got_lockfile_unlock(rt->lf, -1);
+	close_tables(rt->tables, rt->ntables);
+	free(rt->path);
+	free(rt->list_path);
+	free(rt);
+}
+
+const struct got_error *
+got_reftable_lock(struct got_reftable *rt)
+{
+	const struct got_error *err;
+
+	if (rt->nlocks > 0) {
+		rt->nlocks++;
+		return NULL;
+	}
+
+	if (mkdir(rt->path, GOT_DEFAULT_DIR_MODE) == -1 && errno != EEXIST)
+		return got_error_from_errno2("mkdir", rt->path);
+
+	/* This lock file is shared with Git. */
+	err = got_lockfile_lock(&rt->lf, rt->list_path, -1);
+	if (err)
+		return err;
+
+	rt->nlocks = 1;
+	return NULL;
+}
+
+const struct got_error *
+got_reftable_unlock(struct got_reftable *rt)
+{
+	const struct got_error *err;
+
+	if (rt->nlocks == 0 || --rt->nlocks > 0)
+		return NULL;
+
+	err = got_lockfile_unlock(rt->lf, -1);
+	rt->lf = NULL;
+	return err;
+}
+
+const struct got_error *
+got_reftable_lookup(struct got_reftable *rt, const char *name,
+    got_reftable_cb cb, void *arg)
+{
+	const struct got_error *err;
+	struct got_reftable_record rec;
+	struct reftable_iter it;
+	int i;
+
+	err = reftable_reload(rt);
+	if (err)
+		return err;
+
+	memset(&it, 0, sizeof(it));
+	for (i = rt->ntables - 1; i >= 0; i--) {
+		err = iter_seek(&it, rt->tables[i], name);
+		if (err)
+			break;
+		if (it.eof || strcmp(it.key, name) != 0)
+			continue;
+		if (it.type != GOT_REFTABLE_DELETION) {
+			iter_record(&rec, &it);
+			err = cb(arg, &rec);
+		}
+		break;
+	}
+
+	iter_free(&it);
+	return err;
+}
+
+const struct got_error *
+got_reftable_foreach(struct got_reftable *rt, const char *prefix,
+    got_reftable_cb cb, void *arg)
+{
+	const struct got_error *err;
+	struct got_reftable_record rec;
+	struct reftable_merged m;
+	size_t prefixlen = strlen(prefix);
+
+	err = reftable_reload(rt);
+	if (err)
+		return err;
+
+	err = merged_seek(&m, rt->tables, rt->ntables, prefix);
+	while (err == NULL && m.cur != -1) {
+		struct reftable_iter *it = &m.its[m.cur];
+
+		if (strncmp(it->key, prefix, prefixlen) != 0)
+			break;
+		if (it->type != GOT_REFTABLE_DELETION) {
+			iter_record(&rec, it);
+			err = cb(arg, &rec);
+			if (err)
+				break;
+		}
+		err = merged_next(&m);
+	}
+
+	merged_free(&m);
+	return err;
+}
+
+static const struct got_error *
+writer_write(struct reftable_writer *w, const void *buf, size_t len)
+{
+	if (fwrite(buf, 1, len, w->f) != len)
+		return got_ferror(w->f, GOT_ERR_IO);
+	w->off += len;
+	return NULL;
+}
+
+static const struct got_error *
+writer_index_add(struct reftable_writer *w, const char *key, uint64_t pos)
+{
+	struct reftable_index_entry *e;
+
+	if (w->nindex >= w->indexsize) {
+		e = reallocarray(w->index, w->indexsize + 64, sizeof(*e));
+		if (e == NULL)
+			return got_error_from_errno("reallocarray");
+		w->index = e;
+		w->indexsize += 64;
+	}
+
+	e = &w->index[w->nindex];
+	e->key = strdup(key);
+	if (e->key == NULL)
+		return got_error_from_errno("strdup");
+	e->pos = pos;
+	w->nindex++;
+	return NULL;
+}
+
+/*
+ * Write out the current block. Reference blocks are padded to the block
+ * size unless they are the last reference block in the table.
+ */
+static const struct got_error *
+writer_flush_block(struct reftable_writer *w, int pad)
+{
+	const struct got_error *err;
+	size_t i, blk = w->off, len;
+
+	for (i = 0; i < w->nrestarts; i++) {
+		put_be24(w->block + w->used, w->restarts[i]);
+		w->used += 3;
+	}
+	put_be16(w->block + w->used, w->nrestarts);
+	w->used += 2;
+	put_be24(w->block + w->hdr + 1, w->used);
+
+	len = w->used;
+	if (pad && w->block_type == REFTABLE_BLOCK_REF) {
+		memset(w->block + w->used, 0, sizeof(w->block) - w->used);
+		len = sizeof(w->block);
+	}
+
+	err = writer_write(w, w->block, len);
+	if (err)
+		return err;
+
+	err = writer_index_add(w, w->lastkey, blk);
+	if (err)
+		return err;
+
+	w->block_type = 0;
+	w->nrecords = 0;
+	w->nrestarts = 0;
+	return NULL;
+}
+
+static const struct got_error *
+writer_add(struct reftable_writer *w, int block_type, const char *key,
+    int type, const uint8_t *val, size_t vallen)
+{
+	const struct got_error *err;
+	uint8_t hdr[20];
+	size_t keylen = strlen(key), prefix = 0, n, need;
+	int restart;
+
+	if (w->block_type == 0) {
+		w->block_type = block_type;
+		w->hdr = (w->off == 0 ? REFTABLE_HEADER_SIZE : 0);
+		if (w->hdr)
+			memcpy(w->block, w->header, w->hdr);
+		w->block[w->hdr] = block_type;
+		w->used = w->hdr + 4;
+	}
+
+	restart = (w->nrecords % REFTABLE_RESTART_INTERVAL == 0);
+	if (!restart) {
+		while (prefix < keylen && w->lastkey[prefix] == key[prefix])
+			prefix++;
+	}
+
+	n = put_varint(hdr, prefix);
+	n += put_varint(hdr + n, ((uint64_t)(keylen - prefix) << 3) | type);
+
+	need = w->used + n + keylen - prefix + vallen +
+	    (w->nrestarts + restart) * 3 + 2;
+	if (need > sizeof(w->block)) {
+		if (w->nrecords == 0)
+			return got_error(GOT_ERR_NO_SPACE);
+		err = writer_flush_block(w, 1);
+		if (err)
+			return err;
+		return writer_add(w, block_type, key, type, val, vallen);
+	}
+
+	if (restart) {
+		if (w->nrestarts >= w->restartsize) {
+			uint32_t *r;
+			r = reallocarray(w->restarts, w->restartsize + 16,
+			    sizeof(*r));
+			if (r == NULL)
+				return got_error_from_errno("reallocarray");
+			w->restarts = r;
+			w->restartsize += 16;
+		}
+		w->restarts[w->nrestarts++] = w->used;
+	}
+
+	memcpy(w->block + w->used, hdr, n);
+	w->used += n;
+	memcpy(w->block + w->used, key + prefix, keylen - prefix);
+	w->used += keylen - prefix;
+	memcpy(w->block + w->used, val, vallen);
+	w->used += vallen;
+
+	if (keylen + 1 > w->lastkeysize) {
+		char *k = realloc(w->lastkey, keylen + 1);
+		if (k == NULL)
+			return got_error_from_errno("realloc");
+		w->lastkey = k;
+		w->lastkeysize = keylen + 1;
+	}
+	memcpy(w->lastkey, key, keylen + 1);
+	w->nrecords++;
+	return NULL;
+}
+
+static const struct got_error *
+writer_add_ref(struct reftable_writer *w, struct got_reftable_record *rec)
+{
+	size_t len = 0, need, targetlen = 0;
+
+	if (rec->update_index < w->min_update_index)
+		return got_error(GOT_ERR_BAD_REF_DATA);
+
+	if (rec->type == GOT_REFTABLE_SYMREF)
+		targetlen = strlen(rec->target);
+	need = 10 + 10 + 2 * SHA1_DIGEST_LENGTH + targetlen;
+	if (need > w->valsize) {
+		uint8_t *v = realloc(w->val, need);
+		if (v == NULL)
+			return got_error_from_errno("realloc");
+		w->val = v;
+		w->valsize = need;
+	}
+
+	len = put_varint(w->val, rec->update_index - w->min_update_index);
+	switch (rec->type) {
+	case GOT_REFTABLE_DELETION:
+		break;
+	case GOT_REFTABLE_VAL2:
+		memcpy(w->val + len, rec->id.sha1, SHA1_DIGEST_LENGTH);
+		len += SHA1_DIGEST_LENGTH;
+		memcpy(w->val + len, rec->peeled.sha1, SHA1_DIGEST_LENGTH);
+		len += SHA1_DIGEST_LENGTH;
+		break;
+	case GOT_REFTABLE_VAL1:
+		memcpy(w->val + len, rec->id.sha1, SHA1_DIGEST_LENGTH);
+		len += SHA1_DIGEST_LENGTH;
+		break;
+	case GOT_REFTABLE_SYMREF:
+		len += put_varint(w->val + len, targetlen);
+		memcpy(w->val + len, rec->target, targetlen);
+		len += targetlen;
+		break;
+	default:
+		return got_error(GOT_ERR_BAD_REF_DATA);
+	}
+
+	return writer_add(w, REFTABLE_BLOCK_REF, rec->name, rec->type,
+	    w->val, len);
+}
+
+static void
+writer_free_index(struct reftable_writer *w)
+{
+	size_t i;
+
+	for (i = 0; i < w->nindex; i++)
+		free(w->index[i].key);
+	free(w->index);
+	w->index = NULL;
+	w->nindex = 0;
+	w->indexsize = 0;
+}
+
+/*
+ * Write the reference index, if there are enough reference blocks to
+ * warrant one, and the table footer. Index blocks which do not fit into
+ * a single block are indexed by another level of index blocks.
+ */
+static const struct got_error *
+writer_finish(struct reftable_writer *w)
+{
+	const struct got_error *err = NULL;
+	struct reftable_index_entry *index;
+	uint8_t footer[REFTABLE_FOOTER_SIZE], val[10];
+	uint64_t ref_index_pos = 0;
+	size_t nindex, i;
+
+	if (w->block_type != 0) {
+		err = writer_flush_block(w, 0);
+		if (err)
+			return err;
+	} else if (w->off == 0) {
+		/* The table contains no references. */
+		err = writer_write(w, w->header, sizeof(w->header));
+		if (err)
+			return err;
+	}
+
+	while (w->nindex >= (ref_index_pos == 0 ?
+	    REFTABLE_INDEX_MIN_BLOCKS : 2)) {
+		index = w->index;
+		nindex = w->nindex;
+		w->index = NULL;
+		w->nindex = 0;
+		w->indexsize = 0;
+
+		for (i = 0; i < nindex; i++) {
+			err = writer_add(w, REFTABLE_BLOCK_INDEX, index[i].key,
+			    0, val, put_varint(val, index[i].pos));
+			if (err)
+				break;
+		}
+		if (err == NULL)
+			err = writer_flush_block(w, 0);
+		for (i = 0; i < nindex; i++)
+			free(index[i].key);
+		free(index);
+		if (err)
+			return err;
+
+		ref_index_pos = w->index[w->nindex - 1].pos;
+	}
+
+	memcpy(footer, w->header, sizeof(w->header));
+	put_be64(footer + 24, ref_index_pos);
+	memset(footer + 32, 0, 32);
+	put_be32(footer + 64, crc32(0, footer, sizeof(footer) - 4));
+	err = writer_write(w, footer, sizeof(footer));
+	if (err)
+		return err;
+
+	if (fflush(w->f) == EOF)
+		return got_error_from_errno("fflush");
+	return NULL;
+}
+
+/*
+ * Create a new table in the reftable directory and store the name
+ * of the table in *name. The records passed to the callback must
+ * be written in sorted order.
+ */
+static const struct got_error *
+write_table(char **name, struct got_reftable *rt, uint64_t min_update_index,
+    uint64_t max_update_index,
+    const struct got_error *(*write_cb)(struct reftable_writer *, void *),
+    void *arg)
+{
+	const struct got_error *err = NULL;
+	struct reftable_writer w;
+	char *basepath = NULL, *tmppath = NULL, *path = NULL;
+
+	*name = NULL;
+
+	memset(&w, 0, sizeof(w));
+	memcpy(w.header, REFTABLE_MAGIC, 4);
+	w.header[4] = REFTABLE_VERSION;
+	put_be24(w.header + 5, REFTABLE_BLOCK_SIZE);
+	put_be64(w.header + 8, min_update_index);
+	put_be64(w.header + 16, max_update_index);
+	w.min_update_index = min_update_index;
+
+	if (asprintf(&basepath, "%s/tmp", rt->path) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+	err = got_opentemp_named(&tmppath, &w.f, basepath, ".ref");
+	if (err)
+		goto done;
+
+	err = write_cb(&w, arg);
+	if (err)
+		goto done;
+	err = writer_finish(&w);
+	if (err)
+		goto done;
+
+	if (fchmod(fileno(w.f), GOT_DEFAULT_FILE_MODE) == -1) {
+		err = got_error_from_errno2("fchmod", tmppath);
+		goto done;
+	}
+
+	if (asprintf(name, "0x%012llx-0x%012llx-%08x.ref",
+	    (unsigned long long)min_update_index,
+	    (unsigned long long)max_update_index, arc4random()) == -1) {
+		err = got_error_from_errno("asprintf");
+		*name = NULL;
+		goto done;
+	}
+	if (asprintf(&path, "%s/%s", rt->path, *name) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+	if (rename(tmppath, path) == -1) {
+		err = got_error_from_errno3("rename", tmppath, path);
+		goto done;
+	}
+	free(tmppath);
+	tmppath = NULL;
+done:
+	if (w.f && fclose(w.f) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (tmppath && unlink(tmppath) == -1 && err == NULL)
+		err = got_error_from_errno2("unlink", tmppath);
+	if (err) {
+		free(*name);
+		*name = NULL;
+	}
+	writer_free_index(&w);
+	free(w.restarts);
+	free(w.lastkey);
+	free(w.val);
+	free(basepath);
+	free(tmppath);
+	free(path);
+	return err;
+}
+
+/* Replace tables.list. The stack must be locked. */
+static const struct got_error *
+write_list(struct got_reftable *rt, char **names, int nnames)
+{
+	const struct got_error *err = NULL;
+	char *tmppath = NULL;
+	FILE *f = NULL;
+	int i;
+
+	err = got_opentemp_named(&tmppath, &f, rt->list_path, "");
+	if (err)
+		return err;
+
+	for (i = 0; i < nnames; i++) {
+		if (fprintf(f, "%s\n", names[i]) < 0) {
+			err = got_ferror(f, GOT_ERR_IO);
+			goto done;
+		}
+	}
+	if (fflush(f) == EOF) {
+		err = got_error_from_errno("fflush");
+		goto done;
+	}
+	if (fchmod(fileno(f), GOT_DEFAULT_FILE_MODE) == -1) {
+		err = got_error_from_errno2("fchmod", tmppath);
+		goto done;
+	}
+	if (rename(tmppath, rt->list_path) == -1) {
+		err = got_error_from_errno3("rename", tmppath, rt->list_path);
+		goto done;
+	}
+	free(tmppath);
+	tmppath = NULL;
+done:
+	if (fclose(f) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (tmppath && unlink(tmppath) == -1 && err == NULL)
+		err = got_error_from_errno2("unlink", tmppath);
+	free(tmppath);
+	return err;
+}
+
+struct write_records_arg {
+	struct got_reftable_record *recs;
+	int nrecs;
+};
+
+static const struct got_error *
+write_records(struct reftable_writer *w, void *arg)
+{
+	const struct got_error *err;
+	struct write_records_arg *a = arg;
+	int i;
+
+	for (i = 0; i < a->nrecs; i++) {
+		err = writer_add_ref(w, &a->recs[i]);
+		if (err)
+			return err;
+	}
+
+	return NULL;
+}
+
+struct write_merged_arg {
+	struct reftable_table **tables;
+	int ntables;
+	int drop_deletions;
+};
+
+static const struct got_error *
+write_merged(struct reftable_writer *w, void *arg)
+{
+	const struct got_error *err;
+	struct write_merged_arg *a = arg;
+	struct got_reftable_record rec;
+	struct reftable_merged m;
+
+	err = merged_seek(&m, a->tables, a->ntables, "");
+	while (err == NULL && m.cur != -1) {
+		struct reftable_iter *it = &m.its[m.cur];
+
+		if (it->type != GOT_REFTABLE_DELETION || !a->drop_deletions) {
+			iter_record(&rec, it);
+			err = writer_add_ref(w, &rec);
+			if (err)
+				break;
+		}
+		err = merged_next(&m);
+	}
+
+	merged_free(&m);
+	return err;
+}
+
+/*
+ * Keep the stack shallow by merging tables at the top of the stack
+ * until each table is at least twice as large as all newer tables
+ * combined. The cost of writing a table is thus amortized over the
+ * updates which have been merged into it. Tables written by Git may
+ * contain reflogs, which we cannot rewrite, so such tables and any
+ * older tables are never merged. The stack must be locked.
+ */
+static const struct got_error *
+reftable_compact(struct got_reftable *rt)
+{
+	const struct got_error *err = NULL;
+	struct write_merged_arg arg;
+	char **names = NULL, *name = NULL, *path;
+	uint64_t size;
+	int first, oldest, i, nnames = 0;
+
+	for (oldest = rt->ntables; oldest > 0; oldest--) {
+		if (rt->tables[oldest - 1]->log_pos != 0)
+			break;
+	}
+	if (rt->ntables - oldest < 2)
+		return NULL;
+
+	first = rt->ntables - 1;
+	size = rt->tables[first]->size;
+	while (first > oldest && rt->tables[first - 1]->size < 2 * size) {
+		first--;
+		size += rt->tables[first]->size;
+	}
+	if (first == rt->ntables - 1)
+		return NULL;
+
+	/* Deletions must be kept unless older tables are merged, too. */
+	arg.tables = &rt->tables[first];
+	arg.ntables = rt->ntables - first;
+	arg.drop_deletions = (first == 0);
+	err = write_table(&name, rt, rt->tables[first]->min_update_index,
+	    rt->tables[rt->ntables - 1]->max_update_index, write_merged, &arg);
+	if (err)
+		return err;
+
+	names = calloc(rt->ntables, sizeof(*names));
+	if (names == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	for (i = 0; i < rt->ntables; i++) {
+		names[i] = strdup(rt->tables[i]->name);
+		if (names[i] == NULL) {
+			err = got_error_from_errno("strdup");
+			goto done;
+		}
+		nnames++;
+	}
+
+	/* Put the merged table in place of the tables it replaces. */
+	free(names[first]);
+	names[first] = name;
+	err = write_list(rt, names, first + 1);
+	names[first] = NULL;
+	if (err)
+		goto done;
+	free(name);
+	name = NULL;
+
+	/* Readers which still use the old tables keep them open. */
+	for (i = first + 1; i < rt->ntables; i++) {
+		if (asprintf(&path, "%s/%s", rt->path, names[i]) == -1) {
+			err = got_error_from_errno("asprintf");
+			goto done;
+		}
+		if (unlink(path) == -1 && errno != ENOENT)
+			err = got_error_from_errno2("unlink", path);
+		free(path);
+		if (err)
+			goto done;
+	}
+	if (asprintf(&path, "%s/%s", rt->path, rt->tables[first]->name) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+	if (unlink(path) == -1 && errno != ENOENT)
+		err = got_error_from_errno2("unlink", path);
+	free(path);
+	if (err)
+		goto done;
+
+	err = reftable_reload(rt);
+done:
+	if (name) {
+		if (asprintf(&path, "%s/%s", rt->path, name) != -1) {
+			unlink(path);
+			free(path);
+		}
+		free(name);
+	}
+	free_names(names, nnames);
+	return err;
+}
+
+static int
+record_cmp(const void *a, const void *b)
+{
+	const struct got_reftable_record *r1 = a, *r2 = b;
+
+	return strcmp(r1->name, r2->name);
+}
+
+const struct got_error *
+got_reftable_update(struct got_reftable *rt,
+    struct got_reftable_record *recs, int nrecs)
+{
+	const struct got_error *err, *unlock_err;
+	struct write_records_arg arg;
+	char **names = NULL, *name = NULL, *path;
+	uint64_t update_index = 1;
+	int i, nnames = 0;
+
+	qsort(recs, nrecs, sizeof(recs[0]), record_cmp);
+	for (i = 1; i < nrecs; i++) {
+		if (strcmp(recs[i - 1].name, recs[i].name) == 0)
+			return got_error_path(recs[i].name,
+			    GOT_ERR_BAD_REF_DATA);
+	}
+
+	err = got_reftable_lock(rt);
+	if (err)
+		return err;
+
+	err = reftable_reload(rt);
+	if (err)
+		goto done;
+
+	if (rt->ntables > 0)
+		update_index = rt->tables[rt->ntables - 1]->max_update_index + 1;
+	for (i = 0; i < nrecs; i++)
+		recs[i].update_index = update_index;
+
+	arg.recs = recs;
+	arg.nrecs = nrecs;
+	err = write_table(&name, rt, update_index, update_index,
+	    write_records, &arg);
+	if (err)
+		goto done;
+
+	names = calloc(rt->ntables + 1, sizeof(*names));
+	if (names == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	for (i = 0; i < rt->ntables; i++) {
+		names[i] = strdup(rt->tables[i]->name);
+		if (names[i] == NULL) {
+			err = got_error_from_errno("strdup");
+			goto done;
+		}
+		nnames++;
+	}
+	names[nnames++] = name;
+
+	err = write_list(rt, names, nnames);
+	if (err)
+		goto done;
+	name = NULL;	/* now on the stack */
+
+	err = reftable_reload(rt);
+	if (err)
+		goto done;
+
+	/*
+	 * The update has been committed by now. Failing to merge tables
+	 * only leaves the stack deeper than it should be, and the next
+	 * update will try again, so do not report such errors.
+	 */
+	(void)reftable_compact(rt);
+done:
+	if (name) {
+		if (asprintf(&path, "%s/%s", rt->path, name) != -1) {
+			unlink(path);
+			free(path);
+		}
+		if (nnames == 0 || names[nnames - 1] != name)
+			free(name);
+	}
+	free_names(names, nnames);
+	unlock_err = got_reftable_unlock(rt);
+	return err ? err : unlock_err;
+}
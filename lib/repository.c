@@ -64,6 +64,7 @@
 #include "got_lib_object_cache.h"
 #include "got_lib_repository.h"
 #include "got_lib_gotconfig.h"
+#include "got_lib_reftable.h"
 
 #ifndef nitems
 #define nitems(_a) (sizeof(_a) / sizeof((_a)[0]))
@@ -223,6 +224,12 @@ got_repo_get_gotconfig(struct got_repository *repo)
 	return repo->gotconfig;
 }
 
+struct got_reftable *
+got_repo_get_reftable(struct got_repository *repo)
+{
+	return repo->reftable;
+}
+
 void
 got_repo_get_gitconfig_remotes(int *nremotes,
     const struct got_remote_repo **remotes, struct got_repository *repo)
@@ -784,7 +791,7 @@ got_repo_open(struct got_repository **repop, const char *path,
 	err = read_gitconfig(repo, global_gitconfig_path);
 	if (err)
 		goto done;
-	if (repo->gitconfig_repository_format_version != 0) {
+	if (repo->gitconfig_repository_format_version > 1) {
 		err = got_error_path(path, GOT_ERR_GIT_REPO_FORMAT);
 		goto done;
 	}
@@ -793,6 +800,20 @@ got_repo_open(struct got_repository **repop, const char *path,
 		char *val = repo->extvals[i];
 		int j, supported = 0;
 
+		if (strcasecmp(ext, "refStorage") == 0) {
+			if (strcmp(val, "reftable") == 0 &&
+			    repo->reftable == NULL) {
+				err = got_reftable_open(&repo->reftable,
+				    repo->path_git_dir);
+				if (err)
+					goto done;
+			} else if (strcmp(val, "files") != 0) {
+				err = got_error_path(ext, GOT_ERR_GIT_REPO_EXT);
+				goto done;
+			}
+			continue;
+		}
+
 		if (!is_boolean_val(val)) {
 			err = got_error_path(ext, GOT_ERR_GIT_REPO_EXT);
 			goto done;
@@ -880,6 +901,8 @@ got_repo_close(struct got_repository *repo)
 
 	if (repo->gotconfig)
 		got_gotconfig_free(repo->gotconfig);
+	if (repo->reftable)
+		got_reftable_close(repo->reftable);
 	free(repo->gitconfig_author_name);
 	free(repo->gitconfig_author_email);
 	for (i = 0; i < repo->ngitconfig_remotes; i++)
@@ -1581,7 +1604,7 @@ got_repo_unpin_pack(struct got_repository *repo)
 }
 
 const struct got_error *
-got_repo_init(const char *repo_path, const char *head_name)
+got_repo_init(const char *repo_path, const char *head_name, int reftable)
 {
 	const struct got_error *err = NULL;
 	const char *dirnames[] = {
@@ -1596,7 +1619,15 @@ got_repo_init(const char *repo_path, const char *head_name)
 	    "\trepositoryformatversion = 0\n"
 	    "\tfilemode = true\n"
 	    "\tbare = true\n";
-	char *headref_str, *path;
+	const char *gitconfig_reftable_str = "[core]\n"
+	    "\trepositoryformatversion = 1\n"
+	    "\tfilemode = true\n"
+	    "\tbare = true\n"
+	    "[extensions]\n"
+	    "\trefStorage = reftable\n";
+	struct got_reftable *rt = NULL;
+	struct got_reftable_record rec;
+	char *headref_str = NULL, *path;
 	size_t i;
 
 	if (!got_path_dir_is_empty(repo_path))
@@ -1619,27 +1650,55 @@ got_repo_init(const char *repo_path, const char *head_name)
 	if (err)
 		return err;
 
-	if (asprintf(&path, "%s/%s", repo_path, GOT_HEAD_FILE) == -1)
-		return got_error_from_errno("asprintf");
 	if (asprintf(&headref_str, "%s%s", headref,
-	    head_name ? head_name : "main") == -1) {
-		free(path);
+	    head_name ? head_name : "main") == -1)
 		return got_error_from_errno("asprintf");
+
+	if (reftable) {
+		/*
+		 * HEAD lives in the reftable. Like Git, leave an invalid
+		 * HEAD file behind so that the directory is still
+		 * recognized as a repository.
+		 */
+		err = got_reftable_open(&rt, repo_path);
+		if (err)
+			goto done;
+		memset(&rec, 0, sizeof(rec));
+		rec.name = GOT_REF_HEAD;
+		rec.type = GOT_REFTABLE_SYMREF;
+		rec.target = headref_str + strlen("ref: ");
+		err = got_reftable_update(rt, &rec, 1);
+		if (err)
+			goto done;
+		free(headref_str);
+		headref_str = strdup("ref: refs/heads/.invalid");
+		if (headref_str == NULL) {
+			err = got_error_from_errno("strdup");
+			goto done;
+		}
+	}
+
+	if (asprintf(&path, "%s/%s", repo_path, GOT_HEAD_FILE) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
 	}
 	err = got_path_create_file(path, headref_str);
-	free(headref_str);
 	free(path);
 	if (err)
-		return err;
+		goto done;
 
-	if (asprintf(&path, "%s/%s", repo_path, "config") == -1)
-		return got_error_from_errno("asprintf");
-	err = got_path_create_file(path, gitconfig_str);
+	if (asprintf(&path, "%s/%s", repo_path, "config") == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+	err = got_path_create_file(path,
+	    reftable ? gitconfig_reftable_str : gitconfig_str);
 	free(path);
-	if (err)
-		return err;
-
-	return NULL;
+done:
+	if (rt)
+		got_reftable_close(rt);
+	free(headref_str);
+	return err;
 }
 
 static const struct got_error *
@@ -1326,3 +1326,71 @@ done:
 	free(pack_relpath);
 	return err;
 }
+
+const struct got_error *
+got_repo_purge_blame_cache(struct got_repository *repo, int *nentries,
+    off_t *size, int dry_run, got_cancel_cb cancel_cb, void *cancel_arg)
+{
+	const struct got_error *err = NULL;
+	DIR *dir = NULL;
+	struct dirent *dent;
+	struct stat sb;
+	int fd;
+
+	*nentries = 0;
+	*size = 0;
+
+	fd = openat(got_repo_get_fd(repo), GOT_BLAME_CACHE_DIR,
+	    O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1) {
+		if (errno == ENOENT || errno == ENOTDIR)
+			return NULL;
+		return got_error_from_errno_fmt("openat: %s/%s",
+		    got_repo_get_path_git_dir(repo), GOT_BLAME_CACHE_DIR);
+	}
+
+	dir = fdopendir(fd);
+	if (dir == NULL) {
+		err = got_error_from_errno("fdopendir");
+		close(fd);
+		return err;
+	}
+
+	while ((dent = readdir(dir)) != NULL) {
+		if (cancel_cb) {
+			err = cancel_cb(cancel_arg);
+			if (err)
+				goto done;
+		}
+
+		if (strcmp(dent->d_name, ".") == 0 ||
+		    strcmp(dent->d_name, "..") == 0)
+			continue;
+
+		if (fstatat(fd, dent->d_name, &sb, AT_SYMLINK_NOFOLLOW) == -1) {
+			if (errno == ENOENT)
+				continue;
+			err = got_error_from_errno_fmt("fstatat: %s/%s/%s",
+			    got_repo_get_path_git_dir(repo),
+			    GOT_BLAME_CACHE_DIR, dent->d_name);
+			goto done;
+		}
+		if (!S_ISREG(sb.st_mode))
+			continue;
+
+		if (!dry_run && unlinkat(fd, dent->d_name, 0) == -1) {
+			if (errno == ENOENT)
+				continue;
+			err = got_error_from_errno_fmt("unlinkat: %s/%s/%s",
+			    got_repo_get_path_git_dir(repo),
+			    GOT_BLAME_CACHE_DIR, dent->d_name);
+			goto done;
+		}
+		(*nentries)++;
+		*size += sb.st_size;
+	}
+done:
+	if (closedir(dir) != 0 && err == NULL)
+		err = got_error_from_errno("closedir");
+	return err;
+}
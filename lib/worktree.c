@@ -366,6 +366,148 @@ done:
 	return err;
 }
 
+struct got_pathlist_head *
+got_worktree_get_sparse_paths(struct got_worktree *worktree)
+{
+	return &worktree->sparse_paths;
+}
+
+const struct got_error *
+got_worktree_set_sparse_paths(struct got_worktree *worktree,
+    struct got_pathlist_head *paths)
+{
+	const struct got_error *err = NULL;
+	struct got_pathlist_head new_paths;
+	struct got_pathlist_entry *pe, *new;
+	char *path = NULL;
+
+	TAILQ_INIT(&new_paths);
+
+	TAILQ_FOREACH(pe, paths, entry) {
+		const char *p = pe->path;
+
+		while (p[0] == '/')
+			p++;
+		if (p[0] == '\0') {
+			/* The root directory implies a full checkout. */
+			got_pathlist_free(&new_paths, GOT_PATHLIST_FREE_PATH);
+			break;
+		}
+		path = strdup(p);
+		if (path == NULL) {
+			err = got_error_from_errno("strdup");
+			goto done;
+		}
+		got_path_strip_trailing_slashes(path);
+		err = got_pathlist_insert(&new, &new_paths, path, NULL);
+		if (err)
+			goto done;
+		if (new == NULL)
+			free(path);
+		path = NULL;
+	}
+
+	got_pathlist_free(&worktree->sparse_paths, GOT_PATHLIST_FREE_PATH);
+	TAILQ_CONCAT(&worktree->sparse_paths, &new_paths, entry);
+done:
+	got_pathlist_free(&new_paths, GOT_PATHLIST_FREE_PATH);
+	free(path);
+	return err;
+}
+
+const struct got_error *
+got_worktree_write_sparse_paths(struct got_worktree *worktree)
+{
+	const struct got_error *err = NULL;
+	struct got_pathlist_entry *pe;
+	char *path_got = NULL, *path = NULL, *content = NULL, *s;
+	size_t len = 0;
+
+	if (asprintf(&path_got, "%s/%s", worktree->root_path,
+	    GOT_WORKTREE_GOT_DIR) == -1)
+		return got_error_from_errno("asprintf");
+
+	if (TAILQ_EMPTY(&worktree->sparse_paths)) {
+		if (asprintf(&path, "%s/%s", path_got,
+		    GOT_WORKTREE_SPARSE_PATHS) == -1) {
+			err = got_error_from_errno("asprintf");
+			path = NULL;
+			goto done;
+		}
+		if (unlink(path) == -1 && errno != ENOENT)
+			err = got_error_from_errno2("unlink", path);
+		goto done;
+	}
+
+	TAILQ_FOREACH(pe, &worktree->sparse_paths, entry)
+		len += pe->path_len + 1;
+	content = malloc(len);
+	if (content == NULL) {
+		err = got_error_from_errno("malloc");
+		goto done;
+	}
+	s = content;
+	TAILQ_FOREACH(pe, &worktree->sparse_paths, entry) {
+		memcpy(s, pe->path, pe->path_len);
+		s += pe->path_len;
+		*s++ = '\n';
+	}
+	*(s - 1) = '\0'; /* update_meta_file() appends a newline */
+	err = update_meta_file(path_got, GOT_WORKTREE_SPARSE_PATHS, content);
+done:
+	free(path_got);
+	free(path);
+	free(content);
+	return err;
+}
+
+/*
+ * Determine whether a path lies within the work tree's sparse checkout set.
+ * The set contains each listed directory and everything below it, every
+ * parent directory of a listed directory, and files which reside directly
+ * in such a parent directory or in the root directory of the work tree.
+ */
+static int
+path_is_in_sparse_set(struct got_worktree *worktree, const char *path,
+    int is_dir)
+{
+	struct got_pathlist_entry *pe;
+	size_t path_len, parent_len;
+	const char *slash;
+
+	if (TAILQ_EMPTY(&worktree->sparse_paths))
+		return 1;
+
+	while (path[0] == '/')
+		path++;
+	path_len = strlen(path);
+	if (path_len == 0)
+		return 1;
+
+	TAILQ_FOREACH(pe, &worktree->sparse_paths, entry) {
+		if (got_path_cmp(path, pe->path, path_len,
+		    pe->path_len) == 0 ||
+		    got_path_is_child(path, pe->path, pe->path_len))
+			return 1;
+		if (is_dir && got_path_is_child(pe->path, path, path_len))
+			return 1;
+	}
+
+	if (is_dir)
+		return 0;
+
+	slash = strrchr(path, '/');
+	if (slash == NULL)
+		return 1;
+	parent_len = slash - path;
+	TAILQ_FOREACH(pe, &worktree->sparse_paths, entry) {
+		if (got_path_is_child(pe->path, path, parent_len))
+			return 1;
+	}
+
+	return 0;
+}
+
 const struct got_gotconfig *
 got_worktree_get_gotconfig(struct got_worktree *worktree)
 {
@@ -1568,6 +1710,53 @@ stat_info_differs(struct got_fileindex_entry *ie, struct stat *sb)
 	    !xbit_differs(ie, sb->st_mode));
 }
 
+/*
+ * Return non-zero if a file's stat info cannot be trusted to change if the
+ * file is modified after its content was read, because the file was changed
+ * too recently. The file system may assign the same timestamp to two
+ * consecutive modifications, and file system timestamps may lag behind the
+ * system clock.
+ */
+static int
+stat_info_is_racy(struct stat *sb, struct timespec *now)
+{
+	return (sb->st_mtim.tv_sec + 1 >= now->tv_sec ||
+	    sb->st_ctim.tv_sec + 1 >= now->tv_sec);
+}
+
+/*
+ * Record the result of a content comparison in the file index, such that
+ * the comparison can be skipped until the file's stat info changes.
+ */
+static void
+cache_content_status(struct got_fileindex_entry *ie, struct stat *sb,
+    unsigned char status, struct timespec *now)
+{
+	uint32_t content;
+
+	if (!S_ISREG(sb->st_mode) ||
+	    got_fileindex_entry_filetype_get(ie) !=
+	    GOT_FILEIDX_MODE_REGULAR_FILE ||
+	    xbit_differs(ie, sb->st_mode) || stat_info_is_racy(sb, now))
+		return;
+
+	switch (status) {
+	case GOT_STATUS_NO_CHANGE:
+		content = GOT_FILEIDX_CONTENT_UNCHANGED;
+		break;
+	case GOT_STATUS_MODIFY:
+		content = GOT_FILEIDX_CONTENT_MODIFIED;
+		break;
+	case GOT_STATUS_CONFLICT:
+		content = GOT_FILEIDX_CONTENT_CONFLICT;
+		break;
+	default:
+		return;
+	}
+
+	got_fileindex_entry_content_set(ie, sb, content);
+}
+
 static unsigned char
 get_staged_status(struct got_fileindex_entry *ie)
 {
@@ -1650,11 +1839,40 @@ get_file_status(unsigned char *status, struct stat *sb,
 	struct got_blob_object *blob = NULL;
 	size_t flen, blen;
 	unsigned char staged_status;
+	struct timespec now;
+	struct got_preloaded_file *pf = ie->preload;
 
 	staged_status = get_staged_status(ie);
 	*status = GOT_STATUS_NO_CHANGE;
 	memset(sb, 0, sizeof(*sb));
 
+	/* Preloaded results are only valid for the first lookup. */
+	ie->preload = NULL;
+	if (pf) {
+		if (dirfd == -1 && pf->status != GOT_STATUS_NO_CHANGE) {
+			fd = open(abspath, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+			if (fd == -1 && errno != ENOENT &&
+			    !got_err_open_nofollow_on_symlink())
+				return got_error_from_errno2("open", abspath);
+		}
+		if (fd != -1 || dirfd != -1 ||
+		    pf->status == GOT_STATUS_NO_CHANGE) {
+			memcpy(sb, &pf->sb, sizeof(*sb));
+			memcpy(&now, &pf->now, sizeof(now));
+			goto stat_done;
+		}
+		/* The file is gone or was replaced since it was preloaded. */
+		pf = NULL;
+	}
+
+	/*
+	 * Read the clock before the file's stat info, such that any
+	 * modification made while we are reading the file's content
+	 * will have a timestamp which is not older than now.
+	 */
+	if (clock_gettime(CLOCK_REALTIME, &now) == -1)
+		return got_error_from_errno("clock_gettime");
+
 	/*
 	 * Whenever the caller provides a directory descriptor and a
 	 * directory entry name for the file, use them! This prevents
@@ -1692,7 +1910,7 @@ get_file_status(unsigned char *status, struct stat *sb,
 			goto done;
 		}
 	}
-
+stat_done:
 	if (!S_ISREG(sb->st_mode) && !S_ISLNK(sb->st_mode)) {
 		*status = GOT_STATUS_OBSTRUCTED;
 		goto done;
@@ -1707,8 +1925,19 @@ get_file_status(unsigned char *status, struct stat *sb,
 		goto done;
 	}
 
-	if (!stat_info_differs(ie, sb))
+	if (!stat_info_differs(ie, sb)) {
+		switch (got_fileindex_entry_content_get(ie)) {
+		case GOT_FILEIDX_CONTENT_MODIFIED:
+			*status = GOT_STATUS_MODIFY;
+			break;
+		case GOT_FILEIDX_CONTENT_CONFLICT:
+			*status = GOT_STATUS_CONFLICT;
+			break;
+		default:
+			break;
+		}
 		goto done;
+	}
 
 	if (S_ISLNK(sb->st_mode) &&
 	    got_fileindex_entry_filetype_get(ie) != GOT_FILEIDX_MODE_SYMLINK) {
@@ -1716,6 +1945,28 @@ get_file_status(unsigned char *status, struct stat *sb,
 		goto done;
 	}
 
+	if (pf && pf->status != 0) {
+		/* Content was compared by got_worktree_preload(). */
+		*status = pf->status;
+		if (*status == GOT_STATUS_NO_CHANGE)
+			goto content_done;
+		if (dirfd != -1) {
+			fd = openat(dirfd, de_name,
+			    O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+			if (fd == -1) {
+				err = got_error_from_errno2("openat", abspath);
+				goto done;
+			}
+		}
+		f = fdopen(fd, "r");
+		if (f == NULL) {
+			err = got_error_from_errno2("fdopen", abspath);
+			goto done;
+		}
+		fd = -1;
+		goto content_done;
+	}
+
 	if (staged_status == GOT_STATUS_MODIFY ||
 	    staged_status == GOT_STATUS_ADD)
 		got_fileindex_entry_get_staged_blob_id(&id, ie);
@@ -1783,12 +2034,16 @@ get_file_status(unsigned char *status, struct stat *sb,
 		}
 		hdrlen = 0;
 	}
-
+content_done:
 	if (*status == GOT_STATUS_MODIFY) {
 		rewind(f);
 		err = get_modified_file_content_status(status, f);
+		if (err)
+			goto done;
 	} else if (xbit_differs(ie, sb->st_mode))
 		*status = GOT_STATUS_MODE_CHANGE;
+
+	cache_content_status(ie, sb, *status, &now);
 done:
 	if (fd1 != -1 && close(fd1) == -1 && err == NULL)
 		err = got_error_from_errno("close");
@@ -2168,6 +2423,60 @@ diff_old_new(void *arg, struct got_fileindex_entry *ie,
 	    ie->path, a->repo, a->progress_cb, a->progress_arg);
 }
 
+/*
+ * Remove a file which has dropped out of the work tree's sparse checkout
+ * set. Files with local changes are left alone.
+ */
+static const struct got_error *
+remove_sparse_blob(struct got_worktree *worktree,
+    struct got_fileindex *fileindex, struct got_fileindex_entry *ie,
+    struct got_repository *repo, got_worktree_checkout_cb progress_cb,
+    void *progress_arg)
+{
+	const struct got_error *err = NULL;
+	unsigned char status;
+	struct stat sb;
+	char *ondisk_path;
+
+	if (get_staged_status(ie) != GOT_STATUS_NO_CHANGE) {
+		got_fileindex_entry_mark_skipped(ie);
+		return (*progress_cb)(progress_arg, GOT_STATUS_CANNOT_DELETE,
+		    ie->path);
+	}
+
+	if (asprintf(&ondisk_path, "%s/%s", worktree->root_path, ie->path)
+	    == -1)
+		return got_error_from_errno("asprintf");
+
+	err = get_file_status(&status, &sb, ie, ondisk_path, -1, NULL, repo);
+	if (err)
+		goto done;
+
+	switch (status) {
+	case GOT_STATUS_NO_CHANGE:
+		err = (*progress_cb)(progress_arg, GOT_STATUS_DELETE, ie->path);
+		if (err)
+			goto done;
+		err = remove_ondisk_file(worktree->root_path, ie->path);
+		if (err)
+			goto done;
+		/* fallthrough */
+	case GOT_STATUS_MISSING:
+		got_fileindex_entry_remove(fileindex, ie);
+		break;
+	case GOT_STATUS_ADD:
+		break;
+	default:
+		got_fileindex_entry_mark_skipped(ie);
+		err = (*progress_cb)(progress_arg, GOT_STATUS_CANNOT_DELETE,
+		    ie->path);
+		break;
+	}
+done:
+	free(ondisk_path);
+	return err;
+}
+
 static const struct got_error *
 diff_old(void *arg, struct got_fileindex_entry *ie, const char *parent_path)
 {
@@ -2176,10 +2485,32 @@ diff_old(void *arg, struct got_fileindex_entry *ie, const char *parent_path)
 	if (a->cancel_cb && a->cancel_cb(a->cancel_arg))
 		return got_error(GOT_ERR_CANCELLED);
 
+	if (!path_is_in_sparse_set(a->worktree, ie->path, 0))
+		return remove_sparse_blob(a->worktree, a->fileindex, ie,
+		    a->repo, a->progress_cb, a->progress_arg);
+
 	return delete_blob(a->worktree, a->fileindex, ie,
 	    a->repo, a->progress_cb, a->progress_arg);
 }
 
+static int
+diff_filter(void *arg, struct got_tree_entry *te, const char *parent_path)
+{
+	struct diff_cb_arg *a = arg;
+	char path[PATH_MAX];
+	int ret;
+
+	if (TAILQ_EMPTY(&a->worktree->sparse_paths))
+		return 1;
+
+	ret = snprintf(path, sizeof(path), "%s%s%s", parent_path,
+	    parent_path[0] ? "/" : "", te->name);
+	if (ret < 0 || (size_t)ret >= sizeof(path))
+		return 1;
+
+	return path_is_in_sparse_set(a->worktree, path, S_ISDIR(te->mode));
+}
+
 static const struct got_error *
 diff_new(void *arg, struct got_tree_entry *te, const char *parent_path)
 {
@@ -2376,13 +2707,33 @@ get_fileindex_path(char **fileindex_path, struct got_worktree *worktree)
 	return err;
 }
 
+static const struct got_error *
+get_fileindex_delta_path(char **delta_path, const char *fileindex_path)
+{
+	const struct got_error *err;
+	char *path_got;
+
+	*delta_path = NULL;
+
+	err = got_path_dirname(&path_got, fileindex_path);
+	if (err)
+		return err;
+	if (asprintf(delta_path, "%s/%s", path_got,
+	    GOT_WORKTREE_FILE_INDEX_DELTA) == -1) {
+		err = got_error_from_errno("asprintf");
+		*delta_path = NULL;
+	}
+	free(path_got);
+	return err;
+}
 
 static const struct got_error *
 open_fileindex(struct got_fileindex **fileindex, char **fileindex_path,
     struct got_worktree *worktree)
 {
 	const struct got_error *err = NULL;
-	FILE *index = NULL;
+	FILE *index = NULL, *delta = NULL;
+	char *delta_path = NULL;
 
 	*fileindex_path = NULL;
 	*fileindex = got_fileindex_alloc();
@@ -2397,12 +2748,29 @@ open_fileindex(struct got_fileindex **fileindex, char **fileindex_path,
 	if (index == NULL) {
 		if (errno != ENOENT)
 			err = got_error_from_errno2("fopen", *fileindex_path);
+		goto done;
+	}
+	err = got_fileindex_read(*fileindex, index);
+	if (fclose(index) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (err)
+		goto done;
+
+	/* Apply recent changes recorded in the split index's delta file. */
+	err = get_fileindex_delta_path(&delta_path, *fileindex_path);
+	if (err)
+		goto done;
+	delta = fopen(delta_path, "rbe");
+	if (delta == NULL) {
+		if (errno != ENOENT)
+			err = got_error_from_errno2("fopen", delta_path);
 	} else {
-		err = got_fileindex_read(*fileindex, index);
-		if (fclose(index) == EOF && err == NULL)
-			err = got_error_from_errno("fclose");
+		err = got_fileindex_read_delta(*fileindex, delta);
+		if (fclose(delta) == EOF && err == NULL)
+			err = got_error_from_errno2("fclose", delta_path);
 	}
 done:
+	free(delta_path);
 	if (err) {
 		free(*fileindex_path);
 		*fileindex_path = NULL;
@@ -2470,12 +2838,11 @@ bump_base_commit_id_everywhere(struct got_worktree *worktree,
 }
 
 static const struct got_error *
-sync_fileindex(struct got_fileindex *fileindex, const char *fileindex_path)
+rewrite_fileindex(struct got_fileindex *fileindex, const char *fileindex_path)
 {
 	const struct got_error *err = NULL;
 	char *new_fileindex_path = NULL;
 	FILE *new_index = NULL;
-	struct timespec timeout;
 
 	err = got_opentemp_named(&new_fileindex_path, &new_index,
 	    fileindex_path, "");
@@ -2491,6 +2858,63 @@ sync_fileindex(struct got_fileindex *fileindex, const char *fileindex_path)
 		    fileindex_path);
 		unlink(new_fileindex_path);
 	}
+done:
+	if (new_index)
+		fclose(new_index);
+	free(new_fileindex_path);
+	return err;
+}
+
+static const struct got_error *
+sync_fileindex(struct got_fileindex *fileindex, const char *fileindex_path)
+{
+	const struct got_error *err = NULL;
+	FILE *delta = NULL;
+	char *delta_path = NULL;
+	struct timespec timeout;
+	int fd, written = 0;
+
+	err = get_fileindex_delta_path(&delta_path, fileindex_path);
+	if (err)
+		return err;
+
+	/*
+	 * Try to append changes to the split index's delta file.
+	 * This avoids rewriting the entire file index if only a few
+	 * entries have changed.
+	 */
+	fd = open(delta_path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC,
+	    GOT_DEFAULT_FILE_MODE);
+	if (fd == -1) {
+		err = got_error_from_errno2("open", delta_path);
+		goto done;
+	}
+	delta = fdopen(fd, "r+");
+	if (delta == NULL) {
+		err = got_error_from_errno2("fdopen", delta_path);
+		close(fd);
+		goto done;
+	}
+	err = got_fileindex_write_delta(&written, fileindex, delta);
+	if (fclose(delta) == EOF && err == NULL)
+		err = got_error_from_errno2("fclose", delta_path);
+	if (err)
+		goto done;
+
+	if (!written) {
+		/*
+		 * Fold all changes into a new base file. The old delta file
+		 * no longer matches the new base file and will be ignored
+		 * if we crash before removing it.
+		 */
+		err = rewrite_fileindex(fileindex, fileindex_path);
+		if (err)
+			goto done;
+		if (unlink(delta_path) == -1 && errno != ENOENT) {
+			err = got_error_from_errno2("unlink", delta_path);
+			goto done;
+		}
+	}
 
 	/*
 	 * Sleep for a short amount of time to ensure that files modified after
@@ -2501,9 +2925,7 @@ sync_fileindex(struct got_fileindex *fileindex, const char *fileindex_path)
 	timeout.tv_nsec = 1;
 	nanosleep(&timeout,  NULL);
 done:
-	if (new_index)
-		fclose(new_index);
-	free(new_fileindex_path);
+	free(delta_path);
 	return err;
 }
 
@@ -2651,6 +3073,7 @@ checkout_files(struct got_worktree *worktree, struct got_fileindex *fileindex,
 	diff_cb.diff_old_new = diff_old_new;
 	diff_cb.diff_old = diff_old;
 	diff_cb.diff_new = diff_new;
+	diff_cb.diff_filter = diff_filter;
 	arg.fileindex = fileindex;
 	arg.worktree = worktree;
 	arg.repo = repo;
@@ -2716,6 +3139,15 @@ got_worktree_checkout_files(struct got_worktree *worktree,
 			goto done;
 		}
 
+		if (!path_is_in_sparse_set(worktree, pe->path,
+		    tpd->entry_type == GOT_OBJ_TYPE_TREE)) {
+			err = got_error_path(pe->path, GOT_ERR_SPARSE_PATH);
+			free(tpd->relpath);
+			free(tpd->tree_id);
+			free(tpd);
+			goto done;
+		}
+
 		if (tpd->entry_type == GOT_OBJ_TYPE_BLOB) {
 			err = got_path_basename(&tpd->entry_name, pe->path);
 			if (err) {
@@ -2798,6 +3230,86 @@ struct merge_file_cb_arg {
     int allow_bad_symlinks;
 };
 
+static const struct got_error *
+sparse_checkout_progress(void *arg, unsigned char status, const char *path)
+{
+	return NULL;
+}
+
+/*
+ * Install a file which lies outside of the work tree's sparse checkout set
+ * from the work tree's base commit, such that changes to this file can be
+ * merged into the work tree.
+ */
+static const struct got_error *
+checkout_sparse_file(struct got_fileindex_entry **ie,
+    struct got_worktree *worktree, struct got_fileindex *fileindex,
+    const char *path, struct got_repository *repo)
+{
+	const struct got_error *err = NULL;
+	struct got_commit_object *commit = NULL;
+	struct got_tree_object *tree = NULL;
+	struct got_tree_entry *te;
+	struct got_object_id *tree_id = NULL;
+	char *in_repo_path = NULL, *parent_path = NULL, *name = NULL;
+
+	*ie = NULL;
+
+	err = got_path_dirname(&parent_path, path);
+	if (err) {
+		if (err->code != GOT_ERR_BAD_PATH)
+			return err;
+		err = NULL;
+		parent_path = strdup("");
+		if (parent_path == NULL)
+			return got_error_from_errno("strdup");
+	}
+	err = got_path_basename(&name, path);
+	if (err)
+		goto done;
+
+	if (asprintf(&in_repo_path, "%s%s%s", worktree->path_prefix,
+	    got_path_is_root_dir(worktree->path_prefix) ||
+	    parent_path[0] == '\0' ? "" : "/", parent_path) == -1) {
+		err = got_error_from_errno("asprintf");
+		goto done;
+	}
+
+	err = got_object_open_as_commit(&commit, repo,
+	    worktree->base_commit_id);
+	if (err)
+		goto done;
+	err = got_object_id_by_path(&tree_id, repo, commit, in_repo_path);
+	if (err) {
+		if (err->code == GOT_ERR_NO_TREE_ENTRY)
+			err = NULL;
+		goto done;
+	}
+	err = got_object_open_as_tree(&tree, repo, tree_id);
+	if (err)
+		goto done;
+	te = got_object_tree_find_entry(tree, name);
+	if (te == NULL || S_ISDIR(te->mode) ||
+	    got_object_tree_entry_is_submodule(te))
+		goto done;
+
+	err = update_blob(worktree, fileindex, NULL, te, path, repo,
+	    sparse_checkout_progress, NULL);
+	if (err)
+		goto done;
+	*ie = got_fileindex_entry_get(fileindex, path, strlen(path));
+done:
+	if (tree)
+		got_object_tree_close(tree);
+	if (commit)
+		got_object_commit_close(commit);
+	free(tree_id);
+	free(in_repo_path);
+	free(parent_path);
+	free(name);
+	return err;
+}
+
 static const struct got_error *
 merge_file_cb(void *arg, struct got_blob_object *blob1,
     struct got_blob_object *blob2, FILE *f1, FILE *f2,
@@ -2818,6 +3330,13 @@ merge_file_cb(void *arg, struct got_blob_object *blob1,
 	if (blob1 && blob2) {
 		ie = got_fileindex_entry_get(a->fileindex, path2,
 		    strlen(path2));
+		if (ie == NULL &&
+		    !path_is_in_sparse_set(a->worktree, path2, 0)) {
+			err = checkout_sparse_file(&ie, a->worktree,
+			    a->fileindex, path2, repo);
+			if (err)
+				return err;
+		}
 		if (ie == NULL)
 			return (*a->progress_cb)(a->progress_arg,
 			    GOT_STATUS_MISSING, path2);
@@ -2905,6 +3424,13 @@ merge_file_cb(void *arg, struct got_blob_object *blob1,
 	} else if (blob1) {
 		ie = got_fileindex_entry_get(a->fileindex, path1,
 		    strlen(path1));
+		if (ie == NULL &&
+		    !path_is_in_sparse_set(a->worktree, path1, 0)) {
+			err = checkout_sparse_file(&ie, a->worktree,
+			    a->fileindex, path1, repo);
+			if (err)
+				return err;
+		}
 		if (ie == NULL)
 			return (*a->progress_cb)(a->progress_arg,
 			    GOT_STATUS_MISSING, path1);
@@ -3738,6 +4264,7 @@ worktree_status(struct got_worktree *worktree, const char *path,
 	char *ondisk_path = NULL;
 	struct got_pathlist_head ignores;
 	struct got_fileindex_entry *ie;
+	struct got_worktree_preload *preload = NULL;
 
 	TAILQ_INIT(&ignores);
 
@@ -3792,10 +4319,17 @@ worktree_status(struct got_worktree *worktree, const char *path,
 				goto done;
 		}
 		arg.ignores = &ignores;
+#ifndef GOT_WORKTREE_NO_PRELOAD
+		err = got_worktree_preload(&preload, worktree, fileindex,
+		    path);
+		if (err)
+			goto done;
+#endif
 		err = got_fileindex_diff_dir(fileindex, fd,
 		    worktree->root_path, path, repo, &fdiff_cb, &arg);
 	}
 done:
+	got_worktree_preload_free(preload);
 	free_ignores(&ignores);
 	if (fd != -1 && close(fd) == -1 && err == NULL)
 		err = got_error_from_errno("close");
@@ -3803,6 +4337,93 @@ done:
 	return err;
 }
 
+static const struct got_error *
+stat_fileindex(struct stat *base_sb, struct stat *delta_sb,
+    const char *fileindex_path, const char *delta_path)
+{
+	if (lstat(fileindex_path, base_sb) == -1) {
+		if (errno != ENOENT)
+			return got_error_from_errno2("lstat", fileindex_path);
+		memset(base_sb, 0, sizeof(*base_sb));
+	}
+	if (lstat(delta_path, delta_sb) == -1) {
+		if (errno != ENOENT)
+			return got_error_from_errno2("lstat", delta_path);
+		memset(delta_sb, 0, sizeof(*delta_sb));
+	}
+	return NULL;
+}
+
+static int
+fileindex_stat_differs(struct stat *sb1, struct stat *sb2)
+{
+	return (sb1->st_dev != sb2->st_dev ||
+	    sb1->st_ino != sb2->st_ino ||
+	    sb1->st_size != sb2->st_size ||
+	    timespeccmp(&sb1->st_mtim, &sb2->st_mtim, !=) ||
+	    timespeccmp(&sb1->st_ctim, &sb2->st_ctim, !=));
+}
+
+/*
+ * Write file index entries whose content status was refreshed while
+ * reading the file index under a shared lock. This is an optimization
+ * only, and it is skipped if the work tree is being used by another
+ * process, or if another process has modified the file index since
+ * we have read it.
+ */
+static const struct got_error *
+save_refreshed_fileindex(struct got_worktree *worktree,
+    struct got_fileindex *fileindex, const char *fileindex_path)
+{
+	const struct got_error *err, *unlockerr;
+	char *delta_path = NULL;
+	struct stat base_sb, delta_sb, base_sb2, delta_sb2;
+
+	err = get_fileindex_delta_path(&delta_path, fileindex_path);
+	if (err)
+		return err;
+
+	err = stat_fileindex(&base_sb, &delta_sb, fileindex_path, delta_path);
+	if (err)
+		goto done;
+
+	/*
+	 * Converting a shared lock into an exclusive lock is not atomic.
+	 * Another process may obtain the lock and modify the file index
+	 * in the meantime, in which case our copy of the file index is
+	 * out of date and must not be written.
+	 */
+	err = lock_worktree(worktree, LOCK_EX);
+	if (err) {
+		if (err->code == GOT_ERR_WORKTREE_BUSY)
+			err = NULL;
+		goto relock;
+	}
+
+	err = stat_fileindex(&base_sb2, &delta_sb2, fileindex_path,
+	    delta_path);
+	if (err)
+		goto relock;
+	if (fileindex_stat_differs(&base_sb, &base_sb2) ||
+	    fileindex_stat_differs(&delta_sb, &delta_sb2))
+		goto relock;
+
+	err = sync_fileindex(fileindex, fileindex_path);
+relock:
+	/*
+	 * Our shared lock may have been released while we tried to convert
+	 * it. If another process has locked the work tree since then, carry
+	 * on without the lock; our status results were already reported.
+	 */
+	unlockerr = lock_worktree(worktree, LOCK_SH);
+	if (unlockerr && unlockerr->code != GOT_ERR_WORKTREE_BUSY &&
+	    err == NULL)
+		err = unlockerr;
+done:
+	free(delta_path);
+	return err;
+}
+
 const struct got_error *
 got_worktree_status(struct got_worktree *worktree,
     struct got_pathlist_head *paths, struct got_repository *repo,
@@ -3825,6 +4446,9 @@ got_worktree_status(struct got_worktree *worktree,
 		if (err)
 			break;
 	}
+	if (err == NULL && got_fileindex_has_refreshed_entries(fileindex))
+		err = save_refreshed_fileindex(worktree, fileindex,
+		    fileindex_path);
 	free(fileindex_path);
 	got_fileindex_free(fileindex);
 	return err;
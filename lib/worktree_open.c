@@ -104,6 +104,58 @@ done:
 	return err;
 }
 
+static const struct got_error *
+read_sparse_paths(struct got_pathlist_head *paths, const char *path_got)
+{
+	const struct got_error *err = NULL;
+	struct got_pathlist_entry *new;
+	char *path, *line = NULL, *p;
+	size_t linesize = 0;
+	ssize_t linelen;
+	FILE *f;
+
+	if (asprintf(&path, "%s/%s", path_got,
+	    GOT_WORKTREE_SPARSE_PATHS) == -1)
+		return got_error_from_errno("asprintf");
+
+	f = fopen(path, "re");
+	if (f == NULL) {
+		if (errno != ENOENT)
+			err = got_error_from_errno2("fopen", path);
+		free(path);
+		return err;
+	}
+
+	while ((linelen = getline(&line, &linesize, f)) != -1) {
+		if (linelen > 0 && line[linelen - 1] == '\n')
+			line[--linelen] = '\0';
+		if (linelen == 0)
+			continue;
+		if (got_path_is_absolute(line)) {
+			err = got_error_path(path, GOT_ERR_WORKTREE_META);
+			goto done;
+		}
+		p = strdup(line);
+		if (p == NULL) {
+			err = got_error_from_errno("strdup");
+			goto done;
+		}
+		err = got_pathlist_insert(&new, paths, p, NULL);
+		if (err || new == NULL)
+			free(p);
+		if (err)
+			goto done;
+	}
+	if (ferror(f))
+		err = got_error_from_errno2("getline", path);
+done:
+	if (fclose(f) == EOF && err == NULL)
+		err = got_error_from_errno2("fclose", path);
+	free(line);
+	free(path);
+	return err;
+}
+
 static const struct got_error *
 open_worktree(struct got_worktree **worktree, const char *path)
 {
@@ -161,6 +213,7 @@ open_worktree(struct got_worktree **worktree, const char *path)
 		goto done;
 	}
 	(*worktree)->lockfd = -1;
+	TAILQ_INIT(&(*worktree)->sparse_paths);
 
 	(*worktree)->root_path = realpath(path, NULL);
 	if ((*worktree)->root_path == NULL) {
@@ -182,6 +235,10 @@ open_worktree(struct got_worktree **worktree, const char *path)
 	if (err)
 		goto done;
 
+	err = read_sparse_paths(&(*worktree)->sparse_paths, path_got);
+	if (err)
+		goto done;
+
 	err = read_meta_file(&uuidstr, path_got, GOT_WORKTREE_UUID);
 	if (err)
 		goto done;
@@ -316,6 +373,7 @@ got_worktree_close(struct got_worktree *worktree)
 	free(worktree->root_path);
 	free(worktree->gotconfig_path);
 	got_gotconfig_free(worktree->gotconfig);
+	got_pathlist_free(&worktree->sparse_paths, GOT_PATHLIST_FREE_PATH);
 	free(worktree);
 	return err;
 }
@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/queue.h>
+#include <sys/tree.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sha1.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <uuid.h>
+
+#include "got_error.h"
+#include "got_cancel.h"
+#include "got_reference.h"
+#include "got_path.h"
+#include "got_object.h"
+#include "got_worktree.h"
+
+#include "got_lib_fileindex.h"
+#include "got_lib_worktree.h"
+
+#ifndef nitems
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+#endif
+
+/*
+ * Below this number of files the cost of starting threads outweighs
+ * the benefit of running system calls in parallel.
+ */
+#define GOT_PRELOAD_MIN_FILES		256
+
+/* Number of files handled by each thread before it looks for more work. */
+#define GOT_PRELOAD_BATCH_SIZE		32
+
+/*
+ * Maximum number of threads. Each thread has at most one system call in
+ * flight; threads are cheap while they are blocked on I/O.
+ */
+#define GOT_PRELOAD_MAX_THREADS		64
+
+/* Files larger than this are left for the main thread to compare. */
+#define GOT_PRELOAD_MAX_READ_SIZE	(8 * 1024 * 1024)
+
+struct got_worktree_preload {
+	pthread_mutex_t mutex;
+	struct got_fileindex *fileindex;
+	char *path;
+	struct got_fileindex_entry **entries;
+	struct got_preloaded_file *files;
+	size_t nfiles;
+	size_t nalloc;
+	size_t next;
+	int root_fd;
+};
+
+static const struct got_error *
+queue_file(void *arg, struct got_fileindex_entry *ie)
+{
+	struct got_worktree_preload *pl = arg;
+	struct got_fileindex_entry **entries;
+
+	if (!got_fileindex_entry_has_file_on_disk(ie) ||
+	    got_fileindex_entry_filetype_get(ie) !=
+	    GOT_FILEIDX_MODE_REGULAR_FILE)
+		return NULL;
+
+	if (pl->nfiles == pl->nalloc) {
+		size_t nalloc = pl->nalloc ? pl->nalloc * 2 : 1024;
+
+		entries = recallocarray(pl->entries, pl->nalloc, nalloc,
+		    sizeof(*entries));
+		if (entries == NULL)
+			return got_error_from_errno("recallocarray");
+		pl->entries = entries;
+		pl->nalloc = nalloc;
+	}
+
+	pl->entries[pl->nfiles++] = ie;
+	return NULL;
+}
+
+static const struct got_error *
+clear_file(void *arg, struct got_fileindex_entry *ie)
+{
+	ie->preload = NULL;
+	return NULL;
+}
+
+static int
+preload_stat_differs(struct got_fileindex_entry *ie, struct stat *sb)
+{
+	mode_t ie_mode = got_fileindex_perms_to_st(ie);
+
+	return !(ie->ctime_sec == sb->st_ctim.tv_sec &&
+	    ie->ctime_nsec == sb->st_ctim.tv_nsec &&
+	    ie->mtime_sec == sb->st_mtim.tv_sec &&
+	    ie->mtime_nsec == sb->st_mtim.tv_nsec &&
+	    ie->size == (sb->st_size & 0xffffffff) &&
+	    (ie_mode & S_IXUSR) == (sb->st_mode & S_IXUSR));
+}
+
+/*
+ * Hash a file's content as a Git blob and compare the result to the blob
+ * recorded in the file index. Return GOT_STATUS_NO_CHANGE or
+ * GOT_STATUS_MODIFY, or zero if the file could not be compared.
+ */
+static unsigned char
+preload_content_status(int root_fd, struct got_fileindex_entry *ie,
+    struct stat *sb, uint8_t *buf, size_t bufsize)
+{
+	SHA1_CTX ctx;
+	uint8_t digest[SHA1_DIGEST_LENGTH];
+	const uint8_t *expected;
+	char hdr[32];
+	off_t total = 0;
+	ssize_t r;
+	int fd, hdrlen;
+	uint32_t stage = got_fileindex_entry_stage_get(ie);
+
+	if (stage == GOT_FILEIDX_STAGE_MODIFY ||
+	    stage == GOT_FILEIDX_STAGE_ADD)
+		expected = ie->staged_blob_sha1;
+	else if (got_fileindex_entry_has_blob(ie))
+		expected = ie->blob_sha1;
+	else
+		return 0;
+
+	hdrlen = snprintf(hdr, sizeof(hdr), "%s %lld", GOT_OBJ_LABEL_BLOB,
+	    (long long)sb->st_size);
+	if (hdrlen < 0 || (size_t)hdrlen >= sizeof(hdr))
+		return 0;
+
+	fd = openat(root_fd, ie->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd == -1)
+		return 0;
+
+	SHA1Init(&ctx);
+	SHA1Update(&ctx, hdr, hdrlen + 1);
+	while ((r = read(fd, buf, bufsize)) > 0) {
+		SHA1Update(&ctx, buf, r);
+		total += r;
+	}
+	close(fd);
+
+	/* The file was changed while we were reading it. */
+	if (r == -1 || total != sb->st_size)
+		return 0;
+
+	SHA1Final(digest, &ctx);
+	if (memcmp(digest, expected, sizeof(digest)) == 0)
+		return GOT_STATUS_NO_CHANGE;
+
+	return GOT_STATUS_MODIFY;
+}
+
+static void *
+preload_thread(void *arg)
+{
+	struct got_worktree_preload *pl = arg;
+	uint8_t buf[8192];
+
+	for (;;) {
+		size_t i, start, end;
+
+		if (pthread_mutex_lock(&pl->mutex) != 0)
+			break;
+		start = pl->next;
+		end = MIN(start + GOT_PRELOAD_BATCH_SIZE, pl->nfiles);
+		pl->next = end;
+		if (pthread_mutex_unlock(&pl->mutex) != 0)
+			break;
+		if (start >= end)
+			break;
+
+		/* Each entry is only ever touched by a single thread. */
+		for (i = start; i < end; i++) {
+			struct got_fileindex_entry *ie = pl->entries[i];
+			struct got_preloaded_file *pf = &pl->files[i];
+
+			if (clock_gettime(CLOCK_REALTIME, &pf->now) == -1)
+				continue;
+			if (fstatat(pl->root_fd, ie->path, &pf->sb,
+			    AT_SYMLINK_NOFOLLOW) == -1)
+				continue;
+			if (!S_ISREG(pf->sb.st_mode))
+				continue;
+			if (preload_stat_differs(ie, &pf->sb) &&
+			    pf->sb.st_size <= GOT_PRELOAD_MAX_READ_SIZE) {
+				pf->status = preload_content_status(
+				    pl->root_fd, ie, &pf->sb, buf,
+				    sizeof(buf));
+			}
+			ie->preload = pf;
+		}
+	}
+
+	return NULL;
+}
+
+const struct got_error *
+got_worktree_preload(struct got_worktree_preload **plp,
+    struct got_worktree *worktree, struct got_fileindex *fileindex,
+    const char *path)
+{
+	const struct got_error *err = NULL;
+	struct got_worktree_preload *pl;
+	pthread_t threads[GOT_PRELOAD_MAX_THREADS];
+	size_t i, nthreads = 0;
+	int errcode;
+
+	*plp = NULL;
+
+	pl = calloc(1, sizeof(*pl));
+	if (pl == NULL)
+		return got_error_from_errno("calloc");
+	pl->fileindex = fileindex;
+	pl->root_fd = worktree->root_fd;
+	pl->path = strdup(path);
+	if (pl->path == NULL) {
+		err = got_error_from_errno("strdup");
+		free(pl);
+		return err;
+	}
+
+	errcode = pthread_mutex_init(&pl->mutex, NULL);
+	if (errcode) {
+		free(pl->path);
+		free(pl);
+		return got_error_set_errno(errcode, "pthread_mutex_init");
+	}
+
+	err = got_fileindex_for_each_subtree_entry(fileindex, path,
+	    queue_file, pl);
+	if (err || pl->nfiles < GOT_PRELOAD_MIN_FILES)
+		goto done;
+
+	pl->files = calloc(pl->nfiles, sizeof(*pl->files));
+	if (pl->files == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+
+	for (i = 0; i < nitems(threads) &&
+	    i * GOT_PRELOAD_BATCH_SIZE < pl->nfiles; i++) {
+		errcode = pthread_create(&threads[i], NULL, preload_thread,
+		    pl);
+		if (errcode) {
+			/*
+			 * Preloading is an optimization only. Run with the
+			 * threads we already have, if any, and let the main
+			 * thread check the remaining files.
+			 */
+			break;
+		}
+		nthreads++;
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		errcode = pthread_join(threads[i], NULL);
+		if (errcode && err == NULL)
+			err = got_error_set_errno(errcode, "pthread_join");
+	}
+done:
+	if (err) {
+		got_worktree_preload_free(pl);
+		return err;
+	}
+	*plp = pl;
+	return NULL;
+}
+
+void
+got_worktree_preload_free(struct got_worktree_preload *pl)
+{
+	if (pl == NULL)
+		return;
+
+	/*
+	 * Entries which were not visited still point at our results.
+	 * Entries which were removed from the file index are not found
+	 * and need no update.
+	 */
+	if (pl->files)
+		got_fileindex_for_each_subtree_entry(pl->fileindex, pl->path,
+		    clear_file, NULL);
+	pthread_mutex_destroy(&pl->mutex);
+	free(pl->entries);
+	free(pl->files);
+	free(pl->path);
+	free(pl);
+}
@@ -374,6 +374,65 @@ test_add_symlink() {
 	test_done "$testroot" "$ret"
 }
 
+test_add_split_index() {
+	local testroot=`test_init add_split_index`
+
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	if [ -e $testroot/wt/.got/file-index-delta ]; then
+		echo "file index delta exists after checkout" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+	cp $testroot/wt/.got/file-index $testroot/file-index.orig
+
+	echo "new file" > $testroot/wt/foo
+	echo "new file" > $testroot/wt/gamma/bar
+	(cd $testroot/wt && got add foo gamma/bar > /dev/null)
+
+	# the base file index should not have been rewritten
+	cmp -s $testroot/file-index.orig $testroot/wt/.got/file-index
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "base file index was rewritten" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	if [ ! -s $testroot/wt/.got/file-index-delta ]; then
+		echo "file index delta is missing or empty" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	echo 'A  foo' > $testroot/stdout.expected
+	echo 'A  gamma/bar' >> $testroot/stdout.expected
+	(cd $testroot/wt && got status > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	(cd $testroot/wt && got revert gamma/bar > /dev/null)
+
+	echo 'A  foo' > $testroot/stdout.expected
+	echo '?  gamma/bar' >> $testroot/stdout.expected
+	(cd $testroot/wt && got status > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+	fi
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_add_basic
 run_test test_double_add
@@ -383,3 +442,4 @@ run_test test_add_deleted
 run_test test_add_directory
 run_test test_add_clashes_with_submodule
 run_test test_add_symlink
+run_test test_add_split_index
@@ -981,6 +981,122 @@ EOF
 	test_done "$testroot" "$ret"
 }
 
+test_blame_cache() {
+	local testroot=`test_init blame_cache`
+
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo 1 > $testroot/wt/alpha
+	(cd $testroot/wt && got commit -m "change 1" > /dev/null)
+	local commit1=`git_show_head $testroot/repo`
+
+	echo 2 >> $testroot/wt/alpha
+	(cd $testroot/wt && got commit -m "change 2" > /dev/null)
+	local commit2=`git_show_head $testroot/repo`
+
+	# the cache is not used unless its directory exists
+	(cd $testroot/wt && got blame alpha > /dev/null)
+	if [ -e $testroot/repo/.git/got-blame-cache ]; then
+		echo "blame cache was created" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	mkdir $testroot/repo/.git/got-blame-cache
+	(cd $testroot/wt && got blame alpha > /dev/null)
+	ls $testroot/repo/.git/got-blame-cache | wc -l | tr -d ' ' \
+		> $testroot/stdout
+	echo 1 > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "blame result was not cached" >&2
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo 3 >> $testroot/wt/alpha
+	(cd $testroot/wt && got commit -m "change 3" > /dev/null)
+	local commit3=`git_show_head $testroot/repo`
+	local author_time=`git_show_author_time $testroot/repo`
+
+	# the result for commit2 should be reused from the cache
+	(cd $testroot/wt && got blame alpha > $testroot/stdout)
+
+	local short_commit1=`trim_obj_id 32 $commit1`
+	local short_commit2=`trim_obj_id 32 $commit2`
+	local short_commit3=`trim_obj_id 32 $commit3`
+
+	d=`date -u -r $author_time +"%G-%m-%d"`
+	echo "1) $short_commit1 $d $GOT_AUTHOR_8 1" > $testroot/stdout.expected
+	echo "2) $short_commit2 $d $GOT_AUTHOR_8 2" >> $testroot/stdout.expected
+	echo "3) $short_commit3 $d $GOT_AUTHOR_8 3" >> $testroot/stdout.expected
+
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# corrupt cache entries must be ignored
+	for f in $testroot/repo/.git/got-blame-cache/*; do
+		echo garbage > $f
+	done
+	(cd $testroot/wt && got blame alpha > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# a different diff algorithm must not reuse cached results
+	(cd $testroot/wt && got blame -A patience alpha > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# gotadmin cleanup removes cached results but keeps the directory
+	gotadmin cleanup -q -r $testroot/repo
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin cleanup failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	if [ ! -d $testroot/repo/.git/got-blame-cache ]; then
+		echo "blame cache directory was removed" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+	ls $testroot/repo/.git/got-blame-cache > $testroot/stdout
+	cmp -s /dev/null $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "blame cache entries were not removed" >&2
+		diff -u /dev/null $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	blame_cmp "$testroot" "alpha"
+	ret=$?
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_blame_basic
 run_test test_blame_tag
@@ -995,3 +1111,4 @@ run_test test_blame_added_on_branch
 run_test test_blame_submodule
 run_test test_blame_symlink
 run_test test_blame_lines_shifted_skip
+run_test test_blame_cache
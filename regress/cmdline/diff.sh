@@ -1787,6 +1787,69 @@ EOF
 	test_done "$testroot" "$ret"
 }
 
+test_diff_algorithm() {
+	local testroot=`test_init diff_algorithm`
+
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	printf '1\n2\n3\n4\n5\n' > $testroot/wt/numbers
+	(cd $testroot/wt && got add numbers > /dev/null)
+	(cd $testroot/wt && got commit -m 'add numbers' > /dev/null)
+	local head_rev=`git_show_head $testroot/repo`
+	local numbers_blobid=`get_blob_id $testroot/repo "" numbers`
+
+	printf '1\n2\nx\n4\n5\n' > $testroot/wt/numbers
+
+	echo "diff $testroot/wt" > $testroot/stdout.expected
+	echo "commit - $head_rev" >> $testroot/stdout.expected
+	echo "path + $testroot/wt" >> $testroot/stdout.expected
+	echo "blob - $numbers_blobid" >> $testroot/stdout.expected
+	echo 'file + numbers' >> $testroot/stdout.expected
+	echo '--- numbers' >> $testroot/stdout.expected
+	echo '+++ numbers' >> $testroot/stdout.expected
+	echo '@@ -1,5 +1,5 @@' >> $testroot/stdout.expected
+	echo ' 1' >> $testroot/stdout.expected
+	echo ' 2' >> $testroot/stdout.expected
+	echo '-3' >> $testroot/stdout.expected
+	echo '+x' >> $testroot/stdout.expected
+	echo ' 4' >> $testroot/stdout.expected
+	echo ' 5' >> $testroot/stdout.expected
+
+	for algo in myers patience histogram; do
+		(cd $testroot/wt && got diff -A $algo > $testroot/stdout)
+		cmp -s $testroot/stdout.expected $testroot/stdout
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			echo "got diff -A $algo produced unexpected output" >&2
+			diff -u $testroot/stdout.expected $testroot/stdout
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+	done
+
+	(cd $testroot/wt && got diff -A foo > $testroot/stdout \
+		2> $testroot/stderr)
+	ret=$?
+	if [ $ret -eq 0 ]; then
+		echo "got diff succeeded unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	echo "got: invalid diff algorithm: foo" > $testroot/stderr.expected
+	cmp -s $testroot/stderr.expected $testroot/stderr
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stderr.expected $testroot/stderr
+	fi
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_diff_basic
 run_test test_diff_shows_conflict
@@ -1803,3 +1866,4 @@ run_test test_diff_crlf
 run_test test_diff_worktree_newfile_xbit
 run_test test_diff_commit_diffstat
 run_test test_diff_worktree_diffstat
+run_test test_diff_algorithm
@@ -54,6 +54,410 @@ test_init_specified_head() {
 	test_done "$testroot" "$ret"
 }
 
+test_init_reftable() {
+	local testname=init_reftable
+	local testroot=`mktemp -d "$GOT_TEST_ROOT/got-test-$testname-XXXXXXXX"`
+	local headref=trunk
+
+	gotadmin init -R -b $headref $testroot/repo
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "gotadmin init failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	if [ ! -f $testroot/repo/reftable/tables.list ]; then
+		echo "reftable stack not found" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	mkdir $testroot/tree
+	make_test_tree $testroot/tree
+	got import -m init -r $testroot/repo $testroot/tree > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got import failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	local commit_id=`got ref -r $testroot/repo -l refs/heads/$headref | \
+		cut -d ' ' -f 2`
+
+	for b in ref1 ref2 ref3; do
+		got ref -r $testroot/repo -c $headref refs/heads/$b
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			echo "got ref command failed unexpectedly" >&2
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+	done
+
+	got ref -r $testroot/repo -d refs/heads/ref2 > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got ref command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got ref -r $testroot/repo -l > $testroot/stdout
+	echo "HEAD: refs/heads/$headref" > $testroot/stdout.expected
+	echo "refs/heads/ref1: $commit_id" >> $testroot/stdout.expected
+	echo "refs/heads/ref3: $commit_id" >> $testroot/stdout.expected
+	echo "refs/heads/$headref: $commit_id" >> $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# References must not have been written to files.
+	if [ -e $testroot/repo/refs/heads/$headref -o \
+	    -e $testroot/repo/packed-refs ]; then
+		echo "reference files found in reftable repository" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	# Six updates were made; the stack should have been compacted.
+	local ntables=`wc -l < $testroot/repo/reftable/tables.list`
+	if [ $ntables -ge 6 ]; then
+		echo "reftable stack holds $ntables tables" >&2
+		ret=1
+	fi
+	test_done "$testroot" "$ret"
+}
+
+test_init_reftable_git_read() {
+	local testname=init_reftable_git_read
+	local testroot=`mktemp -d "$GOT_TEST_ROOT/got-test-$testname-XXXXXXXX"`
+	local headref=trunk
+
+	gotadmin init -R -b $headref $testroot/repo
+	mkdir $testroot/tree
+	make_test_tree $testroot/tree
+	got import -m init -r $testroot/repo $testroot/tree > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got import failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	local commit_id=`got ref -r $testroot/repo -l refs/heads/$headref | \
+		cut -d ' ' -f 2`
+
+	for r in heads/ref1 heads/ref2 heads/ref3 tags/t1; do
+		got ref -r $testroot/repo -c $headref refs/$r
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			echo "got ref command failed unexpectedly" >&2
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+	done
+	got ref -r $testroot/repo -d refs/heads/ref2 > /dev/null
+
+	# Git must see the refs in the tables written by got.
+	(cd $testroot/repo && git show-ref) > $testroot/stdout
+	echo "$commit_id refs/heads/ref1" > $testroot/stdout.expected
+	echo "$commit_id refs/heads/ref3" >> $testroot/stdout.expected
+	echo "$commit_id refs/heads/$headref" >> $testroot/stdout.expected
+	echo "$commit_id refs/tags/t1" >> $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	(cd $testroot/repo && git symbolic-ref HEAD) > $testroot/stdout
+	echo "refs/heads/$headref" > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	(cd $testroot/repo && git fsck --strict > /dev/null)
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git fsck failed unexpectedly" >&2
+	fi
+	test_done "$testroot" "$ret"
+}
+
+test_init_reftable_git_written() {
+	local testname=init_reftable_git_written
+	local testroot=`mktemp -d "$GOT_TEST_ROOT/got-test-$testname-XXXXXXXX"`
+
+	git init -q --ref-format=reftable -b main $testroot/repo
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "git init failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+	make_test_tree $testroot/repo
+	(cd $testroot/repo && git add .)
+	git_commit $testroot/repo -m "adding the test tree"
+	local commit_id=`git_show_head $testroot/repo`
+	(cd $testroot/repo && git branch ref1 && git tag -a -m "tag" t1)
+	local tag_id=`(cd $testroot/repo && git rev-parse refs/tags/t1)`
+
+	# Git's tables also hold reflogs, which got does not read.
+	got ref -r $testroot/repo -l > $testroot/stdout
+	echo "HEAD: refs/heads/main" > $testroot/stdout.expected
+	echo "refs/heads/main: $commit_id" >> $testroot/stdout.expected
+	echo "refs/heads/ref1: $commit_id" >> $testroot/stdout.expected
+	echo "refs/tags/t1: $tag_id" >> $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	(cd $testroot/repo && git reflog show refs/heads/main) \
+		> $testroot/reflog.expected
+	if [ ! -s $testroot/reflog.expected ]; then
+		echo "git did not write a reflog" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	# Add got's tables on top of the stack written by Git.
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got checkout failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo "modified alpha" > $testroot/wt/alpha
+	(cd $testroot/wt && got commit -m "modified alpha" > /dev/null)
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got commit failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# Enough updates for got to merge tables at the top of the stack.
+	for b in w1 w2 w3 w4 w5 w6 w7 w8; do
+		got ref -r $testroot/repo -c main refs/heads/$b
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			echo "got ref command failed unexpectedly" >&2
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+	done
+
+	# Merging must not lose the reflogs stored in Git's tables.
+	(cd $testroot/repo && git reflog show refs/heads/main) \
+		> $testroot/reflog
+	cmp -s $testroot/reflog.expected $testroot/reflog
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/reflog.expected $testroot/reflog
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	local got_id=`got ref -r $testroot/repo -l refs/heads/main | \
+		cut -d ' ' -f 2`
+	local git_id=`(cd $testroot/repo && git rev-parse refs/heads/main)`
+	if [ "$got_id" = "$commit_id" -o "$got_id" != "$git_id" ]; then
+		echo "refs/heads/main: got $got_id, git $git_id" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	(cd $testroot/repo && git show-ref refs/heads/ref1) > $testroot/stdout
+	echo "$commit_id refs/heads/ref1" > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+	fi
+	test_done "$testroot" "$ret"
+}
+
+test_init_reftable_many_refs() {
+	local testname=init_reftable_many_refs
+	local testroot=`mktemp -d "$GOT_TEST_ROOT/got-test-$testname-XXXXXXXX"`
+	local headref=trunk
+	local pad=`printf '%0200d' 0`
+	local i n name max size
+
+	gotadmin init -R -b $headref $testroot/repo
+	mkdir $testroot/tree
+	make_test_tree $testroot/tree
+	got import -m init -r $testroot/repo $testroot/tree > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got import failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	local commit_id=`got ref -r $testroot/repo -l refs/heads/$headref | \
+		cut -d ' ' -f 2`
+
+	# Long names keep few refs per block and few entries per index
+	# block, so that merged tables span many blocks and need more
+	# than one level of index blocks.
+	echo "HEAD: refs/heads/$headref" > $testroot/stdout.expected
+	rm -f $testroot/show-ref.expected
+	i=0
+	while [ $i -lt 100 ]; do
+		n=`printf '%03d' $i`
+		name=refs/heads/$n-$pad/$pad/$pad
+		got ref -r $testroot/repo -c $headref $name
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			echo "got ref command failed unexpectedly" >&2
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+		echo "$name: $commit_id" >> $testroot/stdout.expected
+		echo "$commit_id $name" >> $testroot/show-ref.expected
+		i=$((i + 1))
+	done
+	echo "refs/heads/$headref: $commit_id" >> $testroot/stdout.expected
+	echo "$commit_id refs/heads/$headref" >> $testroot/show-ref.expected
+
+	max=0
+	for t in `cat $testroot/repo/reftable/tables.list`; do
+		size=`wc -c < $testroot/repo/reftable/$t`
+		if [ $size -gt $max ]; then
+			max=$size
+		fi
+	done
+	if [ $max -lt 40960 ]; then
+		echo "largest table holds only $max bytes" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+
+	got ref -r $testroot/repo -l > $testroot/stdout
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# Look up refs stored near either end and in the middle of a table.
+	for n in 000 001 049 050 098 099; do
+		name=refs/heads/$n-$pad/$pad/$pad
+		got ref -r $testroot/repo -l $name > $testroot/stdout
+		echo "$name: $commit_id" > $testroot/stdout.expected
+		cmp -s $testroot/stdout.expected $testroot/stdout
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			diff -u $testroot/stdout.expected $testroot/stdout
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+	done
+
+	(cd $testroot/repo && git show-ref) > $testroot/stdout
+	cmp -s $testroot/show-ref.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/show-ref.expected $testroot/stdout
+	fi
+	test_done "$testroot" "$ret"
+}
+
+test_init_reftable_concurrent_read() {
+	local testname=init_reftable_concurrent_read
+	local testroot=`mktemp -d "$GOT_TEST_ROOT/got-test-$testname-XXXXXXXX"`
+	local headref=trunk
+	local i pid nreads=0
+
+	gotadmin init -R -b $headref $testroot/repo
+	mkdir $testroot/tree
+	make_test_tree $testroot/tree
+	got import -m init -r $testroot/repo $testroot/tree > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got import failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	local commit_id=`got ref -r $testroot/repo -l refs/heads/$headref | \
+		cut -d ' ' -f 2`
+	echo "refs/heads/$headref: $commit_id" > $testroot/stdout.expected
+
+	# Each update triggers a merge of some tables, which replaces
+	# tables.list and removes the merged tables.
+	(i=0; while [ $i -lt 100 ]; do
+		got ref -r $testroot/repo -c $headref refs/heads/w$i || exit 1
+		i=$((i + 1))
+	done) &
+	pid=$!
+
+	# Readers must keep finding refs which are not being changed.
+	while kill -0 $pid 2> /dev/null; do
+		got ref -r $testroot/repo -l refs/heads/$headref \
+			> $testroot/stdout 2> $testroot/stderr
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			echo "got ref command failed unexpectedly" >&2
+			cat $testroot/stderr >&2
+			wait $pid
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+		cmp -s $testroot/stdout.expected $testroot/stdout
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			diff -u $testroot/stdout.expected $testroot/stdout
+			wait $pid
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+		nreads=$((nreads + 1))
+	done
+
+	wait $pid
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got ref command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	local nrefs=`got ref -r $testroot/repo -l refs/heads | wc -l`
+	if [ $nrefs -ne 101 -o $nreads -eq 0 ]; then
+		echo "$nrefs refs found after $nreads reads" >&2
+		test_done "$testroot" 1
+		return 1
+	fi
+	test_done "$testroot" "0"
+}
+
 test_parseargs "$@"
 run_test test_init_basic
 run_test test_init_specified_head
+run_test test_init_reftable
+run_test test_init_reftable_git_read
+run_test test_init_reftable_git_written
+run_test test_init_reftable_many_refs
+run_test test_init_reftable_concurrent_read
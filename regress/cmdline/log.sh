@@ -900,6 +900,66 @@ EOF
 	test_done "$testroot" "$ret"
 }
 
+test_log_diffstat_many_files() {
+	local testroot=`test_init log_diffstat_many_files`
+
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	mkdir $testroot/wt/d1 $testroot/wt/d2
+	for d in d1 d2; do
+		for i in 01 02 03 04 05 06 07 08 09 10; do
+			printf "one\ntwo\nthree\n" > $testroot/wt/$d/f$i
+		done
+	done
+	(cd $testroot/wt && got add -R d1 d2 > /dev/null)
+	(cd $testroot/wt && got commit -m 'add many files' > /dev/null)
+
+	rm -f $testroot/stdout.expected $testroot/stdout.expected.p
+	for d in d1 d2; do
+		for i in 01 02 03 04 05 06 07 08 09 10; do
+			echo "four" >> $testroot/wt/$d/f$i
+			echo " M  $d/f$i  |  1+  0-" >> $testroot/stdout.expected
+			echo "+++ $d/f$i" >> $testroot/stdout.expected.p
+		done
+	done
+	(cd $testroot/wt && got commit -m 'modify many files' > /dev/null)
+
+	# per-file results must appear in tree order
+	(cd $testroot/wt && got log -d -l1 | grep '^ M' > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	(cd $testroot/wt && got log -d -l1 | grep 'files changed' \
+	    > $testroot/stdout)
+	echo "20 files changed, 20 insertions(+), 0 deletions(-)" \
+	    > $testroot/stdout.expected
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	(cd $testroot/wt && got log -p -l1 | grep '^+++ ' > $testroot/stdout)
+	cmp -s $testroot/stdout.expected.p $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected.p $testroot/stdout
+	fi
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_log_in_repo
 run_test test_log_in_bare_repo
@@ -916,3 +976,4 @@ run_test test_log_in_worktree_different_repo
 run_test test_log_changed_paths
 run_test test_log_submodule
 run_test test_log_diffstat
+run_test test_log_diffstat_many_files
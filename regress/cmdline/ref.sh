@@ -438,7 +438,187 @@ test_ref_list() {
 	test_done "$testroot" "$ret"
 }
 
+test_ref_list_packed() {
+	local testroot=`test_init ref_list_packed`
+	local commit_id=`git_show_head $testroot/repo`
+
+	for b in x1 x2 x3 x10 x20; do
+		got ref -r $testroot/repo -c $commit_id refs/heads/$b
+		got ref -r $testroot/repo -c $commit_id refs/tags/t$b
+	done
+	got ref -r $testroot/repo -c $commit_id refs/remotes/origin/x2
+	(cd $testroot/repo && git pack-refs --all)
+
+	# git pack-refs writes refs sorted and marks the file as such
+	head -n 1 $testroot/repo/.git/packed-refs | grep -q ' sorted'
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "packed-refs file lacks the 'sorted' trait" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got ref -r $testroot/repo -l refs/heads > $testroot/stdout
+
+	for b in master x1 x10 x2 x20 x3; do
+		echo "refs/heads/$b: $commit_id" >> $testroot/stdout.expected
+	done
+	cmp -s $testroot/stdout $testroot/stdout.expected
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got ref -r $testroot/repo -l refs/remotes > $testroot/stdout
+
+	echo "refs/remotes/origin/x2: $commit_id" > $testroot/stdout.expected
+	cmp -s $testroot/stdout $testroot/stdout.expected
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# look up packed references by their short names
+	for b in x1 tx20 origin/x2; do
+		got ref -r $testroot/repo -c $b refs/new/$b
+		ret=$?
+		if [ $ret -ne 0 ]; then
+			echo "got ref command failed unexpectedly" >&2
+			test_done "$testroot" "$ret"
+			return 1
+		fi
+	done
+
+	got ref -r $testroot/repo -l refs/new > $testroot/stdout
+
+	echo "refs/new/origin/x2: $commit_id" > $testroot/stdout.expected
+	echo "refs/new/tx20: $commit_id" >> $testroot/stdout.expected
+	echo "refs/new/x1: $commit_id" >> $testroot/stdout.expected
+	cmp -s $testroot/stdout $testroot/stdout.expected
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got ref -r $testroot/repo -d refs/heads/x2 > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "got ref command failed unexpectedly" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# deleting a packed ref must keep the file sorted
+	head -n 1 $testroot/repo/.git/packed-refs | grep -q ' sorted'
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		echo "packed-refs file lost the 'sorted' trait" >&2
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	got ref -r $testroot/repo -l refs/heads > $testroot/stdout
+
+	rm $testroot/stdout.expected
+	for b in master x1 x10 x20 x3; do
+		echo "refs/heads/$b: $commit_id" >> $testroot/stdout.expected
+	done
+	cmp -s $testroot/stdout $testroot/stdout.expected
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# x2 is only left in refs/remotes/origin, which short names
+	# do not search
+	got ref -r $testroot/repo -c x2 refs/new/x2 2> /dev/null
+	ret=$?
+	if [ $ret -eq 0 ]; then
+		echo "got ref command succeeded unexpectedly" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+	test_done "$testroot" "0"
+}
+
+test_ref_packed_clash() {
+	local testroot=`test_init ref_packed_clash`
+	local head_id=`git_show_head $testroot/repo`
+	local tag_id remote_id
+
+	echo "modified alpha" > $testroot/repo/alpha
+	git_commit $testroot/repo -m "modified alpha"
+	tag_id=`git_show_head $testroot/repo`
+	echo "modified beta" > $testroot/repo/beta
+	git_commit $testroot/repo -m "modified beta"
+	remote_id=`git_show_head $testroot/repo`
+
+	# A short name matching refs in refs/heads, refs/tags, and
+	# refs/remotes resolves to them in that order, whether or not
+	# packed-refs is sorted. Sorted by name, refs/remotes comes
+	# before refs/tags in the file.
+	for trait in sorted unsorted; do
+		got ref -r $testroot/repo -c $head_id refs/heads/clash
+		got ref -r $testroot/repo -c $tag_id refs/tags/clash
+		got ref -r $testroot/repo -c $remote_id refs/remotes/clash
+		(cd $testroot/repo && git pack-refs --all)
+		if [ "$trait" = unsorted ]; then
+			sed -i -e '1s/ sorted//' $testroot/repo/.git/packed-refs
+		fi
+
+		for ns in heads tags remotes; do
+			case $ns in
+			heads)	id=$head_id ;;
+			tags)	id=$tag_id ;;
+			remotes)	id=$remote_id ;;
+			esac
+
+			got ref -r $testroot/repo -c clash refs/new/clash
+			ret=$?
+			if [ $ret -ne 0 ]; then
+				echo "got ref command failed unexpectedly" >&2
+				test_done "$testroot" "$ret"
+				return 1
+			fi
+
+			got ref -r $testroot/repo -l refs/new/clash \
+				> $testroot/stdout
+			echo "refs/new/clash: $id" > $testroot/stdout.expected
+			cmp -s $testroot/stdout $testroot/stdout.expected
+			ret=$?
+			if [ $ret -ne 0 ]; then
+				echo "$trait packed-refs: wrong ref chosen" >&2
+				diff -u $testroot/stdout.expected \
+					$testroot/stdout
+				test_done "$testroot" "$ret"
+				return 1
+			fi
+
+			got ref -r $testroot/repo -d refs/new/clash > /dev/null
+			got ref -r $testroot/repo -d refs/$ns/clash > /dev/null
+			ret=$?
+			if [ $ret -ne 0 ]; then
+				echo "got ref command failed unexpectedly" >&2
+				test_done "$testroot" "$ret"
+				return 1
+			fi
+		done
+	done
+
+	test_done "$testroot" "0"
+}
+
 test_parseargs "$@"
 run_test test_ref_create
 run_test test_ref_delete
 run_test test_ref_list
+run_test test_ref_list_packed
+run_test test_ref_packed_clash
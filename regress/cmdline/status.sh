@@ -1058,6 +1058,126 @@ test_status_empty_file() {
 	test_done "$testroot" "$ret"
 }
 
+test_status_cached_content() {
+	local testroot=`test_init status_cached_content`
+
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo "modified alpha" > $testroot/wt/alpha
+	touch $testroot/wt/beta
+
+	# content status is not cached for files which were changed recently
+	sleep 3
+
+	echo 'M  alpha' > $testroot/stdout.expected
+	(cd $testroot/wt && got status > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# status should have recorded the results in the file index
+	if [ ! -s $testroot/wt/.got/file-index-delta ]; then
+		echo "file index was not refreshed by status" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# the cached status must be reported until the file changes
+	(cd $testroot/wt && got status > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# restore the original content; stat info changes, so it is compared again
+	echo "alpha" > $testroot/wt/alpha
+	echo -n > $testroot/stdout.expected
+	(cd $testroot/wt && got status > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo "modified alpha" > $testroot/wt/alpha
+	(cd $testroot/wt && got revert alpha > /dev/null)
+	(cd $testroot/wt && got status > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+	fi
+	test_done "$testroot" "$ret"
+}
+
+test_status_preload() {
+	local testroot=`test_init status_preload`
+	local i
+
+	# enough files to have status run on a pool of threads
+	mkdir $testroot/repo/many
+	for i in `seq 300`; do
+		echo "file $i" > $testroot/repo/many/f$i
+	done
+	chmod +x $testroot/repo/many/f7
+	(cd $testroot/repo && git add many)
+	git_commit $testroot/repo -m "add many files"
+
+	got checkout $testroot/repo $testroot/wt > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo "file 10" > $testroot/wt/many/f10
+	echo "file xx" > $testroot/wt/many/f20
+	printf '<<<<<<< a\n=======\n>>>>>>> b\n' > $testroot/wt/many/f30
+	chmod -x $testroot/wt/many/f7
+	touch $testroot/wt/many/f40
+	rm $testroot/wt/many/f50
+
+	echo 'M  many/f20' > $testroot/stdout.expected
+	echo 'C  many/f30' >> $testroot/stdout.expected
+	echo '!  many/f50' >> $testroot/stdout.expected
+	echo 'm  many/f7' >> $testroot/stdout.expected
+
+	(cd $testroot/wt && got status > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# files updated by got must not be reported with stale results
+	(cd $testroot/wt && got revert many/f20 many/f30 many/f50 \
+		> /dev/null)
+	echo 'm  many/f7' > $testroot/stdout.expected
+	(cd $testroot/wt && got status > $testroot/stdout)
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+	fi
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_status_basic
 run_test test_status_subdir_no_mods
@@ -1077,3 +1197,5 @@ run_test test_status_gitignore_trailing_slashes
 run_test test_status_status_code
 run_test test_status_suppress
 run_test test_status_empty_file
+run_test test_status_cached_content
+run_test test_status_preload
@@ -3074,6 +3074,108 @@ test_update_umask() {
 	test_done "$testroot" 0
 }
 
+test_update_sparse() {
+	local testroot=`test_init update_sparse`
+	local commit_id=`git_show_head $testroot/repo`
+
+	got checkout -S gamma $testroot/repo $testroot/wt > /dev/null
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	echo "modified delta" > $testroot/wt/gamma/delta
+
+	echo "A  epsilon/zeta" > $testroot/stdout.expected
+	echo "d  gamma/delta" >> $testroot/stdout.expected
+	echo "Updated to refs/heads/master: $commit_id" \
+		>> $testroot/stdout.expected
+	echo -n "Files outside the sparse checkout set not removed " \
+		>> $testroot/stdout.expected
+	echo "due to local changes: 1" >> $testroot/stdout.expected
+
+	(cd $testroot/wt && got update -S epsilon > $testroot/stdout)
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	# the locally modified file was kept
+	echo "modified delta" > $testroot/content.expected
+	cat $testroot/wt/gamma/delta > $testroot/content
+	cmp -s $testroot/content.expected $testroot/content
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/content.expected $testroot/content
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	(cd $testroot/wt && got revert gamma/delta > /dev/null)
+
+	echo "D  gamma/delta" > $testroot/stdout.expected
+	echo "Updated to refs/heads/master: $commit_id" \
+		>> $testroot/stdout.expected
+
+	(cd $testroot/wt && got update -S epsilon > $testroot/stdout)
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	if [ -e $testroot/wt/gamma ]; then
+		echo "gamma exists in sparse work tree" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+
+	# switch back to a full work tree
+	echo "A  gamma/delta" > $testroot/stdout.expected
+	echo "Updated to refs/heads/master: $commit_id" \
+		>> $testroot/stdout.expected
+
+	(cd $testroot/wt && got update -S / > $testroot/stdout)
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	cmp -s $testroot/stdout.expected $testroot/stdout
+	ret=$?
+	if [ $ret -ne 0 ]; then
+		diff -u $testroot/stdout.expected $testroot/stdout
+		test_done "$testroot" "$ret"
+		return 1
+	fi
+
+	if [ -e $testroot/wt/.got/sparse-paths ]; then
+		echo "sparse-paths file still exists" >&2
+		test_done "$testroot" "1"
+		return 1
+	fi
+	test_done "$testroot" "$ret"
+}
+
 test_parseargs "$@"
 run_test test_update_basic
 run_test test_update_adds_file
@@ -3119,3 +3221,4 @@ run_test test_update_file_skipped_due_to_obstruction
 run_test test_update_quiet
 run_test test_update_binary_file
 run_test test_update_umask
+run_test test_update_sparse
@@ -0,0 +1,693 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/queue.h>
+#include <sys/time.h>
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <sha1.h>
+#include <zlib.h>
+#include <time.h>
+
+#include "got_error.h"
+#include "got_object.h"
+#include "got_cancel.h"
+#include "got_commit_graph.h"
+
+#include "got_lib_sha1.h"
+#include "got_lib_inflate.h"
+#include "got_lib_delta.h"
+#include "got_lib_object.h"
+#include "got_lib_object_parse.h"
+
+static int verbose;
+static int quiet;
+
+/*
+ * The commit graph code only needs commit objects to find common
+ * ancestors. Serve them from an in-memory history instead of a
+ * repository so that tests can build arbitrary merge histories.
+ */
+struct mock_commit {
+	int parents[2];
+	int nparents;
+};
+
+static struct mock_commit *mock_commits;
+static int mock_ncommits;
+static size_t mock_nopened;
+
+static void
+test_printf(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!verbose)
+		return;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+}
+
+static void
+mock_reset(void)
+{
+	free(mock_commits);
+	mock_commits = NULL;
+	mock_ncommits = 0;
+	mock_nopened = 0;
+}
+
+static void
+mock_id(struct got_object_id *id, int idx)
+{
+	memset(id, 0, sizeof(*id));
+	id->sha1[0] = 0xc0;
+	id->sha1[1] = (idx >> 24) & 0xff;
+	id->sha1[2] = (idx >> 16) & 0xff;
+	id->sha1[3] = (idx >> 8) & 0xff;
+	id->sha1[4] = idx & 0xff;
+}
+
+static int
+mock_idx(struct got_object_id *id)
+{
+	if (id->sha1[0] != 0xc0)
+		return -1;
+	return (id->sha1[1] << 24) | (id->sha1[2] << 16) |
+	    (id->sha1[3] << 8) | id->sha1[4];
+}
+
+/*
+ * Add a commit with up to two parents, given by their indices, and
+ * return its index. Commit timestamps grow with the index.
+ */
+static int
+mock_add(int parent, int parent2)
+{
+	struct mock_commit *c;
+
+	c = reallocarray(mock_commits, mock_ncommits + 1, sizeof(*c));
+	if (c == NULL)
+		err(1, "reallocarray");
+	mock_commits = c;
+	c = &mock_commits[mock_ncommits];
+	memset(c, 0, sizeof(*c));
+	if (parent != -1)
+		c->parents[c->nparents++] = parent;
+	if (parent2 != -1)
+		c->parents[c->nparents++] = parent2;
+	return mock_ncommits++;
+}
+
+const struct got_error *
+got_object_open_as_commit(struct got_commit_object **commit,
+    struct got_repository *repo, struct got_object_id *id)
+{
+	const struct got_error *err;
+	struct mock_commit *c;
+	struct got_object_qid *qid;
+	int idx, i;
+
+	*commit = NULL;
+
+	idx = mock_idx(id);
+	if (idx < 0 || idx >= mock_ncommits)
+		return got_error_no_obj(id);
+	c = &mock_commits[idx];
+
+	*commit = calloc(1, sizeof(**commit));
+	if (*commit == NULL)
+		return got_error_from_errno("calloc");
+	STAILQ_INIT(&(*commit)->parent_ids);
+	(*commit)->committer_time = 1000000000 + idx;
+	(*commit)->refcnt = 1;
+
+	for (i = 0; i < c->nparents; i++) {
+		err = got_object_qid_alloc_partial(&qid);
+		if (err) {
+			got_object_commit_close(*commit);
+			*commit = NULL;
+			return err;
+		}
+		mock_id(&qid->id, c->parents[i]);
+		STAILQ_INSERT_TAIL(&(*commit)->parent_ids, qid, entry);
+		(*commit)->nparents++;
+	}
+
+	mock_nopened++;
+	return NULL;
+}
+
+/* Path-filtered iteration is not used by these tests. */
+const struct got_error *
+got_object_id_by_path(struct got_object_id **id, struct got_repository *repo,
+    struct got_commit_object *commit, const char *path)
+{
+	return got_error(GOT_ERR_NOT_IMPL);
+}
+
+const struct got_error *
+got_object_open_as_tree(struct got_tree_object **tree,
+    struct got_repository *repo, struct got_object_id *id)
+{
+	return got_error(GOT_ERR_NOT_IMPL);
+}
+
+const struct got_error *
+got_object_tree_path_changed(int *changed,
+    struct got_tree_object *tree01, struct got_tree_object *tree02,
+    const char *path, struct got_repository *repo)
+{
+	return got_error(GOT_ERR_NOT_IMPL);
+}
+
+const struct got_error *
+got_traverse_packed_commits(struct got_object_id_queue *traversed_commits,
+    struct got_object_id *commit_id, const char *path,
+    struct got_repository *repo)
+{
+	return NULL;
+}
+
+static int
+check_yca(int idx, int idx2, int first_parent_traversal, int expected)
+{
+	const struct got_error *err;
+	struct got_object_id id, id2, *yca_id = NULL;
+	int ret;
+
+	mock_id(&id, idx);
+	mock_id(&id2, idx2);
+	err = got_commit_graph_find_youngest_common_ancestor(&yca_id,
+	    &id, &id2, first_parent_traversal, NULL, NULL, NULL);
+	if (err) {
+		if (expected == -1 && err->code == GOT_ERR_ANCESTRY)
+			return 1;
+		test_printf("yca(%d, %d): %s\n", idx, idx2, err->msg);
+		return 0;
+	}
+
+	ret = (mock_idx(yca_id) == expected);
+	test_printf("yca(%d, %d) = %d, expected %d\n", idx, idx2,
+	    mock_idx(yca_id), expected);
+	free(yca_id);
+	return ret;
+}
+
+static int
+check_ahead_behind(int idx, int idx2, int first_parent_traversal,
+    int expected_ahead, int expected_behind)
+{
+	const struct got_error *err;
+	struct got_object_id id, id2;
+	int ahead, behind;
+
+	mock_id(&id, idx);
+	mock_id(&id2, idx2);
+	err = got_commit_graph_count_ahead_behind(&ahead, &behind,
+	    &id, &id2, first_parent_traversal, NULL, NULL, NULL);
+	if (err) {
+		test_printf("ahead/behind(%d, %d): %s\n", idx, idx2,
+		    err->msg);
+		return 0;
+	}
+
+	test_printf("ahead/behind(%d, %d) = %d/%d, expected %d/%d\n",
+	    idx, idx2, ahead, behind, expected_ahead, expected_behind);
+	return (ahead == expected_ahead && behind == expected_behind);
+}
+
+static int
+commit_graph_linear(void)
+{
+	int c0, c1, c2, c3, ok = 1;
+
+	mock_reset();
+	c0 = mock_add(-1, -1);
+	c1 = mock_add(c0, -1);
+	c2 = mock_add(c1, -1);
+	c3 = mock_add(c2, -1);
+
+	ok &= check_yca(c3, c1, 0, c1);
+	ok &= check_yca(c1, c3, 0, c1);
+	ok &= check_yca(c2, c2, 0, c2);
+	ok &= check_ahead_behind(c3, c1, 0, 2, 0);
+	ok &= check_ahead_behind(c1, c3, 0, 0, 2);
+	ok &= check_ahead_behind(c2, c2, 0, 0, 0);
+	return ok;
+}
+
+/*
+ * A topic branch which forks off main, merges main once, and continues:
+ *
+ *   m0 - m1 - m2 - m3 - m4          main
+ *         \         \
+ *          t1 ------ t2 - t3        topic
+ */
+static int
+commit_graph_merged_topic(void)
+{
+	int m0, m1, m2, m3, m4, t1, t2, t3, ok = 1;
+
+	mock_reset();
+	m0 = mock_add(-1, -1);
+	m1 = mock_add(m0, -1);
+	t1 = mock_add(m1, -1);
+	m2 = mock_add(m1, -1);
+	m3 = mock_add(m2, -1);
+	t2 = mock_add(t1, m3);
+	t3 = mock_add(t2, -1);
+	m4 = mock_add(m3, -1);
+
+	ok &= check_yca(t3, m4, 0, m3);
+	ok &= check_yca(m4, t3, 0, m3);
+	ok &= check_ahead_behind(t3, m4, 0, 3, 1);
+	ok &= check_ahead_behind(m4, t3, 0, 1, 3);
+
+	/* Following only first parents, the merge of main is not seen. */
+	ok &= check_yca(t3, m4, 1, m1);
+	ok &= check_ahead_behind(t3, m4, 1, 3, 3);
+	return ok;
+}
+
+/*
+ * A topic branch which was merged back into main, with work continuing
+ * on both sides afterwards:
+ *
+ *   m0 - m1 - m2 ----- m3 - m4      main
+ *         \          /
+ *          t1 - t2 ------ t3        topic
+ */
+static int
+commit_graph_merged_back(void)
+{
+	int m0, m1, m2, m3, m4, t1, t2, t3, ok = 1;
+
+	mock_reset();
+	m0 = mock_add(-1, -1);
+	m1 = mock_add(m0, -1);
+	t1 = mock_add(m1, -1);
+	m2 = mock_add(m1, -1);
+	t2 = mock_add(t1, -1);
+	m3 = mock_add(m2, t2);
+	t3 = mock_add(t2, -1);
+	m4 = mock_add(m3, -1);
+
+	ok &= check_yca(m4, t3, 0, t2);
+	ok &= check_ahead_behind(m4, t3, 0, 3, 1);
+	ok &= check_ahead_behind(t3, m4, 0, 1, 3);
+	return ok;
+}
+
+/*
+ * Criss-cross merges leave two equally good common ancestors; the
+ * youngest of them must be chosen.
+ *
+ *   b - x1 - c1
+ *    \     X
+ *     y1 - c2
+ */
+static int
+commit_graph_criss_cross(void)
+{
+	int b, x1, y1, c1, c2, ok = 1;
+
+	mock_reset();
+	b = mock_add(-1, -1);
+	x1 = mock_add(b, -1);
+	y1 = mock_add(b, -1);
+	c1 = mock_add(x1, y1);
+	c2 = mock_add(y1, x1);
+
+	ok &= check_yca(c1, c2, 0, y1);
+	ok &= check_yca(c2, c1, 0, y1);
+	ok &= check_ahead_behind(c1, c2, 0, 1, 1);
+	return ok;
+}
+
+static int
+commit_graph_unrelated(void)
+{
+	int a0, a1, b0, b1, b2, ok = 1;
+
+	mock_reset();
+	a0 = mock_add(-1, -1);
+	b0 = mock_add(-1, -1);
+	a1 = mock_add(a0, -1);
+	b1 = mock_add(b0, -1);
+	b2 = mock_add(b1, -1);
+
+	ok &= check_yca(a1, b2, 0, -1);
+	ok &= check_ahead_behind(a1, b2, 0, 2, 3);
+	return ok;
+}
+
+/*
+ * Iterate history starting at the given commit and store the commits
+ * returned, and whether iteration was said to be linear after each.
+ */
+static const struct got_error *
+iterate(int *seq, int *linear, int *n, int tip)
+{
+	const struct got_error *err;
+	struct got_commit_graph *graph;
+	struct got_object_id id;
+
+	*n = 0;
+
+	err = got_commit_graph_open(&graph, "/", 0);
+	if (err)
+		return err;
+
+	mock_id(&id, tip);
+	err = got_commit_graph_iter_start(graph, &id, NULL, NULL, NULL);
+	if (err)
+		goto done;
+
+	for (;;) {
+		err = got_commit_graph_iter_next(&id, graph, NULL,
+		    NULL, NULL);
+		if (err) {
+			if (err->code == GOT_ERR_ITER_COMPLETED)
+				err = NULL;
+			break;
+		}
+		if (*n >= mock_ncommits) {
+			err = got_error(GOT_ERR_RANGE);
+			break;
+		}
+		seq[*n] = mock_idx(&id);
+		if (linear)
+			linear[*n] = got_commit_graph_iter_is_linear(graph);
+		(*n)++;
+	}
+done:
+	got_commit_graph_close(graph);
+	return err;
+}
+
+/*
+ * Whenever iteration claims to be linear, the remaining commits must be
+ * the same a new iteration would return. Return the number of commits
+ * after which iteration was linear, or -1 on failure.
+ */
+static int
+check_iter_linear(int tip, int *linear)
+{
+	const struct got_error *error;
+	int *seq, *seq2, n, n2, i, nlinear = 0;
+
+	seq = calloc(mock_ncommits, sizeof(*seq));
+	seq2 = calloc(mock_ncommits, sizeof(*seq2));
+	if (seq == NULL || seq2 == NULL)
+		err(1, "calloc");
+
+	error = iterate(seq, linear, &n, tip);
+	if (error) {
+		test_printf("iterate(%d): %s\n", tip, error->msg);
+		nlinear = -1;
+		goto done;
+	}
+
+	for (i = 0; i < n; i++) {
+		test_printf("%d%s ", seq[i], linear[i] ? "" : "*");
+		if (!linear[i])
+			continue;
+		nlinear++;
+		error = iterate(seq2, NULL, &n2, seq[i]);
+		if (error) {
+			test_printf("iterate(%d): %s\n", seq[i], error->msg);
+			nlinear = -1;
+			goto done;
+		}
+		if (n2 != n - i ||
+		    memcmp(seq2, &seq[i], n2 * sizeof(*seq2)) != 0) {
+			test_printf("\niteration after %d is not linear\n",
+			    seq[i]);
+			nlinear = -1;
+			goto done;
+		}
+	}
+	test_printf("\n");
+done:
+	free(seq);
+	free(seq2);
+	return nlinear;
+}
+
+/*
+ * Iteration is linear except while commits from the branches of a merge
+ * remain to be returned:
+ *
+ *   m0 - m1 - m2 ------ m3 - m4     main
+ *         \           /
+ *          t1 - t2 - t3
+ */
+static int
+commit_graph_iter_linear(void)
+{
+	int m0, m1, m2, m3, m4, t1, t2, t3;
+	int linear[8];
+
+	mock_reset();
+	m0 = mock_add(-1, -1);
+	m1 = mock_add(m0, -1);
+	t1 = mock_add(m1, -1);
+	m2 = mock_add(m1, -1);
+	t2 = mock_add(t1, -1);
+	t3 = mock_add(t2, -1);
+	m3 = mock_add(m2, t3);
+	m4 = mock_add(m3, -1);
+
+	if (check_iter_linear(m4, linear) != 3)
+		return 0;
+
+	/* m4, m3, t3, m2, t2, m1, t1, m0 */
+	return (linear[0] && linear[1] && linear[7]);
+}
+
+/*
+ * A merged history without a common ancestor never joins again:
+ *
+ *   m0 - m1 ------ m2 - m3          main
+ *                /
+ *        r0 - r1
+ */
+static int
+commit_graph_iter_linear_unrelated(void)
+{
+	int m0, m1, m2, m3, r0, r1;
+	int linear[6];
+
+	mock_reset();
+	m0 = mock_add(-1, -1);
+	r0 = mock_add(-1, -1);
+	m1 = mock_add(m0, -1);
+	r1 = mock_add(r0, -1);
+	m2 = mock_add(m1, r1);
+	m3 = mock_add(m2, -1);
+
+	/* m3, m2, r1, m1, r0, m0 */
+	return (check_iter_linear(m3, linear) == 3 &&
+	    linear[0] && linear[1] && linear[5]);
+}
+
+/* Short-lived branches are merged every few commits. */
+static int
+commit_graph_iter_linear_merges(void)
+{
+	int linear[256];
+	int main_tip, side, i, j;
+
+	mock_reset();
+	main_tip = mock_add(-1, -1);
+	for (i = 0; i < 20; i++) {
+		side = main_tip;
+		for (j = 0; j <= i % 4; j++)
+			side = mock_add(side, -1);
+		for (j = 0; j < 5; j++)
+			main_tip = mock_add(main_tip, -1);
+		main_tip = mock_add(main_tip, side);
+	}
+
+	return (check_iter_linear(main_tip, linear) > 0);
+}
+
+/*
+ * Random histories with merges of branches of various lengths, and
+ * occasionally a new root commit.
+ */
+static int
+commit_graph_iter_linear_random(void)
+{
+	int linear[64];
+	unsigned int seed = 1;
+	int round, tip, i, p, p2;
+
+	for (round = 0; round < 500; round++) {
+		mock_reset();
+		mock_add(-1, -1);
+		for (i = 1; i < 63; i++) {
+			seed = seed * 1103515245 + 12345;
+			p = i - 1 - (seed >> 16) % (i < 4 ? i : 4);
+			seed = seed * 1103515245 + 12345;
+			p2 = -1;
+			if ((seed >> 16) % 3 == 0)
+				p2 = (seed >> 20) % i;
+			if (p2 == p)
+				p2 = -1;
+			if ((seed >> 16) % 29 == 0)
+				p = -1;
+			mock_add(p, p2);
+		}
+		tip = mock_add(mock_ncommits - 1, mock_ncommits - 2);
+		if (check_iter_linear(tip, linear) < 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Build a history in which many topic branches fork off the root commit
+ * and are developed one after another, so that commits on different
+ * branches do not interleave in time. All of them are then merged into
+ * main, which leaves as many commits queued at once as there are topic
+ * branches while the history is painted. Report how long it takes to
+ * count commits ahead and behind main's tip and another branch.
+ */
+#define BENCH_NBRANCHES	512
+
+static void
+commit_graph_bench(int ncommits)
+{
+	const struct got_error *error;
+	struct got_object_id id, id2;
+	struct timespec start, end, diff;
+	double secs;
+	int tips[BENCH_NBRANCHES];
+	int root, main_tip, branch_tip, ahead, behind, len, i, j;
+
+	mock_reset();
+	root = mock_add(-1, -1);
+	len = ncommits / BENCH_NBRANCHES + 1;
+	for (i = 0; i < BENCH_NBRANCHES; i++) {
+		tips[i] = root;
+		for (j = 0; j < len; j++)
+			tips[i] = mock_add(tips[i], -1);
+	}
+	main_tip = root;
+	for (i = 0; i < BENCH_NBRANCHES; i++)
+		main_tip = mock_add(main_tip, tips[i]);
+	branch_tip = mock_add(root, -1);
+
+	mock_id(&id, main_tip);
+	mock_id(&id2, branch_tip);
+	mock_nopened = 0;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+		err(1, "clock_gettime");
+	error = got_commit_graph_count_ahead_behind(&ahead, &behind,
+	    &id, &id2, 0, NULL, NULL, NULL);
+	if (error)
+		errx(1, "%s", error->msg);
+	if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+		err(1, "clock_gettime");
+	timespecsub(&end, &start, &diff);
+	secs = diff.tv_sec + diff.tv_nsec / 1e9;
+
+	printf("%d commits: %d ahead, %d behind, %zu commits opened, "
+	    "%.3f ms\n", mock_ncommits, ahead, behind, mock_nopened,
+	    secs * 1e3);
+	mock_reset();
+}
+
+#define RUN_TEST(expr, name) \
+	{ test_ok = (expr);  \
+	if (!quiet) printf("test_%s %s\n", (name), test_ok ? "ok" : "failed"); \
+	failure = (failure || !test_ok); }
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: commit_graph_test [-q] [-v] [-b ncommits]\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	int test_ok = 0, failure = 0;
+	int ch, bench = 0;
+	const char *errstr;
+
+#ifndef PROFILE
+	if (pledge("stdio", NULL) == -1)
+		err(1, "pledge");
+#endif
+
+	while ((ch = getopt(argc, argv, "b:qv")) != -1) {
+		switch (ch) {
+		case 'b':
+			bench = strtonum(optarg, 1, INT_MAX / 2, &errstr);
+			if (errstr != NULL)
+				errx(1, "number of commits is %s: %s",
+				    errstr, optarg);
+			break;
+		case 'q':
+			quiet = 1;
+			verbose = 0;
+			break;
+		case 'v':
+			verbose = 1;
+			quiet = 0;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (bench) {
+		commit_graph_bench(bench);
+		return 0;
+	}
+
+	RUN_TEST(commit_graph_linear(), "commit_graph_linear");
+	RUN_TEST(commit_graph_merged_topic(), "commit_graph_merged_topic");
+	RUN_TEST(commit_graph_merged_back(), "commit_graph_merged_back");
+	RUN_TEST(commit_graph_criss_cross(), "commit_graph_criss_cross");
+	RUN_TEST(commit_graph_unrelated(), "commit_graph_unrelated");
+	RUN_TEST(commit_graph_iter_linear(), "commit_graph_iter_linear");
+	RUN_TEST(commit_graph_iter_linear_unrelated(),
+	    "commit_graph_iter_linear_unrelated");
+	RUN_TEST(commit_graph_iter_linear_merges(),
+	    "commit_graph_iter_linear_merges");
+	RUN_TEST(commit_graph_iter_linear_random(),
+	    "commit_graph_iter_linear_random");
+
+	mock_reset();
+	return failure ? 1 : 0;
+}
@@ -0,0 +1,708 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <ctype.h>
+#include <err.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arraylist.h"
+#include "diff_main.h"
+
+#include "diff_internal.h"
+
+#ifndef nitems
+#define nitems(_a) (sizeof(_a) / sizeof((_a)[0]))
+#endif
+
+static const struct diff_algo_config myers_then_patience;
+static const struct diff_algo_config myers_then_myers_divide;
+static const struct diff_algo_config patience;
+static const struct diff_algo_config myers_divide;
+static const struct diff_algo_config histogram;
+
+static const struct diff_algo_config myers_then_patience = {
+	.impl = diff_algo_myers,
+	.permitted_state_size = 1024 * 1024 * sizeof(int),
+	.fallback_algo = &patience,
+};
+
+static const struct diff_algo_config myers_then_myers_divide = {
+	.impl = diff_algo_myers,
+	.permitted_state_size = 1024 * 1024 * sizeof(int),
+	.fallback_algo = &myers_divide,
+};
+
+static const struct diff_algo_config patience = {
+	.impl = diff_algo_patience,
+	.inner_algo = &patience,
+	.fallback_algo = &myers_then_myers_divide,
+};
+
+static const struct diff_algo_config myers_divide = {
+	.impl = diff_algo_myers_divide,
+	.inner_algo = &myers_then_myers_divide,
+};
+
+static const struct diff_algo_config histogram = {
+	.impl = diff_algo_histogram,
+	.inner_algo = &myers_then_myers_divide,
+	.fallback_algo = &myers_then_myers_divide,
+};
+
+static const struct diff_config configs[] = {
+	{
+		.atomize_func = diff_atomize_text_by_line,
+		.algo = &myers_then_myers_divide,
+	},
+	{
+		.atomize_func = diff_atomize_text_by_line,
+		.algo = &myers_then_patience,
+	},
+	{
+		.atomize_func = diff_atomize_text_by_line,
+		.algo = &patience,
+	},
+};
+
+static const char *config_names[] = {
+	"myers",
+	"myers_then_patience",
+	"patience",
+};
+
+/* Histogram diff falls back to Myers if atoms have not been interned. */
+static const struct diff_config histogram_config = {
+	.atomize_func = diff_atomize_text_by_line,
+	.algo = &histogram,
+};
+
+static int quiet;
+
+static int
+atomize(struct diff_data *d, const struct diff_config *cfg, FILE *f,
+    const char *buf, size_t len, int diff_flags)
+{
+	return diff_atomize_file(d, cfg, f, (const uint8_t *)buf, len,
+	    diff_flags);
+}
+
+static int
+intern_basic(void)
+{
+	const char *left = "a\nb\na\n";
+	const char *right = "b\nc\na\n";
+	struct diff_data l, r;
+	int ok = 0;
+
+	if (atomize(&l, &configs[0], NULL, left, strlen(left), 0) ||
+	    atomize(&r, &configs[0], NULL, right, strlen(right), 0))
+		return 0;
+
+	if (diff_atoms_intern(&l, &r) != 0)
+		goto done;
+	if (l.nclasses != 3 || r.nclasses != 3)
+		goto done;
+	if (l.atoms.head[0].class_id == 0 ||
+	    l.atoms.head[0].class_id != l.atoms.head[2].class_id ||
+	    l.atoms.head[0].class_id != r.atoms.head[2].class_id ||
+	    l.atoms.head[1].class_id != r.atoms.head[0].class_id ||
+	    l.atoms.head[0].class_id == l.atoms.head[1].class_id ||
+	    r.atoms.head[1].class_id == l.atoms.head[0].class_id ||
+	    r.atoms.head[1].class_id == l.atoms.head[1].class_id)
+		goto done;
+
+	/* Interning must be repeatable with different diff partners. */
+	if (diff_atoms_intern(&r, &r) != 0 || r.nclasses != 3)
+		goto done;
+	ok = 1;
+done:
+	diff_data_free(&l);
+	diff_data_free(&r);
+	return ok;
+}
+
+static int
+intern_ignore_whitespace(void)
+{
+	const char *left = "a b\n\nc\n";
+	const char *right = "ab\n \t\nc \n";
+	struct diff_data l, r;
+	int i, ok = 0;
+
+	if (atomize(&l, &configs[0], NULL, left, strlen(left),
+	    DIFF_FLAG_IGNORE_WHITESPACE) ||
+	    atomize(&r, &configs[0], NULL, right, strlen(right),
+	    DIFF_FLAG_IGNORE_WHITESPACE))
+		return 0;
+
+	if (diff_atoms_intern(&l, &r) != 0)
+		goto done;
+	for (i = 0; i < 3; i++) {
+		if (l.atoms.head[i].class_id != r.atoms.head[i].class_id)
+			goto done;
+	}
+	ok = (l.nclasses == 3);
+done:
+	diff_data_free(&l);
+	diff_data_free(&r);
+	return ok;
+}
+
+/* Generate lines of text which contain many duplicates, like source code. */
+static char *
+gen_text(size_t *len, unsigned int seed, int nlines, int nedits)
+{
+	static const char *lines[] = {
+		"{\n", "}\n", "\n", "\treturn 0;\n", "\tint i;\n",
+		"\t\tbreak;\n", "\tif (err)\n", "\t\tgoto done;\n",
+		"done:\n", "\tfree(p);\n",
+	};
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *f;
+	int i;
+
+	f = open_memstream(&buf, &size);
+	if (f == NULL)
+		err(1, "open_memstream");
+
+	srandom(seed);
+	for (i = 0; i < nlines; i++) {
+		long r = random();
+
+		if (r % 4 == 0)
+			fprintf(f, "\tfoo(%d);\n", i);
+		else
+			fputs(lines[r % nitems(lines)], f);
+		if (nedits > 0 && random() % nlines < nedits)
+			fprintf(f, "\tedit(%ld);\n", random() % 1000);
+	}
+
+	if (fclose(f) == EOF)
+		err(1, "fclose");
+	*len = size;
+	return buf;
+}
+
+/* Generate lines of random length with all kinds of line endings. */
+static char *
+gen_lines(size_t *len, unsigned int seed, int nlines)
+{
+	static const char *eols[] = { "\n", "\r\n", "\r", "\n\r", "" };
+	static const char chars[] = "ab \t\0x";
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *f;
+	int i, j;
+
+	f = open_memstream(&buf, &size);
+	if (f == NULL)
+		err(1, "open_memstream");
+
+	srandom(seed);
+	for (i = 0; i < nlines; i++) {
+		long r = random();
+		int linelen = (r % 16 == 0) ? random() % 100000 : r % 80;
+
+		for (j = 0; j < linelen; j++)
+			fputc(chars[random() % (sizeof(chars) - 1)], f);
+		fputs(eols[random() % nitems(eols)], f);
+	}
+
+	if (fclose(f) == EOF)
+		err(1, "fclose");
+	*len = size;
+	return buf;
+}
+
+/*
+ * Atomizing from a file must yield the same atoms as atomizing memory-mapped
+ * data, with hashes identical to a byte-by-byte calculation.
+ */
+static int
+atomize_same_atoms(const char *text, size_t len)
+{
+	int ignore_whitespace, ok = 1;
+	FILE *f;
+
+	f = fmemopen((void *)text, len, "r");
+	if (f == NULL)
+		err(1, "fmemopen");
+
+	for (ignore_whitespace = 0; ok && ignore_whitespace <= 1;
+	    ignore_whitespace++) {
+		int flags = ignore_whitespace ? DIFF_FLAG_IGNORE_WHITESPACE : 0;
+		struct diff_data d1, d2;
+		int i;
+
+		memset(&d1, 0, sizeof(d1));
+		memset(&d2, 0, sizeof(d2));
+		ok = (atomize(&d1, &configs[0], NULL, text, len, flags) == 0 &&
+		    atomize(&d2, &configs[0], f, NULL, len, flags) == 0 &&
+		    d1.atoms.len == d2.atoms.len &&
+		    d1.atomizer_flags == d2.atomizer_flags);
+		for (i = 0; ok && i < d1.atoms.len; i++) {
+			struct diff_atom *a1 = &d1.atoms.head[i];
+			struct diff_atom *a2 = &d2.atoms.head[i];
+			unsigned int hash = 0;
+			off_t j;
+
+			for (j = 0; j < a1->len; j++) {
+				unsigned char c = a1->at[j];
+
+				if (c == '\r' || c == '\n')
+					break;
+				if (!ignore_whitespace || !isspace(c))
+					hash = diff_atom_hash_update(hash, c);
+			}
+			ok = (a1->pos == a2->pos && a1->len == a2->len &&
+			    a1->hash == hash && a2->hash == hash);
+		}
+		diff_data_free(&d1);
+		diff_data_free(&d2);
+	}
+
+	fclose(f);
+	return ok;
+}
+
+static int
+atomize_fd_mmap(void)
+{
+	char *text;
+	size_t len, i;
+	unsigned int seed;
+	int ok = 1;
+
+	for (seed = 1; ok && seed <= 10; seed++) {
+		text = gen_lines(&len, seed, 200);
+		ok = atomize_same_atoms(text, len);
+		if (!ok && !quiet)
+			printf("atomize: atoms differ for seed %u\n", seed);
+		free(text);
+	}
+
+	/* Line endings which straddle the boundary of the read buffer. */
+	len = 256 * 1024;
+	text = malloc(len);
+	if (text == NULL)
+		err(1, "malloc");
+	for (i = 1; ok && i < 16; i++) {
+		memset(text, 'a', len);
+		memcpy(text + i * 16384 - 1, "\r\n", 2);
+		ok = atomize_same_atoms(text, len);
+		if (!ok && !quiet)
+			printf("atomize: atoms differ for CRLF at %zu\n",
+			    i * 16384 - 1);
+	}
+	free(text);
+
+	return ok;
+}
+
+static int
+chunks_equal(struct diff_result *a, struct diff_result *b)
+{
+	int i;
+
+	if (a->rc != DIFF_RC_OK || b->rc != DIFF_RC_OK)
+		return 0;
+	if (a->chunks.len != b->chunks.len)
+		return 0;
+	for (i = 0; i < a->chunks.len; i++) {
+		struct diff_chunk *ca = &a->chunks.head[i];
+		struct diff_chunk *cb = &b->chunks.head[i];
+
+		if (ca->left_count != cb->left_count ||
+		    ca->right_count != cb->right_count ||
+		    diff_atom_root_idx(a->left, ca->left_start) !=
+		    diff_atom_root_idx(b->left, cb->left_start) ||
+		    diff_atom_root_idx(a->right, ca->right_start) !=
+		    diff_atom_root_idx(b->right, cb->right_start))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int
+diff_pair(struct diff_result **result, const struct diff_config *cfg,
+    const char *left, size_t left_len, const char *right, size_t right_len,
+    FILE *fleft, FILE *fright, int diff_flags, struct diff_data *l,
+    struct diff_data *r)
+{
+	if (atomize(l, cfg, fleft, fleft ? NULL : left, left_len,
+	    diff_flags) ||
+	    atomize(r, cfg, fright, fright ? NULL : right, right_len,
+	    diff_flags))
+		return 0;
+	*result = diff_main(cfg, l, r);
+	return (*result != NULL);
+}
+
+/*
+ * Interned and non-interned comparisons of atoms must yield identical
+ * diffs, for both memory-mapped and file-backed data.
+ */
+static int
+intern_same_result(void)
+{
+	char *left, *right;
+	size_t left_len, right_len;
+	FILE *fleft, *fright;
+	size_t i;
+	int ok = 1;
+
+	left = gen_text(&left_len, 1, 5000, 0);
+	right = gen_text(&right_len, 1, 5000, 200);
+
+	fleft = fmemopen(left, left_len, "r");
+	fright = fmemopen(right, right_len, "r");
+	if (fleft == NULL || fright == NULL)
+		err(1, "fmemopen");
+
+	for (i = 0; ok && i < nitems(configs); i++) {
+		int use_file;
+
+		for (use_file = 0; ok && use_file <= 1; use_file++) {
+			struct diff_data l1, r1, l2, r2;
+			struct diff_result *res1 = NULL, *res2 = NULL;
+
+			memset(&l1, 0, sizeof(l1));
+			memset(&r1, 0, sizeof(r1));
+			memset(&l2, 0, sizeof(l2));
+			memset(&r2, 0, sizeof(r2));
+			ok = diff_pair(&res1, &configs[i], left, left_len,
+			    right, right_len, use_file ? fleft : NULL,
+			    use_file ? fright : NULL, 0, &l1, &r1) &&
+			    diff_pair(&res2, &configs[i], left, left_len,
+			    right, right_len, use_file ? fleft : NULL,
+			    use_file ? fright : NULL, DIFF_FLAG_NO_INTERNING,
+			    &l2, &r2) &&
+			    chunks_equal(res1, res2) &&
+			    l1.nclasses > 0 && l2.nclasses == 0;
+			if (!ok && !quiet)
+				printf("%s%s: results differ\n",
+				    config_names[i], use_file ? " (file)" : "");
+			diff_result_free(res1);
+			diff_result_free(res2);
+			diff_data_free(&l1);
+			diff_data_free(&r1);
+			diff_data_free(&l2);
+			diff_data_free(&r2);
+		}
+	}
+
+	fclose(fleft);
+	fclose(fright);
+	free(left);
+	free(right);
+	return ok;
+}
+
+/*
+ * Chunks must cover both sides without gaps, and chunks on both sides
+ * must contain identical atoms.
+ */
+static int
+result_valid(struct diff_result *res)
+{
+	unsigned int left_pos = 0, right_pos = 0;
+	int i, j;
+
+	if (res->rc != DIFF_RC_OK)
+		return 0;
+	for (i = 0; i < res->chunks.len; i++) {
+		struct diff_chunk *c = &res->chunks.head[i];
+
+		if ((c->left_count && diff_atom_root_idx(res->left,
+		    c->left_start) != left_pos) ||
+		    (c->right_count && diff_atom_root_idx(res->right,
+		    c->right_start) != right_pos))
+			return 0;
+		if (c->left_count && c->right_count) {
+			if (c->left_count != c->right_count)
+				return 0;
+			for (j = 0; j < c->left_count; j++) {
+				if (c->left_start[j].class_id !=
+				    c->right_start[j].class_id)
+					return 0;
+			}
+		}
+		left_pos += c->left_count;
+		right_pos += c->right_count;
+	}
+
+	return (left_pos == res->left->atoms.len &&
+	    right_pos == res->right->atoms.len);
+}
+
+static int
+histogram_basic(void)
+{
+	/* The unique line "x" anchors the diff instead of the braces. */
+	const char *left = "{\n}\nx\n{\n}\n";
+	const char *right = "{\n}\n{\nx\n{\n}\n";
+	const unsigned int expected[][2] = {
+		{ 2, 2 }, { 0, 1 }, { 3, 3 },
+	};
+	struct diff_data l, r;
+	struct diff_result *res = NULL;
+	int i, ok = 0;
+
+	memset(&l, 0, sizeof(l));
+	memset(&r, 0, sizeof(r));
+	if (!diff_pair(&res, &histogram_config, left, strlen(left),
+	    right, strlen(right), NULL, NULL, 0, &l, &r))
+		goto done;
+	if (!result_valid(res) || res->chunks.len != nitems(expected))
+		goto done;
+	for (i = 0; i < res->chunks.len; i++) {
+		if (res->chunks.head[i].left_count != expected[i][0] ||
+		    res->chunks.head[i].right_count != expected[i][1])
+			goto done;
+	}
+	ok = 1;
+done:
+	diff_result_free(res);
+	diff_data_free(&l);
+	diff_data_free(&r);
+	return ok;
+}
+
+static int
+histogram_valid(void)
+{
+	unsigned int seed;
+	int ok = 1;
+
+	for (seed = 1; ok && seed <= 20; seed++) {
+		char *left, *right;
+		size_t left_len, right_len;
+		struct diff_data l, r;
+		struct diff_result *res = NULL;
+
+		left = gen_text(&left_len, seed, 2000, seed * 10);
+		right = gen_text(&right_len, seed, 2000, 100);
+
+		memset(&l, 0, sizeof(l));
+		memset(&r, 0, sizeof(r));
+		ok = diff_pair(&res, &histogram_config, left, left_len,
+		    right, right_len, NULL, NULL, 0, &l, &r) &&
+		    result_valid(res);
+		if (!ok && !quiet)
+			printf("histogram: invalid result for seed %u\n",
+			    seed);
+		diff_result_free(res);
+		diff_data_free(&l);
+		diff_data_free(&r);
+		free(left);
+		free(right);
+	}
+
+	return ok;
+}
+
+static double
+elapsed(struct timespec *start)
+{
+	struct timespec now, diff;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+		err(1, "clock_gettime");
+	timespecsub(&now, start, &diff);
+	return diff.tv_sec + diff.tv_nsec / 1e9;
+}
+
+static void
+bench_one(const struct diff_config *cfg, const char *name,
+    const char *left, size_t left_len, const char *right, size_t right_len,
+    int use_file, int iterations)
+{
+	FILE *fleft = NULL, *fright = NULL;
+	double t[2];
+	int i, interned;
+
+	if (use_file) {
+		fleft = fmemopen((void *)left, left_len, "r");
+		fright = fmemopen((void *)right, right_len, "r");
+		if (fleft == NULL || fright == NULL)
+			err(1, "fmemopen");
+	}
+
+	for (interned = 0; interned <= 1; interned++) {
+		struct timespec start;
+
+		if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+			err(1, "clock_gettime");
+		for (i = 0; i < iterations; i++) {
+			struct diff_data l, r;
+			struct diff_result *res;
+
+			if (!diff_pair(&res, cfg, left, left_len, right,
+			    right_len, fleft, fright,
+			    interned ? 0 : DIFF_FLAG_NO_INTERNING, &l, &r))
+				errx(1, "diff failed");
+			if (res->rc != DIFF_RC_OK)
+				errx(1, "diff failed: %d", res->rc);
+			diff_result_free(res);
+			diff_data_free(&l);
+			diff_data_free(&r);
+		}
+		t[interned] = elapsed(&start) / iterations;
+	}
+
+	printf("%-20s %-5s %10.3f ms %10.3f ms %6.2fx\n", name,
+	    use_file ? "file" : "mmap", t[0] * 1000, t[1] * 1000,
+	    t[1] > 0 ? t[0] / t[1] : 0);
+
+	if (fleft)
+		fclose(fleft);
+	if (fright)
+		fclose(fright);
+}
+
+static char *
+read_file(size_t *len, const char *path)
+{
+	struct stat sb;
+	char *buf;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		err(1, "%s", path);
+	if (fstat(fd, &sb) == -1)
+		err(1, "%s", path);
+	buf = malloc(sb.st_size + 1);
+	if (buf == NULL)
+		err(1, "malloc");
+	if (read(fd, buf, sb.st_size) != sb.st_size)
+		err(1, "%s", path);
+	close(fd);
+	*len = sb.st_size;
+	return buf;
+}
+
+static void
+bench(int argc, char *argv[], int iterations)
+{
+	char *left, *right;
+	size_t left_len, right_len, i;
+	int use_file;
+
+	if (argc == 2) {
+		left = read_file(&left_len, argv[0]);
+		right = read_file(&right_len, argv[1]);
+	} else {
+		left = gen_text(&left_len, 1, 200000, 0);
+		right = gen_text(&right_len, 1, 200000, 2000);
+	}
+
+	printf("%-20s %-5s %13s %13s %7s\n", "algorithm", "data",
+	    "not interned", "interned", "speedup");
+	for (i = 0; i < nitems(configs); i++) {
+		for (use_file = 0; use_file <= 1; use_file++)
+			bench_one(&configs[i], config_names[i], left, left_len,
+			    right, right_len, use_file, iterations);
+	}
+	for (use_file = 0; use_file <= 1; use_file++)
+		bench_one(&histogram_config, "histogram", left, left_len,
+		    right, right_len, use_file, iterations);
+
+	free(left);
+	free(right);
+}
+
+#define RUN_TEST(expr, name) \
+	{ test_ok = (expr);  \
+	if (!quiet) printf("test_%s %s\n", (name), test_ok ? "ok" : "failed"); \
+	failure = (failure || !test_ok); }
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: diff_test [-q] [-b [-n iterations] "
+	    "[left-file right-file]]\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *errstr;
+	int test_ok;
+	int failure = 0;
+	int ch, do_bench = 0, iterations = 3;
+
+	while ((ch = getopt(argc, argv, "bn:q")) != -1) {
+		switch (ch) {
+		case 'b':
+			do_bench = 1;
+			break;
+		case 'n':
+			iterations = strtonum(optarg, 1, 1000, &errstr);
+			if (errstr != NULL)
+				errx(1, "number of iterations is %s: %s",
+				    errstr, optarg);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if ((!do_bench && argc != 0) || (do_bench && argc != 0 && argc != 2)) {
+		usage();
+		return 1;
+	}
+
+#ifndef PROFILE
+	if (pledge("stdio rpath", NULL) == -1)
+		err(1, "pledge");
+#endif
+
+	if (do_bench) {
+		bench(argc, argv, iterations);
+		return 0;
+	}
+
+	RUN_TEST(intern_basic(), "intern_basic");
+	RUN_TEST(intern_ignore_whitespace(), "intern_ignore_whitespace");
+	RUN_TEST(intern_same_result(), "intern_same_result");
+	RUN_TEST(atomize_fd_mmap(), "atomize_fd_mmap");
+	RUN_TEST(histogram_basic(), "histogram_basic");
+	RUN_TEST(histogram_valid(), "histogram_valid");
+
+	return failure ? 1 : 0;
+}
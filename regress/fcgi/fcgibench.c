@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <arpa/inet.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <err.h>
+#include <event.h>
+#include <imsg.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "got_error.h"
+
+#include "proc.h"
+#include "gotwebd.h"
+#include "tmpl.h"
+
+#define REQUEST_ID	42
+#define BLOB_SIZE	(256 * 1024)
+
+int		 cgi_inflight;
+volatile int	 client_cnt;
+
+/* The FastCGI stream written so far, as seen by the web server. */
+static struct {
+	uint8_t		 hdr[sizeof(struct fcgi_record_header)];
+	size_t		 hdrlen;
+	size_t		 content_left;
+	size_t		 padding_left;
+	int		 type;
+	size_t		 nwritev;
+	size_t		 nrecords;
+	size_t		 nstdout;
+	size_t		 nend;
+} stream;
+
+/*
+ * Parse the records instead of writing them anywhere, so that we can
+ * count how the output was handed to the kernel and check its framing.
+ */
+ssize_t
+writev(int fd, const struct iovec *iov, int iovcnt)
+{
+	struct fcgi_record_header *h;
+	const uint8_t *p;
+	size_t len, n, tot = 0;
+	int i;
+
+	stream.nwritev++;
+
+	for (i = 0; i < iovcnt; i++) {
+		p = iov[i].iov_base;
+		len = iov[i].iov_len;
+		tot += len;
+
+		while (len > 0) {
+			if (stream.content_left > 0) {
+				n = MIN(len, stream.content_left);
+				if (stream.type == FCGI_STDOUT)
+					stream.nstdout += n;
+				stream.content_left -= n;
+			} else if (stream.padding_left > 0) {
+				n = MIN(len, stream.padding_left);
+				stream.padding_left -= n;
+			} else {
+				n = MIN(len, sizeof(stream.hdr) -
+				    stream.hdrlen);
+				memcpy(stream.hdr + stream.hdrlen, p, n);
+				stream.hdrlen += n;
+				if (stream.hdrlen == sizeof(stream.hdr)) {
+					h = (struct fcgi_record_header *)
+					    stream.hdr;
+					if (h->version != 1 ||
+					    ntohs(h->id) != REQUEST_ID)
+						errx(1, "bad record header");
+					stream.type = h->type;
+					stream.content_left =
+					    ntohs(h->content_len);
+					stream.padding_left = h->padding_len;
+					stream.hdrlen = 0;
+					stream.nrecords++;
+					if (h->type == FCGI_END_REQUEST)
+						stream.nend++;
+				}
+			}
+			p += n;
+			len -= n;
+		}
+	}
+
+	return tot;
+}
+
+void
+cache_capture(struct request *c, const uint8_t *data, size_t len)
+{
+}
+
+void
+cache_capture_abort(struct request *c)
+{
+}
+
+void
+gotweb_free_transport(struct transport *t)
+{
+}
+
+void
+sockets_queue_request(struct request *c)
+{
+}
+
+void
+template_free(struct template *tp)
+{
+}
+
+/*
+ * Emit a page the way the templates do: many short fragments of markup
+ * and escaped text, and a blob which is sent without being buffered.
+ */
+static size_t
+page(struct request *c, const uint8_t *blob)
+{
+	size_t len = 0;
+	int i, r;
+
+	for (i = 0; i < 2000; i++) {
+		r = fcgi_printf(c, "<div class='commit_id'>%d</div>", i);
+		if (r == -1)
+			errx(1, "fcgi_printf");
+		len += strlen("<div class='commit_id'></div>") +
+		    snprintf(NULL, 0, "%d", i);
+		if (fcgi_puts(c->tp, "<div class='commit_msg'>") == -1 ||
+		    fcgi_puts(c->tp, "fix &lt;tags&gt; &amp; quotes") == -1 ||
+		    fcgi_puts(c->tp, "</div>\n") == -1)
+			errx(1, "fcgi_puts");
+		len += strlen("<div class='commit_msg'>") +
+		    strlen("fix &lt;tags&gt; &amp; quotes") + strlen("</div>\n");
+	}
+
+	if (fcgi_gen_binary_response(c, blob, BLOB_SIZE) == -1)
+		errx(1, "fcgi_gen_binary_response");
+	len += BLOB_SIZE;
+
+	return len;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct request	*c;
+	struct template	 tp;
+	struct timespec	 start, end, diff;
+	uint8_t		*blob;
+	double		 secs;
+	size_t		 len = 0;
+	int		 i, iterations = 1000;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+	if (iterations <= 0)
+		errx(1, "bad number of iterations");
+
+	if ((blob = malloc(BLOB_SIZE)) == NULL)
+		err(1, "malloc");
+	memset(blob, 'x', BLOB_SIZE);
+
+	event_init();
+
+	if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+		err(1, "clock_gettime");
+	for (i = 0; i < iterations; ++i) {
+		if ((c = calloc(1, sizeof(*c))) == NULL)
+			err(1, "calloc");
+		c->id = REQUEST_ID;
+		c->fd = -1;
+		c->client_status = CLIENT_CONNECT;
+		c->stdin_done = 1;
+		evtimer_set(&c->tmo, fcgi_timeout, c);
+		memset(&tp, 0, sizeof(tp));
+		tp.tp_arg = c;
+		c->tp = &tp;
+
+		len += page(c, blob);
+
+		/* Flushes the output and frees the request. */
+		fcgi_request_done(c);
+	}
+	if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+		err(1, "clock_gettime");
+	timespecsub(&end, &start, &diff);
+	secs = diff.tv_sec + diff.tv_nsec / 1e9;
+
+	if (stream.hdrlen != 0 || stream.content_left != 0 ||
+	    stream.padding_left != 0)
+		errx(1, "truncated record");
+	if (stream.nstdout != len)
+		errx(1, "%zu bytes of output sent, expected %zu",
+		    stream.nstdout, len);
+	if (stream.nend != (size_t)iterations)
+		errx(1, "%zu end records sent, expected %d",
+		    stream.nend, iterations);
+
+	printf("%d pages of %zu bytes: %.3f us/page, "
+	    "%zu writev calls and %zu records per page\n", iterations,
+	    len / iterations, secs * 1e6 / iterations,
+	    stream.nwritev / iterations, stream.nrecords / iterations);
+
+	free(blob);
+	return (0);
+}
@@ -0,0 +1,676 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/queue.h>
+#include <sys/tree.h>
+#include <sys/stat.h>
+
+#include <endian.h>
+#include <err.h>
+#include <limits.h>
+#include <sha1.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "got_error.h"
+#include "got_object.h"
+#include "got_opentemp.h"
+#include "got_path.h"
+
+#include "got_lib_fileindex.h"
+
+#ifndef nitems
+#define nitems(_a) (sizeof(_a) / sizeof((_a)[0]))
+#endif
+
+static int verbose;
+static int quiet;
+
+static const char *paths[] = { "alpha", "beta", "epsilon/zeta", "gamma/delta" };
+
+static void
+test_printf(const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!verbose)
+		return;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+}
+
+/* Fill an entry with values derived from the given seed. */
+static void
+entry_fill(struct got_fileindex_entry *ie, uint8_t seed)
+{
+	ie->ctime_sec = seed;
+	ie->mtime_sec = seed + 1;
+	ie->uid = 1000;
+	ie->gid = 1000;
+	ie->size = seed * 10;
+	got_fileindex_entry_filetype_set(ie, GOT_FILEIDX_MODE_REGULAR_FILE);
+	memset(ie->blob_sha1, seed, sizeof(ie->blob_sha1));
+	memset(ie->commit_sha1, 0xc0, sizeof(ie->commit_sha1));
+}
+
+static const struct got_error *
+add_entry(struct got_fileindex *fileindex, const char *path, uint8_t seed)
+{
+	const struct got_error *err;
+	struct got_fileindex_entry *ie;
+
+	err = got_fileindex_entry_alloc(&ie, path);
+	if (err)
+		return err;
+	entry_fill(ie, seed);
+	err = got_fileindex_entry_add(fileindex, ie);
+	if (err)
+		got_fileindex_entry_free(ie);
+	return err;
+}
+
+/* Check that an entry exists and carries values derived from the seed. */
+static int
+entry_matches(struct got_fileindex *fileindex, const char *path, uint8_t seed)
+{
+	struct got_fileindex_entry *ie;
+	uint8_t sha1[SHA1_DIGEST_LENGTH];
+
+	ie = got_fileindex_entry_get(fileindex, path, strlen(path));
+	if (ie == NULL) {
+		test_printf("%s: not found\n", path);
+		return 0;
+	}
+
+	memset(sha1, seed, sizeof(sha1));
+	if (ie->size != seed * 10 || ie->mtime_sec != seed + 1 ||
+	    memcmp(ie->blob_sha1, sha1, sizeof(sha1)) != 0) {
+		test_printf("%s: size %u, expected %u\n", path, ie->size,
+		    seed * 10);
+		return 0;
+	}
+
+	return 1;
+}
+
+static const struct got_error *
+count_cb(void *arg, struct got_fileindex_entry *ie)
+{
+	int *n = arg;
+
+	(*n)++;
+	return NULL;
+}
+
+static int
+nentries(struct got_fileindex *fileindex)
+{
+	const struct got_error *err;
+	int n = 0;
+
+	err = got_fileindex_for_each_entry_safe(fileindex, count_cb, &n);
+	if (err) {
+		test_printf("%s\n", err->msg);
+		return -1;
+	}
+	return n;
+}
+
+/* Write a version 3 file index which contains an entry per path. */
+static const struct got_error *
+write_base(FILE *f, uint8_t seed)
+{
+	const struct got_error *err = NULL;
+	struct got_fileindex *fileindex;
+	size_t i;
+
+	fileindex = got_fileindex_alloc();
+	if (fileindex == NULL)
+		return got_error_from_errno("got_fileindex_alloc");
+
+	for (i = 0; i < nitems(paths); i++) {
+		err = add_entry(fileindex, paths[i], seed + i);
+		if (err)
+			goto done;
+	}
+
+	if (ftruncate(fileno(f), 0) == -1) {
+		err = got_error_from_errno("ftruncate");
+		goto done;
+	}
+	rewind(f);
+	err = got_fileindex_write(fileindex, f);
+done:
+	got_fileindex_free(fileindex);
+	return err;
+}
+
+static const struct got_error *
+read_fileindex(struct got_fileindex **fileindex, FILE *base, FILE *delta)
+{
+	const struct got_error *err;
+
+	*fileindex = got_fileindex_alloc();
+	if (*fileindex == NULL)
+		return got_error_from_errno("got_fileindex_alloc");
+
+	rewind(base);
+	err = got_fileindex_read(*fileindex, base);
+	if (err == NULL && delta) {
+		rewind(delta);
+		err = got_fileindex_read_delta(*fileindex, delta);
+	}
+	if (err) {
+		got_fileindex_free(*fileindex);
+		*fileindex = NULL;
+	}
+	return err;
+}
+
+static const struct got_error *
+write_v2_data(SHA1_CTX *ctx, const void *data, size_t len, FILE *f)
+{
+	SHA1Update(ctx, data, len);
+	if (fwrite(data, 1, len, f) != len)
+		return got_ferror(f, GOT_ERR_IO);
+	return NULL;
+}
+
+/* Write an entry in the variable-length format used up to version 2. */
+static const struct got_error *
+write_v2_entry(SHA1_CTX *ctx, FILE *f, const char *path, uint8_t seed,
+    uint32_t stage)
+{
+	const struct got_error *err;
+	struct got_fileindex_entry ie;
+	uint64_t v64[4];
+	uint32_t v32[3], flags;
+	uint16_t mode;
+	uint8_t sha1[SHA1_DIGEST_LENGTH];
+	char buf[PATH_MAX];
+	size_t len = strlen(path), padded_len = len;
+
+	memset(&ie, 0, sizeof(ie));
+	entry_fill(&ie, seed);
+
+	v64[0] = htobe64(ie.ctime_sec);
+	v64[1] = htobe64(ie.ctime_nsec);
+	v64[2] = htobe64(ie.mtime_sec);
+	v64[3] = htobe64(ie.mtime_nsec);
+	err = write_v2_data(ctx, v64, sizeof(v64), f);
+	if (err)
+		return err;
+	v32[0] = htobe32(ie.uid);
+	v32[1] = htobe32(ie.gid);
+	v32[2] = htobe32(ie.size);
+	err = write_v2_data(ctx, v32, sizeof(v32), f);
+	if (err)
+		return err;
+	mode = htobe16(ie.mode);
+	err = write_v2_data(ctx, &mode, sizeof(mode), f);
+	if (err)
+		return err;
+	err = write_v2_data(ctx, ie.blob_sha1, sizeof(ie.blob_sha1), f);
+	if (err)
+		return err;
+	err = write_v2_data(ctx, ie.commit_sha1, sizeof(ie.commit_sha1), f);
+	if (err)
+		return err;
+	flags = htobe32(len | (stage << 12));
+	err = write_v2_data(ctx, &flags, sizeof(flags), f);
+	if (err)
+		return err;
+
+	/* NUL-padded to a multiple of 8, with at least one NUL. */
+	do {
+		padded_len++;
+	} while (padded_len % 8 != 0);
+	memset(buf, 0, padded_len);
+	memcpy(buf, path, len);
+	err = write_v2_data(ctx, buf, padded_len, f);
+	if (err)
+		return err;
+
+	if (stage == GOT_FILEIDX_STAGE_MODIFY) {
+		memset(sha1, 0x5a, sizeof(sha1));
+		err = write_v2_data(ctx, sha1, sizeof(sha1), f);
+	}
+	return err;
+}
+
+static int
+fileindex_upgrade_v2(void)
+{
+	const struct got_error *err = NULL;
+	struct got_fileindex *fileindex = NULL;
+	struct got_fileindex_entry *ie;
+	FILE *v2 = NULL, *v3 = NULL;
+	SHA1_CTX ctx;
+	uint32_t hdr[3], version;
+	uint8_t sha1[SHA1_DIGEST_LENGTH], staged_sha1[SHA1_DIGEST_LENGTH];
+	size_t i;
+	int written;
+
+	v2 = got_opentemp();
+	v3 = got_opentemp();
+	if (v2 == NULL || v3 == NULL) {
+		err = got_error_from_errno("got_opentemp");
+		goto done;
+	}
+
+	SHA1Init(&ctx);
+	hdr[0] = htobe32(GOT_FILE_INDEX_SIGNATURE);
+	hdr[1] = htobe32(2);
+	hdr[2] = htobe32(nitems(paths));
+	err = write_v2_data(&ctx, hdr, sizeof(hdr), v2);
+	if (err)
+		goto done;
+	for (i = 0; i < nitems(paths); i++) {
+		err = write_v2_entry(&ctx, v2, paths[i], i + 1,
+		    i == 1 ? GOT_FILEIDX_STAGE_MODIFY : GOT_FILEIDX_STAGE_NONE);
+		if (err)
+			goto done;
+	}
+	SHA1Final(sha1, &ctx);
+	if (fwrite(sha1, 1, sizeof(sha1), v2) != sizeof(sha1)) {
+		err = got_ferror(v2, GOT_ERR_IO);
+		goto done;
+	}
+	if (fflush(v2) != 0) {
+		err = got_error_from_errno("fflush");
+		goto done;
+	}
+
+	err = read_fileindex(&fileindex, v2, NULL);
+	if (err)
+		goto done;
+
+	/* A version 2 file index cannot be journaled. */
+	err = got_fileindex_write_delta(&written, fileindex, v3);
+	if (err)
+		goto done;
+	if (written) {
+		err = got_error(GOT_ERR_BAD_OBJ_DATA);
+		goto done;
+	}
+
+	err = got_fileindex_write(fileindex, v3);
+	if (err)
+		goto done;
+	got_fileindex_free(fileindex);
+	fileindex = NULL;
+
+	if (fseeko(v3, sizeof(uint32_t), SEEK_SET) == -1) {
+		err = got_error_from_errno("fseeko");
+		goto done;
+	}
+	if (fread(&version, 1, sizeof(version), v3) != sizeof(version)) {
+		err = got_ferror(v3, GOT_ERR_IO);
+		goto done;
+	}
+	if (be32toh(version) != GOT_FILE_INDEX_VERSION) {
+		test_printf("file index version %u\n", be32toh(version));
+		err = got_error(GOT_ERR_FILEIDX_VER);
+		goto done;
+	}
+
+	err = read_fileindex(&fileindex, v3, NULL);
+	if (err)
+		goto done;
+	for (i = 0; i < nitems(paths); i++) {
+		if (!entry_matches(fileindex, paths[i], i + 1)) {
+			err = got_error(GOT_ERR_BAD_OBJ_DATA);
+			goto done;
+		}
+	}
+	ie = got_fileindex_entry_get(fileindex, paths[1], strlen(paths[1]));
+	memset(staged_sha1, 0x5a, sizeof(staged_sha1));
+	if (got_fileindex_entry_stage_get(ie) != GOT_FILEIDX_STAGE_MODIFY ||
+	    memcmp(ie->staged_blob_sha1, staged_sha1,
+	    sizeof(staged_sha1)) != 0) {
+		test_printf("%s: staged changes were lost\n", paths[1]);
+		err = got_error(GOT_ERR_BAD_OBJ_DATA);
+		goto done;
+	}
+	if (nentries(fileindex) != (int)nitems(paths))
+		err = got_error(GOT_ERR_BAD_OBJ_DATA);
+done:
+	if (err)
+		test_printf("%s\n", err->msg);
+	if (fileindex)
+		got_fileindex_free(fileindex);
+	if (v2 && fclose(v2) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (v3 && fclose(v3) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	return (err == NULL);
+}
+
+static int
+fileindex_delta_replay_after_crash(void)
+{
+	const struct got_error *err = NULL;
+	struct got_fileindex *fileindex = NULL;
+	struct got_fileindex_entry *ie;
+	FILE *base = NULL, *delta = NULL;
+	off_t delta_size;
+	int written;
+
+	base = got_opentemp();
+	delta = got_opentemp();
+	if (base == NULL || delta == NULL) {
+		err = got_error_from_errno("got_opentemp");
+		goto done;
+	}
+
+	err = write_base(base, 1);
+	if (err)
+		goto done;
+
+	/* Journal a modified, an added, and a removed entry. */
+	err = read_fileindex(&fileindex, base, delta);
+	if (err)
+		goto done;
+	ie = got_fileindex_entry_get(fileindex, "beta", 4);
+	if (ie == NULL) {
+		err = got_error_path("beta", GOT_ERR_BAD_PATH);
+		goto done;
+	}
+	entry_fill(ie, 42);
+	err = add_entry(fileindex, "epsilon/new", 43);
+	if (err)
+		goto done;
+	ie = got_fileindex_entry_get(fileindex, "alpha", 5);
+	if (ie == NULL) {
+		err = got_error_path("alpha", GOT_ERR_BAD_PATH);
+		goto done;
+	}
+	got_fileindex_entry_remove(fileindex, ie);
+	err = got_fileindex_write_delta(&written, fileindex, delta);
+	if (err)
+		goto done;
+	if (!written) {
+		err = got_error(GOT_ERR_BAD_OBJ_DATA);
+		goto done;
+	}
+	delta_size = ftello(delta);
+	if (delta_size == -1) {
+		err = got_error_from_errno("ftello");
+		goto done;
+	}
+
+	/* Crash while appending another record. */
+	ie = got_fileindex_entry_get(fileindex, "gamma/delta", 11);
+	if (ie == NULL) {
+		err = got_error_path("gamma/delta", GOT_ERR_BAD_PATH);
+		goto done;
+	}
+	entry_fill(ie, 44);
+	err = got_fileindex_write_delta(&written, fileindex, delta);
+	if (err)
+		goto done;
+	got_fileindex_free(fileindex);
+	fileindex = NULL;
+	if (ftruncate(fileno(delta), ftello(delta) - 7) == -1) {
+		err = got_error_from_errno("ftruncate");
+		goto done;
+	}
+
+	err = read_fileindex(&fileindex, base, delta);
+	if (err)
+		goto done;
+	if (!entry_matches(fileindex, "beta", 42) ||
+	    !entry_matches(fileindex, "epsilon/new", 43) ||
+	    !entry_matches(fileindex, "gamma/delta", 4) ||
+	    got_fileindex_entry_get(fileindex, "alpha", 5) != NULL ||
+	    nentries(fileindex) != (int)nitems(paths)) {
+		err = got_error(GOT_ERR_BAD_OBJ_DATA);
+		goto done;
+	}
+
+	/* The torn record is overwritten when the journal is appended to. */
+	ie = got_fileindex_entry_get(fileindex, "gamma/delta", 11);
+	entry_fill(ie, 45);
+	err = got_fileindex_write_delta(&written, fileindex, delta);
+	if (err)
+		goto done;
+	if (!written || ftello(delta) <= delta_size) {
+		err = got_error(GOT_ERR_BAD_OBJ_DATA);
+		goto done;
+	}
+	got_fileindex_free(fileindex);
+	fileindex = NULL;
+
+	err = read_fileindex(&fileindex, base, delta);
+	if (err)
+		goto done;
+	if (!entry_matches(fileindex, "beta", 42) ||
+	    !entry_matches(fileindex, "epsilon/new", 43) ||
+	    !entry_matches(fileindex, "gamma/delta", 45) ||
+	    got_fileindex_entry_get(fileindex, "alpha", 5) != NULL ||
+	    nentries(fileindex) != (int)nitems(paths))
+		err = got_error(GOT_ERR_BAD_OBJ_DATA);
+done:
+	if (err)
+		test_printf("%s\n", err->msg);
+	if (fileindex)
+		got_fileindex_free(fileindex);
+	if (base && fclose(base) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (delta && fclose(delta) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	return (err == NULL);
+}
+
+static int
+fileindex_bad_base_checksum(void)
+{
+	const struct got_error *err = NULL;
+	struct got_fileindex *fileindex = NULL;
+	FILE *base = NULL;
+	off_t off;
+	int n = 0, ret = 0;
+
+	base = got_opentemp();
+	if (base == NULL) {
+		err = got_error_from_errno("got_opentemp");
+		goto done;
+	}
+
+	err = write_base(base, 1);
+	if (err)
+		goto done;
+
+	/* Corrupt the uid of the second record. */
+	off = 4 * sizeof(uint32_t) + sizeof(struct got_fileindex_rec) +
+	    offsetof(struct got_fileindex_rec, uid);
+	if (fseeko(base, off, SEEK_SET) == -1) {
+		err = got_error_from_errno("fseeko");
+		goto done;
+	}
+	if (fputc(0xff, base) == EOF || fflush(base) != 0) {
+		err = got_ferror(base, GOT_ERR_IO);
+		goto done;
+	}
+
+	err = read_fileindex(&fileindex, base, NULL);
+	if (err)
+		goto done;
+
+	/* The checksum is verified once all entries get loaded. */
+	err = got_fileindex_for_each_entry_safe(fileindex, count_cb, &n);
+	if (err && err->code == GOT_ERR_FILEIDX_CSUM) {
+		ret = 1;
+		err = NULL;
+	}
+done:
+	if (err)
+		test_printf("%s\n", err->msg);
+	if (fileindex)
+		got_fileindex_free(fileindex);
+	if (base && fclose(base) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	return (err == NULL && ret);
+}
+
+static int
+fileindex_delta_base_mismatch(void)
+{
+	const struct got_error *err = NULL;
+	struct got_fileindex *fileindex = NULL;
+	struct got_fileindex_entry *ie;
+	FILE *base = NULL, *delta = NULL;
+	size_t i;
+	int written;
+
+	base = got_opentemp();
+	delta = got_opentemp();
+	if (base == NULL || delta == NULL) {
+		err = got_error_from_errno("got_opentemp");
+		goto done;
+	}
+
+	err = write_base(base, 1);
+	if (err)
+		goto done;
+	err = read_fileindex(&fileindex, base, delta);
+	if (err)
+		goto done;
+	ie = got_fileindex_entry_get(fileindex, "beta", 4);
+	if (ie == NULL) {
+		err = got_error_path("beta", GOT_ERR_BAD_PATH);
+		goto done;
+	}
+	entry_fill(ie, 42);
+	err = got_fileindex_write_delta(&written, fileindex, delta);
+	if (err)
+		goto done;
+	got_fileindex_free(fileindex);
+	fileindex = NULL;
+	if (!written) {
+		err = got_error(GOT_ERR_BAD_OBJ_DATA);
+		goto done;
+	}
+
+	/* Replace the base file; the delta file now belongs to another base. */
+	err = write_base(base, 11);
+	if (err)
+		goto done;
+
+	err = read_fileindex(&fileindex, base, delta);
+	if (err)
+		goto done;
+	for (i = 0; i < nitems(paths); i++) {
+		if (!entry_matches(fileindex, paths[i], 11 + i)) {
+			err = got_error(GOT_ERR_BAD_OBJ_DATA);
+			goto done;
+		}
+	}
+
+	/* The stale delta file is discarded when the journal is written. */
+	ie = got_fileindex_entry_get(fileindex, "alpha", 5);
+	entry_fill(ie, 46);
+	err = got_fileindex_write_delta(&written, fileindex, delta);
+	if (err)
+		goto done;
+	got_fileindex_free(fileindex);
+	fileindex = NULL;
+
+	err = read_fileindex(&fileindex, base, delta);
+	if (err)
+		goto done;
+	if (!entry_matches(fileindex, "alpha", 46) ||
+	    !entry_matches(fileindex, "beta", 12) ||
+	    nentries(fileindex) != (int)nitems(paths))
+		err = got_error(GOT_ERR_BAD_OBJ_DATA);
+done:
+	if (err)
+		test_printf("%s\n", err->msg);
+	if (fileindex)
+		got_fileindex_free(fileindex);
+	if (base && fclose(base) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (delta && fclose(delta) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	return (err == NULL);
+}
+
+#define RUN_TEST(expr, name) \
+	{ test_ok = (expr);  \
+	if (!quiet) printf("test_%s %s\n", (name), test_ok ? "ok" : "failed"); \
+	failure = (failure || !test_ok); }
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: fileindex_test [-v] [-q]\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	int test_ok = 0, failure = 0;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "qv")) != -1) {
+		switch (ch) {
+		case 'q':
+			quiet = 1;
+			verbose = 0;
+			break;
+		case 'v':
+			verbose = 1;
+			quiet = 0;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0) {
+		usage();
+		return 1;
+	}
+
+#ifndef PROFILE
+	if (pledge("stdio rpath wpath cpath unveil", NULL) == -1)
+		err(1, "pledge");
+#endif
+	if (unveil(GOT_TMPDIR_STR, "rwc") != 0)
+		err(1, "unveil");
+
+	if (unveil(NULL, NULL) != 0)
+		err(1, "unveil");
+
+	RUN_TEST(fileindex_upgrade_v2(), "fileindex_upgrade_v2");
+	RUN_TEST(fileindex_delta_replay_after_crash(),
+	    "fileindex_delta_replay_after_crash");
+	RUN_TEST(fileindex_bad_base_checksum(), "fileindex_bad_base_checksum");
+	RUN_TEST(fileindex_delta_base_mismatch(),
+	    "fileindex_delta_base_mismatch");
+
+	return failure ? 1 : 0;
+}
@@ -21,26 +21,14 @@
 #include "tmpl.h"
 
 int	 base(struct template *, const char *title);
-int	 my_putc(struct template *, int);
-int	 my_puts(struct template *, const char *);
+int	 my_write(struct template *, const char *, size_t);
 
 int
-my_putc(struct template *tp, int c)
+my_write(struct template *tp, const char *s, size_t len)
 {
 	FILE	*fp = tp->tp_arg;
 
-	if (putc(c, fp) < 0)
-		return (-1);
-
-	return (0);
-}
-
-int
-my_puts(struct template *tp, const char *s)
-{
-	FILE	*fp = tp->tp_arg;
-
-	if (fputs(s, fp) < 0)
+	if (fwrite(s, 1, len, fp) != len)
 		return (-1);
 
 	return (0);
@@ -51,7 +39,7 @@ main(int argc, char **argv)
 {
 	struct template *tp;
 
-	if ((tp = template(stdout, my_puts, my_putc)) == NULL)
+	if ((tp = template(stdout, my_write)) == NULL)
 		err(1, "template");
 
 	if (base(tp, " *hello* ") == -1)
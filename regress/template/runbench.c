@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/queue.h>
+#include <sys/time.h>
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tmpl.h"
+#include "lists.h"
+
+int	page(struct template *, struct tailhead *);
+int	count_write(struct template *, const char *, size_t);
+
+static size_t	nwrites;
+static size_t	nbytes;
+
+/* Discard the output, only count how it was handed to us. */
+int
+count_write(struct template *tp, const char *s, size_t len)
+{
+	nwrites++;
+	nbytes += len;
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct template	*tp;
+	struct tailhead	 head;
+	struct entry	*np;
+	struct timespec	 start, end, diff;
+	double		 secs;
+	int		 i, rows = 50, iterations = 10000;
+
+	if (argc > 1)
+		iterations = atoi(argv[1]);
+	if (iterations <= 0)
+		errx(1, "bad number of iterations");
+
+	if ((tp = template(NULL, count_write)) == NULL)
+		err(1, "template");
+
+	TAILQ_INIT(&head);
+	for (i = 0; i < rows; ++i) {
+		if ((np = calloc(1, sizeof(*np))) == NULL)
+			err(1, "calloc");
+		if (asprintf(&np->text, "commit %d: fix <tags> & \"quotes\" in "
+		    "the template compiler", i) == -1)
+			err(1, "asprintf");
+		TAILQ_INSERT_TAIL(&head, np, entries);
+	}
+
+	if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+		err(1, "clock_gettime");
+	for (i = 0; i < iterations; ++i) {
+		if (page(tp, &head) == -1)
+			errx(1, "render failed");
+	}
+	if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+		err(1, "clock_gettime");
+	timespecsub(&end, &start, &diff);
+	secs = diff.tv_sec + diff.tv_nsec / 1e9;
+
+	printf("%d renders of %d rows: %.3f us/render, "
+	    "%zu writes and %zu bytes per render\n", iterations, rows,
+	    secs * 1e6 / iterations, nwrites / iterations,
+	    nbytes / iterations);
+
+	while ((np = TAILQ_FIRST(&head))) {
+		TAILQ_REMOVE(&head, np, entries);
+		free(np->text);
+		free(np);
+	}
+	template_free(tp);
+	return (0);
+}
@@ -22,26 +22,14 @@
 #include "lists.h"
 
 int	base(struct template *, struct tailhead *);
-int	my_putc(struct template *, int);
-int	my_puts(struct template *, const char *);
+int	my_write(struct template *, const char *, size_t);
 
 int
-my_putc(struct template *tp, int c)
+my_write(struct template *tp, const char *s, size_t len)
 {
 	FILE	*fp = tp->tp_arg;
 
-	if (putc(c, fp) < 0)
-		return (-1);
-
-	return (0);
-}
-
-int
-my_puts(struct template *tp, const char *s)
-{
-	FILE	*fp = tp->tp_arg;
-
-	if (fputs(s, fp) < 0)
+	if (fwrite(s, 1, len, fp) != len)
 		return (-1);
 
 	return (0);
@@ -55,7 +43,7 @@ main(int argc, char **argv)
 	struct entry	*np;
 	int		 i;
 
-	if ((tp = template(stdout, my_puts, my_putc)) == NULL)
+	if ((tp = template(stdout, my_write)) == NULL)
 		err(1, "template");
 
 	TAILQ_INIT(&head);
@@ -66,7 +66,11 @@ void		 lungetc(int);
 int		 findeol(void);
 
 void		 dbg(void);
+void		 dbgline(int);
 void		 printq(const char *);
+void		 printdata(const char *, size_t);
+void		 raw_add(const char *);
+void		 raw_flush(void);
 
 extern int	 nodebug;
 
@@ -77,6 +81,12 @@ static int	 in_define;
 static int	 errors;
 static int	 lastline = -1;
 
+/* Static text not yet written out, merged into a single tp_write(). */
+static char	*rawbuf;
+static size_t	 rawlen;
+static size_t	 rawsize;
+static int	 rawline;
+
 typedef struct {
 	union {
 		char		*string;
@@ -138,11 +148,7 @@ verbatims	: /* empty */
 		;
 
 raw		: STRING {
-			dbg();
-			fprintf(fp, "if ((tp_ret = tp->tp_puts(tp, ");
-			printq($1);
-			fputs(")) == -1) goto err;\n", fp);
-
+			raw_add($1);
 			free($1);
 		}
 		;
@@ -189,7 +195,7 @@ special		: '{' RENDER string '}' {
 		| '{' string '|' UNSAFE '}' {
 			dbg();
 			fprintf(fp,
-			    "if ((tp_ret = tp->tp_puts(tp, %s)) == -1)\n",
+			    "if ((tp_ret = tp_puts(tp, %s)) == -1)\n",
 			    $2);
 			fputs("goto err;\n", fp);
 			free($2);
@@ -259,12 +265,14 @@ else		: '{' ELSE '}' {
 		;
 
 loop		: '{' FOR stringy '}' {
+			raw_flush();
 			fprintf(fp, "for (%s) {\n", $3);
 			free($3);
 		} body end {
 			fputs("}\n", fp);
 		}
 		| '{' TQFOREACH STRING STRING STRING '}' {
+			raw_flush();
 			fprintf(fp, "TAILQ_FOREACH(%s, %s, %s) {\n",
 			    $3, $4, $5);
 			free($3);
@@ -274,6 +282,7 @@ loop		: '{' FOR stringy '}' {
 			fputs("}\n", fp);
 		}
 		| '{' WHILE stringy '}' {
+			raw_flush();
 			fprintf(fp, "while (%s) {\n", $3);
 			free($3);
 		} body end {
@@ -281,7 +290,7 @@ loop		: '{' FOR stringy '}' {
 		}
 		;
 
-end		: '{' END '}'
+end		: '{' END '}'		{ raw_flush(); }
 		;
 
 finally		: '{' FINALLY '}' {
@@ -716,17 +725,24 @@ parse(FILE *outfile, const char *filename)
 
 void
 dbg(void)
+{
+	raw_flush();
+	dbgline(yylval.lineno);
+}
+
+void
+dbgline(int lineno)
 {
 	if (nodebug)
 		return;
 
-	if (yylval.lineno == lastline + 1) {
-		lastline = yylval.lineno;
+	if (lineno == lastline + 1) {
+		lastline = lineno;
 		return;
 	}
-	lastline = yylval.lineno;
+	lastline = lineno;
 
-	fprintf(fp, "#line %d ", yylval.lineno);
+	fprintf(fp, "#line %d ", lineno);
 	printq(file->name);
 	putc('\n', fp);
 }
@@ -742,3 +758,56 @@ printq(const char *str)
 	}
 	putc('"', fp);
 }
+
+void
+printdata(const char *str, size_t len)
+{
+	size_t	 i;
+
+	putc('"', fp);
+	for (i = 0; i < len; ++i) {
+		if (str[i] == '"' || str[i] == '\\')
+			putc('\\', fp);
+		putc(str[i], fp);
+	}
+	putc('"', fp);
+}
+
+void
+raw_add(const char *str)
+{
+	size_t	 len, newsize;
+	void	*p;
+
+	if ((len = strlen(str)) == 0)
+		return;
+
+	if (rawlen == 0)
+		rawline = yylval.lineno;
+
+	if (rawlen + len > rawsize) {
+		newsize = rawsize ? rawsize : 128;
+		while (newsize < rawlen + len)
+			newsize *= 2;
+		if ((p = realloc(rawbuf, newsize)) == NULL)
+			err(1, "realloc");
+		rawbuf = p;
+		rawsize = newsize;
+	}
+
+	memcpy(rawbuf + rawlen, str, len);
+	rawlen += len;
+}
+
+void
+raw_flush(void)
+{
+	if (rawlen == 0)
+		return;
+
+	dbgline(rawline);
+	fprintf(fp, "if ((tp_ret = tp_write(tp, ");
+	printdata(rawbuf, rawlen);
+	fprintf(fp, ", %zu)) == -1) goto err;\n", rawlen);
+	rawlen = 0;
+}
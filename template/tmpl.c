@@ -17,31 +17,58 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "tmpl.h"
 
+int
+tp_write(struct template *tp, const char *str, size_t len)
+{
+	if (len == 0)
+		return (0);
+	return (tp->tp_write(tp, str, len));
+}
+
+int
+tp_puts(struct template *tp, const char *str)
+{
+	if (str == NULL)
+		return (0);
+	return (tp_write(tp, str, strlen(str)));
+}
+
+static inline int
+urlunsafe(unsigned char c)
+{
+	return (iscntrl(c) || isspace(c) ||
+	    c == '\'' || c == '"' || c == '\\');
+}
+
 int
 tp_urlescape(struct template *tp, const char *str)
 {
-	int	 r;
-	char	 tmp[4];
+	const char	*start;
+	int		 r;
+	char		 tmp[4];
 
 	if (str == NULL)
 		return (0);
 
-	for (; *str; ++str) {
-		if (iscntrl((unsigned char)*str) ||
-		    isspace((unsigned char)*str) ||
-		    *str == '\'' || *str == '"' || *str == '\\') {
-			r = snprintf(tmp, sizeof(tmp), "%%%2X", *str);
-			if (r < 0  || (size_t)r >= sizeof(tmp))
-				return (0);
-			if (tp->tp_puts(tp, tmp) == -1)
-				return (-1);
-		} else {
-			if (tp->tp_putc(tp, *str) == -1)
-				return (-1);
-		}
+	while (*str) {
+		/* Copy the longest run which needs no escaping at once. */
+		for (start = str; *str && !urlunsafe((unsigned char)*str); ++str)
+			;
+		if (tp_write(tp, start, str - start) == -1)
+			return (-1);
+		if (*str == '\0')
+			break;
+
+		r = snprintf(tmp, sizeof(tmp), "%%%2X", *str);
+		if (r < 0  || (size_t)r >= sizeof(tmp))
+			return (0);
+		if (tp_write(tp, tmp, r) == -1)
+			return (-1);
+		++str;
 	}
 
 	return (0);
@@ -50,42 +77,49 @@ tp_urlescape(struct template *tp, const char *str)
 int
 tp_htmlescape(struct template *tp, const char *str)
 {
-	int r;
+	size_t	 len;
+	int	 r;
 
 	if (str == NULL)
 		return (0);
 
-	for (; *str; ++str) {
+	while (*str) {
+		/* Copy the longest run which needs no escaping at once. */
+		len = strcspn(str, "<>&\"'");
+		if (tp_write(tp, str, len) == -1)
+			return (-1);
+		str += len;
+
 		switch (*str) {
+		case '\0':
+			return (0);
 		case '<':
-			r = tp->tp_puts(tp, "&lt;");
+			r = tp_write(tp, "&lt;", 4);
 			break;
 		case '>':
-			r = tp->tp_puts(tp, "&gt;");
+			r = tp_write(tp, "&gt;", 4);
 			break;
 		case '&':
-			r = tp->tp_puts(tp, "&amp;");
+			r = tp_write(tp, "&amp;", 5);
 			break;
 		case '"':
-			r = tp->tp_puts(tp, "&quot;");
-			break;
-		case '\'':
-			r = tp->tp_puts(tp, "&apos;");
+			r = tp_write(tp, "&quot;", 6);
 			break;
-		default:
-			r = tp->tp_putc(tp, *str);
+		default:	/* '\'' */
+			r = tp_write(tp, "&apos;", 6);
 			break;
 		}
 
 		if (r == -1)
 			return (-1);
+		++str;
 	}
 
 	return (0);
 }
 
 struct template *
-template(void *arg, tmpl_puts putsfn, tmpl_putc putcfn)
+template(void *arg, tmpl_write writefn)
 {
 	struct template *tp;
 
@@ -94,8 +128,7 @@ template(void *arg, tmpl_puts putsfn, tmpl_putc putcfn)
 
 	tp->tp_arg = arg;
 	tp->tp_escape = tp_htmlescape;
-	tp->tp_puts = putsfn;
-	tp->tp_putc = putcfn;
+	tp->tp_write = writefn;
 
 	return (tp);
 }
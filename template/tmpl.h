@@ -20,20 +20,21 @@
 struct template;
 
 typedef int (*tmpl_puts)(struct template *, const char *);
-typedef int (*tmpl_putc)(struct template *, int);
+typedef int (*tmpl_write)(struct template *, const char *, size_t);
 
 struct template {
 	void		*tp_arg;
 	char		*tp_tmp;
 	tmpl_puts	 tp_escape;
-	tmpl_puts	 tp_puts;
-	tmpl_putc	 tp_putc;
+	tmpl_write	 tp_write;
 };
 
+int		 tp_write(struct template *, const char *, size_t);
+int		 tp_puts(struct template *, const char *);
 int		 tp_urlescape(struct template *, const char *);
 int		 tp_htmlescape(struct template *, const char *);
 
-struct template	*template(void *, tmpl_puts, tmpl_putc);
+struct template	*template(void *, tmpl_write);
 void		 template_free(struct template *);
 
 #endif
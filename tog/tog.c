@@ -46,10 +46,10 @@
 #include "got_object.h"
 #include "got_reference.h"
 #include "got_repository.h"
+#include "got_cancel.h"
 #include "got_diff.h"
 #include "got_opentemp.h"
 #include "got_utf8.h"
-#include "got_cancel.h"
 #include "got_commit_graph.h"
 #include "got_blame.h"
 #include "got_privsep.h"
@@ -128,10 +128,24 @@ enum tog_view_mode {
 
 #define TOG_EOF_STRING	"(END)"
 
+/*
+ * Number of commits the log thread loads in the background beyond those
+ * needed for display, such that scrolling down does not wait for commits.
+ */
+#define TOG_LOG_READAHEAD	512
+
+/*
+ * Commits in the log view only keep the information needed to display
+ * them, in a single allocation per commit. Commit objects are re-opened
+ * on demand, so memory use stays small even with very long histories.
+ */
 struct commit_queue_entry {
 	TAILQ_ENTRY(commit_queue_entry) entry;
 	struct got_object_id *id;
-	struct got_commit_object *commit;
+	time_t committer_time;
+	char *author;		/* author's name as displayed */
+	char *committer;	/* committer's name as displayed */
+	char *logmsg;		/* first line of the log message */
 	int idx;
 };
 TAILQ_HEAD(commit_queue_head, commit_queue_entry);
@@ -326,11 +340,59 @@ get_color_value(const char *envvar)
 	return default_color_value(envvar);
 }
 
+struct tog_diff_request {
+	struct got_object_id *id1, *id2;
+	char *refs_str;
+	int diff_context;
+	int ignore_whitespace;
+	int force_text_diff;
+	enum got_diff_algorithm diff_algo;
+};
+
+/*
+ * Diffs are created by a separate thread which uses its own repository,
+ * so that large diffs do not block the UI. The thread owns everything in
+ * here except fields which are documented as protected by tog_mutex.
+ */
+struct tog_diff_thread_args {
+	pthread_cond_t need_diff;
+	struct got_repository *repo;
+	int *pack_fds;
+	FILE *f1, *f2;
+	int fd1, fd2;
+	char *label1, *label2;
+
+	/* Protected by tog_mutex. */
+	struct tog_diff_request *request;	/* next diff to create */
+	unsigned int generation;		/* bumped for each request */
+	FILE *f;				/* result of the latest request */
+	struct got_diff_line *lines;
+	size_t nlines;
+	size_t ninfo;		/* lines of commit info prefixed to lines */
+	const struct got_error *err;
+	int complete;
+	int quit;
+
+	/*
+	 * While a diff of several files is being created, the output
+	 * produced so far can be read with partial_f. Protected by tog_mutex.
+	 */
+	FILE *partial_f;
+	struct got_diff_line *partial_lines;
+	size_t partial_nlines;
+};
+
+/* State of a diff being created by the diff thread. */
+struct tog_diff_progress_arg {
+	struct tog_diff_thread_args *a;
+	unsigned int generation;
+	FILE *f;		/* reader of the output, until handed over */
+};
+
 struct tog_diff_view_state {
 	struct got_object_id *id1, *id2;
 	const char *label1, *label2;
-	FILE *f, *f1, *f2;
-	int fd1, fd2;
+	FILE *f;
 	int lineno;
 	int first_displayed_line;
 	int last_displayed_line;
@@ -343,6 +405,9 @@ struct tog_diff_view_state {
 	size_t nlines;
 	int matched_line;
 	int selected_line;
+	int diffing;
+	pthread_t thread;
+	struct tog_diff_thread_args *thread_args;
 
 	/* passed from log or blame view; may be NULL */
 	struct tog_view *parent_view;
@@ -355,6 +420,7 @@ struct tog_log_thread_args {
 	pthread_cond_t need_commits;
 	pthread_cond_t commit_loaded;
 	int commits_needed;
+	int commits_readahead;
 	int load_all;
 	struct got_commit_graph *graph;
 	struct commit_queue *real_commits;
@@ -368,13 +434,39 @@ struct tog_log_thread_args {
 	struct commit_queue_entry **selected_entry;
 	int *searching;
 	int *search_next_done;
-	regex_t *regex;
 	int *limiting;
 	int limit_match;
 	regex_t *limit_regex;
 	struct commit_queue *limit_commits;
 };
 
+/*
+ * Commits are matched against the search pattern by a separate thread
+ * which uses its own repository. This keeps the UI responsive while the
+ * search opens commit objects. The thread only looks at the commit queue
+ * and the regex while holding tog_mutex.
+ */
+#define TOG_LOG_SEARCH_IDLE	0
+#define TOG_LOG_SEARCH_RUNNING	1
+#define TOG_LOG_SEARCH_WAITING	2	/* ran out of loaded commits */
+#define TOG_LOG_SEARCH_FOUND	3
+#define TOG_LOG_SEARCH_ERROR	4
+
+struct tog_log_search_args {
+	pthread_cond_t need_search;
+	struct got_repository *repo;
+	int *pack_fds;
+	regex_t *regex;
+	int state;
+	unsigned int generation;
+	int direction;
+	struct commit_queue_entry *next_entry;
+	struct commit_queue_entry *last_entry;
+	struct commit_queue_entry *found_entry;
+	const struct got_error *err;
+	sig_atomic_t quit;
+};
+
 struct tog_log_view_state {
 	struct commit_queue *commits;
 	struct commit_queue_entry *first_displayed_entry;
@@ -391,12 +483,13 @@ struct tog_log_view_state {
 	pthread_t thread;
 	struct tog_log_thread_args thread_args;
 	struct commit_queue_entry *matched_entry;
-	struct commit_queue_entry *search_entry;
 	struct tog_colors colors;
 	int use_committer;
 	int limit_view;
 	regex_t limit_regex;
 	struct commit_queue limit_commits;
+	pthread_t search_thread;
+	struct tog_log_search_args search_args;
 };
 
 #define TOG_COLOR_DIFF_MINUS		1
@@ -1700,12 +1793,19 @@ view_input(struct tog_view **new, int *done, struct tog_view *view,
 			err = view->input(new, view, ch);
 		break;
 	case 'A':
-		if (tog_diff_algo == GOT_DIFF_ALGORITHM_MYERS) {
+		switch (tog_diff_algo) {
+		case GOT_DIFF_ALGORITHM_MYERS:
 			tog_diff_algo = GOT_DIFF_ALGORITHM_PATIENCE;
 			view->action = "Patience diff algorithm";
-		} else {
+			break;
+		case GOT_DIFF_ALGORITHM_PATIENCE:
+			tog_diff_algo = GOT_DIFF_ALGORITHM_HISTOGRAM;
+			view->action = "Histogram diff algorithm";
+			break;
+		default:
 			tog_diff_algo = GOT_DIFF_ALGORITHM_MYERS;
 			view->action = "Myers diff algorithm";
+			break;
 		}
 		TAILQ_FOREACH(v, views, entry) {
 			if (v->reset) {
@@ -2163,9 +2263,8 @@ build_refs_str(char **refs_str, struct got_reflist_head *refs,
 	return err;
 }
 
-static const struct got_error *
-format_author(wchar_t **wauthor, int *author_width, char *author, int limit,
-    int col_tab_align)
+static char *
+get_author_name(char *author)
 {
 	char *smallerthan;
 
@@ -2173,31 +2272,35 @@ format_author(wchar_t **wauthor, int *author_width, char *author, int limit,
 	if (smallerthan && smallerthan[1] != '\0')
 		author = smallerthan + 1;
 	author[strcspn(author, "@>")] = '\0';
+	return author;
+}
+
+static const struct got_error *
+format_author(wchar_t **wauthor, int *author_width, char *author, int limit,
+    int col_tab_align)
+{
+	author = get_author_name(author);
 	return format_line(wauthor, author_width, NULL, author, 0, limit,
 	    col_tab_align, 0);
 }
 
 static const struct got_error *
-draw_commit(struct tog_view *view, struct got_commit_object *commit,
-    struct got_object_id *id, const size_t date_display_cols,
-    int author_display_cols)
+draw_commit(struct tog_view *view, struct commit_queue_entry *entry,
+    const size_t date_display_cols, int author_display_cols)
 {
 	struct tog_log_view_state *s = &view->state.log;
 	const struct got_error *err = NULL;
 	char datebuf[12]; /* YYYY-MM-DD + SPACE + NUL */
-	char *logmsg0 = NULL, *logmsg = NULL;
 	char *author = NULL;
 	wchar_t *wlogmsg = NULL, *wauthor = NULL;
 	int author_width, logmsg_width;
-	char *newline, *line = NULL;
+	char *line = NULL;
 	int col, limit, scrollx;
 	const int avail = view->ncols;
 	struct tm tm;
-	time_t committer_time;
 	struct tog_color *tc;
 
-	committer_time = got_object_commit_get_committer_time(commit);
-	if (gmtime_r(&committer_time, &tm) == NULL)
+	if (gmtime_r(&entry->committer_time, &tm) == NULL)
 		return got_error_from_errno("gmtime_r");
 	if (strftime(datebuf, sizeof(datebuf), "%G-%m-%d ", &tm) == 0)
 		return got_error(GOT_ERR_NO_SPACE);
@@ -2220,7 +2323,7 @@ draw_commit(struct tog_view *view, struct got_commit_object *commit,
 
 	if (avail >= 120) {
 		char *id_str;
-		err = got_object_id_str(&id_str, id);
+		err = got_object_id_str(&id_str, entry->id);
 		if (err)
 			goto done;
 		tc = get_color(&s->colors, TOG_COLOR_COMMIT);
@@ -2237,10 +2340,7 @@ draw_commit(struct tog_view *view, struct got_commit_object *commit,
 			goto done;
 	}
 
-	if (s->use_committer)
-		author = strdup(got_object_commit_get_committer(commit));
-	else
-		author = strdup(got_object_commit_get_author(commit));
+	author = strdup(s->use_committer ? entry->committer : entry->author);
 	if (author == NULL) {
 		err = got_error_from_errno("strdup");
 		goto done;
@@ -2265,20 +2365,11 @@ draw_commit(struct tog_view *view, struct got_commit_object *commit,
 	if (col > avail)
 		goto done;
 
-	err = got_object_commit_get_logmsg(&logmsg0, commit);
-	if (err)
-		goto done;
-	logmsg = logmsg0;
-	while (*logmsg == '\n')
-		logmsg++;
-	newline = strchr(logmsg, '\n');
-	if (newline)
-		*newline = '\0';
 	limit = avail - col;
 	if (view->child && !view_is_hsplit_top(view) && limit > 0)
 		limit--;	/* for the border */
-	err = format_line(&wlogmsg, &logmsg_width, &scrollx, logmsg, view->x,
-	    limit, col, 1);
+	err = format_line(&wlogmsg, &logmsg_width, &scrollx, entry->logmsg,
+	    view->x, limit, col, 1);
 	if (err)
 		goto done;
 	waddwstr(view->window, &wlogmsg[scrollx]);
@@ -2288,7 +2379,6 @@ draw_commit(struct tog_view *view, struct got_commit_object *commit,
 		col++;
 	}
 done:
-	free(logmsg0);
 	free(wlogmsg);
 	free(author);
 	free(wauthor);
@@ -2297,25 +2387,81 @@ done:
 }
 
 static struct commit_queue_entry *
-alloc_commit_queue_entry(struct got_commit_object *commit,
-    struct got_object_id *id)
+new_commit_queue_entry(struct got_object_id *id, time_t committer_time,
+    const char *author, const char *committer, const char *logmsg)
 {
 	struct commit_queue_entry *entry;
-	struct got_object_id *dup;
+	size_t alen, clen, mlen;
+	char *p;
 
-	entry = calloc(1, sizeof(*entry));
+	alen = strlen(author) + 1;
+	clen = strlen(committer) + 1;
+	mlen = strlen(logmsg) + 1;
+
+	entry = calloc(1, sizeof(*entry) + sizeof(*entry->id) +
+	    alen + clen + mlen);
 	if (entry == NULL)
 		return NULL;
 
-	dup = got_object_id_dup(id);
-	if (dup == NULL) {
-		free(entry);
-		return NULL;
+	entry->id = (struct got_object_id *)(entry + 1);
+	memcpy(entry->id, id, sizeof(*entry->id));
+	entry->committer_time = committer_time;
+	p = (char *)(entry->id + 1);
+	entry->author = p;
+	memcpy(entry->author, author, alen);
+	p += alen;
+	entry->committer = p;
+	memcpy(entry->committer, committer, clen);
+	p += clen;
+	entry->logmsg = p;
+	memcpy(entry->logmsg, logmsg, mlen);
+	return entry;
+}
+
+static const struct got_error *
+alloc_commit_queue_entry(struct commit_queue_entry **entry,
+    struct got_commit_object *commit, struct got_object_id *id)
+{
+	const struct got_error *err;
+	char *author = NULL, *committer = NULL, *logmsg0 = NULL, *logmsg;
+
+	*entry = NULL;
+
+	author = strdup(got_object_commit_get_author(commit));
+	if (author == NULL) {
+		err = got_error_from_errno("strdup");
+		goto done;
 	}
+	committer = strdup(got_object_commit_get_committer(commit));
+	if (committer == NULL) {
+		err = got_error_from_errno("strdup");
+		goto done;
+	}
+	err = got_object_commit_get_logmsg(&logmsg0, commit);
+	if (err)
+		goto done;
+	logmsg = logmsg0;
+	while (*logmsg == '\n')
+		logmsg++;
+	logmsg[strcspn(logmsg, "\n")] = '\0';
 
-	entry->id = dup;
-	entry->commit = commit;
-	return entry;
+	*entry = new_commit_queue_entry(id,
+	    got_object_commit_get_committer_time(commit),
+	    get_author_name(author), get_author_name(committer), logmsg);
+	if (*entry == NULL)
+		err = got_error_from_errno("calloc");
+done:
+	free(author);
+	free(committer);
+	free(logmsg0);
+	return err;
+}
+
+static struct commit_queue_entry *
+dup_commit_queue_entry(struct commit_queue_entry *entry)
+{
+	return new_commit_queue_entry(entry->id, entry->committer_time,
+	    entry->author, entry->committer, entry->logmsg);
 }
 
 static void
@@ -2325,9 +2471,7 @@ pop_commit(struct commit_queue *commits)
 
 	entry = TAILQ_FIRST(&commits->head);
 	TAILQ_REMOVE(&commits->head, entry, entry);
-	got_object_commit_close(entry->commit);
 	commits->ncommits--;
-	free(entry->id);
 	free(entry);
 }
 
@@ -2369,16 +2513,28 @@ done:
 	return err;
 }
 
+static const struct got_error *
+match_commit_entry(int *have_match, struct commit_queue_entry *entry,
+    regex_t *regex, struct got_repository *repo)
+{
+	const struct got_error *err;
+	struct got_commit_object *commit;
+
+	*have_match = 0;
+
+	err = got_object_open_as_commit(&commit, repo, entry->id);
+	if (err)
+		return err;
+	err = match_commit(have_match, entry->id, commit, regex);
+	got_object_commit_close(commit);
+	return err;
+}
+
 static const struct got_error *
 queue_commits(struct tog_log_thread_args *a)
 {
 	const struct got_error *err = NULL;
 
-	/*
-	 * We keep all commits open throughout the lifetime of the log
-	 * view in order to avoid having to re-fetch commits from disk
-	 * while updating the display.
-	 */
 	do {
 		struct got_object_id id;
 		struct got_commit_object *commit;
@@ -2394,9 +2550,9 @@ queue_commits(struct tog_log_thread_args *a)
 		err = got_object_open_as_commit(&commit, a->repo, &id);
 		if (err)
 			break;
-		entry = alloc_commit_queue_entry(commit, &id);
-		if (entry == NULL) {
-			err = got_error_from_errno("alloc_commit_queue_entry");
+		err = alloc_commit_queue_entry(&entry, commit, &id);
+		if (err) {
+			got_object_commit_close(commit);
 			break;
 		}
 
@@ -2404,6 +2560,8 @@ queue_commits(struct tog_log_thread_args *a)
 		if (errcode) {
 			err = got_error_set_errno(errcode,
 			    "pthread_mutex_lock");
+			got_object_commit_close(commit);
+			free(entry);
 			break;
 		}
 
@@ -2414,26 +2572,21 @@ queue_commits(struct tog_log_thread_args *a)
 		if (*a->limiting) {
 			err = match_commit(&limit_match, &id, commit,
 			    a->limit_regex);
-			if (err)
-				break;
-
-			if (limit_match) {
+			if (err == NULL && limit_match) {
 				struct commit_queue_entry *matched;
 
-				matched = alloc_commit_queue_entry(
-				    entry->commit, entry->id);
+				matched = dup_commit_queue_entry(entry);
 				if (matched == NULL) {
 					err = got_error_from_errno(
-					    "alloc_commit_queue_entry");
-					break;
+					    "dup_commit_queue_entry");
+				} else {
+					matched->idx =
+					    a->limit_commits->ncommits;
+					TAILQ_INSERT_TAIL(
+					    &a->limit_commits->head,
+					    matched, entry);
+					a->limit_commits->ncommits++;
 				}
-				matched->commit = entry->commit;
-				got_object_commit_retain(entry->commit);
-
-				matched->idx = a->limit_commits->ncommits;
-				TAILQ_INSERT_TAIL(&a->limit_commits->head,
-				    matched, entry);
-				a->limit_commits->ncommits++;
 			}
 
 			/*
@@ -2444,28 +2597,22 @@ queue_commits(struct tog_log_thread_args *a)
 			a->limit_match = limit_match;
 		}
 
-		if (*a->searching == TOG_SEARCH_FORWARD &&
-		    !*a->search_next_done) {
-			int have_match;
-			err = match_commit(&have_match, &id, commit, a->regex);
-			if (err)
-				break;
-
-			if (*a->limiting) {
-				if (limit_match && have_match)
-					*a->search_next_done =
-					    TOG_SEARCH_HAVE_MORE;
-			} else if (have_match)
-				*a->search_next_done = TOG_SEARCH_HAVE_MORE;
-		}
-
 		errcode = pthread_mutex_unlock(&tog_mutex);
 		if (errcode && err == NULL)
 			err = got_error_set_errno(errcode,
 			    "pthread_mutex_unlock");
+
+		/* The commit stays in the repository's object cache. */
+		got_object_commit_close(commit);
 		if (err)
 			break;
-	} while (*a->searching == TOG_SEARCH_FORWARD && !*a->search_next_done);
+
+		/*
+		 * Keep loading commits while a forward search is in
+		 * progress. The search thread matches them as they appear.
+		 */
+	} while (*a->searching == TOG_SEARCH_FORWARD && !*a->search_next_done &&
+	    !*a->quit);
 
 	return err;
 }
@@ -2521,9 +2668,15 @@ draw_commits(struct tog_view *view)
 		}
 	}
 
-	if (s->thread_args.commits_needed == 0)
+	if (s->thread_args.commits_needed == 0 &&
+	    !(view->searching && view->search_next_done == 0))
 		halfdelay(10); /* disable fast refresh */
 
+	/* Show how far a search in progress has come. */
+	if (view->searching && view->search_next_done == 0 &&
+	    s->search_args.last_entry)
+		entry = s->search_args.last_entry;
+
 	if (s->thread_args.commits_needed > 0 || s->thread_args.load_all) {
 		if (asprintf(&ncommits_str, " [%d/%d] %s",
 		    entry ? entry->idx + 1 : 0, s->commits->ncommits,
@@ -2601,16 +2754,13 @@ draw_commits(struct tog_view *view)
 	ncommits = 0;
 	view->maxx = 0;
 	while (entry) {
-		struct got_commit_object *c = entry->commit;
-		char *author, *eol, *msg, *msg0;
+		char *author;
 		wchar_t *wauthor, *wmsg;
 		int width;
 		if (ncommits >= limit - 1)
 			break;
-		if (s->use_committer)
-			author = strdup(got_object_commit_get_committer(c));
-		else
-			author = strdup(got_object_commit_get_author(c));
+		author = strdup(s->use_committer ?
+		    entry->committer : entry->author);
 		if (author == NULL) {
 			err = got_error_from_errno("strdup");
 			goto done;
@@ -2623,20 +2773,11 @@ draw_commits(struct tog_view *view)
 		free(author);
 		if (err)
 			goto done;
-		err = got_object_commit_get_logmsg(&msg0, c);
-		if (err)
-			goto done;
-		msg = msg0;
-		while (*msg == '\n')
-			++msg;
-		if ((eol = strchr(msg, '\n')))
-			*eol = '\0';
-		err = format_line(&wmsg, &width, NULL, msg, 0, INT_MAX,
-		    date_display_cols + author_cols, 0);
+		err = format_line(&wmsg, &width, NULL, entry->logmsg, 0,
+		    INT_MAX, date_display_cols + author_cols, 0);
 		if (err)
 			goto done;
 		view->maxx = MAX(view->maxx, width);
-		free(msg0);
 		free(wmsg);
 		ncommits++;
 		entry = TAILQ_NEXT(entry, entry);
@@ -2650,8 +2791,8 @@ draw_commits(struct tog_view *view)
 			break;
 		if (ncommits == s->selected)
 			wstandout(view->window);
-		err = draw_commit(view, entry->commit, entry->id,
-		    date_display_cols, author_cols);
+		err = draw_commit(view, entry, date_display_cols,
+		    author_cols);
 		if (ncommits == s->selected)
 			wstandend(view->window);
 		if (err)
@@ -2700,7 +2841,11 @@ trigger_log_thread(struct tog_view *view, int wait)
 
 	while (!ta->log_complete && !tog_thread_error &&
 	    (ta->commits_needed > 0 || ta->load_all)) {
-		/* Wake the log thread. */
+		/*
+		 * Wake the log thread. Once it has loaded the commits we
+		 * need it keeps loading more while the view is idle.
+		 */
+		ta->commits_readahead = TOG_LOG_READAHEAD;
 		errcode = pthread_cond_signal(&ta->need_commits);
 		if (errcode)
 			return got_error_set_errno(errcode,
@@ -2797,22 +2942,31 @@ log_scroll_down(struct tog_view *view, int maxscroll)
 
 static const struct got_error *
 open_diff_view_for_commit(struct tog_view **new_view, int begin_y, int begin_x,
-    struct got_commit_object *commit, struct got_object_id *commit_id,
-    struct tog_view *log_view, struct got_repository *repo)
+    struct got_object_id *commit_id, struct tog_view *log_view,
+    struct got_repository *repo)
 {
 	const struct got_error *err;
+	struct got_commit_object *commit;
 	struct got_object_qid *parent_id;
 	struct tog_view *diff_view;
 
+	err = got_object_open_as_commit(&commit, repo, commit_id);
+	if (err)
+		return err;
+
 	diff_view = view_open(0, 0, begin_y, begin_x, TOG_VIEW_DIFF);
-	if (diff_view == NULL)
-		return got_error_from_errno("view_open");
+	if (diff_view == NULL) {
+		err = got_error_from_errno("view_open");
+		goto done;
+	}
 
 	parent_id = STAILQ_FIRST(got_object_commit_get_parent_ids(commit));
 	err = open_diff_view(diff_view, parent_id ? &parent_id->id : NULL,
 	    commit_id, NULL, NULL, 3, 0, 0, log_view, repo);
 	if (err == NULL)
 		*new_view = diff_view;
+done:
+	got_object_commit_close(commit);
 	return err;
 }
 
@@ -2922,6 +3076,7 @@ browse_commit_tree(struct tog_view **new_view, int begin_y, int begin_x,
 	const struct got_error *err = NULL;
 	struct tog_tree_view_state *s;
 	struct tog_view *tree_view;
+	struct got_commit_object *commit;
 
 	tree_view = view_open(0, 0, begin_y, begin_x, TOG_VIEW_TREE);
 	if (tree_view == NULL)
@@ -2937,7 +3092,12 @@ browse_commit_tree(struct tog_view **new_view, int begin_y, int begin_x,
 	if (got_path_is_root_dir(path))
 		return NULL;
 
-	return tree_view_walk_path(s, entry->commit, path);
+	err = got_object_open_as_commit(&commit, repo, entry->id);
+	if (err)
+		return err;
+	err = tree_view_walk_path(s, commit, path);
+	got_object_commit_close(commit);
+	return err;
 }
 
 static const struct got_error *
@@ -3013,7 +3173,8 @@ log_thread(void *arg)
 					a->commits_needed--;
 			} else
 				a->commits_needed--;
-		}
+		} else if (a->commits_readahead > 0)
+			a->commits_readahead--;
 
 		errcode = pthread_mutex_lock(&tog_mutex);
 		if (errcode) {
@@ -3043,7 +3204,8 @@ log_thread(void *arg)
 		if (done)
 			a->commits_needed = 0;
 		else {
-			if (a->commits_needed == 0 && !a->load_all) {
+			if (a->commits_needed == 0 && !a->load_all &&
+			    a->commits_readahead == 0) {
 				errcode = pthread_cond_wait(&a->need_commits,
 				    &tog_mutex);
 				if (errcode) {
@@ -3116,57 +3278,246 @@ stop_log_thread(struct tog_log_view_state *s)
 	return err ? err : thread_err;
 }
 
-static const struct got_error *
-close_log_view(struct tog_view *view)
+static void *
+log_search_thread(void *arg)
 {
 	const struct got_error *err = NULL;
-	struct tog_log_view_state *s = &view->state.log;
+	struct tog_log_search_args *a = arg;
 	int errcode;
 
-	err = stop_log_thread(s);
+	errcode = pthread_mutex_lock(&tog_mutex);
+	if (errcode) {
+		err = got_error_set_errno(errcode, "pthread_mutex_lock");
+		return (void *)err;
+	}
 
-	errcode = pthread_cond_destroy(&s->thread_args.need_commits);
-	if (errcode && err == NULL)
-		err = got_error_set_errno(errcode, "pthread_cond_destroy");
+	err = block_signals_used_by_main_thread();
+	if (err) {
+		pthread_mutex_unlock(&tog_mutex);
+		goto done;
+	}
 
-	errcode = pthread_cond_destroy(&s->thread_args.commit_loaded);
-	if (errcode && err == NULL)
-		err = got_error_set_errno(errcode, "pthread_cond_destroy");
+	while (!a->quit && !tog_fatal_signal_received()) {
+		const struct got_error *match_err;
+		struct got_object_id id;
+		struct got_commit_object *commit = NULL;
+		struct commit_queue_entry *entry;
+		unsigned int generation;
+		int have_match = 0;
 
-	free_commits(&s->limit_commits);
-	free_commits(&s->real_commits);
-	free(s->in_repo_path);
-	s->in_repo_path = NULL;
-	free(s->start_id);
-	s->start_id = NULL;
-	free(s->head_ref_name);
-	s->head_ref_name = NULL;
-	return err;
+		if (a->state != TOG_LOG_SEARCH_RUNNING) {
+			errcode = pthread_cond_wait(&a->need_search,
+			    &tog_mutex);
+			if (errcode) {
+				err = got_error_set_errno(errcode,
+				    "pthread_cond_wait");
+				pthread_mutex_unlock(&tog_mutex);
+				goto done;
+			}
+			continue;
+		}
+
+		entry = a->next_entry;
+		if (entry == NULL) {
+			/* The main thread decides whether to load more. */
+			a->state = TOG_LOG_SEARCH_WAITING;
+			continue;
+		}
+		memcpy(&id, entry->id, sizeof(id));
+		generation = a->generation;
+
+		/* Open the commit without blocking the main thread. */
+		errcode = pthread_mutex_unlock(&tog_mutex);
+		if (errcode) {
+			err = got_error_set_errno(errcode,
+			    "pthread_mutex_unlock");
+			goto done;
+		}
+		match_err = got_object_open_as_commit(&commit, a->repo, &id);
+		errcode = pthread_mutex_lock(&tog_mutex);
+		if (errcode) {
+			err = got_error_set_errno(errcode, "pthread_mutex_lock");
+			if (commit)
+				got_object_commit_close(commit);
+			goto done;
+		}
+
+		/*
+		 * The search may have been cancelled or restarted while
+		 * the mutex was unlocked, in which case entry may be gone.
+		 */
+		if (a->state != TOG_LOG_SEARCH_RUNNING ||
+		    a->generation != generation) {
+			if (commit)
+				got_object_commit_close(commit);
+			continue;
+		}
+
+		if (match_err == NULL) {
+			match_err = match_commit(&have_match, &id, commit,
+			    a->regex);
+			got_object_commit_close(commit);
+		}
+		if (match_err) {
+			a->err = match_err;
+			a->state = TOG_LOG_SEARCH_ERROR;
+		} else if (have_match) {
+			a->found_entry = entry;
+			a->state = TOG_LOG_SEARCH_FOUND;
+		} else {
+			a->last_entry = entry;
+			if (a->direction == TOG_SEARCH_FORWARD)
+				a->next_entry = TAILQ_NEXT(entry, entry);
+			else
+				a->next_entry = TAILQ_PREV(entry,
+				    commit_queue_head, entry);
+		}
+	}
+
+	errcode = pthread_mutex_unlock(&tog_mutex);
+	if (errcode)
+		err = got_error_set_errno(errcode, "pthread_mutex_unlock");
+done:
+	if (err)
+		tog_thread_error = 1;
+	return (void *)err;
 }
 
-/*
- * We use two queues to implement the limit feature: first consists of
- * commits matching the current limit_regex; second is the real queue
- * of all known commits (real_commits). When the user starts limiting,
- * we swap queues such that all movement and displaying functionality
- * works with very slight change.
- */
 static const struct got_error *
-limit_log_view(struct tog_view *view)
+start_log_search_thread(struct tog_view *view)
 {
+	const struct got_error *err;
 	struct tog_log_view_state *s = &view->state.log;
-	struct commit_queue_entry *entry;
-	struct tog_view	*v = view;
-	const struct got_error *err = NULL;
-	char pattern[1024];
-	int ret;
+	struct tog_log_search_args *a = &s->search_args;
+	int errcode;
 
-	if (view_is_hsplit_top(view))
-		v = view->child;
-	else if (view->mode == TOG_VIEW_SPLIT_VERT && view->parent)
-		v = view->parent;
+	if (s->search_thread)
+		return NULL;
 
-	/* Get the pattern */
+	if (a->pack_fds == NULL) {
+		err = got_repo_pack_fds_open(&a->pack_fds);
+		if (err)
+			return err;
+	}
+	if (a->repo == NULL) {
+		err = got_repo_open(&a->repo, got_repo_get_path(s->repo),
+		    NULL, a->pack_fds);
+		if (err)
+			return err;
+	}
+	a->regex = &view->regex;
+	a->quit = 0;
+
+	errcode = pthread_create(&s->search_thread, NULL, log_search_thread,
+	    a);
+	if (errcode) {
+		s->search_thread = NULL;
+		return got_error_set_errno(errcode, "pthread_create");
+	}
+	return NULL;
+}
+
+static const struct got_error *
+stop_log_search_thread(struct tog_log_view_state *s)
+{
+	const struct got_error *err = NULL, *thread_err = NULL;
+	struct tog_log_search_args *a = &s->search_args;
+	int errcode;
+
+	if (s->search_thread) {
+		a->quit = 1;
+		errcode = pthread_cond_signal(&a->need_search);
+		if (errcode)
+			return got_error_set_errno(errcode,
+			    "pthread_cond_signal");
+		errcode = pthread_mutex_unlock(&tog_mutex);
+		if (errcode)
+			return got_error_set_errno(errcode,
+			    "pthread_mutex_unlock");
+		errcode = pthread_join(s->search_thread, (void **)&thread_err);
+		if (errcode)
+			return got_error_set_errno(errcode, "pthread_join");
+		errcode = pthread_mutex_lock(&tog_mutex);
+		if (errcode)
+			return got_error_set_errno(errcode,
+			    "pthread_mutex_lock");
+		s->search_thread = NULL;
+	}
+
+	if (a->repo) {
+		err = got_repo_close(a->repo);
+		a->repo = NULL;
+	}
+
+	if (a->pack_fds) {
+		const struct got_error *pack_err =
+		    got_repo_pack_fds_close(a->pack_fds);
+		if (err == NULL)
+			err = pack_err;
+		a->pack_fds = NULL;
+	}
+
+	return err ? err : thread_err;
+}
+
+static const struct got_error *
+close_log_view(struct tog_view *view)
+{
+	const struct got_error *err = NULL, *log_err;
+	struct tog_log_view_state *s = &view->state.log;
+	int errcode;
+
+	err = stop_log_search_thread(s);
+	log_err = stop_log_thread(s);
+	if (err == NULL)
+		err = log_err;
+
+	errcode = pthread_cond_destroy(&s->thread_args.need_commits);
+	if (errcode && err == NULL)
+		err = got_error_set_errno(errcode, "pthread_cond_destroy");
+
+	errcode = pthread_cond_destroy(&s->thread_args.commit_loaded);
+	if (errcode && err == NULL)
+		err = got_error_set_errno(errcode, "pthread_cond_destroy");
+
+	errcode = pthread_cond_destroy(&s->search_args.need_search);
+	if (errcode && err == NULL)
+		err = got_error_set_errno(errcode, "pthread_cond_destroy");
+
+	free_commits(&s->limit_commits);
+	free_commits(&s->real_commits);
+	free(s->in_repo_path);
+	s->in_repo_path = NULL;
+	free(s->start_id);
+	s->start_id = NULL;
+	free(s->head_ref_name);
+	s->head_ref_name = NULL;
+	return err;
+}
+
+/*
+ * We use two queues to implement the limit feature: first consists of
+ * commits matching the current limit_regex; second is the real queue
+ * of all known commits (real_commits). When the user starts limiting,
+ * we swap queues such that all movement and displaying functionality
+ * works with very slight change.
+ */
+static const struct got_error *
+limit_log_view(struct tog_view *view)
+{
+	struct tog_log_view_state *s = &view->state.log;
+	struct commit_queue_entry *entry;
+	struct tog_view	*v = view;
+	const struct got_error *err = NULL;
+	char pattern[1024];
+	int ret;
+
+	if (view_is_hsplit_top(view))
+		v = view->child;
+	else if (view->mode == TOG_VIEW_SPLIT_VERT && view->parent)
+		v = view->parent;
+
+	/* Get the pattern */
 	wmove(v->window, v->nlines - 1, 0);
 	wclrtoeol(v->window);
 	mvwaddstr(v->window, v->nlines - 1, 0, "&/");
@@ -3224,23 +3575,20 @@ limit_log_view(struct tog_view *view)
 	TAILQ_FOREACH(entry, &s->real_commits.head, entry) {
 		int have_match = 0;
 
-		err = match_commit(&have_match, entry->id,
-		    entry->commit, &s->limit_regex);
+		err = match_commit_entry(&have_match, entry, &s->limit_regex,
+		    s->repo);
 		if (err)
 			return err;
 
 		if (have_match) {
 			struct commit_queue_entry *matched;
 
-			matched = alloc_commit_queue_entry(entry->commit,
-			    entry->id);
+			matched = dup_commit_queue_entry(entry);
 			if (matched == NULL) {
 				err = got_error_from_errno(
-				    "alloc_commit_queue_entry");
+				    "dup_commit_queue_entry");
 				break;
 			}
-			matched->commit = entry->commit;
-			got_object_commit_retain(entry->commit);
 
 			matched->idx = s->limit_commits.ncommits;
 			TAILQ_INSERT_TAIL(&s->limit_commits.head,
@@ -3266,13 +3614,23 @@ limit_log_view(struct tog_view *view)
 	return NULL;
 }
 
+static void
+cancel_log_search(struct tog_log_search_args *a)
+{
+	a->state = TOG_LOG_SEARCH_IDLE;
+	a->generation++;
+	a->next_entry = NULL;
+	a->last_entry = NULL;
+	a->found_entry = NULL;
+}
+
 static const struct got_error *
 search_start_log_view(struct tog_view *view)
 {
 	struct tog_log_view_state *s = &view->state.log;
 
+	cancel_log_search(&s->search_args);
 	s->matched_entry = NULL;
-	s->search_entry = NULL;
 	return NULL;
 }
 
@@ -3281,87 +3639,113 @@ search_next_log_view(struct tog_view *view)
 {
 	const struct got_error *err = NULL;
 	struct tog_log_view_state *s = &view->state.log;
+	struct tog_log_search_args *a = &s->search_args;
 	struct commit_queue_entry *entry;
+	int errcode, ch;
 
 	/* Display progress update in log view. */
 	show_log_view(view);
 	update_panels();
 	doupdate();
 
-	if (s->search_entry) {
-		int errcode, ch;
-		errcode = pthread_mutex_unlock(&tog_mutex);
-		if (errcode)
-			return got_error_set_errno(errcode,
-			    "pthread_mutex_unlock");
-		ch = wgetch(view->window);
-		errcode = pthread_mutex_lock(&tog_mutex);
+	if (a->state == TOG_LOG_SEARCH_IDLE) {
+		err = start_log_search_thread(view);
+		if (err)
+			return err;
+
+		if (s->matched_entry) {
+			/*
+			 * If the user has moved the cursor after we hit a
+			 * match, the position from where we should continue
+			 * searching might have changed.
+			 */
+			a->last_entry = s->selected_entry;
+			if (view->searching == TOG_SEARCH_FORWARD)
+				entry = TAILQ_NEXT(s->selected_entry, entry);
+			else
+				entry = TAILQ_PREV(s->selected_entry,
+				    commit_queue_head, entry);
+		} else
+			entry = s->selected_entry;
+
+		a->direction = view->searching;
+		a->next_entry = entry;
+		a->found_entry = NULL;
+		a->err = NULL;
+		a->generation++;
+		a->state = TOG_LOG_SEARCH_RUNNING;
+		errcode = pthread_cond_signal(&a->need_search);
 		if (errcode)
 			return got_error_set_errno(errcode,
-			    "pthread_mutex_lock");
-		if (ch == CTRL('g') || ch == KEY_BACKSPACE) {
-			view->search_next_done = TOG_SEARCH_HAVE_MORE;
-			return NULL;
-		}
-		if (view->searching == TOG_SEARCH_FORWARD)
-			entry = TAILQ_NEXT(s->search_entry, entry);
-		else
-			entry = TAILQ_PREV(s->search_entry,
-			    commit_queue_head, entry);
-	} else if (s->matched_entry) {
-		/*
-		 * If the user has moved the cursor after we hit a match,
-		 * the position from where we should continue searching
-		 * might have changed.
-		 */
-		if (view->searching == TOG_SEARCH_FORWARD)
-			entry = TAILQ_NEXT(s->selected_entry, entry);
-		else
-			entry = TAILQ_PREV(s->selected_entry, commit_queue_head,
-			    entry);
-	} else {
-		entry = s->selected_entry;
+			    "pthread_cond_signal");
 	}
 
-	while (1) {
-		int have_match = 0;
+	/* Let the search make progress; C-g or backspace aborts. */
+	halfdelay(1);
+	nodelay(view->window, FALSE);
+	errcode = pthread_mutex_unlock(&tog_mutex);
+	if (errcode)
+		return got_error_set_errno(errcode, "pthread_mutex_unlock");
+	ch = wgetch(view->window);
+	errcode = pthread_mutex_lock(&tog_mutex);
+	if (errcode)
+		return got_error_set_errno(errcode, "pthread_mutex_lock");
+	nodelay(view->window, TRUE);
+	if (ch == CTRL('g') || ch == KEY_BACKSPACE) {
+		cancel_log_search(a);
+		view->search_next_done = TOG_SEARCH_HAVE_MORE;
+		return NULL;
+	}
 
-		if (entry == NULL) {
-			if (s->thread_args.log_complete ||
-			    view->searching == TOG_SEARCH_BACKWARD) {
-				view->search_next_done =
-				    (s->matched_entry == NULL ?
-				    TOG_SEARCH_HAVE_NONE : TOG_SEARCH_NO_MORE);
-				s->search_entry = NULL;
-				return NULL;
+	switch (a->state) {
+	case TOG_LOG_SEARCH_WAITING:
+		if (a->direction == TOG_SEARCH_FORWARD) {
+			if (a->last_entry)
+				entry = TAILQ_NEXT(a->last_entry, entry);
+			else
+				entry = TAILQ_FIRST(&s->commits->head);
+			if (entry) {
+				/* More commits were loaded meanwhile. */
+				a->next_entry = entry;
+				a->state = TOG_LOG_SEARCH_RUNNING;
+				errcode = pthread_cond_signal(&a->need_search);
+				if (errcode)
+					return got_error_set_errno(errcode,
+					    "pthread_cond_signal");
+				break;
+			}
+			if (!s->thread_args.log_complete) {
+				/*
+				 * Poke the log thread for more commits. It
+				 * keeps loading until the search is done.
+				 */
+				if (s->thread_args.commits_needed > 0)
+					break;
+				s->thread_args.commits_needed++;
+				return trigger_log_thread(view, 0);
 			}
-			/*
-			 * Poke the log thread for more commits and return,
-			 * allowing the main loop to make progress. Search
-			 * will resume at s->search_entry once we come back.
-			 */
-			s->thread_args.commits_needed++;
-			return trigger_log_thread(view, 0);
-		}
-
-		err = match_commit(&have_match, entry->id, entry->commit,
-		    &view->regex);
-		if (err)
-			break;
-		if (have_match) {
-			view->search_next_done = TOG_SEARCH_HAVE_MORE;
-			s->matched_entry = entry;
-			break;
 		}
-
-		s->search_entry = entry;
-		if (view->searching == TOG_SEARCH_FORWARD)
-			entry = TAILQ_NEXT(entry, entry);
-		else
-			entry = TAILQ_PREV(entry, commit_queue_head, entry);
+		cancel_log_search(a);
+		view->search_next_done = (s->matched_entry == NULL ?
+		    TOG_SEARCH_HAVE_NONE : TOG_SEARCH_NO_MORE);
+		break;
+	case TOG_LOG_SEARCH_ERROR:
+		err = a->err;
+		cancel_log_search(a);
+		view->search_next_done = TOG_SEARCH_HAVE_MORE;
+		return err;
+	case TOG_LOG_SEARCH_FOUND:
+		s->matched_entry = a->found_entry;
+		cancel_log_search(a);
+		view->search_next_done = TOG_SEARCH_HAVE_MORE;
+		break;
+	default:
+		/* Search is still in progress. */
+		return NULL;
 	}
 
-	if (s->matched_entry) {
+	if (s->matched_entry &&
+	    view->search_next_done == TOG_SEARCH_HAVE_MORE) {
 		int cur = s->selected_entry->idx;
 		while (cur < s->matched_entry->idx) {
 			err = input_log_view(NULL, view, KEY_DOWN);
@@ -3377,8 +3761,6 @@ search_next_log_view(struct tog_view *view)
 		}
 	}
 
-	s->search_entry = NULL;
-
 	return NULL;
 }
 
@@ -3480,6 +3862,11 @@ open_log_view(struct tog_view *view, struct got_object_id *start_id,
 		err = got_error_set_errno(errcode, "pthread_cond_init");
 		goto done;
 	}
+	errcode = pthread_cond_init(&s->search_args.need_search, NULL);
+	if (errcode) {
+		err = got_error_set_errno(errcode, "pthread_cond_init");
+		goto done;
+	}
 
 	s->thread_args.commits_needed = view->nlines;
 	s->thread_args.graph = thread_graph;
@@ -3494,7 +3881,6 @@ open_log_view(struct tog_view *view, struct got_object_id *start_id,
 	s->thread_args.selected_entry = &s->selected_entry;
 	s->thread_args.searching = &view->searching;
 	s->thread_args.search_next_done = &view->search_next_done;
-	s->thread_args.regex = &view->regex;
 	s->thread_args.limiting = &s->limit_view;
 	s->thread_args.limit_regex = &s->limit_regex;
 	s->thread_args.limit_commits = &s->limit_commits;
@@ -3921,7 +4307,7 @@ input_log_view(struct tog_view **new_view, struct tog_view *view, int ch)
 		s->quit = 0;
 		s->thread_args.commits_needed = view->lines;
 		s->matched_entry = NULL;
-		s->search_entry = NULL;
+		cancel_log_search(&s->search_args);
 		view->offset = 0;
 		break;
 	case 'R':
@@ -4422,6 +4808,12 @@ draw_file(struct tog_view *view, const char *header)
 		enum got_diff_line_type linetype;
 		attr_t attr = 0;
 
+		/* A diff in progress may end with an incomplete line. */
+		if (s->diffing && s->lineno + 1 >= s->nlines) {
+			s->eof = 1;
+			break;
+		}
+
 		linelen = getline(&line, &linesize, s->f);
 		if (linelen == -1) {
 			if (feof(s->f)) {
@@ -4498,7 +4890,7 @@ draw_file(struct tog_view *view, const char *header)
 
 	view_border(view);
 
-	if (s->eof) {
+	if (s->eof && !s->diffing) {
 		while (nprinted < view->nlines) {
 			waddch(view->window, '\n');
 			nprinted++;
@@ -4520,6 +4912,36 @@ draw_file(struct tog_view *view, const char *header)
 	return NULL;
 }
 
+static const struct got_error *
+draw_diff_progress(struct tog_view *view, const char *header)
+{
+	const struct got_error *err;
+	char *line;
+	wchar_t *wline;
+	int width;
+
+	werase(view->window);
+
+	if (asprintf(&line, "[diffing...] %s", header) == -1)
+		return got_error_from_errno("asprintf");
+	err = format_line(&wline, &width, NULL, line, 0, view->ncols, 0, 0);
+	free(line);
+	if (err)
+		return err;
+
+	if (view_needs_focus_indication(view))
+		wstandout(view->window);
+	waddwstr(view->window, wline);
+	free(wline);
+	while (width++ < view->ncols)
+		waddch(view->window, ' ');
+	if (view_needs_focus_indication(view))
+		wstandend(view->window);
+
+	view_border(view);
+	return NULL;
+}
+
 static char *
 get_datestr(time_t *time, char *datebuf)
 {
@@ -4603,7 +5025,7 @@ cat_diff(FILE *dst, FILE *src, struct got_diff_line **d_lines, size_t *d_nlines,
 
 static const struct got_error *
 write_commit_info(struct got_diff_line **lines, size_t *nlines,
-    struct got_object_id *commit_id, struct got_reflist_head *refs,
+    struct got_object_id *commit_id, const char *refs_str,
     struct got_repository *repo, int ignore_ws, int force_text_diff,
     struct got_diffstat_cb_arg *dsa, FILE *outfile)
 {
@@ -4613,17 +5035,10 @@ write_commit_info(struct got_diff_line **lines, size_t *nlines,
 	char *id_str = NULL, *logmsg = NULL, *s = NULL, *line;
 	time_t committer_time;
 	const char *author, *committer;
-	char *refs_str = NULL;
 	struct got_pathlist_entry *pe;
 	off_t outoff = 0;
 	int n;
 
-	if (refs) {
-		err = build_refs_str(&refs_str, refs, commit_id, repo);
-		if (err)
-			return err;
-	}
-
 	err = got_object_open_as_commit(&commit, repo, commit_id);
 	if (err)
 		return err;
@@ -4772,7 +5187,6 @@ write_commit_info(struct got_diff_line **lines, size_t *nlines,
 done:
 	free(id_str);
 	free(logmsg);
-	free(refs_str);
 	got_object_commit_close(commit);
 	if (err) {
 		free(*lines);
@@ -4783,116 +5197,224 @@ done:
 }
 
 static const struct got_error *
-create_diff(struct tog_diff_view_state *s)
+diff_thread_cancel(void *arg)
+{
+	struct tog_diff_progress_arg *pa = arg;
+	struct tog_diff_thread_args *a = pa->a;
+	int errcode, cancelled;
+
+	errcode = pthread_mutex_lock(&tog_mutex);
+	if (errcode)
+		return got_error_set_errno(errcode, "pthread_mutex_lock");
+	cancelled = (a->quit || a->generation != pa->generation ||
+	    tog_fatal_signal_received());
+	errcode = pthread_mutex_unlock(&tog_mutex);
+	if (errcode)
+		return got_error_set_errno(errcode, "pthread_mutex_unlock");
+
+	return cancelled ? got_error(GOT_ERR_CANCELLED) : NULL;
+}
+
+/* Make the diff output produced so far available to the diff view. */
+static const struct got_error *
+diff_thread_progress(void *arg, struct got_diff_line *lines, size_t nlines)
+{
+	const struct got_error *err = NULL;
+	struct tog_diff_progress_arg *pa = arg;
+	struct tog_diff_thread_args *a = pa->a;
+	struct got_diff_line *p;
+	int errcode;
+
+	errcode = pthread_mutex_lock(&tog_mutex);
+	if (errcode)
+		return got_error_set_errno(errcode, "pthread_mutex_lock");
+
+	if (a->quit || a->generation != pa->generation) {
+		err = got_error(GOT_ERR_CANCELLED);
+		goto done;
+	}
+
+	if (pa->f) {
+		a->partial_f = pa->f;
+		pa->f = NULL;
+	}
+
+	/* Lines which were reported before do not change. */
+	if (nlines > a->partial_nlines) {
+		p = reallocarray(a->partial_lines, nlines, sizeof(*p));
+		if (p == NULL) {
+			err = got_error_from_errno("reallocarray");
+			goto done;
+		}
+		memcpy(&p[a->partial_nlines], &lines[a->partial_nlines],
+		    (nlines - a->partial_nlines) * sizeof(*p));
+		a->partial_lines = p;
+		a->partial_nlines = nlines;
+	}
+done:
+	errcode = pthread_mutex_unlock(&tog_mutex);
+	if (errcode && err == NULL)
+		err = got_error_set_errno(errcode, "pthread_mutex_unlock");
+	return err;
+}
+
+/*
+ * Open a temporary file for diff output, and a second handle on this file
+ * which allows the diff view to read output while more is being written.
+ */
+static const struct got_error *
+open_diff_output(FILE **f, FILE **reader)
+{
+	const struct got_error *err = NULL;
+	char *path = NULL;
+
+	*reader = NULL;
+
+	err = got_opentemp_named(&path, f, GOT_TMPDIR_STR "/tog-diff", "");
+	if (err)
+		return err;
+
+	*reader = fopen(path, "r");
+	if (*reader == NULL)
+		err = got_error_from_errno2("fopen", path);
+	if (unlink(path) == -1 && err == NULL)
+		err = got_error_from_errno2("unlink", path);
+	free(path);
+	return err;
+}
+
+static const struct got_error *
+create_diff(FILE **outfile, struct got_diff_line **out_lines,
+    size_t *out_nlines, size_t *out_ninfo, struct tog_diff_thread_args *a,
+    struct tog_diff_request *r, unsigned int generation)
 {
 	const struct got_error *err = NULL;
 	FILE *f = NULL, *tmp_diff_file = NULL;
 	int obj_type;
-	struct got_diff_line *lines = NULL;
+	struct got_diff_line *lines = NULL, *diff_lines = NULL;
+	size_t nlines = 0, ninfo = 0;
 	struct got_pathlist_head changed_paths;
+	struct tog_diff_progress_arg pa;
 
 	TAILQ_INIT(&changed_paths);
 
-	free(s->lines);
-	s->lines = malloc(sizeof(*s->lines));
-	if (s->lines == NULL)
+	*outfile = NULL;
+	*out_lines = NULL;
+	*out_nlines = 0;
+	*out_ninfo = 0;
+
+	pa.a = a;
+	pa.generation = generation;
+	pa.f = NULL;
+
+	lines = malloc(sizeof(*lines));
+	if (lines == NULL)
 		return got_error_from_errno("malloc");
-	s->nlines = 0;
 
-	f = got_opentemp();
-	if (f == NULL) {
-		err = got_error_from_errno("got_opentemp");
-		goto done;
-	}
-	tmp_diff_file = got_opentemp();
-	if (tmp_diff_file == NULL) {
-		err = got_error_from_errno("got_opentemp");
-		goto done;
-	}
-	if (s->f && fclose(s->f) == EOF) {
-		err = got_error_from_errno("fclose");
+	if (r->id1)
+		err = got_object_get_type(&obj_type, a->repo, r->id1);
+	else
+		err = got_object_get_type(&obj_type, a->repo, r->id2);
+	if (err)
 		goto done;
-	}
-	s->f = f;
 
-	if (s->id1)
-		err = got_object_get_type(&obj_type, s->repo, s->id1);
-	else
-		err = got_object_get_type(&obj_type, s->repo, s->id2);
+	/*
+	 * Diffs of trees and commits are shown while they are being
+	 * created. The diff of a commit is prefixed with commit info
+	 * once it is complete.
+	 */
+	if (obj_type == GOT_OBJ_TYPE_TREE)
+		err = open_diff_output(&f, &pa.f);
+	else {
+		f = got_opentemp();
+		if (f == NULL)
+			err = got_error_from_errno("got_opentemp");
+	}
 	if (err)
 		goto done;
+	if (obj_type == GOT_OBJ_TYPE_COMMIT) {
+		err = open_diff_output(&tmp_diff_file, &pa.f);
+		if (err)
+			goto done;
+	}
 
 	switch (obj_type) {
 	case GOT_OBJ_TYPE_BLOB:
-		err = got_diff_objects_as_blobs(&s->lines, &s->nlines,
-		    s->f1, s->f2, s->fd1, s->fd2, s->id1, s->id2,
-		    s->label1, s->label2, tog_diff_algo, s->diff_context,
-		    s->ignore_whitespace, s->force_text_diff, NULL, s->repo,
-		    s->f);
+		err = got_diff_objects_as_blobs(&lines, &nlines,
+		    a->f1, a->f2, a->fd1, a->fd2, r->id1, r->id2,
+		    a->label1, a->label2, r->diff_algo, r->diff_context,
+		    r->ignore_whitespace, r->force_text_diff, NULL, a->repo,
+		    f);
 		break;
 	case GOT_OBJ_TYPE_TREE:
-		err = got_diff_objects_as_trees(&s->lines, &s->nlines,
-		    s->f1, s->f2, s->fd1, s->fd2, s->id1, s->id2, NULL, "", "",
-		    tog_diff_algo, s->diff_context, s->ignore_whitespace,
-		    s->force_text_diff, NULL, s->repo, s->f);
+		err = got_diff_objects_as_trees(&lines, &nlines,
+		    a->f1, a->f2, a->fd1, a->fd2, r->id1, r->id2, NULL, "", "",
+		    r->diff_algo, r->diff_context, r->ignore_whitespace,
+		    r->force_text_diff, NULL, diff_thread_progress, &pa,
+		    diff_thread_cancel, &pa, a->repo, f);
 		break;
 	case GOT_OBJ_TYPE_COMMIT: {
 		const struct got_object_id_queue *parent_ids;
 		struct got_object_qid *pid;
 		struct got_commit_object *commit2;
-		struct got_reflist_head *refs;
-		size_t nlines = 0;
+		size_t diff_nlines = 0;
 		struct got_diffstat_cb_arg dsa = {
 			0, 0, 0, 0, 0, 0,
 			&changed_paths,
-			s->ignore_whitespace,
-			s->force_text_diff,
-			tog_diff_algo
+			r->ignore_whitespace,
+			r->force_text_diff,
+			r->diff_algo
 		};
 
-		lines = malloc(sizeof(*lines));
-		if (lines == NULL) {
+		diff_lines = malloc(sizeof(*diff_lines));
+		if (diff_lines == NULL) {
 			err = got_error_from_errno("malloc");
 			goto done;
 		}
 
 		/* build diff first in tmp file then append to commit info */
-		err = got_diff_objects_as_commits(&lines, &nlines,
-		    s->f1, s->f2, s->fd1, s->fd2, s->id1, s->id2, NULL,
-		    tog_diff_algo, s->diff_context, s->ignore_whitespace,
-		    s->force_text_diff, &dsa, s->repo, tmp_diff_file);
+		err = got_diff_objects_as_commits(&diff_lines, &diff_nlines,
+		    a->f1, a->f2, a->fd1, a->fd2, r->id1, r->id2, NULL,
+		    r->diff_algo, r->diff_context, r->ignore_whitespace,
+		    r->force_text_diff, &dsa, diff_thread_progress, &pa,
+		    diff_thread_cancel, &pa, a->repo, tmp_diff_file);
 		if (err)
 			break;
 
-		err = got_object_open_as_commit(&commit2, s->repo, s->id2);
+		err = got_object_open_as_commit(&commit2, a->repo, r->id2);
 		if (err)
 			goto done;
-		refs = got_reflist_object_id_map_lookup(tog_refs_idmap, s->id2);
 		/* Show commit info if we're diffing to a parent/root commit. */
-		if (s->id1 == NULL) {
-			err = write_commit_info(&s->lines, &s->nlines, s->id2,
-			    refs, s->repo, s->ignore_whitespace,
-			    s->force_text_diff, &dsa, s->f);
-			if (err)
+		if (r->id1 == NULL) {
+			err = write_commit_info(&lines, &nlines, r->id2,
+			    r->refs_str, a->repo, r->ignore_whitespace,
+			    r->force_text_diff, &dsa, f);
+			if (err) {
+				got_object_commit_close(commit2);
 				goto done;
+			}
 		} else {
 			parent_ids = got_object_commit_get_parent_ids(commit2);
 			STAILQ_FOREACH(pid, parent_ids, entry) {
-				if (got_object_id_cmp(s->id1, &pid->id) == 0) {
-					err = write_commit_info(&s->lines,
-					    &s->nlines, s->id2, refs, s->repo,
-					    s->ignore_whitespace,
-					    s->force_text_diff, &dsa, s->f);
-					if (err)
+				if (got_object_id_cmp(r->id1, &pid->id) == 0) {
+					err = write_commit_info(&lines,
+					    &nlines, r->id2, r->refs_str,
+					    a->repo, r->ignore_whitespace,
+					    r->force_text_diff, &dsa, f);
+					if (err) {
+						got_object_commit_close(
+						    commit2);
 						goto done;
+					}
 					break;
 				}
 			}
 		}
 		got_object_commit_close(commit2);
+		ninfo = nlines;
 
-		err = cat_diff(s->f, tmp_diff_file, &s->lines, &s->nlines,
-		    lines, nlines);
+		err = cat_diff(f, tmp_diff_file, &lines, &nlines,
+		    diff_lines, diff_nlines);
 		break;
 	}
 	default:
@@ -4900,21 +5422,286 @@ create_diff(struct tog_diff_view_state *s)
 		break;
 	}
 done:
-	free(lines);
+	free(diff_lines);
 	got_pathlist_free(&changed_paths, GOT_PATHLIST_FREE_ALL);
-	if (s->f && fflush(s->f) != 0 && err == NULL)
+	if (f && fflush(f) != 0 && err == NULL)
 		err = got_error_from_errno("fflush");
 	if (tmp_diff_file && fclose(tmp_diff_file) == EOF && err == NULL)
 		err = got_error_from_errno("fclose");
+	if (pa.f && fclose(pa.f) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (err) {
+		if (f)
+			fclose(f);
+		free(lines);
+	} else {
+		*outfile = f;
+		*out_lines = lines;
+		*out_nlines = nlines;
+		*out_ninfo = ninfo;
+	}
 	return err;
 }
 
 static void
-diff_view_indicate_progress(struct tog_view *view)
+free_diff_request(struct tog_diff_request *r)
 {
-	mvwaddstr(view->window, 0, 0, "diffing...");
-	update_panels();
-	doupdate();
+	if (r == NULL)
+		return;
+	free(r->id1);
+	free(r->id2);
+	free(r->refs_str);
+	free(r);
+}
+
+static const struct got_error *
+free_diff_thread_args(struct tog_diff_thread_args *a)
+{
+	const struct got_error *err = NULL, *close_err;
+	int errcode;
+
+	if (a->repo) {
+		err = got_repo_close(a->repo);
+		a->repo = NULL;
+	}
+	if (a->pack_fds) {
+		close_err = got_repo_pack_fds_close(a->pack_fds);
+		if (err == NULL)
+			err = close_err;
+		a->pack_fds = NULL;
+	}
+	if (a->f1 && fclose(a->f1) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (a->f2 && fclose(a->f2) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (a->fd1 != -1 && close(a->fd1) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	if (a->fd2 != -1 && close(a->fd2) == -1 && err == NULL)
+		err = got_error_from_errno("close");
+	if (a->f && fclose(a->f) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	if (a->partial_f && fclose(a->partial_f) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	free(a->lines);
+	free(a->partial_lines);
+	free(a->label1);
+	free(a->label2);
+	free_diff_request(a->request);
+	errcode = pthread_cond_destroy(&a->need_diff);
+	if (errcode && err == NULL)
+		err = got_error_set_errno(errcode, "pthread_cond_destroy");
+	free(a);
+	return err;
+}
+
+static void *
+diff_thread(void *arg)
+{
+	const struct got_error *err = NULL;
+	struct tog_diff_thread_args *a = arg;
+	int errcode;
+
+	errcode = pthread_mutex_lock(&tog_mutex);
+	if (errcode) {
+		err = got_error_set_errno(errcode, "pthread_mutex_lock");
+		return (void *)err;
+	}
+
+	err = block_signals_used_by_main_thread();
+	if (err) {
+		pthread_mutex_unlock(&tog_mutex);
+		goto done;
+	}
+
+	while (!a->quit && !tog_fatal_signal_received()) {
+		const struct got_error *diff_err;
+		struct tog_diff_request *r;
+		struct got_diff_line *lines;
+		size_t nlines, ninfo;
+		unsigned int generation;
+		FILE *f;
+
+		if (a->request == NULL) {
+			errcode = pthread_cond_wait(&a->need_diff, &tog_mutex);
+			if (errcode) {
+				err = got_error_set_errno(errcode,
+				    "pthread_cond_wait");
+				pthread_mutex_unlock(&tog_mutex);
+				goto done;
+			}
+			continue;
+		}
+
+		r = a->request;
+		a->request = NULL;
+		generation = a->generation;
+
+		errcode = pthread_mutex_unlock(&tog_mutex);
+		if (errcode) {
+			err = got_error_set_errno(errcode,
+			    "pthread_mutex_unlock");
+			free_diff_request(r);
+			goto done;
+		}
+		diff_err = create_diff(&f, &lines, &nlines, &ninfo, a, r,
+		    generation);
+		free_diff_request(r);
+		errcode = pthread_mutex_lock(&tog_mutex);
+		if (errcode) {
+			err = got_error_set_errno(errcode, "pthread_mutex_lock");
+			if (f)
+				fclose(f);
+			free(lines);
+			goto done;
+		}
+
+		if (a->quit || generation != a->generation) {
+			/* The view was closed or has asked for another diff. */
+			if (f)
+				fclose(f);
+			free(lines);
+			continue;
+		}
+
+		a->f = f;
+		a->lines = lines;
+		a->nlines = nlines;
+		a->ninfo = ninfo;
+		a->err = diff_err;
+		a->complete = 1;
+	}
+
+	errcode = pthread_mutex_unlock(&tog_mutex);
+	if (errcode)
+		err = got_error_set_errno(errcode, "pthread_mutex_unlock");
+done:
+	if (err)
+		tog_thread_error = 1;
+	return (void *)err;
+}
+
+static const struct got_error *
+stop_diff_thread(struct tog_diff_view_state *s)
+{
+	const struct got_error *err = NULL, *thread_err = NULL;
+	struct tog_diff_thread_args *a = s->thread_args;
+	int errcode;
+
+	if (a == NULL)
+		return NULL;
+
+	if (s->thread) {
+		a->quit = 1;
+		errcode = pthread_cond_signal(&a->need_diff);
+		if (errcode)
+			return got_error_set_errno(errcode,
+			    "pthread_cond_signal");
+		/* A diff in progress is cancelled between files. */
+		errcode = pthread_mutex_unlock(&tog_mutex);
+		if (errcode)
+			return got_error_set_errno(errcode,
+			    "pthread_mutex_unlock");
+		errcode = pthread_join(s->thread, (void **)&thread_err);
+		if (errcode)
+			return got_error_set_errno(errcode, "pthread_join");
+		errcode = pthread_mutex_lock(&tog_mutex);
+		if (errcode)
+			return got_error_set_errno(errcode,
+			    "pthread_mutex_lock");
+		s->thread = NULL;
+	}
+
+	err = free_diff_thread_args(a);
+	s->thread_args = NULL;
+	return err ? err : thread_err;
+}
+
+static const struct got_error *
+request_diff(struct tog_view *view)
+{
+	const struct got_error *err = NULL;
+	struct tog_diff_view_state *s = &view->state.diff;
+	struct tog_diff_thread_args *a = s->thread_args;
+	struct tog_diff_request *r;
+	struct got_reflist_head *refs;
+	int errcode;
+
+	r = calloc(1, sizeof(*r));
+	if (r == NULL)
+		return got_error_from_errno("calloc");
+
+	if (s->id1) {
+		r->id1 = got_object_id_dup(s->id1);
+		if (r->id1 == NULL) {
+			err = got_error_from_errno("got_object_id_dup");
+			goto done;
+		}
+	}
+	r->id2 = got_object_id_dup(s->id2);
+	if (r->id2 == NULL) {
+		err = got_error_from_errno("got_object_id_dup");
+		goto done;
+	}
+
+	/* The reference map belongs to the main thread. */
+	refs = got_reflist_object_id_map_lookup(tog_refs_idmap, s->id2);
+	if (refs) {
+		err = build_refs_str(&r->refs_str, refs, s->id2, s->repo);
+		if (err)
+			goto done;
+	}
+
+	r->diff_context = s->diff_context;
+	r->ignore_whitespace = s->ignore_whitespace;
+	r->force_text_diff = s->force_text_diff;
+	r->diff_algo = tog_diff_algo;
+
+	/* Drop any result which has not been displayed yet. */
+	if (a->complete) {
+		if (a->f && fclose(a->f) == EOF)
+			err = got_error_from_errno("fclose");
+		a->f = NULL;
+		free(a->lines);
+		a->lines = NULL;
+		a->nlines = 0;
+		a->err = NULL;
+		a->complete = 0;
+		if (err)
+			goto done;
+	}
+
+	/* Drop the output of the previous diff. */
+	if (a->partial_f && fclose(a->partial_f) == EOF)
+		err = got_error_from_errno("fclose");
+	a->partial_f = NULL;
+	free(a->partial_lines);
+	a->partial_lines = NULL;
+	a->partial_nlines = 0;
+	if (s->f && fclose(s->f) == EOF && err == NULL)
+		err = got_error_from_errno("fclose");
+	s->f = NULL;
+	free(s->lines);
+	s->lines = NULL;
+	s->nlines = 0;
+	if (err)
+		goto done;
+
+	free_diff_request(a->request);
+	a->request = r;
+	r = NULL;
+	a->generation++;
+	s->diffing = 1;
+
+	errcode = pthread_cond_signal(&a->need_diff);
+	if (errcode) {
+		err = got_error_set_errno(errcode, "pthread_cond_signal");
+		goto done;
+	}
+
+	halfdelay(1); /* fast refresh while diffing */
+done:
+	free_diff_request(r);
+	return err;
 }
 
 static const struct got_error *
@@ -4933,7 +5720,7 @@ search_setup_diff_view(struct tog_view *view, FILE **f, off_t **line_offsets,
 	struct tog_diff_view_state *s = &view->state.diff;
 
 	*f = s->f;
-	*nlines = s->nlines;
+	*nlines = s->diffing ? 0 : s->nlines;
 	*line_offsets = NULL;
 	*match = &s->matched_line;
 	*first = &s->first_displayed_line;
@@ -5031,25 +5818,14 @@ close_diff_view(struct tog_view *view)
 	const struct got_error *err = NULL;
 	struct tog_diff_view_state *s = &view->state.diff;
 
+	err = stop_diff_thread(s);
 	free(s->id1);
 	s->id1 = NULL;
 	free(s->id2);
 	s->id2 = NULL;
-	if (s->f && fclose(s->f) == EOF)
+	if (s->f && fclose(s->f) == EOF && err == NULL)
 		err = got_error_from_errno("fclose");
 	s->f = NULL;
-	if (s->f1 && fclose(s->f1) == EOF && err == NULL)
-		err = got_error_from_errno("fclose");
-	s->f1 = NULL;
-	if (s->f2 && fclose(s->f2) == EOF && err == NULL)
-		err = got_error_from_errno("fclose");
-	s->f2 = NULL;
-	if (s->fd1 != -1 && close(s->fd1) == -1 && err == NULL)
-		err = got_error_from_errno("close");
-	s->fd1 = -1;
-	if (s->fd2 != -1 && close(s->fd2) == -1 && err == NULL)
-		err = got_error_from_errno("close");
-	s->fd2 = -1;
 	free(s->lines);
 	s->lines = NULL;
 	s->nlines = 0;
@@ -5064,10 +5840,10 @@ open_diff_view(struct tog_view *view, struct got_object_id *id1,
 {
 	const struct got_error *err;
 	struct tog_diff_view_state *s = &view->state.diff;
+	struct tog_diff_thread_args *a;
+	int errcode;
 
 	memset(s, 0, sizeof(*s));
-	s->fd1 = -1;
-	s->fd2 = -1;
 
 	if (id1 != NULL && id2 != NULL) {
 	    int type1, type2;
@@ -5103,30 +5879,68 @@ open_diff_view(struct tog_view *view, struct got_object_id *id1,
 		goto done;
 	}
 
-	s->f1 = got_opentemp();
-	if (s->f1 == NULL) {
+	a = calloc(1, sizeof(*a));
+	if (a == NULL) {
+		err = got_error_from_errno("calloc");
+		goto done;
+	}
+	a->fd1 = -1;
+	a->fd2 = -1;
+	errcode = pthread_cond_init(&a->need_diff, NULL);
+	if (errcode) {
+		err = got_error_set_errno(errcode, "pthread_cond_init");
+		free(a);
+		goto done;
+	}
+	s->thread_args = a;
+
+	if (label1) {
+		a->label1 = strdup(label1);
+		if (a->label1 == NULL) {
+			err = got_error_from_errno("strdup");
+			goto done;
+		}
+	}
+	if (label2) {
+		a->label2 = strdup(label2);
+		if (a->label2 == NULL) {
+			err = got_error_from_errno("strdup");
+			goto done;
+		}
+	}
+
+	a->f1 = got_opentemp();
+	if (a->f1 == NULL) {
 		err = got_error_from_errno("got_opentemp");
 		goto done;
 	}
 
-	s->f2 = got_opentemp();
-	if (s->f2 == NULL) {
+	a->f2 = got_opentemp();
+	if (a->f2 == NULL) {
 		err = got_error_from_errno("got_opentemp");
 		goto done;
 	}
 
-	s->fd1 = got_opentempfd();
-	if (s->fd1 == -1) {
+	a->fd1 = got_opentempfd();
+	if (a->fd1 == -1) {
 		err = got_error_from_errno("got_opentempfd");
 		goto done;
 	}
 
-	s->fd2 = got_opentempfd();
-	if (s->fd2 == -1) {
+	a->fd2 = got_opentempfd();
+	if (a->fd2 == -1) {
 		err = got_error_from_errno("got_opentempfd");
 		goto done;
 	}
 
+	err = got_repo_pack_fds_open(&a->pack_fds);
+	if (err)
+		goto done;
+	err = got_repo_open(&a->repo, got_repo_get_path(repo), NULL,
+	    a->pack_fds);
+	if (err)
+		goto done;
+
 	s->diff_context = diff_context;
 	s->ignore_whitespace = ignore_whitespace;
 	s->force_text_diff = force_text_diff;
@@ -5168,12 +5982,7 @@ open_diff_view(struct tog_view *view, struct got_object_id *id1,
 		}
 	}
 
-	if (parent_view && parent_view->type == TOG_VIEW_LOG &&
-	    view_is_splitscreen(view))
-		show_log_view(parent_view); /* draw border */
-	diff_view_indicate_progress(view);
-
-	err = create_diff(s);
+	err = request_diff(view);
 
 	view->show = show_diff_view;
 	view->input = input_diff_view;
@@ -5193,8 +6002,80 @@ show_diff_view(struct tog_view *view)
 {
 	const struct got_error *err;
 	struct tog_diff_view_state *s = &view->state.diff;
+	struct tog_diff_thread_args *a = s->thread_args;
 	char *id_str1 = NULL, *id_str2, *header;
 	const char *label1, *label2;
+	int errcode;
+
+	if (s->thread == NULL) {
+		errcode = pthread_create(&s->thread, NULL, diff_thread, a);
+		if (errcode)
+			return got_error_set_errno(errcode, "pthread_create");
+	}
+
+	if (s->diffing && a->complete) {
+		size_t npartial = s->nlines;
+
+		if (s->f && fclose(s->f) == EOF) {
+			s->f = NULL;
+			return got_error_from_errno("fclose");
+		}
+		free(s->lines);
+		s->f = a->f;
+		s->lines = a->lines;
+		s->nlines = a->nlines;
+		a->f = NULL;
+		a->lines = NULL;
+		a->nlines = 0;
+		a->complete = 0;
+		s->diffing = 0;
+		halfdelay(10); /* disable fast refresh */
+		if (a->partial_f && fclose(a->partial_f) == EOF) {
+			a->partial_f = NULL;
+			return got_error_from_errno("fclose");
+		}
+		a->partial_f = NULL;
+		free(a->partial_lines);
+		a->partial_lines = NULL;
+		a->partial_nlines = 0;
+		if (a->err) {
+			err = a->err;
+			a->err = NULL;
+			return err;
+		}
+		/*
+		 * Keep showing the same lines if the partial diff was
+		 * prefixed with commit info when it was completed.
+		 */
+		if (npartial > 0 && s->first_displayed_line > 1)
+			s->first_displayed_line += a->ninfo;
+		if (s->first_displayed_line + view->nlines - 1 > s->nlines) {
+			s->first_displayed_line = 1;
+			s->last_displayed_line = view->nlines;
+		}
+	} else if (s->diffing) {
+		/* Show the output which the diff thread has produced so far. */
+		if (a->partial_f) {
+			if (s->f && fclose(s->f) == EOF) {
+				s->f = NULL;
+				return got_error_from_errno("fclose");
+			}
+			s->f = a->partial_f;
+			a->partial_f = NULL;
+		}
+		if (s->f && a->partial_nlines > s->nlines) {
+			struct got_diff_line *p;
+
+			p = reallocarray(s->lines, a->partial_nlines,
+			    sizeof(*p));
+			if (p == NULL)
+				return got_error_from_errno("reallocarray");
+			memcpy(&p[s->nlines], &a->partial_lines[s->nlines],
+			    (a->partial_nlines - s->nlines) * sizeof(*p));
+			s->lines = p;
+			s->nlines = a->partial_nlines;
+		}
+	}
 
 	if (s->id1) {
 		err = got_object_id_str(&id_str1, s->id1);
@@ -5218,7 +6099,21 @@ show_diff_view(struct tog_view *view)
 	free(id_str1);
 	free(id_str2);
 
-	err = draw_file(view, header);
+	/* Partial output is shown once it reaches the first displayed line. */
+	if (s->diffing && s->first_displayed_line >= s->nlines)
+		err = draw_diff_progress(view, header);
+	else if (s->diffing) {
+		char *progress_header;
+
+		if (asprintf(&progress_header, "[diffing...] %s",
+		    header) == -1)
+			err = got_error_from_errno("asprintf");
+		else {
+			err = draw_file(view, progress_header);
+			free(progress_header);
+		}
+	} else
+		err = draw_file(view, header);
 	free(header);
 	return err;
 }
@@ -5258,8 +6153,7 @@ reset_diff_view(struct tog_view *view)
 	s->first_displayed_line = 1;
 	s->last_displayed_line = view->nlines;
 	s->matched_line = 0;
-	diff_view_indicate_progress(view);
-	return create_diff(s);
+	return request_diff(view);
 }
 
 static void
@@ -5315,6 +6209,37 @@ input_diff_view(struct tog_view **new_view, struct tog_view *view, int ch)
 	ssize_t linelen;
 	int i, nscroll = view->nlines - 1, up = 0;
 
+	if (s->diffing) {
+		/*
+		 * Only accept keys which ask for a different diff, or
+		 * which scroll through the output produced so far.
+		 */
+		switch (ch) {
+		case 'a':
+		case 'w':
+		case '[':
+		case ']':
+		case '<':
+		case ',':
+		case 'K':
+		case '>':
+		case '.':
+		case 'J':
+		case 'g':
+		case KEY_HOME:
+		case 'k':
+		case KEY_UP:
+		case CTRL('p'):
+		case 'j':
+		case KEY_DOWN:
+		case CTRL('n'):
+			break;
+		default:
+			view->count = 0;
+			return NULL;
+		}
+	}
+
 	s->lineno = s->first_displayed_line - 1 + s->selected_line;
 
 	switch (ch) {
@@ -5429,13 +6354,7 @@ input_diff_view(struct tog_view **new_view, struct tog_view *view, int ch)
 		if (s->diff_context > 0) {
 			s->diff_context--;
 			s->matched_line = 0;
-			diff_view_indicate_progress(view);
-			err = create_diff(s);
-			if (s->first_displayed_line + view->nlines - 1 >
-			    s->nlines) {
-				s->first_displayed_line = 1;
-				s->last_displayed_line = view->nlines;
-			}
+			err = request_diff(view);
 		} else
 			view->count = 0;
 		break;
@@ -5443,8 +6362,7 @@ input_diff_view(struct tog_view **new_view, struct tog_view *view, int ch)
 		if (s->diff_context < GOT_DIFF_MAX_CONTEXT) {
 			s->diff_context++;
 			s->matched_line = 0;
-			diff_view_indicate_progress(view);
-			err = create_diff(s);
+			err = request_diff(view);
 		} else
 			view->count = 0;
 		break;
@@ -5512,8 +6430,7 @@ input_diff_view(struct tog_view **new_view, struct tog_view *view, int ch)
 		s->matched_line = 0;
 		view->x = 0;
 
-		diff_view_indicate_progress(view);
-		err = create_diff(s);
+		err = request_diff(view);
 		break;
 	default:
 		view->count = 0;
@@ -6629,7 +7546,7 @@ cmd_blame(int argc, char *argv[])
 	struct got_repository *repo = NULL;
 	struct got_worktree *worktree = NULL;
 	char *cwd = NULL, *repo_path = NULL, *in_repo_path = NULL;
-	char *link_target = NULL;
+	char *link_target = NULL, *blame_cache_path = NULL;
 	struct got_object_id *commit_id = NULL;
 	struct got_commit_object *commit = NULL;
 	char *commit_id_str = NULL;
@@ -6693,6 +7610,15 @@ cmd_blame(int argc, char *argv[])
 
 	init_curses();
 
+	/* Allow got_blame() to store its results in the repository. */
+	error = got_blame_get_cache_path(&blame_cache_path, repo);
+	if (error)
+		goto done;
+	if (unveil(blame_cache_path, "rwc") != 0) {
+		error = got_error_from_errno2("unveil", blame_cache_path);
+		goto done;
+	}
+
 	error = apply_unveil(got_repo_get_path(repo), NULL);
 	if (error)
 		goto done;
@@ -6745,6 +7671,7 @@ done:
 	free(repo_path);
 	free(in_repo_path);
 	free(link_target);
+	free(blame_cache_path);
 	free(cwd);
 	free(commit_id);
 	if (commit)
@@ -9089,8 +10016,7 @@ view_dispatch_request(struct tog_view **new_view, struct tog_view *view,
 			struct tog_log_view_state *s = &view->state.log;
 
 			err = open_diff_view_for_commit(new_view, y, x,
-			    s->selected_entry->commit, s->selected_entry->id,
-			    view, s->repo);
+			    s->selected_entry->id, view, s->repo);
 		} else
 			return got_error_msg(GOT_ERR_NOT_IMPL,
 			    "parent/child view pair not supported");
@@ -9512,6 +10438,8 @@ main(int argc, char *argv[])
 			tog_diff_algo = GOT_DIFF_ALGORITHM_PATIENCE;
 		if (strcasecmp(diff_algo_str, "myers") == 0)
 			tog_diff_algo = GOT_DIFF_ALGORITHM_MYERS;
+		if (strcasecmp(diff_algo_str, "histogram") == 0)
+			tog_diff_algo = GOT_DIFF_ALGORITHM_HISTOGRAM;
 	}
 
 	if (cmd == NULL) {